@@ -0,0 +1,880 @@
+#include <algorithm>
+
+#include "common.h"
+#include "Bench.h"
+#include "PseuWoW.h"
+#include "MemoryDataHolder.h"
+#include "SessionSocketHandler.h"
+#include "World/CacheHandler.h"
+#include "World/MapMgr.h"
+#include "World/PathFinder.h"
+#include "Network/TcpSocket.h"
+#include "Network/Utility.h"
+#include "DefScript/DefScript.h"
+#include "Auth/MD5Hash.h"
+#include "SCPDatabase.h"
+#include "MapTile.h"
+
+// pseuwow-bench: benchmarks for parts of the client that don't need a server or a capture to replay.
+// results go to the console; run from the bin directory so that the data paths match the ones of pseuwow.
+
+static BenchCommand commands[] =
+{
+    { "net", BenchNet, "[-n <conns>] [-active <n>] [-rate <pkts/s>] [-seconds <n>] [-backend <0|1>]",
+      "cpu time of the socket handler for idle and active loopback connections" },
+    { "defvars", BenchDefVars, "[-scripts <dir>] [-vars <n>] [-runs <n>]",
+      "DefScript variable set/get/unset with <n> variables around, directly and through the core scripts" },
+    { "defscript", BenchDefScript, "[-scripts <dir>] [-runs <n>]",
+      "DefScript lines/s running functions from the core scripts" },
+    { "getz", BenchGetZ, "[-adt <file>] [-n <queries>]",
+      "MapTile::GetZ() throughput and accuracy against the old nearest vertex lookup, on a generated tile or an .adt" },
+    { "path", BenchPath, "[-map <id>] [-x <x>] [-y <y>] [-dist <yards>] [-n <queries>]",
+      "PathFinder::FindPath() latency for random queries near a position, on the map data pseuwow uses" },
+    { "scp", BenchSCP, "[-db <name>]... [-runs <n>] [-n <lookups>]",
+      "compact SCP database load time and GetUint32() lookups/s against the old heap loader, default the largest DBs" },
+    { "scplookup", BenchSCPLookup, "[-db <name>]... [-n <lookups>] [-oldn <lookups>]",
+      "GetFieldByUint32Value()/GetFieldByStringValue() on every column against the old column scan" },
+    { NULL, NULL, NULL, NULL }
+};
+
+void PrintHelp(void)
+{
+    printf("Usage: pseuwow-bench <benchmark> [options]\n\n");
+    for(uint32 i = 0; commands[i].name; i++)
+        printf("%-10s %s\n           %s\n", commands[i].name, commands[i].args, commands[i].desc);
+}
+
+// reads and throws away everything, like a session that has nothing to handle
+class BenchSocket : public TcpSocket
+{
+public:
+    BenchSocket(SocketHandler& h) : TcpSocket(h, 16384, 1024) { _bytes = 0; }
+    void OnRead(void)
+    {
+        TcpSocket::OnRead();
+        _bytes += ibuf.GetLength();
+        ibuf.Remove(ibuf.GetLength());
+    }
+    uint64 _bytes;
+};
+
+// runs the handler like the instance's main loop would for <seconds>, while the first <active> peers
+// each send a packet of <size> bytes <rate> times per second. returns the cpu time of the handler side.
+static uint64 _NetPhase(SocketHandler *h, std::vector<SOCKET>& peers, uint32 active, uint32 rate, uint32 size, uint32 seconds)
+{
+    std::vector<char> pkt(size, 0);
+    uint64 interval = 1000000 / std::max<uint32>(rate, 1), sendus = 0;
+    uint64 now = GetMonotonicUS(), end = now + uint64(seconds) * 1000000, next = now;
+    uint64 cpu = GetProcessCPUTimeUS();
+    while(now < end)
+    {
+        if(active && now >= next)
+        {
+            // the sending side is not what we want to measure
+            uint64 c = GetProcessCPUTimeUS();
+            for(uint32 i = 0; i < active; i++)
+                send(peers[i], &pkt[0], size, MSG_NOSIGNAL);
+            sendus += GetProcessCPUTimeUS() - c;
+            next += interval;
+        }
+        uint64 wait = std::min(active ? (next > now ? next - now : 0) : end - now, end - now);
+        h->Select(long(wait / 1000000), long(wait % 1000000));
+        now = GetMonotonicUS();
+    }
+    return GetProcessCPUTimeUS() - cpu - sendus;
+}
+
+int BenchNet(int argc, char *argv[])
+{
+    uint32 conns = 200, active = 20, rate = 20, size = 64, seconds = 5;
+    uint8 backend = NETWORK_BACKEND_SELECT;
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-n") && a + 1 < argc)
+            conns = atoi(argv[++a]);
+        else if(!strcmp(argv[a],"-active") && a + 1 < argc)
+            active = atoi(argv[++a]);
+        else if(!strcmp(argv[a],"-rate") && a + 1 < argc)
+            rate = atoi(argv[++a]);
+        else if(!strcmp(argv[a],"-seconds") && a + 1 < argc)
+            seconds = atoi(argv[++a]);
+        else if(!strcmp(argv[a],"-backend") && a + 1 < argc)
+            backend = atoi(argv[++a]);
+        else
+            return 1;
+    }
+    active = std::min(active, conns);
+
+    SocketHandler *h = SessionSocketHandler::CreateInstanceHandler(backend);
+    std::vector<SOCKET> peers;
+    std::vector<BenchSocket*> socks;
+    for(uint32 i = 0; i < conns; i++)
+    {
+        SOCKET a, b;
+        if(!Utility::LoopbackPair(a, b))
+        {
+            logerror("net: can't open connection %u: %s", i, StrError(Errno));
+            break;
+        }
+#ifndef _WIN32
+        if(backend == NETWORK_BACKEND_SELECT && (a >= FD_SETSIZE || b >= FD_SETSIZE))
+        {
+            logerror("net: select() can't handle more than %u descriptors, use fewer connections", FD_SETSIZE);
+            closesocket(a);
+            closesocket(b);
+            break;
+        }
+#endif
+        BenchSocket *s = new BenchSocket(*h);
+        s->Attach(b);
+        s->SetNonblocking(true);
+        h->Add(s);
+        socks.push_back(s);
+        peers.push_back(a);
+    }
+    conns = socks.size();
+    active = std::min(active, conns);
+    log("net: %u connections on the %s handler, %u of them get %u packets/s of %u bytes; %u s per phase",
+        conns, backend == NETWORK_BACKEND_SELECT ? "select" : "epoll", active, rate, size, seconds);
+
+    uint64 idle = _NetPhase(h, peers, 0, rate, size, seconds);
+    uint64 busy = _NetPhase(h, peers, active, rate, size, seconds);
+    uint64 bytes = 0;
+    for(uint32 i = 0; i < socks.size(); i++)
+        bytes += socks[i]->_bytes;
+
+    log("net: idle:   %.1f ms cpu/s, %.2f us/s per connection", idle / 1000.0 / seconds, double(idle) / seconds / std::max<uint32>(conns, 1));
+    log("net: active: %.1f ms cpu/s, %.2f us/s per active connection on top, %s received",
+        busy / 1000.0 / seconds, (double(busy) - double(idle)) / seconds / std::max<uint32>(active, 1), FilesizeFormat(bytes).c_str());
+
+    for(uint32 i = 0; i < socks.size(); i++)
+    {
+        h->Remove(socks[i]);
+        delete socks[i];
+        closesocket(peers[i]);
+    }
+    delete h;
+    return 0;
+}
+
+// the core scripts that only need DefScript's own functions, the others need a running instance
+static const char *coreScripts[] = { "__core_func.def", "__core_list_extensions.def", "__core_funstuff.def", "__core_hookHelper.def", NULL };
+
+static bool _LoadCoreScripts(DefScriptPackage& scp, std::string dir)
+{
+    if(dir.size() && dir[dir.size() - 1] != '/')
+        dir += '/';
+    for(uint32 i = 0; coreScripts[i]; i++)
+        if(!scp.LoadScriptFromFile(dir + coreScripts[i]))
+        {
+            logerror("can't load '%s%s', run from the bin directory or use -scripts <dir>", dir.c_str(), coreScripts[i]);
+            return false;
+        }
+    return true;
+}
+
+// creates (or replaces) a script from lines separated by '\n', lines must not be indented
+static void _CreateScript(DefScriptPackage& scp, const char *name, const char *code)
+{
+    scp.RunSingleLine(std::string("createdef ") + name);
+    DefScript *sc = scp.GetScript(name);
+    sc->Clear();
+    sc->SetName(name);
+    std::string line;
+    for(const char *c = code; *c; c++)
+    {
+        if(*c != '\n')
+            line += *c;
+        if(*c == '\n' || !c[1])
+        {
+            sc->AddLine(line);
+            line.clear();
+        }
+    }
+}
+
+int BenchDefVars(int argc, char *argv[])
+{
+    std::string dir = "./scripts/";
+    uint32 vars = 10000, runs = 100000;
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-scripts") && a + 1 < argc)
+            dir = argv[++a];
+        else if(!strcmp(argv[a],"-vars") && a + 1 < argc)
+            vars = atoi(argv[++a]);
+        else if(!strcmp(argv[a],"-runs") && a + 1 < argc)
+            runs = atoi(argv[++a]);
+        else
+            return 1;
+    }
+    vars = std::max<uint32>(vars, 1);
+
+    DefScriptPackage scp;
+    if(!_LoadCoreScripts(scp, dir))
+        return 2;
+    // what a bot that has been running for a while has: lots of globals and per-script vars
+    for(uint32 i = 0; i < vars; i++)
+        scp.variables.Set("#bench::v" + toString(i), toString(i));
+    scp.variables.Set("#bench::count", toString(vars));
+    log("defvars: %u variables set, %u runs per phase", scp.variables.Size(), runs);
+
+    // the engine's own accesses, spread over all variables
+    std::vector<std::string> names(vars);
+    for(uint32 i = 0; i < vars; i++)
+        names[i] = "#bench::v" + toString(i);
+    uint64 start = GetMonotonicUS(), found = 0;
+    for(uint32 i = 0; i < runs; i++)
+    {
+        const std::string& n = names[(i * 2654435761u) % vars];
+        if(scp.variables.Exists(n))
+            found++;
+        scp.variables.Set("#bench::tmp", n);
+        scp.variables.Unset("#bench::tmp");
+    }
+    uint64 us = std::max<uint64>(GetMonotonicUS() - start, 1);
+    log("defvars: direct: %.0f exists+set+unset/s (%.3f us each), %u found", runs * 1000000.0 / us, double(us) / runs, uint32(found));
+
+    // the same through scripts: getvar and append from __core_func.def set, read and unset
+    // several local vars on every call, which is what most scripts spend their time on
+    _CreateScript(scp, "benchvars",
+        "set,i 0\n"
+        "loop\n"
+        "if ?{equal,${i} ${@def}}\n"
+        "exitloop\n"
+        "endif\n"
+        "set,k ${i}\n"
+        "mul,k 7919\n"
+        "mod,k ${#bench::count}\n"
+        "set,v ?{getvar #bench::v${k}}\n"
+        "set,#bench::v${k} ${v}\n"
+        "append,tmp ${v}\n"
+        "unset tmp\n"
+        "add,i 1\n"
+        "endloop\n"
+        "unset i\n"
+        "unset k\n"
+        "unset v");
+    uint32 loops = std::max<uint32>(runs / 10, 1);
+    CmdSet set;
+    set.defaultarg = toString(loops);
+    start = GetMonotonicUS();
+    scp.RunScript("benchvars", &set);
+    us = std::max<uint64>(GetMonotonicUS() - start, 1);
+    log("defvars: scripts: %.0f iterations/s (%.2f us each, getvar + append + 6 lines)", loops * 1000000.0 / us, double(us) / loops);
+    return 0;
+}
+
+struct DefBenchCall
+{
+    const char *script;
+    const char *arg0;
+    const char *def;
+};
+
+// string and list handling as the chat and hook scripts use it
+static DefBenchCall defBenchCalls[] =
+{
+    { "reverse", "", "PseuWoW DefScript benchmark" },
+    { "normalize_name", "", "pSEUwOW" },
+    { "toleet", "", "the quick brown fox jumps over the lazy dog" },
+    { "lcontains", "#benchlist", "e49" },
+    { "lfind", "#benchlist", "e25" },
+    { "globname", "", "somevar" },
+    { NULL, NULL, NULL }
+};
+
+int BenchDefScript(int argc, char *argv[])
+{
+    std::string dir = "./scripts/";
+    uint32 runs = 2000;
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-scripts") && a + 1 < argc)
+            dir = argv[++a];
+        else if(!strcmp(argv[a],"-runs") && a + 1 < argc)
+            runs = atoi(argv[++a]);
+        else
+            return 1;
+    }
+
+    DefScriptPackage scp;
+    if(!_LoadCoreScripts(scp, dir))
+        return 2;
+    for(uint32 i = 0; i < 50; i++)
+        scp.RunSingleLine("lpushback,#benchlist e" + toString(i));
+    log("defscript: %u runs per function", runs);
+
+    uint32 totallines = 0;
+    uint64 totalus = 0;
+    for(uint32 i = 0; defBenchCalls[i].script; i++)
+    {
+        DefBenchCall& c = defBenchCalls[i];
+        if(!scp.ScriptExists(c.script))
+        {
+            logerror("defscript: script '%s' not loaded", c.script);
+            continue;
+        }
+        DefReturnResult r;
+        uint32 lines = scp.GetLinesRun();
+        uint64 start = GetMonotonicUS();
+        for(uint32 j = 0; j < runs; j++)
+        {
+            CmdSet set;
+            set.arg[0] = c.arg0;
+            set.defaultarg = c.def;
+            r = scp.RunScript(c.script, &set);
+        }
+        uint64 us = std::max<uint64>(GetMonotonicUS() - start, 1);
+        lines = scp.GetLinesRun() - lines;
+        totallines += lines;
+        totalus += us;
+        log("defscript: %-15s %8.0f lines/s, %7.2f us/call, %3u lines/call -> \"%s\"",
+            c.script, lines * 1000000.0 / us, double(us) / runs, lines / std::max<uint32>(runs, 1), r.ret.c_str());
+    }
+    log("defscript: total           %8.0f lines/s", totallines * 1000000.0 / std::max<uint64>(totalus, 1));
+    return 0;
+}
+
+// the terrain of the generated tile; smooth, so the error of a lookup can be told exactly
+static float _BenchTerrainZ(float x, float y)
+{
+    return 100.0f + 30.0f * sinf(x * 0.01f) + 20.0f * cosf(y * 0.013f);
+}
+
+// MapTile::GetZ() before it interpolated: the height of the nearest vertex
+static float _NearestVertexZ(MapTile *tile, float x, float y)
+{
+    MapChunk *first = tile->GetChunk(0, 0);
+    uint32 chx = (uint32)fabs((first->basex - x) / CHUNKSIZE);
+    uint32 chy = (uint32)fabs((first->basey - y) / CHUNKSIZE);
+    if(chx > 15 || chy > 15)
+        return INVALID_HEIGHT;
+    MapChunk& ch = *tile->GetChunk(chy, chx);
+    uint32 vx, vy = (uint32)floor((fabs(ch.basey - y) / (CHUNKSIZE / 16.0f)) + 0.5f);
+    if(vy % 2 == 0)
+    {
+        vx = (uint32)floor((fabs(ch.basex - x) / (CHUNKSIZE / 8.0f)) + 0.5f);
+        return vx > 8 ? INVALID_HEIGHT : ch.hmap_rough[vx * 9 + vy / 2] + ch.baseheight;
+    }
+    vx = (uint32)floor(fabs(ch.basex - x) / (CHUNKSIZE / 7.0f));
+    return vx > 7 ? INVALID_HEIGHT : ch.hmap_fine[vx * 8 + (vy - 1) / 2] + ch.baseheight;
+}
+
+int BenchGetZ(int argc, char *argv[])
+{
+    std::string adtfile;
+    uint32 n = 1 << 20;
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-adt") && a + 1 < argc)
+            adtfile = argv[++a];
+        else if(!strcmp(argv[a],"-n") && a + 1 < argc)
+            n = atoi(argv[++a]);
+        else
+            return 1;
+    }
+    n = std::max<uint32>(n, 1);
+
+    ADTFile *adt = new ADTFile();
+    if(adtfile.size())
+    {
+        if(!adt->Load(adtfile))
+        {
+            logerror("getz: can't load '%s'", adtfile.c_str());
+            delete adt;
+            return 2;
+        }
+    }
+    else
+    {
+        // tile 30,20 with the vertices sampled from _BenchTerrainZ(), 9 outer and 8 inner per row
+        float tilex = ZEROPOINT - 30 * TILESIZE, tiley = ZEROPOINT - 20 * TILESIZE;
+        for(uint32 c = 0; c < CHUNKS_PER_TILE; c++)
+        {
+            ADTMapChunk& ch = adt->_chunks[c];
+            memset(&ch, 0, sizeof(ch));
+            ch.hdr.xbase = tilex - (c / 16) * CHUNKSIZE;
+            ch.hdr.ybase = tiley - (c % 16) * CHUNKSIZE;
+            ch.hdr.zbase = 100.0f;
+            ch.hdr.sizeAlpha = 8; // no alpha layers
+            uint32 v = 0;
+            for(uint32 row = 0; row < 17; row++)
+                for(uint32 k = 0; k < (row % 2 ? 8u : 9u); k++)
+                    ch.vertices[v++] = _BenchTerrainZ(ch.hdr.xbase - row * 0.5f * UNITSIZE,
+                        ch.hdr.ybase - (k + (row % 2 ? 0.5f : 0.0f)) * UNITSIZE) - ch.hdr.zbase;
+        }
+    }
+    MapTile *tile = new MapTile();
+    tile->ImportFromADT(adt);
+    delete adt;
+
+    MapChunk *first = tile->GetChunk(0, 0);
+    std::vector<float> xs(n), ys(n), znear(n), z(n), zbatch(n);
+    for(uint32 i = 0; i < n; i++)
+    {
+        xs[i] = first->basex - (rand() % 1000000) / 1000000.0f * TILESIZE;
+        ys[i] = first->basey - (rand() % 1000000) / 1000000.0f * TILESIZE;
+    }
+    log("getz: %u random positions on %s", n, adtfile.size() ? adtfile.c_str() : "a generated tile");
+
+    uint64 t0 = GetMonotonicUS();
+    for(uint32 i = 0; i < n; i++)
+        znear[i] = _NearestVertexZ(tile, xs[i], ys[i]);
+    uint64 t1 = GetMonotonicUS();
+    for(uint32 i = 0; i < n; i++)
+        z[i] = tile->GetZ(xs[i], ys[i]);
+    uint64 t2 = GetMonotonicUS();
+    tile->GetZ(&xs[0], &ys[0], &zbatch[0], n);
+    uint64 t3 = GetMonotonicUS();
+
+    // on a generated tile both are compared to the real terrain, on an .adt to each other
+    double errnear = 0, err = 0, maxnear = 0, maxerr = 0;
+    uint32 mismatches = 0;
+    for(uint32 i = 0; i < n; i++)
+    {
+        double ref = adtfile.size() ? znear[i] : _BenchTerrainZ(xs[i], ys[i]);
+        double en = fabs(znear[i] - ref), e = fabs(z[i] - ref);
+        errnear += en;
+        err += e;
+        maxnear = std::max(maxnear, en);
+        maxerr = std::max(maxerr, e);
+        if(z[i] != zbatch[i])
+            mismatches++;
+    }
+    log("getz: nearest vertex: %6.1f M/s", n / double(std::max<uint64>(t1 - t0, 1)));
+    log("getz: GetZ():         %6.1f M/s", n / double(std::max<uint64>(t2 - t1, 1)));
+    log("getz: batch GetZ():   %6.1f M/s, %u results differ from GetZ()", n / double(std::max<uint64>(t3 - t2, 1)), mismatches);
+    if(adtfile.size())
+        log("getz: GetZ() vs nearest vertex: avg %.3f, max %.3f", err / n, maxerr);
+    else
+        log("getz: error vs terrain: nearest vertex avg %.3f max %.3f, GetZ() avg %.3f max %.3f",
+            errnear / n, maxnear, err / n, maxerr);
+    delete tile;
+    return 0;
+}
+
+// times FindPath() for queries that start within <dist> of (x,y) and end up to <dist> further away,
+// so that they stay on the 3x3 tiles MapMgr loads around (x,y)
+static void _PathQueries(MapMgr *mmgr, float x, float y, float dist, uint32 n)
+{
+    PathFinder *pf = mmgr->GetPathFinder();
+    std::vector<PathNode> path;
+    std::vector<float> sx(n), sy(n), ex(n), ey(n);
+    for(uint32 i = 0; i < n; i++)
+    {
+        float a = (rand() % 10000) * float(2 * M_PI / 10000), d = (rand() % 10000) / 10000.0f * dist;
+        sx[i] = x + cosf(a) * d;
+        sy[i] = y + sinf(a) * d;
+        a = (rand() % 10000) * float(2 * M_PI / 10000);
+        d = (0.25f + 0.75f * (rand() % 10000) / 10000.0f) * dist;
+        ex[i] = sx[i] + cosf(a) * d;
+        ey[i] = sy[i] + sinf(a) * d;
+    }
+
+    // the walkability of a tile is computed when a query needs it first, don't count that.
+    // the first query builds it for all tiles of its search area
+    uint64 start = GetMonotonicUS();
+    pf->FindPath(sx[0], sy[0], ex[0], ey[0], path);
+    log("path: first query (builds walkability) %.1f ms", (GetMonotonicUS() - start) / 1000.0);
+    start = GetMonotonicUS();
+    for(uint32 i = 1; i < std::min<uint32>(n, 200); i++)
+        pf->FindPath(sx[i], sy[i], ex[i], ey[i], path);
+    log("path: warmup: %u queries in %.1f ms", std::min<uint32>(n, 200) - 1, (GetMonotonicUS() - start) / 1000.0);
+
+    std::vector<uint32> us(n);
+    uint32 found = 0, over = 0;
+    uint64 expanded = 0, nodes = 0;
+    for(uint32 i = 0; i < n; i++)
+    {
+        uint64 t = GetMonotonicUS();
+        bool ok = pf->FindPath(sx[i], sy[i], ex[i], ey[i], path);
+        us[i] = uint32(GetMonotonicUS() - t);
+        if(ok)
+        {
+            found++;
+            nodes += path.size();
+        }
+        if(us[i] > 1000)
+            over++;
+        expanded += pf->GetLastExpanded();
+    }
+    std::sort(us.begin(), us.end());
+    log("path: %u queries, %u found (avg %.1f waypoints), avg %.0f cells expanded",
+        n, found, double(nodes) / std::max<uint32>(found, 1), double(expanded) / n);
+    log("path: us: p50 %u  p90 %u  p99 %u  max %u;  %u queries (%.2f%%) over 1 ms",
+        us[n / 2], us[n * 9 / 10], us[n * 99 / 100], us[n - 1], over, over * 100.0 / n);
+}
+
+int BenchPath(int argc, char *argv[])
+{
+    uint32 map = 0, n = 2000;
+    float x = -8913.0f, y = -137.0f, dist = 200.0f; // northshire abbey
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-map") && a + 1 < argc)
+            map = atoi(argv[++a]);
+        else if(!strcmp(argv[a],"-x") && a + 1 < argc)
+            x = atof(argv[++a]);
+        else if(!strcmp(argv[a],"-y") && a + 1 < argc)
+            y = atof(argv[++a]);
+        else if(!strcmp(argv[a],"-dist") && a + 1 < argc)
+            dist = std::min<float>(atof(argv[++a]), TILESIZE / 2);
+        else if(!strcmp(argv[a],"-n") && a + 1 < argc)
+            n = atoi(argv[++a]);
+        else
+            return 1;
+    }
+    n = std::max<uint32>(n, 1);
+
+    // MapMgr needs an instance for the conf (UseHeightMaps) and the map names
+    log_prepare("bench_log.txt","w");
+    MemoryDataHolder::Init();
+    PseuInstanceRunnable runnable;
+    PseuInstance *ins = new PseuInstance(&runnable);
+    ins->SetConfDir("./conf/");
+    ins->SetScpDir("./scripts/");
+    ins->SetHeadless();
+    int ret = 2;
+    if(ins->Init())
+    {
+        MapMgr *mmgr = new MapMgr(ins);
+        uint64 start = GetMonotonicUS();
+        mmgr->Update(x, y, map);
+        while(!mmgr->Loaded() && GetMonotonicUS() - start < 30000000)
+        {
+            ZThread::Thread::sleep(10);
+            mmgr->Update(x, y, map);
+        }
+        if(!mmgr->Loaded() || mmgr->GetZ(x, y) == INVALID_HEIGHT)
+            logerror("path: no map data at (%.1f, %.1f) on map %u, are the maps extracted?", x, y, map);
+        else
+        {
+            log("path: map %u, %u tiles around (%.1f, %.1f) loaded in %.1f ms, %s",
+                map, mmgr->GetLoadedMapsCount(), x, y, (GetMonotonicUS() - start) / 1000.0,
+                mmgr->UsesHeightMap() ? "heightmap" : "adt files");
+            _PathQueries(mmgr, x, y, dist, n);
+            ret = 0;
+        }
+        delete mmgr;
+    }
+    delete ins;
+
+    SCPDatabaseMgr::DropSharedDBs();
+    PrototypeCache_Delete();
+    DefScriptPackage::ClearSharedScripts();
+    SessionSocketHandler::Shutdown();
+    log_close();
+    MemoryDataHolder::Shutdown();
+    return ret;
+}
+
+// the compact SCP loader before the mapped format: everything copied to the heap into std::map indexes,
+// and every source file read and hashed at each load. rebuilt here from a current file to compare with.
+struct OldSCPDB
+{
+    std::map<uint32,uint32> indexes, indexes_reverse;
+    std::map<std::string,SCPFieldDef> fielddefs;
+    std::vector<uint32> intbuf;
+    std::vector<char> stringbuf;
+    uint32 fields_per_row;
+
+    bool Load(const char *fn);
+    // the lookups did two tree searches each, and then the same ones again
+    uint32 GetUint32(uint32 index, const char *entry)
+    {
+        if(indexes.find(index) == indexes.end() || fielddefs.find(entry) == fielddefs.end())
+            return 0;
+        return intbuf[fields_per_row * indexes[index] + fielddefs[entry].id];
+    }
+    uint32 GetUint32(uint32 index, uint32 entry)
+    {
+        if(indexes.find(index) == indexes.end())
+            return 0;
+        return intbuf[fields_per_row * indexes[index] + entry];
+    }
+    // searching by value scanned the column
+    uint32 GetFieldByUint32Value(uint32 entry, uint32 val)
+    {
+        for(uint32 row = 0; row < indexes.size(); row++)
+            if(intbuf[row * fields_per_row + entry] == val)
+                return indexes_reverse[row];
+        return SCP_INVALID_INT;
+    }
+    uint32 GetFieldByStringValue(uint32 entry, const char *val)
+    {
+        for(uint32 row = 0; row < indexes.size(); row++)
+        {
+            uint32 offs = intbuf[row * fields_per_row + entry];
+            if(!stricmp(offs < stringbuf.size() ? &stringbuf[offs] : "", val))
+                return indexes_reverse[row];
+        }
+        return SCP_INVALID_INT;
+    }
+};
+
+bool OldSCPDB::Load(const char *fn)
+{
+    uint32 size = GetFileSize(fn);
+    FILE *fh = fopen(fn, "rb");
+    if(!fh)
+        return false;
+    std::vector<uint8> file(std::max<uint32>(size, sizeof(SCPHeader)));
+    size = fread(&file[0], 1, size, fh);
+    fclose(fh);
+    SCPHeader hdr;
+    memcpy(&hdr, &file[0], sizeof(hdr));
+    if(size < sizeof(hdr) || (hdr.flags & SCP_FLAG_COMPRESSED) || size - sizeof(hdr) < hdr.offsStrings + hdr.sizeStrings)
+        return false;
+    const uint8 *body = &file[sizeof(hdr)];
+
+    ByteBuffer md5buf(hdr.sizeMD5);
+    md5buf.append(body + hdr.offsMD5, hdr.sizeMD5);
+    for(uint32 i = 0; i < hdr.nMD5; i++)
+    {
+        uint8 digest[MD5_DIGEST_LENGTH];
+        uint32 refSize, refTime;
+        std::string refFn;
+        md5buf >> refSize >> refTime;
+        md5buf.read(digest, MD5_DIGEST_LENGTH);
+        md5buf >> refFn;
+        uint32 refFileSize = GetFileSize(refFn.c_str());
+        FILE *refFile = fopen(refFn.c_str(), "rb");
+        if(!refFile)
+            return false;
+        std::vector<uint8> refFileBuf(std::max<uint32>(refFileSize, 1));
+        fread(&refFileBuf[0], 1, refFileSize, refFile);
+        fclose(refFile);
+        MD5Hash md5;
+        md5.Update(&refFileBuf[0], refFileSize);
+        md5.Finalize();
+        if(memcmp(digest, md5.GetDigest(), MD5_DIGEST_LENGTH))
+            return false;
+    }
+
+    const SCPIndexEntry *index = (const SCPIndexEntry*)(body + hdr.offsIndexes);
+    for(uint32 i = 0; i < hdr.nIndexes; i++)
+    {
+        indexes[index[i].id] = index[i].row;
+        indexes_reverse[index[i].row] = index[i].id;
+    }
+    const SCPFieldEntry *fields = (const SCPFieldEntry*)(body + hdr.offsFields);
+    const char *names = (const char*)(fields + hdr.nFields - 1);
+    for(uint32 i = 0; i + 1 < hdr.nFields; i++)
+    {
+        SCPFieldDef d;
+        d.id = fields[i].id;
+        d.type = fields[i].type;
+        fielddefs[names + fields[i].nameoffs] = d;
+    }
+    intbuf.assign((const uint32*)(body + hdr.offsData), (const uint32*)(body + hdr.offsData + hdr.sizeData));
+    stringbuf.assign((const char*)(body + hdr.offsStrings), (const char*)(body + hdr.offsStrings + hdr.sizeStrings));
+    fields_per_row = hdr.nFields;
+    return true;
+}
+
+// the largest databases StuffExtract creates
+static const char *scpBenchDBs[] = { "itemdisplayinfo", "creaturedisplayinfo", "charsections", "sound", "zone", NULL };
+
+// loads the DB from source if needed, so that ./cache/<db>.ccp is up to date. returns the number of source files.
+static uint32 _PrepareSCP(SCPDatabaseMgr& mgr, const std::string& db)
+{
+    uint32 nsrc = mgr.SearchAndLoad(db.c_str(), false);
+    if(!nsrc || !mgr.GetDB(db))
+    {
+        logerror("scp: no database '%s', are the scp files extracted?", db.c_str());
+        return 0;
+    }
+    return nsrc;
+}
+
+int BenchSCP(int argc, char *argv[])
+{
+    std::vector<std::string> dbs;
+    uint32 runs = 20, n = 1000000;
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-db") && a + 1 < argc)
+            dbs.push_back(argv[++a]);
+        else if(!strcmp(argv[a],"-runs") && a + 1 < argc)
+            runs = std::max(atoi(argv[++a]), 1);
+        else if(!strcmp(argv[a],"-n") && a + 1 < argc)
+            n = std::max(atoi(argv[++a]), 1);
+        else
+            return 1;
+    }
+    if(dbs.empty())
+        for(uint32 i = 0; scpBenchDBs[i]; i++)
+            dbs.push_back(scpBenchDBs[i]);
+
+    log_prepare("bench_log.txt","w");
+    SCPDatabaseMgr mgr;
+    mgr.AddSearchPath("./cache");
+    mgr.AddSearchPath("./data/scp");
+    mgr.SetCompression(0); // as pseuwow does
+    int ret = 2;
+    for(uint32 i = 0; i < dbs.size(); i++)
+    {
+        std::string& db = dbs[i];
+        std::string fn = "./cache/" + db + ".ccp";
+        uint32 nsrc = _PrepareSCP(mgr, db);
+        if(!nsrc)
+            continue;
+
+        uint64 t = GetMonotonicUS();
+        for(uint32 r = 0; r < runs; r++)
+            if(!mgr.LoadCompactSCP(fn.c_str(), db.c_str(), nsrc))
+                break;
+        uint64 loadus = GetMonotonicUS() - t;
+        SCPDatabase *sdb = mgr.GetDB(db);
+        OldSCPDB *old = NULL;
+        uint64 oldus = 0;
+        for(uint32 r = 0; r < runs; r++)
+        {
+            delete old;
+            old = new OldSCPDB();
+            t = GetMonotonicUS();
+            bool ok = old->Load(fn.c_str());
+            oldus += GetMonotonicUS() - t;
+            if(!ok)
+                break;
+        }
+        if(!sdb || !sdb->IsCompact() || old->indexes.empty() || old->fielddefs.empty())
+        {
+            logerror("scp: can't load '%s'", fn.c_str());
+            delete old;
+            continue;
+        }
+        log("scp: %s: %u rows x %u fields, %s, %u source files", db.c_str(), sdb->GetRowsCount(), sdb->GetFieldsCount(),
+            FilesizeFormat(GetFileSize(fn.c_str())).c_str(), nsrc);
+        log("scp: load: %.3f ms, old loader %.3f ms", loadus / 1000.0 / runs, oldus / 1000.0 / runs);
+
+        // random existing ids and field names
+        std::vector<uint32> ids, allids;
+        std::vector<const char*> names, allnames;
+        std::vector<uint32> fieldids;
+        for(std::map<uint32,uint32>::iterator it = old->indexes.begin(); it != old->indexes.end(); it++)
+            allids.push_back(it->first);
+        for(std::map<std::string,SCPFieldDef>::iterator it = old->fielddefs.begin(); it != old->fielddefs.end(); it++)
+            allnames.push_back(it->first.c_str());
+        for(uint32 k = 0; k < n; k++)
+        {
+            ids.push_back(allids[(uint32(rand()) * RAND_MAX + rand()) % allids.size()]);
+            names.push_back(allnames[rand() % allnames.size()]);
+            fieldids.push_back(old->fielddefs[names.back()].id);
+        }
+
+        uint32 sum[4] = { 0, 0, 0, 0 };
+        uint64 t0 = GetMonotonicUS();
+        for(uint32 k = 0; k < n; k++)
+            sum[0] += sdb->GetUint32(ids[k], names[k]);
+        uint64 t1 = GetMonotonicUS();
+        for(uint32 k = 0; k < n; k++)
+            sum[1] += old->GetUint32(ids[k], names[k]);
+        uint64 t2 = GetMonotonicUS();
+        for(uint32 k = 0; k < n; k++)
+            sum[2] += sdb->GetUint32(ids[k], fieldids[k]);
+        uint64 t3 = GetMonotonicUS();
+        for(uint32 k = 0; k < n; k++)
+            sum[3] += old->GetUint32(ids[k], fieldids[k]);
+        uint64 t4 = GetMonotonicUS();
+        log("scp: GetUint32(id, name):     %6.2f M/s, old %6.2f M/s", n / double(std::max<uint64>(t1 - t0, 1)),
+            n / double(std::max<uint64>(t2 - t1, 1)));
+        log("scp: GetUint32(id, field id): %6.2f M/s, old %6.2f M/s%s", n / double(std::max<uint64>(t3 - t2, 1)),
+            n / double(std::max<uint64>(t4 - t3, 1)), (sum[0] == sum[1] && sum[2] == sum[3]) ? "" : ", RESULTS DIFFER");
+        delete old;
+        ret = 0;
+    }
+    log_close();
+    return ret;
+}
+
+// times <n> lookups of random values that exist in column <field>, the first one also builds the index
+static void _SCPLookups(SCPDatabase *db, OldSCPDB *old, const char *field, uint32 n, uint32 oldn)
+{
+    uint32 id = db->GetFieldId(field);
+    bool str = db->GetFieldType(field) == SCP_TYPE_STRING;
+    std::vector<uint32> ids, vals(n), res(n);
+    for(std::map<uint32,uint32>::iterator it = old->indexes.begin(); it != old->indexes.end(); it++)
+        ids.push_back(it->first);
+    for(uint32 k = 0; k < n; k++)
+        vals[k] = db->GetUint32(ids[(uint32(rand()) * RAND_MAX + rand()) % ids.size()], id);
+
+    uint64 t0 = GetMonotonicUS();
+    res[0] = str ? db->GetFieldByStringValue(id, db->GetStringByOffset(vals[0])) : db->GetFieldByUint32Value(id, vals[0]);
+    uint64 t1 = GetMonotonicUS();
+    for(uint32 k = 1; k < n; k++)
+        res[k] = str ? db->GetFieldByStringValue(id, db->GetStringByOffset(vals[k])) : db->GetFieldByUint32Value(id, vals[k]);
+    uint64 t2 = GetMonotonicUS();
+    uint32 differ = 0;
+    for(uint32 k = 0; k < oldn; k++)
+        if(res[k] != (str ? old->GetFieldByStringValue(id, db->GetStringByOffset(vals[k])) : old->GetFieldByUint32Value(id, vals[k])))
+            differ++;
+    uint64 t3 = GetMonotonicUS();
+    log("scplookup: %-24s %s: first %.2f ms, then %.3f us/lookup; old scan %.1f us/lookup%s", field,
+        str ? "string" : "uint32", (t1 - t0) / 1000.0, double(t2 - t1) / std::max<uint32>(n - 1, 1),
+        double(t3 - t2) / std::max<uint32>(oldn, 1), differ ? ", RESULTS DIFFER" : "");
+}
+
+int BenchSCPLookup(int argc, char *argv[])
+{
+    std::vector<std::string> dbs;
+    uint32 n = 100000, oldn = 1000;
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-db") && a + 1 < argc)
+            dbs.push_back(argv[++a]);
+        else if(!strcmp(argv[a],"-n") && a + 1 < argc)
+            n = std::max(atoi(argv[++a]), 1);
+        else if(!strcmp(argv[a],"-oldn") && a + 1 < argc)
+            oldn = atoi(argv[++a]);
+        else
+            return 1;
+    }
+    oldn = std::min(oldn, n);
+    if(dbs.empty())
+        for(uint32 i = 0; scpBenchDBs[i]; i++)
+            dbs.push_back(scpBenchDBs[i]);
+
+    log_prepare("bench_log.txt","w");
+    SCPDatabaseMgr mgr;
+    mgr.AddSearchPath("./cache");
+    mgr.AddSearchPath("./data/scp");
+    mgr.SetCompression(0);
+    int ret = 2;
+    for(uint32 i = 0; i < dbs.size(); i++)
+    {
+        std::string fn = "./cache/" + dbs[i] + ".ccp";
+        if(!_PrepareSCP(mgr, dbs[i]))
+            continue;
+        SCPDatabase *db = mgr.GetDB(dbs[i]);
+        OldSCPDB old;
+        if(!old.Load(fn.c_str()) || old.indexes.empty())
+        {
+            logerror("scplookup: can't load '%s'", fn.c_str());
+            continue;
+        }
+        log("scplookup: %s: %u rows x %u fields", dbs[i].c_str(), db->GetRowsCount(), db->GetFieldsCount());
+        // every column, a fresh index is built for each
+        for(std::map<std::string,SCPFieldDef>::iterator it = old.fielddefs.begin(); it != old.fielddefs.end(); it++)
+            if(it->second.type != SCP_TYPE_FLOAT)
+                _SCPLookups(db, &old, it->first.c_str(), n, oldn);
+        ret = 0;
+    }
+    log_close();
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    for(uint32 i = 0; argc > 1 && commands[i].name; i++)
+        if(!strcmp(argv[1], commands[i].name))
+        {
+            int ret = commands[i].func(argc - 1, argv + 1);
+            if(ret == 1)
+                PrintHelp();
+            return ret;
+        }
+    PrintHelp();
+    return 1;
+}
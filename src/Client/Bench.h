@@ -0,0 +1,21 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+struct BenchCommand
+{
+    const char *name;
+    int (*func)(int argc, char *argv[]); // argv[0] is the command name
+    const char *args;
+    const char *desc;
+};
+
+void PrintHelp(void);
+int BenchNet(int argc, char *argv[]);
+int BenchDefVars(int argc, char *argv[]);
+int BenchDefScript(int argc, char *argv[]);
+int BenchGetZ(int argc, char *argv[]);
+int BenchPath(int argc, char *argv[]);
+int BenchSCP(int argc, char *argv[]);
+int BenchSCPLookup(int argc, char *argv[]);
+
+#endif
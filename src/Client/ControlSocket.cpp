@@ -14,10 +14,8 @@ void ControlSocket::OnAccept(void)
 {
     logdetail("ControlSocket: Incoming connection from %s:%u [host:%s]",GetRemoteAddress().c_str(),GetRemotePort(),GetRemoteHostname().c_str());
 
-    // must perform some crappy ptr conversion here, doesnt want to typecast SocketHandler -> ControlSocketHandler directly
-    SocketHandler& hnd = Handler();
-    ControlSocketHandler *chnd = static_cast<ControlSocketHandler*>(&hnd);
-    _instance = chnd->GetInstance();
+    // the listen socket that accepted us knows the instance; the handler is the instance's one, shared with the sessions
+    _instance = static_cast<ControlListenSocket*>(GetParent())->GetInstance();
     DEBUG(logdebug("ControlSocket: setting instance = %X",_instance));
 
     // accept only connections from one host for now, if set
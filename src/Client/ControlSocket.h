@@ -2,7 +2,8 @@
 #define CONTROLSOCKET_H
 
 #include "Network/TcpSocket.h"
-#include "RemoteController.h"
+
+class PseuInstance;
 
 class ControlSocket : public TcpSocket
 {
@@ -7,11 +7,19 @@
 #include <stdarg.h>
 #include "VarSet.h"
 #include "DefScript.h"
+#include "zthread/FastMutex.h"
+#include "zthread/Guard.h"
 
 using namespace DefScriptTools;
 
 #define SN_ONLOAD "?onload?"
 
+// script lines shared between all packages that have SetShareScripts() enabled.
+// maps script name -> all different contents seen for it; entries are never changed.
+typedef std::map<std::string, std::deque<DefList*> > SharedScriptPool;
+SharedScriptPool sharedScripts;
+ZThread::FastMutex sharedScriptsMutex;
+
 
 enum DefScriptBlockType
 {
@@ -28,6 +36,10 @@ DefScriptPackage::DefScriptPackage()
         hLogfile << "DefScript engine execution log, compilation date: " __DATE__ "  " __TIME__ "\n\n" ;
     )
     _eventmgr=new DefScript_DynamicEventMgr(this);
+    _scriptsVersion=0;
+    _shareScripts=false;
+    _funcVersion=0;
+    _linesRun=0;
     _InitFunctions();
 #   ifdef USING_DEFSCRIPT_EXTENSIONS
     _InitDefScriptInterface();
@@ -55,7 +67,8 @@ void DefScriptPackage::Clear(void)
         delete i->second; // delete each script
     }
 
-	Script.empty();
+	Script.clear();
+    _scriptsVersion++;
 }
 
 void DefScriptPackage::_InitFunctions(void)
@@ -167,15 +180,22 @@ void DefScriptPackage::AddFunc(std::string n,DefReturnResult (DefScriptPackage::
 void DefScriptPackage::AddFunc(DefScriptFunctionEntry e)
 {
     if( (!e.name.empty()) && (!HasFunc(e.name)) )
+    {
+        _funcindex[e.name] = _functable.size();
         _functable.push_back(e);
+        _funcVersion++;
+    }
 }
 
 bool DefScriptPackage::HasFunc(std::string n)
 {
-    for(DefScriptFunctionTable::iterator i=_functable.begin();i!=_functable.end();i++)
-        if(i->name==n)
-            return true;
-    return false;
+    return _FindFunc(n) >= 0;
+}
+
+int DefScriptPackage::_FindFunc(const std::string& n)
+{
+    std::map<std::string,unsigned int>::iterator i = _funcindex.find(n);
+    return i == _funcindex.end() ? -1 : int(i->second);
 }
 
 void DefScriptPackage::DelFunc(std::string n)
@@ -184,6 +204,10 @@ void DefScriptPackage::DelFunc(std::string n)
         if(i->name==n)
         {
             _functable.erase(i);
+            _funcindex.clear();
+            for(unsigned int j = 0; j < _functable.size(); j++)
+                _funcindex[_functable[j].name] = j;
+            _funcVersion++;
             break;
         }
 }
@@ -207,10 +231,68 @@ DefScript_DynamicEventMgr *DefScriptPackage::GetEventMgr(void)
 
 bool DefScriptPackage::ScriptExists(std::string name)
 {
-    for (std::map<std::string,DefScript*>::iterator i = Script.begin();i != Script.end();i++)
-        if(i->first == name && i->second != NULL)
-            return true;
-    return false;
+    std::map<std::string,DefScript*>::iterator i = Script.find(name);
+    return i != Script.end() && i->second != NULL;
+}
+
+// replaces the script's own lines with an identical copy from the shared pool, or donates them to the pool
+void DefScriptPackage::_ShareScript(DefScript *sc)
+{
+    if(sc->IsShared() || sc->Line.empty())
+        return;
+    ZThread::Guard<ZThread::FastMutex> g(sharedScriptsMutex);
+    std::deque<DefList*>& versions = sharedScripts[sc->GetName()];
+    DefList *shared = NULL;
+    for(std::deque<DefList*>::iterator it = versions.begin(); it != versions.end(); it++)
+    {
+        if(**it == sc->Line)
+        {
+            shared = *it;
+            break;
+        }
+    }
+    if(!shared)
+    {
+        shared = new DefList;
+        shared->swap(sc->Line);
+        versions.push_back(shared);
+    }
+    sc->Line.clear();
+    sc->_lines = shared;
+    lists.Assign(SCRIPT_NAMESPACE + sc->GetName(), shared, false);
+}
+
+// gives the script a private copy of its lines, must be done before changing them
+void DefScriptPackage::_UnshareScript(DefScript *sc)
+{
+    if(!sc->IsShared())
+        return;
+    sc->Line = *sc->_lines;
+    sc->_lines = &sc->Line;
+    sc->_compiled = false;
+    lists.Assign(SCRIPT_NAMESPACE + sc->GetName(), &sc->Line, false);
+}
+
+// use this instead of lists.Get() if the list is about to be changed, it could be a shared script
+DefList *DefScriptPackage::_GetWritableList(std::string lname, bool create)
+{
+    if(strncmp(lname.c_str(), SCRIPT_NAMESPACE, strlen(SCRIPT_NAMESPACE))==0)
+        if(DefScript *sc = GetScript(lname.substr(strlen(SCRIPT_NAMESPACE))))
+        {
+            _UnshareScript(sc);
+            sc->_compiled = false; // the caller is going to change the lines
+        }
+    return create ? lists.Get(lname) : lists.GetNoCreate(lname);
+}
+
+// must only be called after all packages that shared scripts are deleted
+void DefScriptPackage::ClearSharedScripts(void)
+{
+    ZThread::Guard<ZThread::FastMutex> g(sharedScriptsMutex);
+    for(SharedScriptPool::iterator it = sharedScripts.begin(); it != sharedScripts.end(); it++)
+        for(std::deque<DefList*>::iterator v = it->second.begin(); v != it->second.end(); v++)
+            delete *v;
+    sharedScripts.clear();
 }
 
 void DefScriptPackage::DeleteScript(std::string sn)
@@ -221,6 +303,7 @@ void DefScriptPackage::DeleteScript(std::string sn)
 
         delete GetScript(sn); // delete the script itself
         Script.erase(sn); // remove reference
+        _scriptsVersion++;
     }
 }
 
@@ -258,6 +341,7 @@ bool DefScriptPackage::LoadScriptFromFile(std::string fn){
     sn = stringToLower(fn.substr(slashpos+1,(ppos-slashpos-1)));
     _UpdateOrCreateScriptByName(sn);
     curScript=Script[sn];
+    std::deque<std::string> loaded(1,sn); // names of all scripts in this file, to share them after loading
 
     DeleteScript(sn + SN_ONLOAD);
 
@@ -335,6 +419,7 @@ bool DefScriptPackage::LoadScriptFromFile(std::string fn){
                     DeleteScript(curScript->GetName());
                 sn = stringToLower(value);
                 _UpdateOrCreateScriptByName(sn);
+                loaded.push_back(sn);
                 _DEFSC_DEBUG(PRINT_DEBUG("DefScript: now loading '%s'",sn.c_str()));
                 curScript=Script[sn];
             }
@@ -464,6 +549,16 @@ bool DefScriptPackage::LoadScriptFromFile(std::string fn){
         DeleteScript(sn);
         return false;
     }
+
+    for(std::deque<std::string>::iterator it = loaded.begin(); it != loaded.end(); it++)
+    {
+        if(DefScript *sc = GetScript(*it))
+        {
+            if(_shareScripts)
+                _ShareScript(sc);
+            _CompileScript(sc);
+        }
+    }
 	
 	// ...
     return true;
@@ -475,18 +570,27 @@ bool DefScriptPackage::LoadScriptFromFile(std::string fn){
 DefScript::DefScript(DefScriptPackage *p)
 {
     _parent=p;
+    _lines=&Line;
+    _compiled=false;
+    _running=0;
 	scriptname="{NONAME}";
     debugmode=false;
 }
 
 DefScript::~DefScript()
 {
-    Clear();
+    // the list storage entry is already unlinked, so just leave shared lines alone
 }
 
 void DefScript::Clear(void)
 {
+    if(IsShared())
+    {
+        _lines=&Line;
+        _parent->lists.Assign(SCRIPT_NAMESPACE + scriptname, &Line, false);
+    }
     Line.clear();
+    _compiled=false;
 }
 
 void DefScript::SetDebug(bool d)
@@ -512,7 +616,9 @@ std::string DefScript::GetName(void)
 bool DefScript::AddLine(std::string l){
 	if(l.empty())
 		return false;
+    _parent->_UnshareScript(this);
     Line.push_back(l);
+    _compiled=false;
 	return true;
 }
 
@@ -579,14 +685,19 @@ DefReturnResult DefScriptPackage::RunScript(std::string name, CmdSet *pSet,std::
 
     std::deque<Def_Block> Blocks;
     CmdSet mySet;
-    std::string line;
+    CmdSet *lineSet;
+    int func;
+    bool held;
 
+    sc->_running++;
     for(unsigned int i=0;i<sc->GetLines();i++)
     {
-        line=sc->GetLine(i);
-        if(line.empty() || line[0] == '#') // skip markers and preload statements if not removed before
+        if(!sc->_compiled) // the script may have changed itself
+            _CompileScript(sc);
+        DefCompiledLine& cl = sc->_code[i];
+        if(cl.op==DEFOP_SKIP) // skip markers and preload statements if not removed before
             continue;
-        if(line=="else")
+        if(cl.op==DEFOP_ELSE)
         {
             if(!Blocks.size())
             {
@@ -596,24 +707,10 @@ DefReturnResult DefScriptPackage::RunScript(std::string name, CmdSet *pSet,std::
             }
             Def_Block b=Blocks.back();
             if(b.type==BLOCK_IF && b.istrue)
-            {
-                unsigned int other_ifs=0;
-                for(i=b.startline+1;;i++)
-                {
-                    if(memcmp(sc->GetLine(i).c_str(),"if ",3)==0)
-                        other_ifs++;
-                    else if(sc->GetLine(i)=="endif")
-                    {
-                        if(!other_ifs)
-                            break;
-                        other_ifs--;
-                    }
-                }
-                i--; // next line read will be "endif", decide then what to do
-            }
+                i=_GetIfEndJump(sc,b.startline)-1; // next line read will be "endif", decide then what to do
             continue;
         }
-        else if(line=="endif")
+        else if(cl.op==DEFOP_ENDIF)
         {
             if(!Blocks.size())
             {
@@ -630,7 +727,7 @@ DefReturnResult DefScriptPackage::RunScript(std::string name, CmdSet *pSet,std::
             Blocks.pop_back();
             continue;
         }
-        else if(line=="loop")
+        else if(cl.op==DEFOP_LOOP)
         {
             Def_Block b;
             b.startline=i;
@@ -639,7 +736,7 @@ DefReturnResult DefScriptPackage::RunScript(std::string name, CmdSet *pSet,std::
             Blocks.push_back(b);
             continue;
         }
-        else if(line=="endloop")
+        else if(cl.op==DEFOP_ENDLOOP)
         {
             if(!Blocks.size())
             {
@@ -656,73 +753,484 @@ DefReturnResult DefScriptPackage::RunScript(std::string name, CmdSet *pSet,std::
             i=Blocks.back().startline; // next line executed will be the line after "loop"
             continue;
         }
-        //_DEFSC_DEBUG(printf("DefScript before: \"%s\"\n",line.c_str()));
-        DefXChgResult final=ReplaceVars(line,pSet,0,true);
-        //_DEFSC_DEBUG(printf("DefScript parsed: \"%s\"\n",final.str.c_str()));
-        mySet.Clear();
-	    SplitLine(mySet,final.str);
-        if(mySet.cmd=="if")
+
+        _linesRun++;
+        // cl stays valid even if ?{..} or the command change this script, see _CompileScript().
+        // a line that is already running further up the stack gets its own copy.
+        lineSet=&mySet;
+        func=-2; // look up later
+        held=!cl.busy && (cl.dynamic ? cl.tpl.size() : !cl.escaped);
+        if(held)
+            cl.busy=true;
+        if(cl.dynamic && held)
+        {
+            DefXChgResult final;
+            if(_FillTemplate(cl,0,pSet,DEFSCRIPT_NONE,final))
+            {
+                lineSet=&cl.tpl[0].set;
+                func=_GetTemplateFunc(cl.tpl[0]);
+            }
+            else
+            {
+                mySet.Clear();
+                SplitLine(mySet,final.str);
+            }
+        }
+        else if(cl.dynamic)
+        {
+            DefXChgResult final=ReplaceVars(sc->GetLine(i),pSet,0,true);
+            mySet.Clear();
+            SplitLine(mySet,final.str);
+        }
+        else
+        {
+            if(held)
+                lineSet=&cl.set;
+            else
+                mySet=cl.set;
+            if(cl.funcversion!=_funcVersion)
+            {
+                cl.func=_FindFunc(cl.set.cmd);
+                cl.funcversion=_funcVersion;
+            }
+            func=cl.func;
+        }
+
+        if(lineSet->cmd=="if")
         {
             Def_Block b;
             b.startline=i;
             b.type=BLOCK_IF;
-            b.istrue=isTrue(mySet.defaultarg);
+            b.istrue=isTrue(lineSet->defaultarg);
+            if(held)
+                cl.busy=false;
             Blocks.push_back(b);
             if(!b.istrue)
-            {
-                unsigned int other_ifs=0;
-                for(i=b.startline+1; i < sc->GetLines() ;i++)
-                {
-                    if(!memcmp(sc->GetLine(i).c_str(),"if ",3))
-                        other_ifs++;
-                    if(sc->GetLine(i)=="else" || sc->GetLine(i)=="endif")
-                    {
-                        if(!other_ifs)
-                            break;
-                        if(sc->GetLine(i)=="endif")
-                            other_ifs--;
-                    }
-                }
-                i--; // next line read will be either "else" or "endif", decide then what to do
-            }
+                i=_GetIfFalseJump(sc,i)-1; // next line read will be either "else" or "endif", decide then what to do
             continue; // and read line after "else"
         }
-        else if(mySet.cmd=="exitloop")
+        else if(lineSet->cmd=="exitloop")
         {
+            if(held)
+                cl.busy=false;
             // skip some ifs if they are present
             while(Blocks.back().type!=BLOCK_LOOP)
                 Blocks.pop_back();
             Blocks.pop_back();
-            unsigned int other_loops=0;
-
-            while(true)
-            {
-                if(sc->GetLine(i)=="loop")
-                    other_loops++;
-                if(sc->GetLine(i)=="endloop")
-                {
-                    if(!other_loops)
-                        break;
-                    other_loops--;
-                }
-                i++; // go until next endloop
-            }
+            i=_GetLoopEndJump(sc,i);
             // next line read will be the line after "endloop"
             continue;
         }
 
-        mySet.myname=name;
-        mySet.caller=pSet?pSet->myname:"";
-        r=Interpret(mySet);
+        lineSet->myname=name;
+        lineSet->caller=pSet?pSet->myname:"";
+        r=Interpret(*lineSet,func);
+        if(held)
+            cl.busy=false;
         if(r.mustreturn)
         {
             r.mustreturn=false;
             break;
         }
     }
+    if(!--sc->_running)
+        sc->_oldcode.clear();
     return r;
 }
 
+// prepares all lines of a script, so that RunScript() does not have to parse them every time.
+// lines containing ${..} or ?{..} are split into templates, only their values are looked up on each run.
+void DefScriptPackage::_CompileScript(DefScript *sc)
+{
+    if(sc->_running) // RunScript() may still be using the old lines
+    {
+        sc->_oldcode.push_back(std::vector<DefCompiledLine>());
+        sc->_oldcode.back().swap(sc->_code);
+    }
+    sc->_code.resize(sc->GetLines());
+    for(unsigned int i = 0; i < sc->GetLines(); i++)
+    {
+        const std::string& line = (*sc->_lines)[i];
+        DefCompiledLine& cl = sc->_code[i];
+        cl.set.Clear();
+        cl.tpl.clear();
+        cl.dynamic=false;
+        cl.escaped = line.find('\\')!=std::string::npos;
+        cl.busy=false;
+        cl.func=-1;
+        cl.funcversion=_funcVersion;
+        cl.iffalse=cl.ifend=cl.loopend=-1;
+        if(line.empty() || line[0] == '#')
+            cl.op=DEFOP_SKIP;
+        else if(line=="else")
+            cl.op=DEFOP_ELSE;
+        else if(line=="endif")
+            cl.op=DEFOP_ENDIF;
+        else if(line=="loop")
+            cl.op=DEFOP_LOOP;
+        else if(line=="endloop")
+            cl.op=DEFOP_ENDLOOP;
+        else
+        {
+            cl.op=DEFOP_CMD;
+            cl.dynamic = line.find("${")!=std::string::npos || line.find("?{")!=std::string::npos;
+            if(!cl.dynamic) // ReplaceVars() would not change anything
+            {
+                SplitLine(cl.set,line);
+                cl.func=_FindFunc(cl.set.cmd);
+            }
+            else if(_CompileTemplate(cl,line) < 0)
+                cl.tpl.clear();
+        }
+    }
+    sc->_compiled=true;
+}
+
+// splits a line with ${..} and ?{..} like SplitLine() would, with a placeholder for each value, and the lines
+// inside the ?{..} as well. returns the index of the template in cl.tpl, or -1 if the line must go through
+// ReplaceVars() on every run: escapes, ${..} inside other brackets and unbalanced brackets are not compiled.
+int DefScriptPackage::_CompileTemplate(DefCompiledLine& cl, const std::string& src)
+{
+    if(src.find_first_of("\\\x01")!=std::string::npos)
+        return -1;
+    unsigned int t=cl.tpl.size();
+    cl.tpl.push_back(DefLineTemplate());
+    std::vector<DefSegment> segs;
+    std::string line; // src with placeholders
+    unsigned int depth=0;
+    for(unsigned int i=0;i<src.length();i++)
+    {
+        if(src[i]=='}')
+        {
+            if(!depth)
+                return -1;
+            depth--;
+        }
+        else if(src[i]=='{' && i>0 && (src[i-1]=='$' || src[i-1]=='?'))
+        {
+            unsigned int j, open=1;
+            for(j=i+1; j<src.length(); j++)
+            {
+                if(src[j]=='{')
+                    open++;
+                else if(src[j]=='}' && !--open)
+                    break;
+            }
+            if(depth || j>=src.length() || segs.size()>=30*30)
+                return -1;
+            DefSegment seg;
+            seg.type=src[i-1]=='$' ? DEFSCRIPT_VAR : DEFSCRIPT_FUNC;
+            seg.sub=0;
+            seg.start=i-1;
+            seg.end=j+1;
+            seg.split=false;
+            seg.local=false;
+            seg.hash=0;
+            std::string inner=src.substr(i+1,j-i-1);
+            if(inner.empty()) // ${} and ?{} are replaced by nothing
+                seg.type=DEFSCRIPT_VAR;
+            else if(seg.type==DEFSCRIPT_VAR)
+            {
+                if(inner.find_first_of("{}")!=std::string::npos) // var name from other vars
+                    return -1;
+                seg.name=inner;
+                seg.vname=_NormalizeVarName(inner,"");
+                seg.hash=VarSet::Hash(seg.vname);
+                seg.local=_NormalizeVarName(inner,"-")!=seg.vname; // resolved when first read
+            }
+            else
+            {
+                int sub=_CompileTemplate(cl,inner);
+                if(sub<0)
+                    return -1;
+                seg.sub=sub;
+            }
+            // the placeholder: \x01 and the index in two bytes that no parsing step changes
+            line.erase(line.length()-1);
+            line+='\x01';
+            line+=char(2+segs.size()/30);
+            line+=char(2+segs.size()%30);
+            segs.push_back(seg);
+            i=j;
+            continue;
+        }
+        else if(src[i]=='{')
+            depth++;
+        line+=src[i];
+    }
+    if(depth)
+        return -1;
+
+    CmdSet set;
+    SplitLine(set,line);
+    std::vector<DefField> fields; // defaultarg, cmd, args
+    std::vector<bool> seen(segs.size(),false);
+    for(int f=-2; f<(int)set.arg.size(); f++)
+    {
+        DefField field;
+        field.arg=f;
+        field.dynamic=false;
+        if(f>=0 && !set.arg.count(f))
+            return -1;
+        const std::string& s = f==-1 ? set.cmd : (f==-2 ? set.defaultarg : set.arg[f]);
+        unsigned int p=0;
+        while(p<s.length())
+        {
+            DefPiece piece;
+            unsigned int q=s.find('\x01',p);
+            if(q==p)
+            {
+                if(p+2>=s.length())
+                    return -1;
+                piece.seg=(s[p+1]-2)*30+(s[p+2]-2);
+                if(piece.seg<0 || piece.seg>=(int)segs.size() || seen[piece.seg])
+                    return -1;
+                seen[piece.seg]=true;
+                segs[piece.seg].split=(f!=-2);
+                field.dynamic=true;
+                p+=3;
+            }
+            else
+            {
+                piece.seg=-1;
+                piece.text=s.substr(p,q==std::string::npos ? std::string::npos : q-p);
+                p=(q==std::string::npos) ? s.length() : q;
+            }
+            field.pieces.push_back(piece);
+        }
+        fields.push_back(field);
+    }
+    for(unsigned int k=0; k<segs.size(); k++)
+        if(!seen[k])
+            return -1;
+
+    DefLineTemplate& tpl=cl.tpl[t];
+    tpl.src=src;
+    tpl.segs=segs;
+    tpl.fields=fields;
+    tpl.vals.resize(segs.size());
+    tpl.args=set.arg.size();
+    tpl.textlen=line.length()-3*segs.size();
+    tpl.cmdvals=tpl.defvals=false;
+    for(unsigned int f=0; f<fields.size(); f++)
+    {
+        bool valsonly=fields[f].dynamic;
+        for(unsigned int p=0; p<fields[f].pieces.size(); p++)
+            if(fields[f].pieces[p].seg<0)
+                valsonly=false;
+        if(fields[f].arg==-1)
+            tpl.cmdvals=valsonly;
+        else if(fields[f].arg==-2)
+            tpl.defvals=valsonly;
+    }
+    tpl.set=set;
+    tpl.func=fields[1].dynamic ? -2 : _FindFunc(set.cmd); // cmd
+    tpl.funcversion=_funcVersion;
+    return t;
+}
+
+// replaces the values of cl.tpl[t] like ReplaceVars(..,..,type,true) and fills its set like SplitLine() would.
+// a value that would change how the rest of the line is read stops this: then ReplaceVars() does the rest,
+// its result is in xchg and false is returned.
+bool DefScriptPackage::_FillTemplate(DefCompiledLine& cl, unsigned int t, CmdSet *pSet, unsigned char type, DefXChgResult& xchg)
+{
+    DefLineTemplate& tpl=cl.tpl[t];
+    unsigned int k, n=tpl.segs.size();
+    bool plain=true, raw=false;
+    for(k=0; k<n; k++)
+    {
+        DefSegment& seg=tpl.segs[k];
+        std::string& v=tpl.vals[k];
+        if(seg.type==DEFSCRIPT_FUNC)
+            raw=!_RunEmbedded(cl,seg.sub,pSet,v);
+        else if(seg.name.empty())
+            v.clear();
+        else
+            raw=!_GetVar(seg,pSet,v);
+        if(raw) // stays in the line as it is
+            break;
+        char next = seg.end<tpl.src.length() ? tpl.src[seg.end] : 0;
+        if(v.find_first_of("{}\\")!=std::string::npos)
+            plain=false;
+        else if(v.empty()) // ReplaceVars() skips the char behind it, and brackets around it may merge
+            plain = next!='{' && next!='}' && next!='\\' && !(seg.start && tpl.src[seg.start-1]=='}' &&
+                !(k && tpl.segs[k-1].end==seg.start && !tpl.vals[k-1].empty()));
+        else if(next=='{')
+            plain = v[v.length()-1]!='$' && v[v.length()-1]!='?';
+        if(plain && seg.split && v.find_first_of(" ,")!=std::string::npos)
+            plain=false;
+        if(!plain)
+        {
+            k++; // the value is in
+            break;
+        }
+    }
+
+    if(k==n && plain)
+    {
+        CmdSet& set=tpl.set;
+        bool all=set.arg.size()!=tpl.args; // a called script may have added args
+        if(all)
+            set.arg.clear();
+        for(unsigned int f=0; f<tpl.fields.size(); f++)
+        {
+            DefField& field=tpl.fields[f];
+            if(!field.dynamic && !all)
+                continue;
+            std::string& s = field.arg==-1 ? set.cmd : (field.arg==-2 ? set.defaultarg : set.arg[field.arg]);
+            s.clear();
+            for(unsigned int p=0; p<field.pieces.size(); p++)
+            {
+                if(field.pieces[p].seg<0)
+                    s+=field.pieces[p].text;
+                else if(field.arg==-1)
+                    s+=DefScriptTools::stringToLower(tpl.vals[field.pieces[p].seg]);
+                else
+                    s+=tpl.vals[field.pieces[p].seg];
+            }
+        }
+        bool done = !(tpl.cmdvals && set.cmd.empty()) && !(tpl.defvals && set.defaultarg.empty()); // SplitLine() treats these differently
+        if(done && type==DEFSCRIPT_FUNC)
+        {
+            bool empty=!tpl.textlen;
+            for(unsigned int j=0; empty && j<n; j++)
+                empty=tpl.vals[j].empty();
+            done = !empty && GetScript(pSet->myname); // RunSingleLineFromScript() would not run
+        }
+        if(done)
+            return true;
+    }
+
+    // the line with the values so far, ReplaceVars() continues behind the last of them
+    std::string str;
+    unsigned int pos=0;
+    int valuepos=-1;
+    for(unsigned int j=0; j<k; j++)
+    {
+        str.append(tpl.src,pos,tpl.segs[j].start-pos);
+        valuepos=str.length();
+        str+=tpl.vals[j];
+        pos=tpl.segs[j].end;
+    }
+    unsigned int rawend=0;
+    if(raw)
+    {
+        str.append(tpl.src,pos,tpl.segs[k].start-pos);
+        valuepos=str.length();
+        rawend=valuepos+tpl.segs[k].end-tpl.segs[k].start;
+        pos=tpl.segs[k].start;
+    }
+    str.append(tpl.src,pos,std::string::npos);
+    xchg=ReplaceVars(str,pSet,type,true,valuepos,rawend);
+    return false;
+}
+
+// value of the ?{..} cl.tpl[t], like ReplaceVars() and RunSingleLineFromScript() would return it.
+// false if ReplaceVars() would leave the ?{..} in the line.
+bool DefScriptPackage::_RunEmbedded(DefCompiledLine& cl, unsigned int t, CmdSet *pSet, std::string& value)
+{
+    DefXChgResult xchg;
+    if(_FillTemplate(cl,t,pSet,DEFSCRIPT_FUNC,xchg))
+    {
+        DefLineTemplate& tpl=cl.tpl[t];
+        tpl.set.myname=GetScript(pSet->myname)->GetName();
+        tpl.set.caller.clear();
+        value=Interpret(tpl.set,_GetTemplateFunc(tpl)).ret;
+        return true;
+    }
+    value=xchg.str;
+    return xchg.changed;
+}
+
+int DefScriptPackage::_GetTemplateFunc(DefLineTemplate& tpl)
+{
+    if(tpl.func!=-2 && tpl.funcversion!=_funcVersion)
+    {
+        tpl.func=_FindFunc(tpl.set.cmd);
+        tpl.funcversion=_funcVersion;
+    }
+    return tpl.func;
+}
+
+// line of the "else" or "endif" that belongs to the if-statement at line start
+unsigned int DefScriptPackage::_GetIfFalseJump(DefScript *sc, unsigned int start)
+{
+    if(!sc->_compiled)
+        _CompileScript(sc);
+    if(start >= sc->GetLines())
+        return sc->GetLines();
+    if(sc->_code[start].iffalse >= 0)
+        return sc->_code[start].iffalse;
+    unsigned int i, other_ifs=0;
+    for(i=start+1; i < sc->GetLines() ;i++)
+    {
+        const std::string& line = (*sc->_lines)[i];
+        if(!memcmp(line.c_str(),"if ",3))
+            other_ifs++;
+        if(line=="else" || line=="endif")
+        {
+            if(!other_ifs)
+                break;
+            if(line=="endif")
+                other_ifs--;
+        }
+    }
+    sc->_code[start].iffalse = i;
+    return i;
+}
+
+// line of the "endif" that belongs to the if-statement at line start
+unsigned int DefScriptPackage::_GetIfEndJump(DefScript *sc, unsigned int start)
+{
+    if(!sc->_compiled)
+        _CompileScript(sc);
+    if(start >= sc->GetLines())
+        return sc->GetLines();
+    if(sc->_code[start].ifend >= 0)
+        return sc->_code[start].ifend;
+    unsigned int i, other_ifs=0;
+    for(i=start+1; i < sc->GetLines() ;i++)
+    {
+        const std::string& line = (*sc->_lines)[i];
+        if(memcmp(line.c_str(),"if ",3)==0)
+            other_ifs++;
+        else if(line=="endif")
+        {
+            if(!other_ifs)
+                break;
+            other_ifs--;
+        }
+    }
+    sc->_code[start].ifend = i;
+    return i;
+}
+
+// line of the "endloop" that closes the loop the exitloop at line start is in
+unsigned int DefScriptPackage::_GetLoopEndJump(DefScript *sc, unsigned int start)
+{
+    if(!sc->_compiled)
+        _CompileScript(sc);
+    if(start >= sc->GetLines())
+        return sc->GetLines();
+    if(sc->_code[start].loopend >= 0)
+        return sc->_code[start].loopend;
+    unsigned int i, other_loops=0;
+    for(i=start; i < sc->GetLines() ;i++)
+    {
+        const std::string& line = (*sc->_lines)[i];
+        if(line=="loop")
+            other_loops++;
+        if(line=="endloop")
+        {
+            if(!other_loops)
+                break;
+            other_loops--;
+        }
+    }
+    sc->_code[start].loopend = i;
+    return i;
+}
+
 DefReturnResult DefScriptPackage::RunSingleLine(std::string line)
 {
     DefXChgResult final=ReplaceVars(line,NULL,0,true);
@@ -873,7 +1381,10 @@ void DefScriptPackage::UnescapeSet(CmdSet& Set)
 }
 
 
-DefXChgResult DefScriptPackage::ReplaceVars(std::string str, CmdSet *pSet, unsigned char VarType, bool run_embedded)
+// valuepos: if not -1, str is already replaced up to there, and the value of a ${..} or ?{..} was just inserted at
+// valuepos; or, if rawend is set, the ${..} or ?{..} from valuepos to rawend was left as it is. reading continues
+// as it would after that.
+DefXChgResult DefScriptPackage::ReplaceVars(std::string str, CmdSet *pSet, unsigned char VarType, bool run_embedded, int valuepos, unsigned int rawend)
 {
 
     unsigned int
@@ -891,8 +1402,23 @@ DefXChgResult DefScriptPackage::ReplaceVars(std::string str, CmdSet *pSet, unsig
 
     std::string subStr;
     DefXChgResult xchg;
+    unsigned int i=0;
 
-    for(unsigned int i=0;i<str.length();i++)
+    if(valuepos>=0)
+    {
+        i=openingBracket=valuepos+1;
+        escaped = i<=str.length() && str[valuepos]=='\\';
+        xchg.changed=true; // as left by the call that returned the value
+    }
+    if(rawend)
+    {
+        i=rawend;
+        escaped=false;
+        hasVar=true;
+        nextVar = str[valuepos]=='$' ? DEFSCRIPT_VAR : DEFSCRIPT_FUNC;
+        xchg.changed=false;
+    }
+    for( ;i<str.length();i++)
     {
         if(escaped)
         {
@@ -975,55 +1501,12 @@ DefXChgResult DefScriptPackage::ReplaceVars(std::string str, CmdSet *pSet, unsig
         }
         if(VarType==DEFSCRIPT_VAR)
         {
-            std::string vname=_NormalizeVarName(str, (pSet==NULL) ? "" : pSet->myname);
-            if(vname[0]=='@')
+            std::string value;
+            if(_GetVar(str,pSet,value))
             {
-                std::stringstream vns;
-                std::string subs=vname.substr(1,str.length()-1);
-                unsigned int vn=atoi( subs.c_str() );
-                vns << vn;
-                if(pSet && vns.str()==subs) // resolve arg macros @0 - @4294967295
-                    str=pSet->arg[vn];
-                else if(pSet && subs=="def")
-                    str=pSet->defaultarg;
-                else if(pSet && subs=="myname")
-                    str=pSet->myname;
-                else if(pSet && subs=="cmd")
-                    str=pSet->cmd;
-                else if(pSet && subs=="caller")
-                    str=pSet->caller;
-                else if(subs=="n")
-                    str="\n";
-                else if(subs=="clock")
-                {
-                    std::stringstream clock_s;
-                    clock_s << clock();
-                    str = clock_s.str();
-                }
-                else if(subs=="time")
-                {
-                    std::stringstream time_s;
-                    time_s << time(NULL);
-                    str = time_s.str();
-                }
-                else if(variables.Exists(vname))
-                    str=variables.Get(vname);
-                else
-                {
-                    // TODO: call custom macro table
-                    //...
-                    str.clear();
-                }
+                str=value;
                 xchg.changed=true;
             }
-            else
-            {
-                if(variables.Exists(vname))
-                {
-                    str=variables.Get(vname);
-                    xchg.changed=true;
-                }
-            }
         }
         else if(VarType==DEFSCRIPT_FUNC)
         {
@@ -1054,6 +1537,78 @@ DefXChgResult DefScriptPackage::ReplaceVars(std::string str, CmdSet *pSet, unsig
     return xchg;
 }
 
+// value of ${vn} as seen from the script pSet belongs to, false if there is no such var.
+// macros like ${@def} always exist.
+bool DefScriptPackage::_GetVar(const std::string& vn, CmdSet *pSet, std::string& value)
+{
+    std::string vname=_NormalizeVarName(vn, (pSet==NULL) ? "" : pSet->myname);
+    return _GetNormalizedVar(vname,VarSet::Hash(vname),pSet,value);
+}
+
+// same for the var of a compiled segment, its normalized name is kept for the last script it was read from
+bool DefScriptPackage::_GetVar(DefSegment& seg, CmdSet *pSet, std::string& value)
+{
+    if(!seg.local || !pSet || pSet->myname.empty())
+        return seg.local ? _GetVar(seg.name,pSet,value) : _GetNormalizedVar(seg.vname,seg.hash,pSet,value);
+    if(seg.owner!=pSet->myname)
+    {
+        seg.owner=pSet->myname;
+        seg.vname=_NormalizeVarName(seg.name,seg.owner);
+        seg.hash=VarSet::Hash(seg.vname);
+    }
+    return _GetNormalizedVar(seg.vname,seg.hash,pSet,value);
+}
+
+bool DefScriptPackage::_GetNormalizedVar(const std::string& vname, unsigned int hash, CmdSet *pSet, std::string& value)
+{
+    if(vname[0]=='@')
+    {
+        std::stringstream vns;
+        std::string subs=vname.substr(1);
+        unsigned int n=atoi( subs.c_str() );
+        vns << n;
+        if(pSet && vns.str()==subs) // resolve arg macros @0 - @4294967295
+            value=pSet->arg[n];
+        else if(pSet && subs=="def")
+            value=pSet->defaultarg;
+        else if(pSet && subs=="myname")
+            value=pSet->myname;
+        else if(pSet && subs=="cmd")
+            value=pSet->cmd;
+        else if(pSet && subs=="caller")
+            value=pSet->caller;
+        else if(subs=="n")
+            value="\n";
+        else if(subs=="clock")
+        {
+            std::stringstream clock_s;
+            clock_s << clock();
+            value = clock_s.str();
+        }
+        else if(subs=="time")
+        {
+            std::stringstream time_s;
+            time_s << time(NULL);
+            value = time_s.str();
+        }
+        else if(const std::string *v = variables.Find(vname,hash))
+            value=*v;
+        else
+        {
+            // TODO: call custom macro table
+            //...
+            value.clear();
+        }
+        return true;
+    }
+    if(const std::string *v = variables.Find(vname,hash))
+    {
+        value=*v;
+        return true;
+    }
+    return false;
+}
+
 std::string DefScriptPackage::_NormalizeVarName(std::string vn, std::string sn)
 {
     bool global=false;
@@ -1077,7 +1632,8 @@ std::string DefScriptPackage::_NormalizeVarName(std::string vn, std::string sn)
     return vn;
 }
 
-DefReturnResult DefScriptPackage::Interpret(CmdSet& Set)
+// func is the index of Set.cmd in the function table if already known, -1 if it is no function, -2 to look it up
+DefReturnResult DefScriptPackage::Interpret(CmdSet& Set, int func)
 {
     // TODO: remove this debug block again as soon as the interpreter bugs are fixed.
     _DEFSC_DEBUG
@@ -1093,18 +1649,18 @@ DefReturnResult DefScriptPackage::Interpret(CmdSet& Set)
     DefReturnResult result;
 
     // first search if the script is defined in the internal functions
-    for(unsigned int i=0;i<_functable.size();i++)
+    if(func == -2)
+        func = _FindFunc(Set.cmd);
+    if(func >= 0)
     {
-        if(Set.cmd==_functable[i].name)
-        {
-            if(_functable[i].escape) // if we are going to use a C++ function, unescape the whole set, if supposed to do so.
-                UnescapeSet(Set);    // it will not have any bad side effects, we leave the func within this block!
+        bool escape = _functable[func].escape;
+        if(escape) // if we are going to use a C++ function, unescape the whole set, if supposed to do so.
+            UnescapeSet(Set);    // it will not have any bad side effects, we leave the func within this block!
 
-            result=(this->*(_functable[i].func))(Set);
-            if(_functable[i].escape)
-                result.ret = EscapeString(result.ret); // and since we are returning a string into the engine, escape it again, if set.
-            return result;
-        }
+        result=(this->*(_functable[func].func))(Set);
+        if(escape)
+            result.ret = EscapeString(result.ret); // and since we are returning a string into the engine, escape it again, if set.
+        return result;
     }
 
     if(Set.cmd=="return")
@@ -1131,6 +1687,7 @@ void DefScriptPackage::_UpdateOrCreateScriptByName(std::string sn)
     newscript->SetName(sn); // necessary that the script knows its own name
     Script[sn] = newscript;
     lists.Assign(SCRIPT_NAMESPACE + sn, &(newscript->Line));
+    _scriptsVersion++;
 }
 
 std::string DefScriptPackage::SecureString(std::string s)
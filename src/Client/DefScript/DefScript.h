@@ -5,6 +5,7 @@
 #include "DefScriptDefines.h"
 #include <map>
 #include <deque>
+#include <vector>
 #include <fstream>
 #include "VarSet.h"
 #include "ByteBuffer.h"
@@ -75,6 +76,73 @@ struct DefScriptFunctionEntry {
 
 typedef std::deque<DefScriptFunctionEntry> DefScriptFunctionTable;
 
+enum DefScriptOp
+{
+    DEFOP_SKIP, // empty lines, markers
+    DEFOP_ELSE,
+    DEFOP_ENDIF,
+    DEFOP_LOOP,
+    DEFOP_ENDLOOP,
+    DEFOP_CMD
+};
+
+// a ${..} or ?{..} in a line template
+struct DefSegment
+{
+    unsigned char type; // DEFSCRIPT_VAR or DEFSCRIPT_FUNC
+    std::string name; // var name, empty for ${} and ?{}
+    unsigned int sub; // DEFSCRIPT_FUNC: index of the embedded line in DefCompiledLine::tpl
+    unsigned int start, end; // position of the '$' or '?' and behind the '}' in the source line
+    bool split; // ends up in cmd or an arg, where ' ' and ',' would split it
+    bool local; // name depends on the script it is read from
+    std::string vname, owner; // name as normalized for script owner (always, if not local)
+    unsigned int hash; // VarSet::Hash(vname)
+};
+
+// part of a split line: either text or the value of a segment
+struct DefPiece
+{
+    int seg; // index in DefLineTemplate::segs, -1 if text
+    std::string text;
+};
+
+struct DefField
+{
+    int arg; // index in CmdSet::arg, -1 for cmd, -2 for defaultarg
+    bool dynamic; // has values
+    std::vector<DefPiece> pieces;
+};
+
+// a line (or the line inside a ?{..}) that is split once with placeholders for its values,
+// see DefScriptPackage::_CompileTemplate()
+struct DefLineTemplate
+{
+    std::string src;
+    std::vector<DefSegment> segs;
+    std::vector<DefField> fields;
+    std::vector<std::string> vals; // values of segs in the current run
+    unsigned int args; // number of args the line splits into
+    unsigned int textlen; // length of src without the segments
+    bool cmdvals, defvals; // cmd or defaultarg consist of values only
+    CmdSet set; // the split line, the fields with values are filled in on every run
+    int func; // index in the function table for set.cmd, -2 if cmd has values
+    unsigned int funcversion;
+};
+
+// a script line as prepared by DefScriptPackage::_CompileScript(), so that it does not have to be parsed again on every run
+struct DefCompiledLine
+{
+    unsigned char op; // DefScriptOp
+    bool dynamic; // contains ${..} or ?{..}, must be replaced and split every time it runs
+    bool escaped; // contains a backslash, Interpret() may unescape set
+    bool busy; // set or tpl are in use by a run of this line further up the stack
+    CmdSet set; // the already split line, only if not dynamic
+    std::vector<DefLineTemplate> tpl; // if dynamic: the line itself and the lines of its ?{..}, empty if it can not be compiled
+    int func; // index in the function table for set.cmd, -1 if it is no function
+    unsigned int funcversion; // function table version at the time func was looked up
+    int iffalse, ifend, loopend; // jump targets, looked up when first needed (-1 until then)
+};
+
 typedef std::deque<std::string> DefList;
 typedef std::map<std::string,DefList*> DefListMap;
 
@@ -84,8 +152,9 @@ public:
 	DefScript(DefScriptPackage *p);
 	~DefScript();
 
-    inline std::string GetLine(unsigned int id) { return Line[id]; }
-    inline unsigned int GetLines(void) { return Line.size(); }
+    inline std::string GetLine(unsigned int id) { return (*_lines)[id]; }
+    inline unsigned int GetLines(void) { return _lines->size(); }
+    inline bool IsShared(void) { return _lines != &Line; }
 	bool AddLine(std::string );
 	std::string GetName(void);
 	void SetName(std::string);
@@ -98,7 +167,12 @@ public:
 
 
 private:
-    DefList Line;
+    DefList Line; // own lines, unused while the script is shared
+    DefList *_lines; // either &Line or read-only lines from the shared pool, see DefScriptPackage::SetShareScripts()
+    std::vector<DefCompiledLine> _code; // same index as _lines
+    bool _compiled; // false if _code is outdated
+    unsigned int _running; // RunScript() calls of this script on the stack
+    std::deque<std::vector<DefCompiledLine> > _oldcode; // code replaced while running, kept until the script returns
 	unsigned int lines;
 	std::string scriptname;
 	unsigned char permission;
@@ -124,7 +198,12 @@ public:
 	unsigned int GetScriptID(std::string);
 	DefReturnResult RunSingleLine(std::string);
 	bool ScriptExists(std::string);
+    inline unsigned int GetScriptsVersion(void) { return _scriptsVersion; } // changes whenever a script is created or deleted
+    inline unsigned int GetLinesRun(void) { return _linesRun; } // script commands run so far, wraps around
     void DeleteScript(std::string);
+    // if set, identical script contents loaded by different packages are kept only once and copied on write
+    inline void SetShareScripts(bool b = true) { _shareScripts = b; }
+    static void ClearSharedScripts(void);
 	VarSet variables;
     void SetPath(std::string);
     bool LoadByName(std::string);
@@ -151,10 +230,25 @@ public:
 
 private:
     void _UpdateOrCreateScriptByName(std::string);
+    void _ShareScript(DefScript*);
+    void _UnshareScript(DefScript*);
+    DefList *_GetWritableList(std::string lname, bool create = true);
     void _InitFunctions(void);
-    DefXChgResult ReplaceVars(std::string str, CmdSet* pSet, unsigned char VarType, bool run_embedded);
+    DefXChgResult ReplaceVars(std::string str, CmdSet* pSet, unsigned char VarType, bool run_embedded, int valuepos = -1, unsigned int rawend = 0);
+    bool _GetVar(const std::string& vn, CmdSet *pSet, std::string& value);
+    bool _GetVar(DefSegment& seg, CmdSet *pSet, std::string& value);
+    bool _GetNormalizedVar(const std::string& vname, unsigned int hash, CmdSet *pSet, std::string& value);
 	void SplitLine(CmdSet&,std::string);
-    DefReturnResult Interpret(CmdSet&);
+    DefReturnResult Interpret(CmdSet&, int func = -2);
+    int _FindFunc(const std::string&);
+    void _CompileScript(DefScript*);
+    int _CompileTemplate(DefCompiledLine&, const std::string&);
+    bool _FillTemplate(DefCompiledLine&, unsigned int t, CmdSet *pSet, unsigned char type, DefXChgResult& xchg);
+    bool _RunEmbedded(DefCompiledLine&, unsigned int t, CmdSet *pSet, std::string& value);
+    int _GetTemplateFunc(DefLineTemplate&);
+    unsigned int _GetIfFalseJump(DefScript*, unsigned int);
+    unsigned int _GetIfEndJump(DefScript*, unsigned int);
+    unsigned int _GetLoopEndJump(DefScript*, unsigned int);
     void RemoveBrackets(CmdSet&);
     void UnescapeSet(CmdSet&);
     std::string RemoveBracketsFromString(std::string);
@@ -162,8 +256,13 @@ private:
     void *parentMethod;
     DefScript_DynamicEventMgr *_eventmgr;
     std::map<std::string,DefScript*> Script;
+    unsigned int _scriptsVersion;
+    bool _shareScripts;
     std::map<std::string,unsigned char> scriptPermissionMap;
     DefScriptFunctionTable _functable;
+    std::map<std::string,unsigned int> _funcindex; // name -> index in _functable
+    unsigned int _funcVersion; // changes whenever _funcindex changes
+    unsigned int _linesRun;
     _DEFSC_DEBUG(std::fstream hLogfile);
 
     // Usable internal basic functions:
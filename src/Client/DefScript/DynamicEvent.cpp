@@ -4,99 +4,99 @@
 struct DefScript_DynamicEvent
 {
 	std::string name, cmd, parent;
-	clock_t counter, interval;
-    bool ran; // if a script has an execution time longer then the interval, and modifies an event, need to check if the event was already triggered, to prevent endless loop
+	uint32 interval;
+    uint64 due; // TimerWheel::Now() time of the next run
+    uint64 timer; // id in the timer wheel
 };
 
 DefScript_DynamicEventMgr::DefScript_DynamicEventMgr(DefScriptPackage *pack)
 {
 	_pack = pack;
-	_lastclock = clock();
-    _events_changed = false;
+    _wheel = &_ownwheel;
 }
 
 DefScript_DynamicEventMgr::~DefScript_DynamicEventMgr()
 {
+    for(std::map<std::string,DefScript_DynamicEvent*>::iterator i = _storage.GetMap().begin(); i != _storage.GetMap().end(); i++)
+        _wheel->Remove(i->second->timer);
     _storage.Clear();
 }
 
-void DefScript_DynamicEventMgr::Add(std::string name, std::string script, clock_t interval, const char *parent, bool force)
+void DefScript_DynamicEventMgr::SetTimerWheel(TimerWheel *tw)
+{
+    if(!tw)
+        tw = &_ownwheel;
+    if(tw == _wheel)
+        return;
+    // move all pending events over
+    for(std::map<std::string,DefScript_DynamicEvent*>::iterator i = _storage.GetMap().begin(); i != _storage.GetMap().end(); i++)
+    {
+        DefScript_DynamicEvent *e = i->second;
+        _wheel->Remove(e->timer);
+        e->timer = tw->Add(e->due, this, e);
+    }
+    _wheel = tw;
+}
+
+void DefScript_DynamicEventMgr::Add(std::string name, std::string script, uint32 interval, const char *parent, bool force)
 {
     _DEFSC_DEBUG( printf("DEFSCRIPT: Add Event %s, interval=%u, parent=%s\n",name.c_str(),interval,parent?parent:""); printf("DEFSCRIPT: EventRun='%s'\n",script.c_str()); )
     if(name.empty() || script.empty() || interval==0)
         return;
-    if(_storage.Exists(name) && !force)
-        return;
+    if(_storage.Exists(name))
+    {
+        if(!force)
+            return;
+        _wheel->Remove(_storage.Get(name)->timer);
+    }
 
     DefScript_DynamicEvent *e = _storage.Get(name);
     e->name = name;
     e->cmd = script;
     e->interval = interval;
     e->parent = parent?parent:"";
-    e->counter = 0;
-    e->ran = false;
-    _events_changed = true;
+    e->due = TimerWheel::Now() + interval;
+    e->timer = _wheel->Add(e->due, this, e);
 }
 
 void DefScript_DynamicEventMgr::Remove(std::string name)
 {
+    if(DefScript_DynamicEvent *e = _storage.GetNoCreate(name))
+        _wheel->Remove(e->timer);
     _storage.Delete(name);
-    _events_changed = true;
 }
 
 void DefScript_DynamicEventMgr::Update(void)
 {
-    bool decr_timer = false;
-    clock_t diff = clock() - _lastclock;
-    _lastclock = clock();
-    DefScript *sc;
-    DefScript_DynamicEvent *e;
-    _events_changed = false;
-
-    for(std::map<std::string,DefScript_DynamicEvent*>::iterator i = _storage.GetMap().begin(); i != _storage.GetMap().end(); i++ )
-    {
-        i->second->ran = false;
-    }
+    if(_wheel == &_ownwheel)
+        _wheel->Update();
+}
 
-    for(std::map<std::string,DefScript_DynamicEvent*>::iterator i = _storage.GetMap().begin(); i != _storage.GetMap().end(); )
-    {
-        e = i->second;
-        sc = NULL;
-		try
-		{
-			e->counter += diff;
-			if(e->counter >= e->interval && !e->ran)
-			{
-				decr_timer = true;
+void DefScript_DynamicEventMgr::OnTimer(uint64 id, void *arg)
+{
+    DefScript_DynamicEvent *e = (DefScript_DynamicEvent*)arg;
 
-				if(!e->parent.empty())
-					sc = _pack->GetScript(e->parent);
+    // schedule the next run before the script runs, it may remove or replace the event.
+    // if we are late by more than one interval, the missed runs are dropped.
+    uint64 now = TimerWheel::Now();
+    e->due += e->interval;
+    if(e->due <= now)
+        e->due = now + e->interval - (now - e->due) % e->interval;
+    e->timer = _wheel->Add(e->due, this, e);
 
-				if(sc)
-					_pack->RunSingleLineFromScript(e->cmd,sc);
-				else
-					_pack->RunSingleLine(e->cmd);
-			}
-		}
-		catch (...)
-		{
-			printf("Error in DefScript_DynamicEventMgr::Update()\n");
-            return;
-		}
-        if(decr_timer)
-        {
-            e->counter %= e->interval;
-            e->ran = true;
-            decr_timer = false;
-        }
-        if(_events_changed)
-        {
-            _events_changed = false;
-            i = _storage.GetMap().begin();
-        }
+    std::string cmd = e->cmd; // e may be deleted by the script
+    DefScript *sc = NULL;
+    if(!e->parent.empty())
+        sc = _pack->GetScript(e->parent);
+    try
+    {
+        if(sc)
+            _pack->RunSingleLineFromScript(cmd,sc);
         else
-        {
-            i++;
-        }
+            _pack->RunSingleLine(cmd);
+    }
+    catch (...)
+    {
+        printf("Error in DefScript_DynamicEventMgr::OnTimer()\n");
     }
 }
@@ -6,26 +6,30 @@
 #include <string>
 
 #include "TypeStorage.h"
+#include "TimerWheel.h"
 
 struct DefScript_DynamicEvent;
 class DefScript;
 class DefScriptPackage;
 typedef TypeStorage<DefScript_DynamicEvent> DefDynamicEventStorage;
 
-class DefScript_DynamicEventMgr
+class DefScript_DynamicEventMgr : public TimerWheelHandler
 {
 public:
     DefScript_DynamicEventMgr(DefScriptPackage *pack);
     ~DefScript_DynamicEventMgr();
-    void Add(std::string name, std::string script, clock_t interval, const char *parent, bool force = false);
+    void Add(std::string name, std::string script, uint32 interval, const char *parent, bool force = false); // interval in ms
 	void Remove(std::string name);
-	void Update(void);
+	void Update(void); // only needed if no external timer wheel is set
+    // schedule events into a timer wheel that is updated by someone else, NULL to use an own one again
+    void SetTimerWheel(TimerWheel *tw);
+    void OnTimer(uint64 id, void *arg);
 	
 private:
 	DefDynamicEventStorage _storage;
-	clock_t _lastclock;
     DefScriptPackage *_pack;
-    bool _events_changed; // this one helps to detect if a script called from an event has modified the event storage (risk of iterator invalidation!)
+    TimerWheel _ownwheel;
+    TimerWheel *_wheel;
 };
 
 #endif
@@ -8,6 +8,8 @@
 
 VarSet::VarSet()
 {
+    deleted=0;
+    _Rehash(64);
 }
 
 VarSet::~VarSet()
@@ -15,69 +17,146 @@ VarSet::~VarSet()
 	Clear();
 }
 
-std::string VarSet::Get(std::string varname)
+// FNV-1a
+unsigned int VarSet::Hash(const std::string& s)
 {
-    for(std::deque<Var>::iterator i=buffer.begin();i!=buffer.end();i++)
-		if( i->name==varname )
-			return i->value;
-    return ""; // if var has not been set return empty string
+    unsigned int h = 2166136261u;
+    for(unsigned int i = 0; i < s.length(); i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int VarSet::_FindIndex(const std::string& varname, unsigned int hash)
+{
+    for(int i = buckets[hash & (buckets.size() - 1)]; i >= 0; i = buffer[i].next)
+        if(buffer[i].hash == hash && buffer[i].v.name == varname)
+            return i;
+    return -1;
 }
 
-void VarSet::Set(std::string varname, std::string varvalue)
+void VarSet::_Rehash(unsigned int bucketcount)
+{
+    buckets.assign(bucketcount, -1);
+    // insert backwards, so that each chain ends up in creation order
+    for(int i = int(buffer.size()) - 1; i >= 0; i--)
+    {
+        if(!buffer[i].used)
+            continue;
+        unsigned int b = buffer[i].hash & (bucketcount - 1);
+        buffer[i].next = buckets[b];
+        buckets[b] = i;
+    }
+}
+
+void VarSet::_Compact(void)
+{
+    unsigned int j = 0;
+    for(unsigned int i = 0; i < buffer.size(); i++)
+        if(buffer[i].used)
+        {
+            if(i != j)
+                buffer[j] = buffer[i];
+            j++;
+        }
+    buffer.resize(j);
+    deleted = 0;
+    _Rehash(buckets.size());
+}
+
+const std::string *VarSet::Find(const std::string& varname)
+{
+    return Find(varname, Hash(varname));
+}
+
+const std::string *VarSet::Find(const std::string& varname, unsigned int hash)
+{
+    int i = _FindIndex(varname, hash);
+    return i < 0 ? NULL : &buffer[i].v.value;
+}
+
+std::string VarSet::Get(const std::string& varname)
+{
+    const std::string *v = Find(varname);
+    return v ? *v : ""; // if var has not been set return empty string
+}
+
+void VarSet::Set(const std::string& varname, const std::string& varvalue)
 {
 	if(varname.empty())
         return;
-	for(std::deque<Var>::iterator i = buffer.begin();i!=buffer.end();i++)
+    unsigned int h = Hash(varname);
+    int i = _FindIndex(varname, h);
+    if(i >= 0)
     {
-		if( i->name==varname )
-        {
-			i->value=varvalue;
-			return;
-		}
-	}
-    Var v;
-    v.name=varname;
-    v.value=varvalue;
-    buffer.push_back(v);
-	return;
+        buffer[i].v.value = varvalue;
+        return;
+    }
+    if(deleted > 32 && deleted * 2 > buffer.size())
+        _Compact();
+    Entry e;
+    e.v.name = varname;
+    e.v.value = varvalue;
+    e.hash = h;
+    e.used = true;
+    buffer.push_back(e);
+    if(buffer.size() > buckets.size())
+        _Rehash(buckets.size() * 2);
+    else
+    {
+        unsigned int b = h & (buckets.size() - 1);
+        buffer.back().next = buckets[b];
+        buckets[b] = buffer.size() - 1;
+    }
 }
 
 unsigned int VarSet::Size(void)
 {
-    return buffer.size();
+    return buffer.size() - deleted;
 }
 
-bool VarSet::Exists(std::string varname)
+bool VarSet::Exists(const std::string& varname)
 {
-	for(std::deque<Var>::iterator i = buffer.begin();i!=buffer.end();i++)
-        if(i->name==varname)
-            return true;
-	return false;
+    return _FindIndex(varname, Hash(varname)) >= 0;
 }
 
-void VarSet::Unset(std::string varname)
+void VarSet::Unset(const std::string& varname)
 {
     if ( varname.empty() )
         return;
-	for(std::deque<Var>::iterator i = buffer.begin();i!=buffer.end();i++)
+    unsigned int h = Hash(varname);
+    int *link = &buckets[h & (buckets.size() - 1)];
+    while(*link >= 0)
     {
-		if(i->name==varname)
+        Entry& e = buffer[*link];
+        if(e.hash == h && e.v.name == varname)
         {
-			buffer.erase(i);
-			return;
-		}
-	}
+            *link = e.next;
+            e.used = false;
+            e.v.name.clear();
+            e.v.value.clear();
+            deleted++;
+            return;
+        }
+        link = &e.next;
+    }
 }
 
 void VarSet::Clear(void)
 {
     buffer.clear();
+    deleted = 0;
+    buckets.assign(buckets.size(), -1);
 }
 
 Var VarSet::operator[](unsigned int id)
- {
-     return buffer.at(id);
- }
+{
+    if(deleted)
+        _Compact();
+    return buffer.at(id).v;
+}
 	
 bool VarSet::ReadVarsFromFile(std::string fn)
 {
@@ -2,7 +2,7 @@
 #define __VARSET_H
 
 #include <string>
-#include <deque>
+#include <vector>
 
 
 struct Var {
@@ -12,20 +12,38 @@ struct Var {
 
 class VarSet {
 public:
-    void Set(std::string,std::string);
-    std::string Get(std::string);
+    void Set(const std::string&,const std::string&);
+    std::string Get(const std::string&);
+    const std::string *Find(const std::string&); // NULL if not set; pointer is valid until the next change
+    const std::string *Find(const std::string&, unsigned int hash); // same, hash must be Hash(name)
 	void Clear(void);
-	void Unset(std::string);
+	void Unset(const std::string&);
 	unsigned int Size(void);
-	bool Exists(std::string);
+	bool Exists(const std::string&);
     bool ReadVarsFromFile(std::string fn);
-    Var operator[](unsigned int id);
+    Var operator[](unsigned int id); // in order of creation
 	VarSet();
 	~VarSet();
+    static unsigned int Hash(const std::string&);
 	// far future: MergeWith(VarSet,bool overwrite);
 
 private:
-    std::deque<Var> buffer;
+    // vars are kept in creation order, and chained into hash buckets by index.
+    // unset vars are only marked and removed in the next _Compact().
+    struct Entry
+    {
+        Var v;
+        unsigned int hash;
+        int next; // next entry in the same bucket, -1 = end
+        bool used;
+    };
+    std::vector<Entry> buffer;
+    std::vector<int> buckets;
+    unsigned int deleted;
+
+    int _FindIndex(const std::string&, unsigned int hash);
+    void _Rehash(unsigned int bucketcount);
+    void _Compact(void);
     std::string toLower(std::string);
     std::string toUpper(std::string);
 
@@ -1,4 +1,5 @@
 #include <stdarg.h>
+#include <algorithm>
 #include "common.h"
 #include "PseuWoW.h"
 #include "DefScript/DefScript.h"
@@ -9,6 +10,8 @@
 #include "World/WorldSession.h"
 #include "World/Channel.h"
 #include "World/CacheHandler.h"
+#include "World/World.h"
+#include "World/MovementMgr.h"
 #include "SCPDatabase.h"
 #include "MemoryDataHolder.h"
 
@@ -56,12 +59,15 @@ void DefScriptPackage::_InitDefScriptInterface(void)
     AddFunc("sendwho",&DefScriptPackage::SCSendWho);
     AddFunc("getobjectdist",&DefScriptPackage::SCGetObjectDistance);
     AddFunc("getobjectpos",&DefScriptPackage::SCGetPos);
+    AddFunc("getobjectsinrange",&DefScriptPackage::SCGetObjectsInRange);
+    AddFunc("moveto",&DefScriptPackage::SCMoveTo);
     AddFunc("switchopcodehandler",&DefScriptPackage::SCSwitchOpcodeHandler);
     AddFunc("opcodedisabled",&DefScriptPackage::SCOpcodeDisabled);
     AddFunc("spoofworldpacket",&DefScriptPackage::SCSpoofWorldPacket);
     AddFunc("loaddb",&DefScriptPackage::SCLoadDB);
     AddFunc("adddbpath",&DefScriptPackage::SCAddDBPath);
     AddFunc("preloadfile",&DefScriptPackage::SCPreloadFile);
+    AddFunc("getdatacachestats",&DefScriptPackage::SCGetDataCacheStats);
 }
 
 DefReturnResult DefScriptPackage::SCshdn(CmdSet& Set)
@@ -802,7 +808,7 @@ DefReturnResult DefScriptPackage::SCGetItemProtoValue(CmdSet& Set)
 
 DefReturnResult DefScriptPackage::SCGetFileList(CmdSet& Set)
 {
-    DefList *l = lists.Get(_NormalizeVarName(Set.arg[0],Set.myname));
+    DefList *l = _GetWritableList(_NormalizeVarName(Set.arg[0],Set.myname));
     l->clear();
     *l = (DefList)GetFileList(Set.defaultarg);
     if(Set.arg[1].length())
@@ -1110,6 +1116,59 @@ DefReturnResult DefScriptPackage::SCGetObjectDistance(CmdSet &Set)
     return "";
 }
 
+// fills list @0 with the guids of all objects within range @def around object @2 (own char if not given),
+// nearest first. @1 restricts the search to one type id. returns the amount of objects found.
+DefReturnResult DefScriptPackage::SCGetObjectsInRange(CmdSet &Set)
+{
+    WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
+    if(!ws)
+    {
+        logerror("Invalid Script call: SCGetObjectsInRange: WorldSession not valid");
+        DEF_RETURN_ERROR;
+    }
+    DefList *l = _GetWritableList(_NormalizeVarName(Set.arg[0],Set.myname));
+    l->clear();
+
+    float range = (float)DefScriptTools::toNumber(Set.defaultarg);
+    uint32 typemask = (1 << TYPEID_MAX) - 1;
+    if(Set.arg[1].length())
+        typemask = 1 << ((uint32)DefScriptTools::toUint64(Set.arg[1]) % TYPEID_MAX);
+    uint64 guid = Set.arg[2].length() ? DefScriptTools::toUint64(Set.arg[2]) : ws->GetGuid();
+    Object *center = ws->objmgr.GetObj(guid);
+    if(!center || !center->IsWorldObject() || range <= 0)
+        return "0";
+
+    WorldObject *wo = (WorldObject*)center;
+    std::vector<WorldObject*> found;
+    ws->objmgr.GetObjectsInRange(wo->GetX(), wo->GetY(), wo->GetZ(), range, typemask, found);
+
+    std::vector< std::pair<float,uint64> > sorted;
+    for(uint32 i = 0; i < found.size(); i++)
+        if(found[i] != wo)
+            sorted.push_back(std::make_pair(wo->GetDistance(found[i]), found[i]->GetGUID()));
+    std::sort(sorted.begin(), sorted.end());
+    for(uint32 i = 0; i < sorted.size(); i++)
+        l->push_back(toString(sorted[i].second));
+
+    return toString((uint64)l->size());
+}
+
+// walks the own character to position x=@0 y=@1 z=@2, around steep terrain if maps are used.
+// returns false if no path was found.
+DefReturnResult DefScriptPackage::SCMoveTo(CmdSet &Set)
+{
+    WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
+    if(!ws || !ws->GetWorld() || !ws->GetWorld()->GetMoveMgr())
+    {
+        logerror("Invalid Script call: SCMoveTo: WorldSession not valid or not in world");
+        DEF_RETURN_ERROR;
+    }
+    float x = (float)DefScriptTools::toNumber(Set.arg[0]);
+    float y = (float)DefScriptTools::toNumber(Set.arg[1]);
+    float z = (float)DefScriptTools::toNumber(Set.arg[2]);
+    return ws->GetWorld()->GetMoveMgr()->MoveTo(x, y, z);
+}
+
 DefReturnResult DefScriptPackage::SCSwitchOpcodeHandler(CmdSet &Set)
 {
     WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
@@ -1181,7 +1240,7 @@ DefReturnResult DefScriptPackage::SCSpoofWorldPacket(CmdSet &Set)
             if(bb->size())
                 wp->append(bb->contents(), bb->size());
             logdebug("Spoofing WorldPacket with opcode %s (%u), size %u",GetOpcodeName(opcode),opcode,wp->size());
-            ws->AddToPktQueue(wp); // handle this packet as if it was sent by the server
+            ws->InjectPacket(wp); // handle this packet as if it was sent by the server
             return true;
         }
     }
@@ -1236,6 +1295,26 @@ DefReturnResult DefScriptPackage::SCPreloadFile(CmdSet& Set)
     return true;
 }
 
+DefReturnResult DefScriptPackage::SCGetDataCacheStats(CmdSet& Set)
+{
+    MemoryDataHolder::CacheStats cs = MemoryDataHolder::GetCacheStats();
+    std::string t = stringToLower(Set.defaultarg);
+    if(t == "files")            return DefScriptTools::toString(cs.files);
+    else if(t == "bytes")       return DefScriptTools::toString(cs.bytes);
+    else if(t == "unusedfiles") return DefScriptTools::toString(cs.unusedfiles);
+    else if(t == "unusedbytes") return DefScriptTools::toString(cs.unusedbytes);
+    else if(t == "budget")      return DefScriptTools::toString(cs.budget);
+    else if(t == "hits")        return DefScriptTools::toString(cs.hits);
+    else if(t == "misses")      return DefScriptTools::toString(cs.misses);
+    else if(t == "evictions")   return DefScriptTools::toString(cs.evictions);
+    else if(t.empty())
+    {
+        MemoryDataHolder::LogCacheStats();
+        return true;
+    }
+    return "";
+}
+
 void DefScriptPackage::My_LoadUserPermissions(VarSet &vs)
 {
     static const char *prefix = "USERS::";
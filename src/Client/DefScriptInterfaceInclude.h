@@ -51,7 +51,10 @@ DefReturnResult SCSpoofWorldPacket(CmdSet&);
 DefReturnResult SCLoadDB(CmdSet&);
 DefReturnResult SCAddDBPath(CmdSet&);
 DefReturnResult SCGetPos(CmdSet&);
+DefReturnResult SCGetObjectsInRange(CmdSet&);
+DefReturnResult SCMoveTo(CmdSet&);
 DefReturnResult SCPreloadFile(CmdSet&);
+DefReturnResult SCGetDataCacheStats(CmdSet&);
 
 
 void my_print(const char *fmt, ...);
@@ -15,32 +15,69 @@ DrawObjMgr::~DrawObjMgr()
 
 void DrawObjMgr::Clear(void)
 {
-    DEBUG( logdebug("DrawObjMgr::Clear(), deleting %u DrawObjects...", _storage.size() ) );
+    _Process(); // what was added before is deleted below, pending deletes have nothing left to do
+    _DeleteStorage();
+}
+
+void DrawObjMgr::_DeleteStorage(void)
+{
+    DEBUG( logdebug("DrawObjMgr: deleting %u DrawObjects...", _storage.size() ) );
     for(DrawObjStorage::iterator i = _storage.begin(); i != _storage.end(); i++)
     {
         DEBUG( logdebug("del for guid "I64FMT, i->first) );
         delete i->second; // this can be done safely, since the object ptrs are not accessed
     }
     _storage.clear();
-
-    while(_add.size())
-    {
-        delete _add.next().second;
-    }
-    while(_del.size())
-    {
-        _del.next();
-    }
 }
 
 void DrawObjMgr::Add(uint64 objguid, DrawObject *o)
 {
-    _add.add(std::pair<uint64,DrawObject*>(objguid,o));
+    _cmds.Push(DrawObjCmd(DRAWOBJ_ADD,objguid,o));
 }
 
 void DrawObjMgr::Delete(uint64 guid)
 {
-    _del.add(guid);
+    _cmds.Push(DrawObjCmd(DRAWOBJ_DELETE,guid,NULL));
+}
+
+void DrawObjMgr::RequestClear(void)
+{
+    _cmds.Push(DrawObjCmd(DRAWOBJ_CLEAR,0,NULL));
+}
+
+void DrawObjMgr::_Process(void)
+{
+    DrawObjCmd c;
+    while(_cmds.Pop(c))
+    {
+        switch(c.type)
+        {
+            case DRAWOBJ_ADD:
+            {
+                DEBUG(logdebug("DrawObjMgr: adding DrawObj 0x%X guid "I64FMT" to main storage",c.obj,c.guid));
+                _storage[c.guid] = c.obj;
+                break;
+            }
+            case DRAWOBJ_DELETE:
+            {
+                DrawObjStorage::iterator it = _storage.find(c.guid);
+                if(it != _storage.end())
+                {
+                    DEBUG(logdebug("DrawObjMgr: removing DrawObj 0x%X guid "I64FMT" from main storage",it->second,c.guid));
+                    delete it->second;
+                    _storage.erase(it);
+                }
+                else
+                {
+                    DEBUG(logdebug("DrawObjMgr: ERROR: removable DrawObject "I64FMT" not exising",c.guid));
+                }
+                break;
+            }
+            case DRAWOBJ_CLEAR:
+                _DeleteStorage();
+                break;
+        }
+    }
 }
 
 void DrawObjMgr::UnlinkAll(void)
@@ -61,31 +98,8 @@ void DrawObjMgr::Update(void)
     // TODO: lock only main thread (that should be the only one to delete objects anyway!)
     //mut.acquire();
 
-    // add objects waiting on the add queue to the real storage
-    while(_add.size())
-    {
-        std::pair<uint64,DrawObject*> p = _add.next();
-        DEBUG(logdebug("DrawObjMgr: adding DrawObj 0x%X guid "I64FMT" to main storage",p.second,p.first));
-        _storage[p.first] = p.second;
-    }
-
-    // same for objects that should be deleted
-    while(_del.size())
-    {
-        uint64 guid = _del.next();
-        if(_storage.find(guid) != _storage.end())
-        {
-
-            DrawObject *o = _storage[guid];
-            DEBUG(logdebug("DrawObjMgr: removing DrawObj 0x%X guid "I64FMT" from main storage",o,guid));
-            _storage.erase(guid);
-            delete o;
-        }
-        else
-        {
-            DEBUG(logdebug("DrawObjMgr: ERROR: removable DrawObject "I64FMT" not exising",guid));
-        }
-    }
+    // add and delete what the session thread queued since the last call
+    _Process();
 
     // now draw everything
     for(DrawObjStorage::iterator i = _storage.begin(); i != _storage.end(); i++)
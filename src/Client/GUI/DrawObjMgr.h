@@ -2,28 +2,50 @@
 #define DRAWOBJMGR_H
 
 #include <utility>
+#include "SPSCRing.h"
 
 class DrawObject;
 
 typedef std::map<uint64,DrawObject*> DrawObjStorage;
 
+enum DrawObjCmdType
+{
+    DRAWOBJ_ADD,
+    DRAWOBJ_DELETE,
+    DRAWOBJ_CLEAR,
+};
+
+struct DrawObjCmd
+{
+    DrawObjCmd() : type(DRAWOBJ_CLEAR), guid(0), obj(NULL) {}
+    DrawObjCmd(uint8 t, uint64 g, DrawObject *o) : type(t), guid(g), obj(o) {}
+    uint8 type;
+    uint64 guid;
+    DrawObject *obj; // DRAWOBJ_ADD only
+};
+
+// the session thread queues changes, the GUI thread carries them out in Update().
+// one queue for all of them, so a clear can't overtake adds queued before it, or eat adds queued after it.
 class DrawObjMgr
 {
 public:
     DrawObjMgr();
     ~DrawObjMgr();
-    void Add(uint64,DrawObject*);
-    void Delete(uint64);
-    void Clear(void);
+    void Add(uint64,DrawObject*); // from the session thread
+    void Delete(uint64); // from the session thread
+    void RequestClear(void); // from the session thread, the next Update() deletes everything queued or stored up to here
+    void Clear(void); // from the GUI thread only
     void Update(void); // Threadsafe! delete code must be called from here!
     uint32 StorageSize(void) { return _storage.size(); }
     void UnlinkAll(void);
     DrawObject *Get(uint64);
 
 private:
+    void _DeleteStorage(void);
+    void _Process(void); // carries out the queued commands, the only consumer of _cmds
+
     DrawObjStorage _storage;
-    ZThread::LockedQueue<uint64,ZThread::FastMutex> _del;
-    ZThread::LockedQueue<std::pair<uint64,DrawObject*>,ZThread::FastMutex > _add;
+    SPSCRing<DrawObjCmd> _cmds;
 
 };
 
@@ -277,9 +277,10 @@ void PseuGUI::NotifyObjectCreation(Object *o)
     domgr.Add(o->GetGUID(),d);
 }
 
+// called from ObjMgr::RemoveAll(), on the session thread while the scene may be drawing
 void PseuGUI::NotifyAllObjectsDeletion(void)
 {
-    domgr.Clear();
+    domgr.RequestClear();
 }
 
 void PseuGUI::SetInstance(PseuInstance* in)
@@ -545,19 +545,14 @@ void SceneWorld::UpdateTerrain(void)
     if(map_gridX == mapmgr->GetGridX() && map_gridY == mapmgr->GetGridY())
         return; // grid not changed, not necessary to update tile data
 
+    // tiles are loaded in the background. if they are not there yet, keep drawing the old terrain and try again next frame
+    if(!mapmgr->Loaded())
+        return;
+
     // ... if changed, do necessary stuff...
     map_gridX = mapmgr->GetGridX();
     map_gridY = mapmgr->GetGridY();
 
-    // TODO: better to do this with some ZThread Condition or FastMutex, but dont know how to. help plz! [FG]
-    if(!mapmgr->Loaded())
-    {
-        logdebug("SceneWorld: Waiting until maps are loaded...");
-        while(!mapmgr->Loaded())
-            device->sleep(1);
-        logdebug("SceneWorld: ... maps done loading");
-    }
-
     // TODO: as soon as WMO-only worlds are implemented, remove this!!
     if(!mapmgr->GetLoadedMapsCount())
     {
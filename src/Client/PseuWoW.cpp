@@ -13,6 +13,8 @@
 #include "World/CacheHandler.h"
 #include "GUI/PseuGUI.h"
 #include "RemoteController.h"
+#include "SessionSocketHandler.h"
+#include "WakeupSocket.h"
 #include "Cli.h"
 #include "GUI/SceneData.h"
 #include "MemoryDataHolder.h"
@@ -20,8 +22,11 @@
 
 //###### Start of program code #######
 
-PseuInstanceRunnable::PseuInstanceRunnable()
+PseuInstanceRunnable::PseuInstanceRunnable(uint32 swarmindex)
 {
+    _i = NULL;
+    _swarmindex = swarmindex;
+    _initdone = false;
 }
 
 void PseuInstanceRunnable::run(void)
@@ -29,15 +34,19 @@ void PseuInstanceRunnable::run(void)
     _i = new PseuInstance(this);
     _i->SetConfDir("./conf/");
     _i->SetScpDir("./scripts/");
-    if(_i->Init())
+    _i->SetSwarmIndex(_swarmindex);
+    bool initok = _i->Init();
+    _initdone = true;
+    if(initok)
     {
         _i->Run();
     }
-    else
+    else if(!_swarmindex)
     {
         getchar(); // if init failed, wait for keypress before exit
     }
     delete _i;
+    _i = NULL;
 }
 
 void PseuInstanceRunnable::sleep(uint32 msecs)
@@ -56,6 +65,8 @@ PseuInstance::PseuInstance(PseuInstanceRunnable *run)
     _conf=NULL;
     _cli=NULL;
     _rmcontrol=NULL;
+    _sh=NULL;
+    _wakeup=NULL;
     _gui=NULL;
     _guithread=NULL;
     _stop=false;
@@ -64,7 +75,9 @@ PseuInstance::PseuInstance(PseuInstanceRunnable *run)
     _createws=false;
     _creaters=false;
     _error=false;
+    _headless=false;
     _initialized=false;
+    _swarmindex=0;
     for(uint32 i = 0; i < COND_MAX; i++)
     {
         _condition[i] = new ZThread::Condition(_mutex);
@@ -96,6 +109,11 @@ PseuInstance::~PseuInstance()
     if(_wsession)
         delete _wsession;
 
+    // deletes the wakeup socket and what the remote controller left
+    _wakeup = NULL;
+    if(_sh)
+        delete _sh;
+
     delete _scp;
     delete _conf;
 
@@ -123,19 +141,29 @@ bool PseuInstance::Init(void)
 
     _scp=new DefScriptPackage();
     _scp->SetParentMethod((void*)this);
+    _scp->GetEventMgr()->SetTimerWheel(&_timers);
     _conf=new PseuInstanceConf();
+    _conf->swarmindex=_swarmindex;
 
     _scp->SetPath(_scpdir);
 
+    if(_swarmindex)
+    {
+        // all bots of a swarm load the same things, keep them in memory only once
+        _scp->SetShareScripts(true);
+        dbmgr.SetShared(true);
+    }
+
     CreateDir("cache");
 
     dbmgr.AddSearchPath("./cache");
     dbmgr.AddSearchPath("./data/scp");
-    dbmgr.SetCompression(6);
+    dbmgr.SetCompression(0); // uncompressed .ccp files are mapped and used in place, without copying
 
     _scp->variables.Set("@version_short",_ver_short);
     _scp->variables.Set("@version",_ver);
     _scp->variables.Set("@inworld","false");
+    _scp->variables.Set("@swarmindex",toString(_swarmindex));
 
     if(!_scp->LoadScriptFromFile("./_startup.def"))
     {
@@ -148,6 +176,27 @@ bool PseuInstance::Init(void)
         SetError();
     }
 
+    if(_headless)
+    {
+        GetConf()->enablegui = false;
+        GetConf()->enablecli = false;
+        GetConf()->rmcontrolport = 0;
+    }
+
+    _sh = SessionSocketHandler::CreateInstanceHandler(GetConf()->networkbackend);
+    WakeupSocket *wakeup = new WakeupSocket(*_sh);
+    if(wakeup->Open())
+    {
+        wakeup->SetDeleteByHandler(true);
+        _sh->Add(wakeup);
+        _wakeup = wakeup; // from now on other threads may use it
+    }
+    else
+    {
+        logerror("Can't create wakeup socket, commands from other threads may wait up to NetworkSleepTime ms");
+        delete wakeup;
+    }
+
     // TODO: find a better loaction where to place this block!
     if(GetConf()->enablegui)
     {
@@ -297,7 +346,7 @@ void PseuInstance::Run(void)
         GetScripts()->RunScript("_onexit",&Set);
     }
 
-    if(GetConf()->exitonerror == false && _error)
+    if(GetConf()->exitonerror == false && _error && !GetConf()->swarmindex)
     {
         log("Exiting on error is disabled, PseuWoW is now IDLE");
         log("-- Press enter to exit --");
@@ -379,19 +428,39 @@ void PseuInstance::Update()
         }
 
 
-    if(_rmcontrol)
+    if(_rmcontrol && _rmcontrol->MustDie())
     {
-        _rmcontrol->Update();
-        if(_rmcontrol->MustDie())
-        {
-            delete _rmcontrol;
-            _rmcontrol = NULL;
-        }
+        delete _rmcontrol;
+        _rmcontrol = NULL;
     }
 
-    GetScripts()->GetEventMgr()->Update();
+    _timers.Update();
+
+    // packets sent by timers or commands since the session update
+    if(_wsession)
+        _wsession->FlushSends();
+
+    // wait until a socket is ready, another thread calls Wakeup() or the next timer is due. whatever became ready is handled
+    // right here, so received packets are in the session queues for the next Update().
+    // networksleeptime caps the wait for things nobody wakes us up for, like state changes made by the GUI
+    uint32 waittime = GetConf()->networksleeptime;
+    uint64 next, now = GetMonotonicMS();
+    if(_timers.GetNextExpiry(next))
+        waittime = next > now ? std::min<uint64>(waittime, next - now) : 0;
+    // without a wakeup socket and sessions there is nothing to wait on, and select() on empty sets fails at once on windows
+    if(_sh->GetCount() || _sh->GetPendingCount())
+        _sh->Select(waittime / 1000, (waittime % 1000) * 1000);
+    else
+        Sleep(waittime);
+}
 
-    this->Sleep(GetConf()->networksleeptime);
+WorldSession *PseuInstance::CreateOfflineWorldSession(void)
+{
+    if(_wsession)
+        delete _wsession;
+    _wsession = new WorldSession(this);
+    _wsession->SetOffline();
+    return _wsession;
 }
 
 void PseuInstance::ProcessCliQueue(void)
@@ -414,10 +483,20 @@ void PseuInstance::ProcessCliQueue(void)
 void PseuInstance::AddCliCommand(std::string cmd)
 {
     _cliQueue.add(cmd);
+    Wakeup();
+}
+
+void PseuInstance::Wakeup(void)
+{
+    if(_wakeup)
+        _wakeup->Wakeup();
 }
 
 void PseuInstance::SaveAllCache(void)
 {
+    // in a swarm all bots would write the same files at once, so leave it to the first one
+    if(GetConf()->swarmindex > 1)
+        return;
     //...
     if(GetWSession())
     {
@@ -448,21 +527,11 @@ void PseuInstance::DeleteGUI(void)
 #endif
 }
 
-bool PseuInstance::ConnectToRealm(void)
+void PseuInstance::ConnectToRealm(void)
 {
     _rsession = new RealmSession(this);
     _rsession->SetLogonData(); // get accname & accpass from PseuInstanceConfig and set it in the realm session
-    _rsession->Connect();
-    if(_rsession->MustDie() || !_rsession->SocketGood()) // something failed. it will be deleted in next Update() call
-    {
-        logerror("PseuInstance: Connecting to Realm failed!");
-        if(_gui)
-            _gui->SetSceneData(ISCENE_LOGIN_CONN_STATUS, DSCENE_LOGIN_CONN_FAILED);
-        return false;
-    }
-
-    _rsession->SendLogonChallenge();
-    return true;
+    _rsession->Connect(); // the session sends the logon challenge or dies in its Update()
 }
 
 void PseuInstance::WaitForCondition(InstanceConditions c, uint32 timeout /* = 0 */)
@@ -482,6 +551,26 @@ PseuInstanceConf::PseuInstanceConf()
     exitonerror=false;
     debug=0;
     rmcontrolport=0;
+    networksleeptime=100;
+    networkbackend=0;
+    sendbatching=1;
+    swarmindex=0;
+    swarmlogindelay=0;
+}
+
+// replaces {n} in a swarm name template with the bot number, or appends the number if there is no {n}
+std::string _FormatSwarmName(std::string tpl, uint32 index)
+{
+    std::string num = toString(index);
+    size_t pos = tpl.find("{n}");
+    if(pos == std::string::npos)
+        return tpl + num;
+    while(pos != std::string::npos)
+    {
+        tpl.replace(pos, 3, num);
+        pos = tpl.find("{n}", pos + num.length());
+    }
+    return tpl;
 }
 
 void PseuInstanceConf::ApplyFromVarSet(VarSet &v)
@@ -497,7 +586,9 @@ void PseuInstanceConf::ApplyFromVarSet(VarSet &v)
     clientlang=v.Get("CLIENTLANGUAGE");
     realmname=v.Get("REALMNAME");
     charname=v.Get("CHARNAME");
-    networksleeptime=atoi(v.Get("NETWORKSLEEPTIME").c_str());
+    networksleeptime=v.Exists("NETWORKSLEEPTIME") ? atoi(v.Get("NETWORKSLEEPTIME").c_str()) : 100;
+    networkbackend=atoi(v.Get("NETWORKBACKEND").c_str());
+    sendbatching=v.Exists("SENDBATCHING") ? atoi(v.Get("SENDBATCHING").c_str()) : 1;
     showopcodes=atoi(v.Get("SHOWOPCODES").c_str());
     hidefreqopcodes=(bool)atoi(v.Get("HIDEFREQOPCODES").c_str());
     hideDisabledOpcodes=(bool)atoi(v.Get("HIDEDISABLEDOPCODES").c_str());
@@ -513,9 +604,32 @@ void PseuInstanceConf::ApplyFromVarSet(VarSet &v)
     useMaps=(bool)atoi(v.Get("USEMAPS").c_str());
     skipaddonchat=(bool)atoi(v.Get("SKIPADDONCHAT").c_str());
     dumpPackets=(uint8)atoi(v.Get("DUMPPACKETS").c_str());
+    packetcapture=v.Get("PACKETCAPTURE");
     softquit=(bool)atoi(v.Get("SOFTQUIT").c_str());
     dataLoaderThreads=atoi(v.Get("DATALOADERTHREADS").c_str());
+    dataCacheSize=v.Exists("DATACACHESIZE") ? atoi(v.Get("DATACACHESIZE").c_str()) : 256;
     useMPQ=(bool)atoi(v.Get("USEMPQ").c_str());
+    useHeightMaps=(bool)atoi(v.Get("USEHEIGHTMAPS").c_str());
+    swarmlogindelay=atoi(v.Get("SWARMLOGINDELAY").c_str());
+
+    // swarm bots run headless and get their own login data from the name templates
+    if(swarmindex)
+    {
+        std::string tpl = v.Get("SWARMACCNAME");
+        if(tpl.size())
+            accname = _FormatSwarmName(tpl, swarmindex);
+        tpl = v.Get("SWARMACCPASS");
+        if(tpl.size())
+            accpass = tpl.find("{n}") != std::string::npos ? _FormatSwarmName(tpl, swarmindex) : tpl;
+        tpl = v.Get("SWARMCHARNAME");
+        charname = tpl.size() ? _FormatSwarmName(tpl, swarmindex) : "";
+        enablegui = false;
+        if(swarmindex > 1)
+        {
+            enablecli = false;
+            rmcontrolport = 0;
+        }
+    }
 
     switch(client)
     {
@@ -576,6 +690,7 @@ void PseuInstanceConf::ApplyFromVarSet(VarSet &v)
     log_setloglevel(debug);
     log_setlogtime((bool)atoi(v.Get("LOGTIME").c_str()));
     MemoryDataHolder::SetThreadCount(dataLoaderThreads);
+    MemoryDataHolder::SetCacheSize(uint64(dataCacheSize) * 1024 * 1024);
     MemoryDataHolder::SetUseMPQ(clientlang);
 }
 
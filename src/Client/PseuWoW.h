@@ -6,6 +6,7 @@
 #include "HelperDefs.h"
 #include "log.h"
 #include "Auth/BigNumber.h"
+#include "TimerWheel.h"
 #include "DefScript/DefScript.h"
 #include "Network/SocketHandler.h"
 #include "SCPDatabase.h"
@@ -17,6 +18,7 @@ class Sockethandler;
 class PseuInstanceRunnable;
 class CliRunnable;
 class RemoteController;
+class WakeupSocket;
 
 // possible conditions threads can wait for. used for thread synchronisation. extend if needed.
 enum InstanceConditions
@@ -63,7 +65,9 @@ class PseuInstanceConf
     std::string realmname;
     std::string charname;
     std::string worldhost;
-    uint16 networksleeptime;
+    uint16 networksleeptime; // longest wait for network data, commands or timers
+    uint8 networkbackend;
+    uint8 sendbatching; // 0 = off, 1 = packets sent during a session update, 2 = all packets
     uint8 showopcodes;
     bool hidefreqopcodes;
     bool hideDisabledOpcodes;
@@ -78,9 +82,16 @@ class PseuInstanceConf
     bool useMaps;
     bool skipaddonchat;
     uint8 dumpPackets;
+    std::string packetcapture; // file name; empty = don't record
     bool softquit;
     uint8 dataLoaderThreads;
+    uint32 dataCacheSize; // MB
     bool useMPQ;
+    bool useHeightMaps;
+
+    // swarm related
+    uint32 swarmindex; // number of this bot, 1..count; 0 if not running in a swarm
+    uint32 swarmlogindelay;
 
     // gui related
     bool enablegui;
@@ -111,14 +122,18 @@ public:
     inline RealmSession *GetRSession(void) { return _rsession; }
     inline PseuInstanceConf *GetConf(void) { return _conf; }
     inline DefScriptPackage *GetScripts(void) { return _scp; }
+    inline TimerWheel& GetTimers(void) { return _timers; }
     inline PseuInstanceRunnable *GetRunnable(void) { return _runnable; }
     inline PseuGUI *GetGUI(void) { return _gui; }
+    inline SocketHandler& GetSocketHandler(void) { return *_sh; }
     void DeleteGUI(void);
-    bool ConnectToRealm(void);
+    void ConnectToRealm(void);
 
     inline void SetConfDir(std::string dir) { _confdir = dir; }
     inline std::string GetConfDir(void) { return _confdir; }
     inline void SetScpDir(std::string dir) { _scpdir = dir; }
+    inline void SetSwarmIndex(uint32 i) { _swarmindex = i; }
+    inline void SetHeadless(bool h = true) { _headless = h; } // no GUI, CLI and remote control, must be set before Init()
     inline void SetSessionKey(BigNumber key) { _sessionkey = key; }
     inline BigNumber *GetSessionKey(void) { return &_sessionkey; }
     inline void SetError(void) { _error = true; }
@@ -127,15 +142,17 @@ public:
     bool Init(void);
     bool InitGUI(void);
     void SaveAllCache(void);
-    inline void Stop(void) { _stop = true; }
+    inline void Stop(void) { _stop = true; Wakeup(); }
     inline bool Stopped(void) { return _stop; }
     inline void SetFastQuit(bool q=true) { _fastquit=true; }
     void Run(void);
     void Update(void);
     void Sleep(uint32 msecs);
+    void Wakeup(void); // ends the wait in Update() early; any thread
 
-    inline void CreateWorldSession(void) { _createws = true; }
-    inline void CreateRealmSession(void) { _creaters = true; }
+    inline void CreateWorldSession(void) { _createws = true; Wakeup(); }
+    inline void CreateRealmSession(void) { _creaters = true; Wakeup(); }
+    WorldSession *CreateOfflineWorldSession(void); // without connection, the caller feeds the packets (pseuwow-replay)
 
     void ProcessCliQueue(void);
     void AddCliCommand(std::string);
@@ -150,15 +167,19 @@ private:
     WorldSession *_wsession;
     PseuInstanceConf *_conf;
     DefScriptPackage *_scp;
+    TimerWheel _timers; // script events and delayed packets, updated once per Update()
     std::string _confdir,_scpdir; // _scpdir is the scripts dir, and NOT where SCP files are stored!!
     bool _initialized;
     bool _stop,_fastquit;
     bool _startrealm;
     bool _error;
+    bool _headless;
     bool _createws, _creaters; // must create world/realm session?
+    uint32 _swarmindex;
     BigNumber _sessionkey;
     const char *_ver,*_ver_short;
-    SocketHandler _sh;
+    SocketHandler *_sh; // what Update() waits on: session sockets (unless shared), remote control, _wakeup
+    WakeupSocket *_wakeup;
     CliRunnable *_cli;
     ZThread::Thread _clithread;
     RemoteController *_rmcontrol;
@@ -173,13 +194,16 @@ private:
 class PseuInstanceRunnable : public ZThread::Runnable
 {
 public:
-    PseuInstanceRunnable();
+    PseuInstanceRunnable(uint32 swarmindex = 0);
     void run(void);
     void sleep(uint32);
     inline PseuInstance *GetInstance(void) { return _i; }
+    inline bool IsInitDone(void) { return _initdone; } // true as soon as PseuInstance::Init() returned
 
 private:
     PseuInstance *_i;
+    uint32 _swarmindex;
+    volatile bool _initdone;
 };
 
 
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "zthread/Guard.h"
 #include "Auth/Sha1.h"
 #include "Auth/BigNumber.h"
 #include "PseuWoW.h"
@@ -103,14 +104,14 @@ struct sAuthLogonProof_S_6005
 #pragma pack(pop)
 #endif
 
-RealmSession::RealmSession(PseuInstance* instance)
+RealmSession::RealmSession(PseuInstance* instance) : _sh(instance->GetConf()->networkbackend, instance->GetSocketHandler()), pktQueue(256)
 {
     _instance = instance;
     _socket = NULL;
     _mustdie = false;
+    _connecting = false;
     _filetransfer = false;
     _file_size = 0;
-    _sh.SetAutoCloseSockets(false);
 }
 
 RealmSession::~RealmSession()
@@ -120,11 +121,8 @@ RealmSession::~RealmSession()
 
     // clear the queue
     ByteBuffer *packet;
-    while(!pktQueue.empty())
-    {
-        packet = pktQueue.next();
+    while(pktQueue.Pop(packet))
         delete packet;
-    }
     memset(_m2,0,20);
     _key=0;
 }
@@ -132,17 +130,19 @@ RealmSession::~RealmSession()
 void RealmSession::Connect(void)
 {
     ClearSocket();
-    _socket = new RealmSocket(_sh);
+    _socket = new RealmSocket(_sh.Get());
     _socket->SetSession(this);
     _socket->Open(GetInstance()->GetConf()->realmlist,GetInstance()->GetConf()->realmport);
     _sh.Add(_socket);
-    _sh.Select(3,0);
+    _connecting = true; // Update() sends the logon challenge once the socket is connected
 }
 
 void RealmSession::ClearSocket(void)
 {
     if(_socket)
     {
+        ZThread::Guard<ZThread::FastRecursiveMutex> g(_sh.GetMutex());
+        _sh.Remove(_socket);
         delete _socket;
         _socket = NULL;
     }
@@ -151,6 +151,7 @@ void RealmSession::ClearSocket(void)
 void RealmSession::SetMustDie(void)
 {
     _mustdie = true;
+    GetInstance()->Wakeup(); // may be called by the shared network thread
     logdebug("RealmSession: Must die now.");
 }
 
@@ -175,7 +176,9 @@ AuthHandler *RealmSession::_GetAuthHandlerTable(void) const
 
 void RealmSession::AddToPktQueue(ByteBuffer *pkt)
 {
-    pktQueue.add(pkt);
+    pktQueue.Push(pkt);
+    if(_sh.IsShared())
+        GetInstance()->Wakeup();
 }
 
 void RealmSession::Update(void)
@@ -185,20 +188,33 @@ void RealmSession::Update(void)
     uint8 cmd;
     bool valid = true;
 
-    if( _sh.GetCount() ) // the socket will remove itself from the handler if it got closed
-        _sh.Select(0,0);
-    else // so we just need to check if the socket doesnt exist or if it exists but isnt valid anymore.
-    {    // if thats the case, we dont need the session anymore either
-        if(!_socket || (_socket && !_socket->IsOk()))
+    if(_connecting)
+    {
+        if(SocketGood())
+        {
+            _connecting = false;
+            SendLogonChallenge();
+        }
+        else if(!_sh.HasSockets())
         {
-            SetMustDie();
+            _connecting = false;
+            logerror("RealmSession: Connecting to Realm failed!");
+            if(PseuGUI *gui = GetInstance()->GetGUI())
+                gui->SetSceneData(ISCENE_LOGIN_CONN_STATUS, DSCENE_LOGIN_CONN_FAILED);
         }
     }
 
-    while(pktQueue.size())
+    // the instance polls the socket. it will remove itself from the handler if it got closed,
+    // so we just need to check if the socket doesnt exist or if it exists but isnt valid anymore.
+    // if thats the case, we dont need the session anymore either
+    if( !_sh.HasSockets() && (!_socket || (_socket && !_socket->IsOk())) )
+    {
+        SetMustDie();
+    }
+
+    while(pktQueue.Pop(pkt))
     {
         valid = false;
-        pkt = pktQueue.next();
         cmd = (*pkt)[0];
 
         // this is a dirty hack for oversize/splitted up packets that are buffered wrongly by realmd
@@ -775,6 +791,7 @@ void RealmSession::DumpInvalidPacket(ByteBuffer& pkt)
 
 void RealmSession::SendRealmPacket(ByteBuffer& pkt)
 {
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(_sh.GetMutex());
     if(_socket && _socket->IsOk())
     {
         if(pkt.size()) // dont send packets with no data
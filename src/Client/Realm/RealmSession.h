@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include "Auth/MD5Hash.h"
+#include "SessionSocketHandler.h"
+#include "SPSCRing.h"
 
 struct SRealmInfo
 {
@@ -26,7 +28,7 @@ public:
     RealmSession(PseuInstance*);
     ~RealmSession();
     void AddToPktQueue(ByteBuffer*);
-    void Connect(void);
+    void Connect(void); // returns at once, Update() goes on when the socket is connected
     void Update(void);
     PseuInstance *GetInstance(void);
     void ClearSocket(void);
@@ -51,14 +53,15 @@ private:
     void DumpInvalidPacket(ByteBuffer&);
     void DieOrReconnect(bool err = false);
     std::string _accname,_accpass;
-    SocketHandler _sh;
+    SessionSocketHandler _sh;
     PseuInstance *_instance;
-    ZThread::LockedQueue<ByteBuffer*,ZThread::FastMutex> pktQueue;
+    SPSCRing<ByteBuffer*> pktQueue; // socket -> Update()
     RealmSocket *_socket;
     uint8 _m2[20];
     RealmSession *_session;
     BigNumber _key;
     bool _mustdie;
+    bool _connecting; // Connect() was called, logon challenge not sent yet
     bool _filetransfer;
     uint8 _file_md5[MD5_DIGEST_LENGTH];
     uint64 _file_done, _file_size;
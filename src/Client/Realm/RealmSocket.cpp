@@ -66,6 +66,7 @@ void RealmSocket::OnConnect(void)
 {
     logdetail("RealmSocket connected!");
     _ok = true;
+    _session->GetInstance()->Wakeup(); // the logon challenge is sent from the session's Update()
 }
 
 void RealmSocket::OnConnectFailed(void)
@@ -1,23 +1,24 @@
 #include "common.h"
 #include "log.h"
-#include "ControlSocket.h"
-#include "Network/ListenSocket.h"
+#include "PseuWoW.h"
 #include "RemoteController.h"
 
 RemoteController::RemoteController(PseuInstance *in,uint32 port)
 {
     DEBUG(logdebug("RemoteController: setting instance = %X",in));
-    h.SetInstance(in);
     _mustdie = false;
     _instance = in;
-    ListenSocket<ControlSocket> *ls = new ListenSocket<ControlSocket>(h);
+    // the instance polls the sockets together with its sessions' ones
+    ControlListenSocket *ls = new ControlListenSocket(in->GetSocketHandler(),in);
     if(ls->Bind(port))
     {
         logerror("RemoteController: Can't bind to port %u",port);
+        delete ls;
         _mustdie = true;
         return;
     }
-    h.Add(ls);
+    ls->SetDeleteByHandler(true);
+    in->GetSocketHandler().Add(ls);
     log("RemoteController: listening on port %u",port);
 }
 
@@ -26,13 +27,6 @@ RemoteController::~RemoteController()
     DEBUG(logdebug("~RemoteController()"));
 }
 
-void RemoteController::Update(void)
-{
-    if(_mustdie)
-        return;
-    h.Select(0,0);
-}
-
 
 
 
@@ -1,19 +1,19 @@
 #ifndef REMOTECONTROLLER_H
 #define REMOTECONTROLLER_H
 
-#include "Network/SocketHandler.h"
+#include "Network/ListenSocket.h"
+#include "ControlSocket.h"
 
 class PseuInstance;
-class ControlSocket;
 
-class ControlSocketHandler : public SocketHandler
+// accepts ControlSockets in the instance's socket handler, they get the instance from here
+class ControlListenSocket : public ListenSocket<ControlSocket>
 {
 public:
-    void SetInstance(PseuInstance *in) { _instance = in; }
+    ControlListenSocket(SocketHandler& h, PseuInstance *in) : ListenSocket<ControlSocket>(h), _instance(in) {}
     PseuInstance *GetInstance(void) { return _instance; }
 private:
     PseuInstance *_instance;
-
 };
 
 
@@ -24,11 +24,9 @@ public:
     RemoteController(PseuInstance*,uint32 port);
     ~RemoteController();
     void SetPermission(uint8 p) { _perm = p; }
-    void Update(void);
     bool MustDie(void) { return _mustdie; }
 
 private:
-    ControlSocketHandler h;
     bool _mustdie;
     PseuInstance *_instance;
     uint8 _perm;
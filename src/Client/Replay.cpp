@@ -0,0 +1,363 @@
+#include <algorithm>
+
+#include "common.h"
+#include "Replay.h"
+#include "PseuWoW.h"
+#include "MemoryDataHolder.h"
+#include "SessionSocketHandler.h"
+#include "World/CacheHandler.h"
+#include "World/PacketCapture.h"
+#include "World/WorldSession.h"
+#include "World/WorldSocket.h"
+#include "Network/SocketHandler.h"
+#include "Network/Utility.h"
+
+// pseuwow-replay: feeds a packet capture (see PacketCapture.h) through WorldSession::HandleWorldPacket() and
+// the opcode scripts, without any network. uses conf and scripts from the working directory like pseuwow.
+// the cache files are read like on a real login, but never written, so that runs on the same files are comparable.
+
+struct OpcodeStats
+{
+    uint32 count;
+    uint64 bytes;
+    uint64 us; // handler time
+    uint32 maxus;
+};
+
+static OpcodeStats stats[MAX_OPCODE_ID + 1]; // [MAX_OPCODE_ID] collects invalid opcodes
+
+static bool _MoreTime(uint16 a, uint16 b)
+{
+    return stats[a].us > stats[b].us;
+}
+
+void PrintHelp(void)
+{
+    printf("Usage: pseuwow-replay [-paced] [-socket] [-nopool] [-repeat <n>] [-top <n>] [-lookups <n>] <capture file>\n\n");
+    printf("Plays back a packet capture recorded with PacketCapture=<file> in PseuWoW.conf.\n");
+    printf("-paced       - keep the delays between packets as recorded, default is as fast as possible\n");
+    printf("-socket      - send the packets with server headers through a loopback connection and WorldSocket,\n");
+    printf("               reports packets/s and allocations of the receive path. can't be used with -paced\n");
+    printf("-nopool      - don't recycle received packets, every packet is allocated and freed again\n");
+    printf("-repeat <n>  - play the capture <n> times, for stable timings of short captures. the per opcode list shows\n");
+    printf("               what handling e.g. update blocks costs (SMSG_UPDATE_OBJECT). can't be used with -paced\n");
+    printf("-top <n>     - list the <n> opcodes that took the most time, default 20, 0 lists all\n");
+    printf("-lookups <n> - afterwards, time <n> guid lookups and <n>/100 range searches over the objects the capture\n");
+    printf("               created. \"stubserver -npcs 5000 -capture <file>\" records a capture with many objects\n");
+}
+
+void PrintReport(uint32 packets, uint64 bytes, uint64 wallus, uint64 handlerus, uint32 dropped, uint32 top)
+{
+    wallus = std::max<uint64>(wallus, 1);
+    log("Replay: %u packets (%s) in %.3f s, %.0f packets/s",
+        packets, FilesizeFormat(bytes).c_str(), wallus / 1000000.0, packets * 1000000.0 / wallus);
+    log("Replay: handlers took %.3f s (%.1f%%), %u packets not sent, peak memory %u KB",
+        handlerus / 1000000.0, handlerus * 100.0 / wallus, dropped, GetProcessPeakMemoryUsage());
+
+    std::vector<uint16> ops;
+    for(uint32 i = 0; i <= MAX_OPCODE_ID; i++)
+        if(stats[i].count)
+            ops.push_back(i);
+    if(ops.empty())
+        return;
+    std::sort(ops.begin(), ops.end(), _MoreTime);
+    if(top && ops.size() > top)
+        ops.resize(top);
+
+    log("%-40s %8s %10s %10s %10s %10s","opcode","count","bytes","total ms","avg us","max us");
+    for(uint32 i = 0; i < ops.size(); i++)
+    {
+        OpcodeStats& st = stats[ops[i]];
+        log("%-40s %8u %10s %10.2f %10.1f %10u", ops[i] < MAX_OPCODE_ID ? GetOpcodeName(ops[i]) : "(invalid)",
+            st.count, FilesizeFormat(st.bytes).c_str(), st.us / 1000.0, double(st.us) / st.count, st.maxus);
+    }
+}
+
+// next record, starts over at the end of the capture until all passes are done
+static bool _NextRecord(PacketCaptureReader& reader, const ReplayOptions& opt, uint32& pass, PacketCaptureRecord& rec, const uint8*& data)
+{
+    while(!reader.Next(rec, data))
+    {
+        if(++pass >= opt.repeat)
+            return false;
+        reader.Rewind();
+    }
+    return true;
+}
+
+void Replay(PseuInstance *ins, PacketCaptureReader& reader, const ReplayOptions& opt)
+{
+    WorldSession *ws = ins->CreateOfflineWorldSession();
+    if(opt.nopool)
+        ws->GetPacketPool().SetMaxPooled(0);
+    PacketCaptureRecord rec;
+    const uint8 *data;
+    uint32 packets = 0, lasttime = 0, pass = 0;
+    uint64 bytes = 0, handlerus = 0;
+    uint64 start = GetMonotonicMS(), wallstart = GetMonotonicUS();
+
+    log("Replay: starting, %s",opt.paced ? "at recorded pace" : "as fast as possible");
+    while(!ins->Stopped() && _NextRecord(reader, opt, pass, rec, data))
+    {
+        // the client handles everything it read at once and then updates, do the same for packets recorded at the same time
+        if(rec.time != lasttime)
+        {
+            lasttime = rec.time;
+            while(true)
+            {
+                ins->ProcessCliQueue();
+                ws->Update();
+                ins->GetTimers().Update();
+                uint64 now = GetMonotonicMS();
+                if(!opt.paced || now >= start + rec.time)
+                    break;
+                ins->Sleep(uint32(std::min<uint64>(start + rec.time - now, 10)));
+            }
+        }
+
+        WorldPacket *pkt = ws->GetPacketPool().Acquire(rec.opcode, rec.size);
+        if(rec.size)
+            memcpy((void*)pkt->contents(), data, rec.size);
+
+        uint64 t = GetMonotonicUS();
+        ws->HandleWorldPacket(pkt);
+        t = GetMonotonicUS() - t;
+
+        OpcodeStats& st = stats[std::min<uint32>(rec.opcode, MAX_OPCODE_ID)];
+        st.count++;
+        st.bytes += rec.size;
+        st.us += t;
+        st.maxus = std::max<uint32>(st.maxus, uint32(t));
+        handlerus += t;
+        bytes += rec.size;
+        packets++;
+    }
+    ws->Update();
+    ins->GetTimers().Update();
+
+    PrintReport(packets, bytes, GetMonotonicUS() - wallstart, handlerus, ws->GetDroppedSendCount(), opt.top);
+    if(opt.lookups)
+        BenchObjMgr(ws, opt.lookups);
+}
+
+// guid lookups and range searches as the handlers and scripts do them, over what is in the ObjMgr after the replay
+void BenchObjMgr(WorldSession *ws, uint32 lookups)
+{
+    ObjMgr& om = ws->objmgr;
+    std::vector<WorldObject*> objs;
+    om.GetObjectsInRange(0, 0, 0, 1e18f, 0xFFFFFFFF, objs); // everything that has a position
+    if(objs.empty())
+    {
+        log("Replay: no world objects to look up");
+        return;
+    }
+    std::vector<uint64> guids(objs.size());
+    for(uint32 i = 0; i < objs.size(); i++)
+        guids[i] = objs[i]->GetGUID();
+
+    // random order, a replay would hit the same objects the capture has
+    uint32 found = 0;
+    uint64 t = GetMonotonicUS();
+    for(uint32 i = 0; i < lookups; i++)
+        if(om.GetObj(guids[(i * 2654435761u) % guids.size()]))
+            found++;
+    t = std::max<uint64>(GetMonotonicUS() - t, 1);
+    log("Replay: %u objects in ObjMgr, %u world objects; %u lookups (%u found) in %.3f ms, %.0f lookups/s",
+        om.GetObjectCount(), uint32(guids.size()), lookups, found, t / 1000.0, lookups * 1000000.0 / t);
+
+    uint32 searches = std::max<uint32>(lookups / 100, 1);
+    uint64 results = 0;
+    std::vector<WorldObject*> inrange;
+    t = GetMonotonicUS();
+    for(uint32 i = 0; i < searches; i++)
+    {
+        WorldObject *o = objs[(i * 2654435761u) % objs.size()];
+        inrange.clear();
+        results += om.GetObjectsInRange(o->GetX(), o->GetY(), o->GetZ(), 30.0f, 0xFFFFFFFF, inrange);
+    }
+    t = std::max<uint64>(GetMonotonicUS() - t, 1);
+    log("Replay: %u range searches (30 yd, %.1f objects found on average) in %.3f ms, %.0f searches/s",
+        searches, double(results) / searches, t / 1000.0, searches * 1000000.0 / t);
+}
+
+// hands the stream to the kernel and lets the WorldSocket read it back; the time spent in Select() is the receive path
+static bool _SendThrough(SOCKET s, SocketHandler& h, WorldSession *ws, ByteBuffer& stream, uint64& recvus, uint64& handlerus)
+{
+    const char *buf = (const char*)stream.contents();
+    size_t len = stream.size(), done = 0;
+    while(done < len)
+    {
+        int n = send(s, buf + done, int(len - done), MSG_NOSIGNAL);
+        if(n > 0)
+            done += n;
+#ifdef _WIN32
+        else if(Errno != WSAEWOULDBLOCK)
+#else
+        else if(Errno != EWOULDBLOCK && Errno != EINTR)
+#endif
+        {
+            logerror("Replay: send() failed: %s", StrError(Errno));
+            return false;
+        }
+        uint64 t = GetMonotonicUS();
+        while(h.Select(0, 0) > 0) // one recv per Select(), as in the client
+            ;
+        recvus += GetMonotonicUS() - t;
+
+        t = GetMonotonicUS();
+        ws->Update();
+        handlerus += GetMonotonicUS() - t;
+    }
+    stream.clear();
+    return true;
+}
+
+// like Replay(), but the packets come in framed with server headers (unencrypted, as before the auth) through WorldSocket::OnRead(),
+// the packet queue and WorldSession::Update(). per opcode handler times are not collected.
+void ReplaySocket(PseuInstance *ins, PacketCaptureReader& reader, const ReplayOptions& opt)
+{
+    WorldSession *ws = ins->CreateOfflineWorldSession();
+    WorldPacketPool& pool = ws->GetPacketPool();
+    if(opt.nopool)
+        pool.SetMaxPooled(0);
+
+    SOCKET feed, recvfd;
+    if(!Utility::LoopbackPair(feed, recvfd))
+    {
+        logerror("Replay: can't connect over loopback: %s", StrError(Errno));
+        return;
+    }
+    SocketHandler h;
+    WorldSocket *sock = new WorldSocket(h, ws);
+    sock->Attach(recvfd);
+    sock->SetNonblocking(true);
+    sock->SetNonblocking(true, feed);
+    h.Add(sock);
+
+    bool bighdr = ins->GetConf()->client > CLIENT_TBC;
+    PacketCaptureRecord rec;
+    const uint8 *data;
+    ByteBuffer stream;
+    stream.reserve(0x20000);
+    uint32 packets = 0, skipped = 0, pass = 0;
+    uint64 bytes = 0, recvus = 0, handlerus = 0;
+    uint64 wallstart = GetMonotonicUS();
+    bool ok = true;
+
+    log("Replay: starting, through WorldSocket%s", opt.nopool ? ", packet pool off" : "");
+    while(ok && !ins->Stopped() && _NextRecord(reader, opt, pass, rec, data))
+    {
+        uint32 size = rec.size + 2; // + opcode
+        if(rec.opcode > MAX_OPCODE_ID || size > (bighdr ? 0x7FFFFFu : 0xFFFFu))
+        {
+            skipped++; // would be taken for a crypt error or can't be framed
+            continue;
+        }
+        if(bighdr && size > 0x7FFF)
+        {
+            stream << uint8(0x80 | (size >> 16)) << uint8(size >> 8) << uint8(size);
+        }
+        else
+        {
+            stream << uint8(size >> 8) << uint8(size);
+        }
+        stream << uint16(rec.opcode);
+        if(rec.size)
+            stream.append(data, rec.size);
+        bytes += rec.size;
+        packets++;
+        if(stream.size() >= 0x10000)
+            ok = _SendThrough(feed, h, ws, stream, recvus, handlerus);
+    }
+    if(ok && stream.size())
+        ok = _SendThrough(feed, h, ws, stream, recvus, handlerus);
+    uint64 t = GetMonotonicUS();
+    ws->Update();
+    ins->GetTimers().Update();
+    handlerus += GetMonotonicUS() - t;
+
+    h.Remove(sock);
+    delete sock;
+    closesocket(feed);
+
+    recvus = std::max<uint64>(recvus, 1);
+    PrintReport(packets, bytes, GetMonotonicUS() - wallstart, handlerus, ws->GetDroppedSendCount(), opt.top);
+    log("Replay: receive path took %.3f s, %.0f packets/s, %s/s; %u packets received, %u not framed",
+        recvus / 1000000.0, packets * 1000000.0 / recvus, FilesizeFormat(uint64(bytes * 1000000.0 / recvus)).c_str(),
+        pool.GetAcquireCount(), skipped);
+    log("Replay: %u WorldPackets allocated, %.3f per packet", pool.GetAllocCount(),
+        pool.GetAcquireCount() ? double(pool.GetAllocCount()) / pool.GetAcquireCount() : 0.0);
+    if(opt.lookups)
+        BenchObjMgr(ws, opt.lookups);
+}
+
+int main(int argc, char* argv[])
+{
+    ReplayOptions opt;
+    bool badargs = false;
+    const char *fn = NULL;
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-paced"))
+            opt.paced = true;
+        else if(!strcmp(argv[a],"-socket"))
+            opt.socket = true;
+        else if(!strcmp(argv[a],"-nopool"))
+            opt.nopool = true;
+        else if(!strcmp(argv[a],"-top") && a + 1 < argc)
+            opt.top = atoi(argv[++a]);
+        else if(!strcmp(argv[a],"-lookups") && a + 1 < argc)
+            opt.lookups = atoi(argv[++a]);
+        else if(!strcmp(argv[a],"-repeat") && a + 1 < argc)
+            opt.repeat = std::max(atoi(argv[++a]), 1);
+        else if(argv[a][0] != '-' && !fn)
+            fn = argv[a];
+        else
+            badargs = true;
+    }
+    if(badargs || !fn || (opt.paced && (opt.socket || opt.repeat > 1)))
+    {
+        PrintHelp();
+        return 1;
+    }
+
+    log_prepare("replay_log.txt","w");
+    PacketCaptureReader reader;
+    if(!reader.Open(fn))
+    {
+        logerror("Can't replay '%s'",fn);
+        log_close();
+        return 1;
+    }
+
+    int ret = 1;
+    MemoryDataHolder::Init();
+    PseuInstanceRunnable runnable;
+    PseuInstance *ins = new PseuInstance(&runnable);
+    ins->SetConfDir("./conf/");
+    ins->SetScpDir("./scripts/");
+    ins->SetHeadless();
+    if(ins->Init())
+    {
+        // opcode numbers differ between client versions
+        if(reader.GetBuild() != ins->GetConf()->clientbuild)
+            logerror("Capture was recorded with client build %u, but the conf is set up for %u",reader.GetBuild(),ins->GetConf()->clientbuild);
+        else
+        {
+            if(opt.socket)
+                ReplaySocket(ins, reader, opt);
+            else
+                Replay(ins, reader, opt);
+            ret = 0;
+        }
+    }
+    delete ins;
+
+    SCPDatabaseMgr::DropSharedDBs();
+    PrototypeCache_Delete();
+    DefScriptPackage::ClearSharedScripts();
+    SessionSocketHandler::Shutdown();
+    log_close();
+    MemoryDataHolder::Shutdown();
+    return ret;
+}
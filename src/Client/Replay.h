@@ -0,0 +1,25 @@
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+class PseuInstance;
+class PacketCaptureReader;
+class WorldSession;
+
+struct ReplayOptions
+{
+    ReplayOptions() : paced(false), socket(false), nopool(false), top(20), lookups(0), repeat(1) {}
+    bool paced;
+    bool socket; // through a loopback connection and WorldSocket::OnRead(), see ReplaySocket()
+    bool nopool; // allocate every received packet
+    uint32 top;
+    uint32 lookups; // ObjMgr lookups to time after the replay, see BenchObjMgr()
+    uint32 repeat; // passes over the capture
+};
+
+void PrintHelp(void);
+void PrintReport(uint32 packets, uint64 bytes, uint64 wallus, uint64 handlerus, uint32 dropped, uint32 top);
+void Replay(PseuInstance*, PacketCaptureReader&, const ReplayOptions&);
+void ReplaySocket(PseuInstance*, PacketCaptureReader&, const ReplayOptions&);
+void BenchObjMgr(WorldSession*, uint32 lookups);
+
+#endif
@@ -2,14 +2,20 @@
 #include "common.h"
 #include "Auth/MD5Hash.h"
 #include "SCPDatabase.h"
-
-#define HEADER_SIZE (21*sizeof(uint32))
+#include "zthread/Guard.h"
 
 inline char *gettypename(uint32 ty)
 {
     return (char*)(ty==0 ? "INT" : (ty==1 ? "FLOAT" : "STRING"));
 }
 
+// appends zeros until the size is a multiple of 4, so that the next block is aligned
+static void _PadBuffer(ByteBuffer& buf)
+{
+    while(buf.size() & 3)
+        buf << (uint8)0;
+}
+
 // file-globally declared pointer holder. NOT multi-instance-safe for now!!
 struct memblock
 {
@@ -22,6 +28,16 @@ struct memblock
 TypeStorage<memblock> Pointers; // stores filename -> file content
 std::map<std::string,std::string> FileRelation; // stores filename -> DB name
 
+// compacted DBs that can be linked into any SCPDatabaseMgr with SetShared().
+// the mutex also serializes loading, since the pointer holders above are shared too.
+struct SharedSCPEntry
+{
+    SCPDatabase *db;
+    uint32 sourcefiles; // return value of the SearchAndLoad() call that created it
+};
+std::map<std::string,SharedSCPEntry> SharedDBs;
+ZThread::FastMutex SharedDBsMutex;
+
 SCPDatabase::~SCPDatabase()
 {
     DEBUG(logdebug("Deleting SCPDatabase '%s'",_name.c_str()));
@@ -30,25 +46,39 @@ SCPDatabase::~SCPDatabase()
 
 SCPDatabase::SCPDatabase()
 {
-    _stringbuf = NULL;
-    _intbuf = NULL;
+    _heapimage = NULL;
     _compact = false;
+    _DropImage();
 }
 
 void SCPDatabase::DropAll(void)
 {
     DropTextData();
-    if(_stringbuf)
-        delete [] _stringbuf;
-    if(_intbuf)
-        delete [] _intbuf;
-    _indexes.clear();
-    _indexes_reverse.clear();
-    _fielddefs.clear();
+    _DropImage();
+}
+
+void SCPDatabase::_DropImage(void)
+{
+    _file.Close();
+    if(_heapimage)
+        delete [] _heapimage;
+    _heapimage = NULL;
     _stringbuf = NULL;
-    _intbuf = NULL;
     _stringsize = 0;
+    _intbuf = NULL;
+    _rowcount = 0;
+    _fields_per_row = 0;
+    _index = NULL;
+    _indexsize = 0;
+    _directindex = NULL;
+    _directbase = _directsize = 0;
+    _fieldtable = NULL;
+    _fieldnames = NULL;
+    _fieldcount = 0;
     _compact = false;
+    for(uint32 i = 0; i < _valueindexes.size(); i++)
+        delete _valueindexes[i];
+    _valueindexes.clear();
 }
 
 void SCPDatabase::DropTextData(void)
@@ -60,105 +90,273 @@ void SCPDatabase::DropTextData(void)
     fields.clear();
 }
 
+// sets up the DB to use the blocks of a compact file body in place. false if the blocks don't fit.
+bool SCPDatabase::_Attach(const SCPHeader& hdr, const uint8 *body, uint32 size)
+{
+    uint32 nDefs = hdr.nFields ? hdr.nFields - 1 : 0; // the index column has no field entry
+    const uint32 offs[4] = { hdr.offsIndexes, hdr.offsFields, hdr.offsData, hdr.offsStrings };
+    const uint32 sizes[4] = { hdr.sizeIndexes, hdr.sizeFields, hdr.sizeData, hdr.sizeStrings };
+    for(uint32 i = 0; i < 4; i++)
+        if((offs[i] & 3) || offs[i] > size || sizes[i] > size - offs[i])
+            return false;
+    // 64 bit products, so that huge counts in a damaged header can't wrap around and pass
+    if(hdr.nIndexes != hdr.nRows
+        || hdr.sizeIndexes < (uint64(hdr.nIndexes) * 2 + hdr.directsize) * sizeof(uint32)
+        || hdr.sizeFields < uint64(nDefs) * sizeof(SCPFieldEntry)
+        || hdr.sizeData != uint64(hdr.nRows) * hdr.nFields * sizeof(uint32)
+        || !hdr.sizeStrings || body[hdr.offsStrings + hdr.sizeStrings - 1])
+        return false;
+
+    // everything the lookups use without checking must point into the blocks
+    const SCPIndexEntry *index = (const SCPIndexEntry*)(body + hdr.offsIndexes);
+    for(uint32 i = 0; i < hdr.nIndexes; i++)
+        if(index[i].row >= hdr.nRows || (i && index[i].id <= index[i - 1].id))
+            return false;
+    const uint32 *direct = (const uint32*)(index + hdr.nIndexes);
+    for(uint32 i = 0; i < hdr.directsize; i++)
+        if(direct[i] != SCP_INVALID_INT && direct[i] >= hdr.nRows)
+            return false;
+    const SCPFieldEntry *fieldtable = (const SCPFieldEntry*)(body + hdr.offsFields);
+    uint32 namesize = hdr.sizeFields - nDefs * sizeof(SCPFieldEntry);
+    const char *names = (const char*)(fieldtable + nDefs);
+    if(nDefs && (!namesize || names[namesize - 1]))
+        return false;
+    for(uint32 i = 0; i < nDefs; i++)
+        if(fieldtable[i].nameoffs >= namesize || !fieldtable[i].id || fieldtable[i].id >= hdr.nFields
+            || fieldtable[i].type > SCP_TYPE_STRING)
+            return false;
+
+    _index = index;
+    _indexsize = hdr.nIndexes;
+    _directindex = hdr.directsize ? direct : NULL;
+    _directbase = hdr.directbase;
+    _directsize = hdr.directsize;
+    _fieldtable = fieldtable;
+    _fieldnames = names;
+    _fieldcount = nDefs;
+    _intbuf = (const uint32*)(body + hdr.offsData);
+    _rowcount = hdr.nRows;
+    _fields_per_row = hdr.nFields;
+    _stringbuf = (const char*)(body + hdr.offsStrings);
+    _stringsize = hdr.sizeStrings;
+    return true;
+}
+
+uint32 SCPDatabase::_GetRow(uint32 index)
+{
+    if(_directindex)
+    {
+        uint32 i = index - _directbase; // wraps around if index < _directbase
+        return i < _directsize ? _directindex[i] : SCP_INVALID_INT;
+    }
+    uint32 lo = 0, hi = _indexsize;
+    while(lo < hi)
+    {
+        uint32 mid = (lo + hi) / 2;
+        if(_index[mid].id < index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < _indexsize && _index[lo].id == index) ? _index[lo].row : SCP_INVALID_INT;
+}
+
+const SCPFieldEntry *SCPDatabase::_GetField(const char *entry)
+{
+    uint32 lo = 0, hi = _fieldcount;
+    while(lo < hi)
+    {
+        uint32 mid = (lo + hi) / 2;
+        int c = strcmp(_fieldnames + _fieldtable[mid].nameoffs, entry);
+        if(!c)
+            return &_fieldtable[mid];
+        if(c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
 void *SCPDatabase::GetPtr(uint32 index, const char *entry)
 {
-    std::map<uint32,uint32>::iterator it = _indexes.find(index);
-    if(it == _indexes.end())
+    uint32 row = _GetRow(index);
+    if(row == SCP_INVALID_INT)
         return NULL;
-    std::map<std::string,SCPFieldDef>::iterator fi = _fielddefs.find(entry);
-    if(fi == _fielddefs.end())
+    const SCPFieldEntry *f = _GetField(entry);
+    if(!f)
         return NULL;
 
-    uint32 target_row = _indexes[index];
-    uint32 field_id = _fielddefs[entry].id;
-    return (void*)&_intbuf[(_fields_per_row * target_row) + field_id];
+    return (void*)&_intbuf[(_fields_per_row * row) + f->id];
 }
 
 void *SCPDatabase::GetPtrByField(uint32 index, uint32 entry)
 {
-    std::map<uint32,uint32>::iterator it = _indexes.find(index);
-    if(it == _indexes.end())
+    uint32 row = _GetRow(index);
+    if(row == SCP_INVALID_INT || entry >= _fields_per_row)
         return NULL;
 
-    uint32 target_row = _indexes[index];
-    return (void*)&_intbuf[(_fields_per_row * target_row) + entry];
+    return (void*)&_intbuf[(_fields_per_row * row) + entry];
+}
+
+static inline uint32 _HashUint32(uint32 v)
+{
+    v ^= v >> 16;
+    v *= 0x45D9F3B;
+    v ^= v >> 16;
+    return v;
+}
+
+// FNV-1a, case insensitive like the stricmp() compare in the lookups
+static inline uint32 _HashString(const char *s)
+{
+    uint32 h = 2166136261u;
+    for( ; *s; s++)
+    {
+        h ^= (uint8)tolower(*s);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+const SCPValueIndex *SCPDatabase::_GetValueIndex(uint32 entry, bool str)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_indexmutex);
+    uint32 slot = entry * 2 + (str ? 1 : 0);
+    if(_valueindexes.size() <= slot)
+        _valueindexes.resize(_fields_per_row * 2, NULL);
+    SCPValueIndex *& idx = _valueindexes[slot];
+    if(!idx)
+    {
+        idx = new SCPValueIndex;
+        uint32 nbuckets = 16;
+        while(nbuckets < _rowcount)
+            nbuckets <<= 1;
+        idx->buckets.resize(nbuckets, 0);
+        idx->next.resize(_rowcount, 0);
+        // insert backwards, so that lookups find the lowest matching row first, as a scan would
+        for(uint32 row = _rowcount; row--; )
+        {
+            uint32 val = _intbuf[row * _fields_per_row + entry];
+            uint32& head = idx->buckets[(str ? _HashString(GetStringByOffset(val)) : _HashUint32(val)) & (nbuckets - 1)];
+            idx->next[row] = head;
+            head = row + 1;
+        }
+        DEBUG(logdebug("SCP: built %s index for field %u of DB '%s'", str ? "string" : "value", entry, _name.c_str()));
+    }
+    return idx;
 }
 
 uint32 SCPDatabase::GetFieldByUint32Value(const char *entry, uint32 val)
 {
-    std::map<std::string,SCPFieldDef>::iterator fi = _fielddefs.find(entry);
-    if(fi == _fielddefs.end())
+    const SCPFieldEntry *f = _GetField(entry);
+    if(!f)
         return SCP_INVALID_INT;
 
-    uint32 field_id = _fielddefs[entry].id;
-    return GetFieldByUint32Value(field_id,val);
+    return GetFieldByUint32Value(f->id,val);
 }
 
+// the id of a row is always stored in column 0
 uint32 SCPDatabase::GetFieldByUint32Value(uint32 entry, uint32 val)
 {
-    for(uint32 row = 0; row < _rowcount; row++)
-        if(_intbuf[row * _fields_per_row + entry] == val)
-            return _indexes_reverse[row];
+    if(entry >= _fields_per_row)
+        return SCP_INVALID_INT;
+    const SCPValueIndex *idx = _GetValueIndex(entry, false);
+    for(uint32 r = idx->buckets[_HashUint32(val) & (idx->buckets.size() - 1)]; r; r = idx->next[r - 1])
+        if(_intbuf[(r - 1) * _fields_per_row + entry] == val)
+            return _intbuf[(r - 1) * _fields_per_row];
     return SCP_INVALID_INT;
 }
 
 uint32 SCPDatabase::GetFieldByIntValue(const char *entry, int32 val)
 {
-    std::map<std::string,SCPFieldDef>::iterator fi = _fielddefs.find(entry);
-    if(fi == _fielddefs.end())
+    const SCPFieldEntry *f = _GetField(entry);
+    if(!f)
         return SCP_INVALID_INT;
 
-    uint32 field_id = _fielddefs[entry].id;
-    return GetFieldByIntValue(field_id,val);
+    return GetFieldByIntValue(f->id,val);
 }
 
+// same bits, same index
 uint32 SCPDatabase::GetFieldByIntValue(uint32 entry, int32 val)
 {
-    for(uint32 row = 0; row < _rowcount; row++)
-        if((int)_intbuf[row * _fields_per_row + entry] == val)
-            return _indexes_reverse[row];
-    return (int)SCP_INVALID_INT;
+    return GetFieldByUint32Value(entry, (uint32)val);
 }
 
 uint32 SCPDatabase::GetFieldByStringValue(const char *entry, const char *val)
 {
-    std::map<std::string,SCPFieldDef>::iterator fi = _fielddefs.find(entry);
-    if(fi == _fielddefs.end())
+    const SCPFieldEntry *f = _GetField(entry);
+    if(!f)
         return SCP_INVALID_INT;
 
-    uint32 field_id = _fielddefs[entry].id;
-    return GetFieldByStringValue(field_id,val);
+    return GetFieldByStringValue(f->id,val);
 }
 
 uint32 SCPDatabase::GetFieldByStringValue(uint32 entry, const char *val)
 {
-    for(uint32 row = 0; row < _rowcount; row++)
-        if(!stricmp(GetStringByOffset(_intbuf[row * _fields_per_row + entry]), val))
-            return _indexes_reverse[row];
+    if(entry >= _fields_per_row)
+        return SCP_INVALID_INT;
+    const SCPValueIndex *idx = _GetValueIndex(entry, true);
+    for(uint32 r = idx->buckets[_HashString(val) & (idx->buckets.size() - 1)]; r; r = idx->next[r - 1])
+        if(!stricmp(GetStringByOffset(_intbuf[(r - 1) * _fields_per_row + entry]), val))
+            return _intbuf[(r - 1) * _fields_per_row];
     return SCP_INVALID_INT;
 }
 
 uint32 SCPDatabase::GetFieldType(const char *entry)
 {
-    std::map<std::string,SCPFieldDef>::iterator it = _fielddefs.find(entry);
-    if(it != _fielddefs.end())
-        return it->second.type;
-    return SCP_INVALID_INT;
+    const SCPFieldEntry *f = _GetField(entry);
+    return f ? f->type : SCP_INVALID_INT;
 }
 
 uint32 SCPDatabase::GetFieldId(const char *entry)
 {
-    std::map<std::string,SCPFieldDef>::iterator it = _fielddefs.find(entry);
-    if(it != _fielddefs.end())
-        return it->second.id;
-    return SCP_INVALID_INT;
+    const SCPFieldEntry *f = _GetField(entry);
+    return f ? f->id : SCP_INVALID_INT;
+}
+
+SCPDatabaseMgr::~SCPDatabaseMgr()
+{
+    // shared DBs are deleted in DropSharedDBs()
+    for(std::set<std::string>::iterator it = _linked.begin(); it != _linked.end(); it++)
+        _map.Unlink(*it);
 }
 
 SCPDatabase *SCPDatabaseMgr::GetDB(std::string n, bool create)
 {
+    // anyone who wants to add data must not write into a DB that other instances use as well
+    if(create && _linked.size())
+        _UnlinkShared(n);
     return create ? _map.Get(n) : _map.GetNoCreate(n);
 }
 
+void SCPDatabaseMgr::DropDB(std::string s)
+{
+    s = stringToLower(s);
+    if(_linked.find(s) != _linked.end())
+        _UnlinkShared(s);
+    else
+        _map.Delete(s);
+}
+
+void SCPDatabaseMgr::_UnlinkShared(std::string n)
+{
+    std::set<std::string>::iterator it = _linked.find(n);
+    if(it != _linked.end())
+    {
+        _map.Unlink(n);
+        _linked.erase(it);
+    }
+}
+
+void SCPDatabaseMgr::DropSharedDBs(void)
+{
+    ZThread::Guard<ZThread::FastMutex> g(SharedDBsMutex);
+    for(std::map<std::string,SharedSCPEntry>::iterator it = SharedDBs.begin(); it != SharedDBs.end(); it++)
+        delete it->second.db;
+    SharedDBs.clear();
+}
+
 uint32 SCPDatabaseMgr::AutoLoadFile(const char *fn)
 {
     char *buf;
@@ -381,17 +579,14 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
         pass++;
     }
 
-    // used header fields, some are pre-declared above, if needed
-    uint32 offsMD5, nMD5, sizeMD5;
-    uint32 offsIndexes, nIndexes, sizeIndexes;
-    uint32 offsFields, sizeFields;
-    uint32 offsData, sizeData;
-    uint32 offsStrings, sizeStrings;
+    SCPHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.tag, "SCPC", 4);
+    hdr.version = SCP_FORMAT_VERSION;
 
-    // MD5 hashes of source files
+    // MD5 hashes of source files, with size and modification time to skip hashing unchanged files at load
     SCPSourceList& src = db->sources;
     ByteBuffer md5buf;
-    nMD5 = 0;
     for(SCPSourceList::iterator it = src.begin(); it != src.end(); it++)
     {
         memblock *mb = Pointers.GetNoCreate(*it);
@@ -405,76 +600,83 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
         MD5Hash md5;
         md5.Update(mb->ptr,mb->size);
         md5.Finalize();
-        md5buf << *it;
+        md5buf << mb->size << GetFileModTime(it->c_str());
         md5buf.append(md5.GetDigest(),md5.GetLength());
-        nMD5++;
-    }
-    sizeMD5 = md5buf.size();
-
-    // field types, sorted by IDs
-    ByteBuffer fieldbuf;
-    // put the entries and their type into ByteBuffer, sorted by their position in the membuf rows
-    // note that the first field in the data row is always the field id, so the values start from 1
-    for(std::map<std::string,SCPFieldDef>::iterator itf = fieldIdMap.begin(); itf != fieldIdMap.end(); itf++)
-    {
-        fieldbuf << itf->first << itf->second.id << itf->second.type; // entry name, id, type.
+        md5buf << *it;
+        hdr.nMD5++;
     }
-    sizeFields = fieldbuf.size();
+    _PadBuffer(md5buf);
 
-    // index -> ID lookup table, e.g. data with ID 500 will have field index 214, because some IDs in between are missing
-    // it *could* be calculated at load-time from the existing data field, but this way is faster when random-accessing the file itself
-    // (what we dont do anyway, for now)
+    // index -> row lookup table, e.g. data with ID 500 will have row 214, because some IDs in between are missing.
+    // sorted by id for binary search; if the ids are dense enough, a table with the row of every id in range follows.
     ByteBuffer indexbuf;
     for(std::map<uint32,uint32>::iterator itx = idToSectionMap.begin(); itx != idToSectionMap.end(); itx++)
     {
         indexbuf << itx->first << itx->second; // field id; row number
     }
-    nIndexes = idToSectionMap.size();
-    sizeIndexes = indexbuf.size();
-
-    // string data
-    // -- most of it is handled somewhere above
-    sizeStrings = stringdata.size();
-
-    // calc data field size in bytes
-    sizeData = blocksize * sizeof(uint32);
-
-    // precalc relative offsets, after header (min 21 bytes, maybe some extra bytes)
-    offsMD5 = 0; // directly after header
-    offsIndexes = offsMD5 + sizeMD5;
-    offsFields = offsIndexes + sizeIndexes;
-    offsData = offsFields + sizeFields;
-    offsStrings = offsData + sizeData;
-
-    // buffer the file header
-    ByteBuffer hbuf(HEADER_SIZE);
-    hbuf.append("SCPC",4); // identifier
+    hdr.nIndexes = idToSectionMap.size();
+    uint32 lowest = idToSectionMap.begin()->first, highest = idToSectionMap.rbegin()->first;
+    if(highest - lowest < hdr.nIndexes * SCP_DIRECT_INDEX_FACTOR)
+    {
+        std::vector<uint32> direct(highest - lowest + 1, SCP_INVALID_INT);
+        for(std::map<uint32,uint32>::iterator itx = idToSectionMap.begin(); itx != idToSectionMap.end(); itx++)
+            direct[itx->first - lowest] = itx->second;
+        indexbuf.append((uint8*)&direct[0], direct.size() * sizeof(uint32));
+        hdr.directbase = lowest;
+        hdr.directsize = direct.size();
+    }
 
-    uint32 flags = 0;
+    // field entries sorted by name, followed by the names.
+    // note that the first field in the data row is always the field id, so the ids start from 1
+    ByteBuffer fieldbuf, namebuf;
+    for(std::map<std::string,SCPFieldDef>::iterator itf = fieldIdMap.begin(); itf != fieldIdMap.end(); itf++)
+    {
+        fieldbuf << (uint32)namebuf.size() << itf->second.id << (uint32)itf->second.type;
+        namebuf << itf->first;
+    }
+    fieldbuf.append(namebuf);
+    _PadBuffer(fieldbuf);
 
-    hbuf << flags; // flags, placeholder; real value is put below
-    hbuf << (uint32)0 << (uint32)0 << (uint32)0 << (uint32)0; // padding, not yet used
-    hbuf << offsMD5 << nMD5 << sizeMD5;
-    hbuf << offsIndexes << nIndexes << sizeIndexes;
-    hbuf << offsFields << nFields << sizeFields;
-    hbuf << offsData << section << sizeData;
-    hbuf << offsStrings << nStrings << sizeStrings;
+    // string data
+    // -- most of it is handled somewhere above, and it is the last block, no padding needed
+
+    hdr.offsMD5 = 0; // directly after header
+    hdr.sizeMD5 = md5buf.size();
+    hdr.offsIndexes = hdr.offsMD5 + hdr.sizeMD5;
+    hdr.sizeIndexes = indexbuf.size();
+    hdr.offsFields = hdr.offsIndexes + hdr.sizeIndexes;
+    hdr.nFields = nFields;
+    hdr.sizeFields = fieldbuf.size();
+    hdr.offsData = hdr.offsFields + hdr.sizeFields;
+    hdr.nRows = section;
+    hdr.sizeData = blocksize * sizeof(uint32);
+    hdr.offsStrings = hdr.offsData + hdr.sizeData;
+    hdr.nStrings = nStrings;
+    hdr.sizeStrings = stringdata.size();
 
     ZCompressor z;
-    z.reserve(sizeMD5 + sizeIndexes + sizeFields + sizeData + sizeStrings);
+    z.reserve(hdr.offsStrings + hdr.sizeStrings);
     z.append(md5buf);
     z.append(indexbuf);
     z.append(fieldbuf);
-    z.append((uint8*)membuf, sizeData);
+    z.append((uint8*)membuf, hdr.sizeData);
     z.append(stringdata);
+    delete [] membuf;
+
+    // the uncompressed body is used by the DB from now on, as if loaded from the file
+    uint32 bodysize = z.size();
+    uint8 *image = new uint8[bodysize];
+    memcpy(image, z.contents(), bodysize);
 
+    // compressed files must be inflated into memory at load, uncompressed ones are mapped and used in place
+    uint32 realsize = 0;
     if(compression)
     {
         z.Deflate(compression);
         if(z.Compressed())
         {
-            hbuf << z.RealSize();
-            flags |= SCP_FLAG_COMPRESSED;
+            realsize = z.RealSize();
+            hdr.flags |= SCP_FLAG_COMPRESSED;
         }
         else
         {
@@ -482,38 +684,35 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
         }
     }
 
-    hbuf.put<uint32>(4,flags); // first 4 bytes are 'SCPC', then flags...
-
-    FILE *fh = fopen(outfile,"wb");
+    // other processes may have the old file mapped, so it must be replaced instead of overwritten
+    std::string tmpfile = MakeTempFileName(outfile); // several processes may compact the same DB at once
+    FILE *fh = fopen(tmpfile.c_str(),"wb");
     if(!fh)
+    {
+        delete [] image;
         return false;
+    }
 
-    fwrite(hbuf.contents(), hbuf.size(), 1, fh);
+    fwrite(&hdr, sizeof(hdr), 1, fh);
+    if(hdr.flags & SCP_FLAG_COMPRESSED)
+        fwrite(&realsize, sizeof(uint32), 1, fh);
     fwrite(z.contents(), z.size(), 1, fh);
     fclose(fh);
+    if(!RenameFile(tmpfile.c_str(), outfile))
+    {
+        logerror("SCP Compact: Can't replace '%s'",outfile);
+        remove(tmpfile.c_str());
+        delete [] image;
+        return false;
+    }
 
-    if(!db)
-        db = GetDB(dbname,true); // create if not exist
-
+    // drop all data no longer needed if the database is compacted
+    db->DropAll();
+    db->_Attach(hdr, image, bodysize);
+    db->_heapimage = image;
     db->_compact = true;
     db->_name = dbname;
 
-    // drop all data no longer needed if the database is compacted
-    db->DropTextData();
-
-    // we keep the membuf, since the compiled data are now usable as if loaded directly from a file
-    // associate it with the buffers used by the db accessing functions
-    db->_stringbuf = new char[sizeStrings];
-    db->_stringsize = sizeStrings;
-    memcpy(db->_stringbuf,stringdata.contents(),sizeStrings);
-    db->_intbuf = membuf; // <<-- do NOT drop the membuf, its still used and will be deleted with ~SCPDatabase()!!
-    db->_fields_per_row = nFields;
-    db->_rowcount = nRows;
-    db->_indexes = idToSectionMap;
-    db->_fielddefs = fieldIdMap;
-    for(std::map<uint32,uint32>::iterator it = idToSectionMap.begin(); it != idToSectionMap.end(); it++)
-        db->_indexes_reverse[it->second] = it->first;
-
     return true;
 }
 
@@ -588,6 +787,35 @@ void SCPDatabaseMgr::_FilterFiles(std::deque<std::string>& files, std::string db
 }
 
 uint32 SCPDatabaseMgr::SearchAndLoad(const char *dbname, bool no_compiled)
+{
+    if(!_shared)
+        return _SearchAndLoad(dbname, no_compiled);
+
+    ZThread::Guard<ZThread::FastMutex> g(SharedDBsMutex);
+    std::map<std::string,SharedSCPEntry>::iterator it = SharedDBs.find(dbname);
+    if(it != SharedDBs.end())
+    {
+        DropDB(dbname);
+        _map.Assign(dbname, it->second.db);
+        _linked.insert(dbname);
+        logdebug("Linked shared database '%s'", dbname);
+        return it->second.sourcefiles;
+    }
+
+    uint32 count = _SearchAndLoad(dbname, no_compiled);
+    SCPDatabase *db = GetDB(dbname);
+    if(count && db && db->IsCompact())
+    {
+        SharedSCPEntry e;
+        e.db = db;
+        e.sourcefiles = count;
+        SharedDBs[dbname] = e;
+        _linked.insert(dbname); // owned by SharedDBs from now on
+    }
+    return count;
+}
+
+uint32 SCPDatabaseMgr::_SearchAndLoad(const char *dbname, bool no_compiled)
 {
     uint32 count = 0;
     std::deque<std::string> goodfiles;
@@ -702,103 +930,93 @@ void SCPDatabaseMgr::AddSearchPath(const char *path)
 
 bool SCPDatabaseMgr::LoadCompactSCP(const char *fn, const char *dbname, uint32 nSourcefiles)
 {
-    uint32 filesize = GetFileSize(fn);
-    if(filesize < HEADER_SIZE)
+    SCPDatabase *db = GetDB(dbname,true);
+    db->_DropImage();
+    MappedFile& file = db->_file;
+    if(!file.Open(fn) || file.GetSize() < sizeof(SCPHeader))
     {
         logerror("Database file '%s' is too small!",fn);
+        db->_DropImage();
         return false;
     }
-    std::fstream fh;
-    fh.open(fn, std::ios_base::in | std::ios_base::binary);
-    if(!fh.is_open())
+
+    SCPHeader hdr;
+    memcpy(&hdr, file.GetData(), sizeof(hdr));
+    if(memcmp(hdr.tag,"SCPC",4))
     {
-        logerror("Error opening '%s'",fn);
+        logerror("'%s' is not a compact database file!",fn);
+        db->_DropImage();
         return false;
     }
-
-    ByteBuffer hbuf;
-    hbuf.resize(HEADER_SIZE);
-    fh.read((char*)hbuf.contents(), HEADER_SIZE);
-
-    char tag[4];
-    uint32 flags, padding[4];
-    uint32 offsMD5, nMD5, sizeMD5;
-    uint32 offsIndexes, nIndexes, sizeIndexes;
-    uint32 offsFields, nFields, sizeFields;
-    uint32 offsData, nRows, sizeData;
-    uint32 offsStrings, nStrings, sizeStrings;
-
-    uint32 realsize; // used when compressed
-
-    hbuf.read((uint8*)&tag[0],4);
-    if(memcmp(tag,"SCPC",4))
+    if(hdr.version != SCP_FORMAT_VERSION)
     {
-        logerror("'%s' is not a compact database file!",fn);
+        logdebug("'%s' has format version %u, need %u, must recompact.",fn,hdr.version,SCP_FORMAT_VERSION);
+        db->_DropImage();
         return false;
     }
-    hbuf >> flags;
-    hbuf >> padding[0] >> padding[1] >> padding[2] >> padding[3];
-    hbuf >> offsMD5 >> nMD5 >> sizeMD5;
-    hbuf >> offsIndexes >> nIndexes >> sizeIndexes;
-    hbuf >> offsFields >> nFields >> sizeFields;
-    hbuf >> offsData >> nRows >> sizeData;
-    hbuf >> offsStrings >> nStrings >> sizeStrings;
-
-    // read some extra bytes depending on flags
-    if(flags & SCP_FLAG_COMPRESSED)
-        fh.read((char*)&realsize, sizeof(uint32));
 
-    ZCompressor z;
-    uint32 remain = sizeMD5 + sizeIndexes + sizeFields + sizeData + sizeStrings;
-    z.resize(remain);
-    fh.read((char*)z.contents(), remain);
-
-    fh.close(); // All data are read from the file now, it can safely be closed
-
-    if(flags & SCP_FLAG_COMPRESSED)
+    // uncompressed files are used directly from the mapping, without copying anything
+    uint32 bodysize = hdr.offsStrings + hdr.sizeStrings;
+    const uint8 *body = file.GetData() + sizeof(hdr);
+    uint32 avail = file.GetSize() - sizeof(hdr);
+    if(hdr.flags & SCP_FLAG_COMPRESSED)
     {
-        z.Compressed(true);
-        z.RealSize(realsize);
-        z.Inflate();
-        if(z.Compressed())
+        uint32 realsize;
+        if(avail < sizeof(uint32))
+        {
+            logerror("'%s' is too small!",fn);
+            db->_DropImage();
+            return false;
+        }
+        memcpy(&realsize, body, sizeof(uint32));
+        ZInflateStream zs;
+        uint8 *image = new uint8[realsize];
+        if(realsize < bodysize || !zs.Inflate(body + sizeof(uint32), avail - sizeof(uint32), image, realsize))
         {
             logerror("LoadCompactSCP: Unable to uncompress '%s'",fn);
+            delete [] image;
+            db->_DropImage();
             return false;
         }
+        file.Close();
+        db->_heapimage = image;
+        body = image;
+        avail = realsize;
     }
 
-    SCPDatabase *db = GetDB(dbname,true);
-    db->_name = dbname;
-    db->_compact = true;
-
-    ByteBuffer md5buf(sizeMD5);
-    md5buf.resize(sizeMD5);
-    // read MD5 block
-    z.rpos(offsMD5);
-    if(z.rpos() == offsMD5)
+    if(avail < bodysize || hdr.offsMD5 > bodysize || hdr.sizeMD5 > bodysize - hdr.offsMD5)
     {
-        z.read((uint8*)md5buf.contents(),sizeMD5);
-    }
-    else
-    {
-        logerror("'%s' has wrong MD5 offset, can't load",fn);
+        logerror("'%s' is truncated, can't load",fn);
+        db->_DropImage();
         return false;
     }
 
-    for(uint32 i = 0; i < nMD5; i++)
+    ByteBuffer md5buf(hdr.sizeMD5);
+    md5buf.append(body + hdr.offsMD5, hdr.sizeMD5);
+    for(uint32 i = 0; i < hdr.nMD5; i++)
     {
-        // read filename and MD5 hash from compiled database
+        // read file size, time, MD5 hash and filename from compiled database
         uint8 buf[MD5_DIGEST_LENGTH];
+        uint32 refSize, refTime;
         std::string refFn;
-        md5buf >> refFn;
+        md5buf >> refSize >> refTime;
         md5buf.read(buf,MD5_DIGEST_LENGTH);
+        md5buf >> refFn;
 
-        // load the file referred to
+        // if size and time did not change, the file can be trusted without reading it
         uint32 refFileSize = GetFileSize(refFn.c_str());
+        if(refFileSize == refSize && GetFileModTime(refFn.c_str()) == refTime)
+        {
+            DEBUG(logdebug("MD5-check: '%s' -> unchanged",refFn.c_str()));
+            continue;
+        }
+
+        // load the file referred to
         FILE *refFile = fopen(refFn.c_str(), "rb");
         if(!refFile)
         {
             logdebug("Not loading '%s', file doesn't exist",fn);
+            db->_DropImage();
             return false;
         }
         uint8 *refFileBuf = new uint8[refFileSize];
@@ -812,6 +1030,7 @@ bool SCPDatabaseMgr::LoadCompactSCP(const char *fn, const char *dbname, uint32 n
         if(memcmp(buf, md5.GetDigest(), MD5_DIGEST_LENGTH))
         {
             logdebug("MD5-check: '%s' has changed!", refFn.c_str());
+            db->_DropImage();
             return false;
         }
         else
@@ -822,86 +1041,22 @@ bool SCPDatabaseMgr::LoadCompactSCP(const char *fn, const char *dbname, uint32 n
 
     // check if there are any new files matching this database, that are not yet compacted and hashed.
     // if the size differs now, and no changes were detected so far, there are probably new files added
-    if(nSourcefiles > nMD5)
+    if(nSourcefiles > hdr.nMD5)
     {
         logdebug("There are more source files existing then hashed in the CCP file, must recompact.");
+        db->_DropImage();
         return false;
     }
-    ASSERT(nMD5 == nSourcefiles); // if we didnt return until now, something isnt good
-
-    // everything good so far? we reached this point? then its likely that the rest of the file is ok, alloc remaining buffers
-    ByteBuffer indexbuf(sizeIndexes);
-    ByteBuffer fieldsbuf(sizeFields);
-    indexbuf.resize(sizeIndexes);
-    fieldsbuf.resize(sizeFields);
+    ASSERT(hdr.nMD5 == nSourcefiles); // if we didnt return until now, something isnt good
 
-    // read indexes block
-    z.rpos(offsIndexes);
-    if(z.rpos() == offsIndexes)
-        z.read((uint8*)indexbuf.contents(),sizeIndexes);
-    else
+    if(!db->_Attach(hdr, body, bodysize))
     {
-        logerror("'%s' has wrong indexes offset, can't load",fn);
+        logerror("'%s' is damaged, can't load",fn);
+        db->_DropImage();
         return false;
     }
-
-    // read field definitions buf
-    z.rpos(offsFields);
-    if(z.rpos() == offsFields)
-        z.read((uint8*)fieldsbuf.contents(),sizeFields);
-    else
-    {
-        logerror("'%s' has wrong field defs offset, can't load",fn);
-        return false;
-    }
-
-    // main data and string blocks follow below
-
-    for(uint32 i = 0; i < nIndexes; i++)
-    {
-        uint32 field_id, row;
-        indexbuf >> field_id >> row;
-        db->_indexes[field_id] = row;
-        db->_indexes_reverse[row] = field_id;
-    }
-
-    for(uint32 i = 0; i < nFields - 1; i++) // the first field (index column) is never written to the file!
-    {
-        SCPFieldDef fieldd;
-        std::string fieldn;
-        fieldsbuf >> fieldn >> fieldd.id >> fieldd.type;
-        db->_fielddefs[fieldn] = fieldd;
-    }
-
-    // read main data block
-    ASSERT(nRows * nFields == sizeData / sizeof(uint32));
-    z.rpos(offsData);
-    if(z.rpos() == offsData)
-    {
-        db->_intbuf = new uint32[nRows * nFields];
-        z.read((uint8*)db->_intbuf, sizeData); // load this somewhat fast and without a for loop
-    }
-    else
-    {
-        logerror("'%s' has wrong data offset, can't load",fn);
-        return false;
-    }
-
-    // read strings
-    z.rpos(offsStrings);
-    if(z.rpos() == offsStrings)
-    {
-        db->_stringbuf = new char[sizeStrings];
-        z.read((uint8*)db->_stringbuf,sizeStrings);
-    }
-    else
-    {
-        logerror("'%s' has wrong strings offset, can't load",fn);
-        return false;
-    }
-    db->_stringsize = sizeStrings;
-    db->_rowcount = nRows;
-    db->_fields_per_row = nFields;
+    db->_name = dbname;
+    db->_compact = true;
 
     db->DropTextData(); // delete pointers to file content created at md5 comparison
 
@@ -922,10 +1077,11 @@ void SCPDatabase::DumpStructureToFile(const char *fn)
     ftype[0] = SCP_TYPE_INT;
 
     f << "Fields: (0 is always index field)\n";
-    for(std::map<std::string,SCPFieldDef>::iterator it = _fielddefs.begin(); it != _fielddefs.end(); it++)
+    for(uint32 i = 0; i < _fieldcount; i++)
     {
-        f << "-> Name: " << it->first << ", ID: " << it->second.id << ", type: " << gettypename(it->second.type) << "\n";
-        ftype[it->second.id] = it->second.type;
+        const SCPFieldEntry& fe = _fieldtable[i];
+        f << "-> Name: " << (_fieldnames + fe.nameoffs) << ", ID: " << fe.id << ", type: " << gettypename(fe.type) << "\n";
+        ftype[fe.id] = fe.type;
     }
     f << "\n";
 
@@ -955,9 +1111,5 @@ void SCPDatabase::DumpStructureToFile(const char *fn)
         }
         f << _stringbuf[i];
     }
+    delete [] ftype;
 }
-
-
-
-
-
@@ -3,6 +3,8 @@
 
 #include "TypeStorage.h"
 #include "ZCompressor.h"
+#include "MappedFile.h"
+#include "zthread/FastMutex.h"
 #include <set>
 
 enum SCPFieldTypes
@@ -24,6 +26,48 @@ struct SCPFieldDef
 };
 
 #define SCP_INVALID_INT 0xFFFFFFFF
+// increase this whenever the layout of compact (.ccp) files changes, older files are recompacted then
+#define SCP_FORMAT_VERSION 1
+// ids are looked up in a plain array if they use at least 1/n of the range between the lowest and highest one
+#define SCP_DIRECT_INDEX_FACTOR 4
+
+// these are stored in compact files like this, and used in place after loading
+struct SCPIndexEntry
+{
+    uint32 id;
+    uint32 row;
+};
+
+struct SCPFieldEntry
+{
+    uint32 nameoffs; // into the name table following the field entries
+    uint32 id;
+    uint32 type;
+};
+
+// compact file header, the body follows directly (after the uint32 real size if compressed).
+// all block offsets are relative to the start of the body and aligned to 4 bytes.
+struct SCPHeader
+{
+    char tag[4]; // "SCPC"
+    uint32 flags;
+    uint32 version;
+    uint32 directbase, directsize; // direct index table, follows the sorted index entries
+    uint32 reserved;
+    uint32 offsMD5, nMD5, sizeMD5;
+    uint32 offsIndexes, nIndexes, sizeIndexes;
+    uint32 offsFields, nFields, sizeFields;
+    uint32 offsData, nRows, sizeData;
+    uint32 offsStrings, nStrings, sizeStrings;
+};
+
+// the rows of one column, chained by the hash of their value.
+// built when the column is searched by value for the first time, dropped together with the data.
+struct SCPValueIndex
+{
+    std::vector<uint32> buckets; // first row + 1, 0 if empty
+    std::vector<uint32> next; // per row: next row + 1 in the same bucket, chains are sorted by row
+};
 
 typedef std::map<std::string,std::string> SCPEntryMap;
 typedef std::map<uint32,SCPEntryMap> SCPFieldMap;
@@ -72,20 +116,36 @@ public:
 
     void DumpStructureToFile(const char *fn);
 private:
+    uint32 _GetRow(uint32 index);
+    const SCPFieldEntry *_GetField(const char *entry);
+    bool _Attach(const SCPHeader& hdr, const uint8 *body, uint32 size);
+    void _DropImage(void);
+    const SCPValueIndex *_GetValueIndex(uint32 entry, bool str);
+
     // text data related
     SCPSourceList sources;
     SCPFieldMap fields;
 
-    // binary data related
+    // binary data related. all pointers below point into the file body, which is either
+    // mapped read-only from the .ccp file (shared between processes) or held in _heapimage.
     bool _compact;
     std::string _name;
     uint32 _rowcount;
     uint32 _fields_per_row;
-    char *_stringbuf;
+    const char *_stringbuf;
     uint32 _stringsize;
-    uint32 *_intbuf;
-    std::map<uint32,uint32> _indexes, _indexes_reverse; // stores index-to-rowID, rowID-to-index
-    std::map<std::string,SCPFieldDef> _fielddefs;
+    const uint32 *_intbuf;
+    const SCPIndexEntry *_index; // sorted by id
+    uint32 _indexsize;
+    const uint32 *_directindex; // row of id (_directbase + i), or SCP_INVALID_INT. NULL if the ids are too sparse
+    uint32 _directbase, _directsize;
+    const SCPFieldEntry *_fieldtable; // sorted by name
+    const char *_fieldnames;
+    uint32 _fieldcount;
+    MappedFile _file;
+    uint8 *_heapimage; // used if the file was compressed, or the DB was just compacted
+    std::vector<SCPValueIndex*> _valueindexes; // [field id * 2 + (string compare ? 1 : 0)]
+    ZThread::FastMutex _indexmutex; // shared DBs may be searched from several threads
 };
 
 typedef TypeStorage<SCPDatabase> SCPDatabaseMap;
@@ -95,10 +155,11 @@ class SCPDatabaseMgr
 {
     friend class SCPDatabase;
 public:
-    SCPDatabaseMgr() : _compr(0) {}
+    SCPDatabaseMgr() : _compr(0), _shared(false) {}
+    ~SCPDatabaseMgr();
     SCPDatabase *GetDB(std::string n, bool create = false);
     uint32 AutoLoadFile(const char *fn);
-    inline void DropDB(std::string s) { _map.Delete(stringToLower(s)); }
+    void DropDB(std::string s);
     bool Compact(const char *dbname, const char *outfile, uint32 compression = 0);
     static uint32 GetDataTypeFromString(const char *s);
     uint32 SearchAndLoad(const char*,bool);
@@ -107,11 +168,20 @@ public:
     void SetCompression(uint32 c) { _compr = c; } // min=0, max=9
     uint32 GetCompression(void) { return _compr; }
 
+    // if set, compacted databases are loaded only once per process and linked read-only into every shared mgr
+    inline void SetShared(bool b = true) { _shared = b; }
+    inline bool IsShared(void) { return _shared; }
+    static void DropSharedDBs(void);
+
 private:
     void _FilterFiles(std::deque<std::string>& files, std::string dbname);
+    uint32 _SearchAndLoad(const char*,bool);
+    void _UnlinkShared(std::string);
     SCPDatabaseMap _map;
     std::deque<std::string> _paths;
     uint32 _compr; // zlib compression level
+    bool _shared;
+    std::set<std::string> _linked; // names in _map that point to shared DBs and are not owned by this mgr
 };
 
 
@@ -0,0 +1,135 @@
+#include "common.h"
+#include "zthread/Guard.h"
+#include "Network/Socket.h"
+#include "Network/EpollSocketHandler.h"
+#include "SessionSocketHandler.h"
+
+#ifdef HAVE_EPOLL
+namespace SharedNetwork
+{
+    class NetworkRunnable : public ZThread::Runnable
+    {
+    public:
+        NetworkRunnable() : _stop(false) {}
+        void stop(void) { _stop = true; }
+        void run(void);
+    private:
+        volatile bool _stop;
+    };
+
+    ZThread::FastRecursiveMutex mutex;
+    ZThread::FastMutex startmutex;
+    EpollSocketHandler *handler = NULL;
+    NetworkRunnable *runnable = NULL;
+    ZThread::Thread *thread = NULL;
+
+    void NetworkRunnable::run(void)
+    {
+        while(!_stop)
+        {
+            // wait for activity without holding the lock, so that sessions can send meanwhile.
+            // notifications are level-triggered, so Select() will see the same sockets ready again.
+            // the timeout makes sure newly added sockets and connect timeouts are processed.
+            handler->Wait(10);
+            ZThread::Guard<ZThread::FastRecursiveMutex> g(mutex);
+            handler->Select(0,0);
+        }
+    }
+
+    EpollSocketHandler *Start(void)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(startmutex);
+        if(!handler)
+        {
+            handler = new EpollSocketHandler();
+            handler->SetAutoCloseSockets(false); // sockets are owned by their sessions
+            runnable = new NetworkRunnable();
+            thread = new ZThread::Thread(runnable);
+            log("Started shared network thread (epoll)");
+        }
+        return handler;
+    }
+}
+#endif
+
+SessionSocketHandler::SessionSocketHandler(uint8 backend, SocketHandler& instancehandler)
+{
+    _shared = false;
+    _mutex = &_ownmutex;
+#ifdef HAVE_EPOLL
+    if(backend == NETWORK_BACKEND_EPOLL_SHARED)
+    {
+        _sh = SharedNetwork::Start();
+        _mutex = &SharedNetwork::mutex;
+        _shared = true;
+    }
+    else
+#endif
+        _sh = &instancehandler;
+}
+
+SessionSocketHandler::~SessionSocketHandler()
+{
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(GetMutex());
+    for(std::set<Socket*>::iterator it = _mysockets.begin(); it != _mysockets.end(); it++)
+        _sh->Remove(*it);
+}
+
+SocketHandler *SessionSocketHandler::CreateInstanceHandler(uint8 backend)
+{
+    SocketHandler *h;
+#ifdef HAVE_EPOLL
+    if(backend == NETWORK_BACKEND_EPOLL || backend == NETWORK_BACKEND_EPOLL_SHARED)
+        h = new EpollSocketHandler();
+    else
+#endif
+        h = new SocketHandler();
+    return h;
+}
+
+void SessionSocketHandler::Add(Socket *s)
+{
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(GetMutex());
+    _sh->Add(s);
+    _mysockets.insert(s);
+}
+
+void SessionSocketHandler::Remove(Socket *s)
+{
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(GetMutex());
+    _sh->Remove(s);
+    _mysockets.erase(s);
+}
+
+int SessionSocketHandler::Select(long sec, long usec)
+{
+    if(_shared)
+        return 0;
+    return _sh->Select(sec, usec);
+}
+
+bool SessionSocketHandler::HasSockets(void)
+{
+    // the handler removes closed sockets, but not from our own list
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(GetMutex());
+    for(std::set<Socket*>::iterator it = _mysockets.begin(); it != _mysockets.end(); it++)
+        if(_sh->Handles(*it))
+            return true;
+    return false;
+}
+
+void SessionSocketHandler::Shutdown(void)
+{
+#ifdef HAVE_EPOLL
+    ZThread::Guard<ZThread::FastMutex> g(SharedNetwork::startmutex);
+    if(SharedNetwork::thread)
+    {
+        SharedNetwork::runnable->stop();
+        SharedNetwork::thread->wait();
+        delete SharedNetwork::thread;
+        delete SharedNetwork::handler;
+        SharedNetwork::thread = NULL;
+        SharedNetwork::handler = NULL;
+    }
+#endif
+}
@@ -0,0 +1,49 @@
+#ifndef _SESSIONSOCKETHANDLER_H
+#define _SESSIONSOCKETHANDLER_H
+
+#include <set>
+#include "common.h"
+#include "Network/SocketHandler.h"
+
+class Socket;
+
+enum NetworkBackend
+{
+    NETWORK_BACKEND_SELECT        = 0, // sockets are in the instance's select() based handler (default)
+    NETWORK_BACKEND_EPOLL         = 1, // sockets are in the instance's epoll based handler
+    NETWORK_BACKEND_EPOLL_SHARED  = 2, // one epoll based handler + network thread for all sessions in the process
+};
+
+// Socket handler used by RealmSession and WorldSession.
+// Normally the sockets go into the handler of the instance, which waits on all of them at once (see PseuInstance::Update()).
+// In shared mode the sockets are polled by a process-wide network thread, so the session must hold
+// GetMutex() whenever it touches its socket (sending, crypt init, deleting), and wake up the instance when it queued something.
+// Falls back to select() on platforms without epoll.
+class SessionSocketHandler
+{
+public:
+    SessionSocketHandler(uint8 backend, SocketHandler& instancehandler);
+    ~SessionSocketHandler();
+
+    static SocketHandler *CreateInstanceHandler(uint8 backend); // the handler PseuInstance waits on
+
+    inline SocketHandler& Get(void) { return *_sh; }
+    inline bool IsShared(void) { return _shared; }
+    inline ZThread::FastRecursiveMutex& GetMutex(void) { return *_mutex; }
+
+    void Add(Socket *s);
+    void Remove(Socket *s); // call before deleting a socket that may still be handled
+    int Select(long sec, long usec); // also handles the instance's other sockets; does nothing in shared mode, the network thread does it
+    bool HasSockets(void);
+
+    static void Shutdown(void); // stops the shared network thread, if running
+
+private:
+    SocketHandler *_sh;
+    ZThread::FastRecursiveMutex *_mutex;
+    ZThread::FastRecursiveMutex _ownmutex;
+    bool _shared;
+    std::set<Socket*> _mysockets; // the handler also contains other sockets
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "common.h"
+#include "SPSCRing.h"
+#include "Network/SocketHandler.h"
+#include "WakeupSocket.h"
+
+WakeupSocket::WakeupSocket(SocketHandler& h) : Socket(h)
+{
+    _sender = INVALID_SOCKET;
+    memset(&_addr, 0, sizeof(_addr));
+    _pending = 0;
+    _wakeups = 0;
+}
+
+WakeupSocket::~WakeupSocket()
+{
+    if(_sender != INVALID_SOCKET)
+        closesocket(_sender);
+    if(GetSocket() != INVALID_SOCKET)
+        Close();
+}
+
+bool WakeupSocket::Open(void)
+{
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    if(s == INVALID_SOCKET)
+    {
+        logerror("WakeupSocket: socket() failed: %s", StrError(Errno));
+        return false;
+    }
+    _addr.sin_family = AF_INET;
+    _addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    _addr.sin_port = 0;
+    socklen_t len = sizeof(_addr);
+    if(bind(s, (struct sockaddr*)&_addr, len) == -1 || getsockname(s, (struct sockaddr*)&_addr, &len) == -1)
+    {
+        logerror("WakeupSocket: can't bind to loopback: %s", StrError(Errno));
+        closesocket(s);
+        return false;
+    }
+    Attach(s);
+    SetNonblocking(true);
+
+    _sender = socket(AF_INET, SOCK_DGRAM, 0);
+    if(_sender == INVALID_SOCKET)
+    {
+        logerror("WakeupSocket: socket() failed: %s", StrError(Errno));
+        return false;
+    }
+    SetNonblocking(true, _sender); // a full receive buffer already means the instance will wake up
+    return true;
+}
+
+void WakeupSocket::Wakeup(void)
+{
+    // pairs with the barrier in OnRead(): either the instance sees what was queued before this call, or we see _pending cleared
+    SPSCAtomic::FullBarrier();
+    if(SPSCAtomic::LoadAcquire(&_pending) || _sender == INVALID_SOCKET)
+        return;
+    SPSCAtomic::StoreRelease(&_pending, 1);
+    char c = 0;
+    sendto(_sender, &c, 1, 0, (struct sockaddr*)&_addr, sizeof(_addr));
+}
+
+void WakeupSocket::OnRead(void)
+{
+    // drain first and clear the flag after; clearing first could swallow the datagram of a wakeup that comes in between
+    char buf[64];
+    while(recv(GetSocket(), buf, sizeof(buf), 0) > 0)
+        _wakeups++;
+    SPSCAtomic::StoreRelease(&_pending, 0);
+    SPSCAtomic::FullBarrier();
+}
+
+int WakeupSocket::Close(void)
+{
+    int n = closesocket(GetSocket());
+    Attach(INVALID_SOCKET);
+    return n;
+}
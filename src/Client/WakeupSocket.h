@@ -0,0 +1,30 @@
+#ifndef _WAKEUPSOCKET_H
+#define _WAKEUPSOCKET_H
+
+#include "common.h"
+#include "Network/Socket.h"
+
+// lets other threads (CLI, GUI, the shared network thread, signal handlers) interrupt the Select() an instance waits in.
+// a loopback UDP socket instead of a pipe, because select() on windows only takes sockets.
+// Wakeup() sends at most one datagram until OnRead() has drained it, so a burst of wakeups costs one sendto().
+class WakeupSocket : public Socket
+{
+public:
+    WakeupSocket(SocketHandler& h);
+    ~WakeupSocket();
+
+    bool Open(void); // call before adding it to the handler
+    void Wakeup(void); // any thread; async-signal-safe
+    inline uint32 GetWakeups(void) { return _wakeups; }
+
+    void OnRead(void);
+    int Close(void); // Socket::Close() does a shutdown(), which fails for udp
+
+private:
+    SOCKET _sender;
+    struct sockaddr_in _addr;
+    volatile uint32 _pending;
+    uint32 _wakeups; // datagrams read, for stats
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include <vector>
 #include <fstream>
+#include <algorithm>
 #include "common.h"
 #include "PseuWoW.h"
 #include "Opcodes.h"
@@ -9,11 +10,12 @@
 #include "WorldSession.h"
 #include "CacheHandler.h"
 #include "Item.h"
+#include "zthread/Guard.h"
 
 // increase this number whenever you change something that makes old files unusable
-uint32 ITEMPROTOTYPES_CACHE_VERSION = 5;
-uint32 CREATURETEMPLATES_CACHE_VERSION = 1;
-uint32 GOTEMPLATES_CACHE_VERSION = 1;
+uint32 ITEMPROTOTYPES_CACHE_VERSION = 6;
+uint32 CREATURETEMPLATES_CACHE_VERSION = 2;
+uint32 GOTEMPLATES_CACHE_VERSION = 2;
 
 PlayerNameCache::~PlayerNameCache()
 {
@@ -135,43 +137,156 @@ uint32 PlayerNameCache::GetSize(void)
     return _cache.size();
 }
 
-void ItemProtoCache_InsertDataToSession(WorldSession *session)
+PrototypeCacheFile::PrototypeCacheFile(const char *fn, uint32 version, const char *what)
 {
-    logdetail("ItemProtoCache: Loading...");
-    const char* fn = "./cache/ItemPrototypes.cache";
-    std::fstream fh;
-    fh.open(fn, std::ios_base::in | std::ios_base::binary);
-    if(!fh)
+    _fn = fn;
+    _version = version;
+    _what = what;
+    _reset = true;
+}
+
+// maps the file and indexes the records. if it is missing, outdated or damaged, the next Append() starts a new file.
+bool PrototypeCacheFile::Load(void)
+{
+    logdetail("%s: Loading...",_what);
+    _index.clear();
+    _stored.clear();
+    _reset = true;
+    if(!_file.Open(_fn))
     {
-        logerror("ItemProtoCache: Could not open file '%s'!",fn);
-        return;
+        logerror("%s: Could not open file '%s'!",_what,_fn);
+        return false;
     }
 
-	uint32 cacheversion, total;
+    const uint8 *data = _file.GetData();
+    uint32 size = _file.GetSize();
+    uint32 version = 0;
+    if(size >= sizeof(uint32))
+        memcpy(&version, data, sizeof(uint32));
+    if(version != _version)
+    {
+        logerror("%s is outdated! Creating new cache.",_what);
+        _file.Close();
+        return false;
+    }
 
-    try
+    uint32 pos = sizeof(uint32);
+    while(size - pos >= 2 * sizeof(uint32))
+    {
+        uint32 id, datasize;
+        memcpy(&id, data + pos, sizeof(uint32));
+        memcpy(&datasize, data + pos + sizeof(uint32), sizeof(uint32));
+        if(datasize > size - pos - 2 * sizeof(uint32))
+            break;
+        _index.push_back(std::make_pair(id, pos));
+        pos += 2 * sizeof(uint32) + datasize;
+    }
+    if(pos != size)
     {
+        logerror("%s: '%s' is damaged! Creating new cache.",_what,_fn);
+        _index.clear();
+        _file.Close();
+        return false;
+    }
 
-	fh.read((char*)&cacheversion,4);
-	if(cacheversion != ITEMPROTOTYPES_CACHE_VERSION)
-	{
-		logerror("ItemProtoCache is outdated! Creating new cache.");
-		fh.close();
-		return;
-	}
-    fh.read((char*)&total,4);
-    logdetail("ItemProtoCache: %u item prototypes stored",total);
-
-    uint32 datasize, counter = 0;
-    ByteBuffer buf;
-    for(uint32 i = 0; i < total && !fh.eof(); i++)
+    // sorted by id, then by position; if an id was stored more than once, the last record counts
+    std::sort(_index.begin(), _index.end());
+    uint32 n = 0;
+    for(uint32 i = 0; i < _index.size(); i++)
+    {
+        if(n && _index[n - 1].first == _index[i].first)
+            _index[n - 1] = _index[i];
+        else
+            _index[n++] = _index[i];
+    }
+    _index.resize(n);
+    _reset = false;
+    logdetail("%s: %u records indexed",_what,n);
+    return true;
+}
+
+const uint8 *PrototypeCacheFile::Find(uint32 id, uint32& size) const
+{
+    std::vector<std::pair<uint32,uint32> >::const_iterator it =
+        std::lower_bound(_index.begin(), _index.end(), std::make_pair(id, uint32(0)));
+    if(it == _index.end() || it->first != id)
+        return NULL;
+    const uint8 *rec = _file.GetData() + it->second;
+    memcpy(&size, rec + sizeof(uint32), sizeof(uint32));
+    return rec + 2 * sizeof(uint32);
+}
+
+bool PrototypeCacheFile::Contains(uint32 id) const
+{
+    uint32 size;
+    return Find(id, size) || _stored.find(id) != _stored.end();
+}
+
+void PrototypeCacheFile::AddRecord(ByteBuffer& records, uint32 id, const ByteBuffer& data)
+{
+    records << id << (uint32)data.size();
+    records.append(data);
+    _pending.push_back(id);
+}
+
+// writes records built with AddRecord() to the end of the file
+bool PrototypeCacheFile::Append(const ByteBuffer& records)
+{
+    if(!records.size())
+        return true;
+
+    bool ok;
+    if(_reset)
+    {
+        // a new file is written next to the old one and then replaces it, since other processes may still have the old one mapped
+        std::string tmpfile = MakeTempFileName(_fn);
+        FILE *fh = fopen(tmpfile.c_str(), "wb");
+        ok = fh != NULL;
+        if(fh)
+        {
+            ok = fwrite(&_version, sizeof(uint32), 1, fh) == 1;
+            ok = fwrite(records.contents(), records.size(), 1, fh) == 1 && ok;
+            ok = !fclose(fh) && ok;
+            ok = ok && RenameFile(tmpfile.c_str(), _fn);
+            if(!ok)
+                remove(tmpfile.c_str());
+        }
+    }
+    else // other processes may append to the same file, so the records must get there in one piece
+        ok = AppendToFile(_fn, records.contents(), records.size());
+    if(!ok)
+    {
+        logerror("%s: Could not write to file '%s'!",_what,_fn);
+        _pending.clear();
+        return false;
+    }
+
+    _stored.insert(_pending.begin(), _pending.end());
+    _pending.clear();
+    _reset = false;
+    return true;
+}
+
+PrototypeCache::PrototypeCache()
+: items("./cache/ItemPrototypes.cache", ITEMPROTOTYPES_CACHE_VERSION, "ItemProtoCache"),
+  creatures("./cache/CreatureTemplates.cache", CREATURETEMPLATES_CACHE_VERSION, "CreatureTemplateCache"),
+  gameobjects("./cache/GOTemplates.cache", GOTEMPLATES_CACHE_VERSION, "GOTemplateCache")
+{
+}
+
+ItemProto *ItemProtoCache_Read(PrototypeCacheFile& cache, uint32 id)
+{
+    uint32 size;
+    const uint8 *data = cache.Find(id, size);
+    if(!data)
+        return NULL;
+
+    ByteBuffer buf(size);
+    buf.append(data, size);
+    ItemProto *proto = new ItemProto();
+
+    try
     {
-        buf.clear();
-        fh.read((char*)&datasize,sizeof(uint32));
-        //DEBUG(logdebug("ItemProtoCache: (%u/%u) - datasize=%u",i,total,datasize));
-        buf.resize(datasize);
-        fh.read((char*)buf.contents(),datasize);
-        ItemProto *proto = new ItemProto();
         buf >> proto->Id;
         buf >> proto->Class;
         buf >> proto->SubClass;
@@ -198,6 +313,12 @@ void ItemProtoCache_InsertDataToSession(WorldSession *session)
         buf >> proto->Stackable;
         buf >> proto->ContainerSlots;
         buf >> proto->StatsCount;
+        if(proto->StatsCount > MAX_ITEM_PROTO_STATS)
+        {
+            logerror("ItemProtoCache: record %u damaged, %u stats",id,proto->StatsCount);
+            delete proto;
+            return NULL;
+        }
         for(uint32 i = 0; i < proto->StatsCount; i++)
         {
             buf >> proto->ItemStat[i].ItemStatType;
@@ -205,7 +326,7 @@ void ItemProtoCache_InsertDataToSession(WorldSession *session)
         }
         buf >> proto->ScalingStatDistribution;
         buf >> proto->ScalingStatValue;
-        for(int i = 0; i < 5; i++)
+        for(int i = 0; i < MAX_ITEM_PROTO_DAMAGES; i++)
         {
             buf >> proto->Damage[i].DamageMin;
             buf >> proto->Damage[i].DamageMax;
@@ -222,7 +343,7 @@ void ItemProtoCache_InsertDataToSession(WorldSession *session)
         buf >> proto->Ammo_type;
 
         buf >> proto->RangedModRange;
-        for(int s = 0; s < 5; s++)
+        for(int s = 0; s < MAX_ITEM_PROTO_SPELLS; s++)
         {
             buf >> proto->Spells[s].SpellId;
             buf >> proto->Spells[s].SpellTrigger;
@@ -261,49 +382,29 @@ void ItemProtoCache_InsertDataToSession(WorldSession *session)
         buf >> proto->Duration;
         buf >> proto->ItemLimitCategory;
         buf >> proto->HolidayId;
-
-        if(proto->Id)
-        {
-            //DEBUG(logdebug("ItemProtoCache: Loaded %u [%s]",proto->Id, proto->Name[0].c_str()));
-            session->objmgr.Add(proto);
-            counter++;
-        } else
-            delete proto;
-    }
-
     }
     catch (ByteBufferException bbe)
     {
-        logerror("ByteBuffer exception: attempt to \"%s\" %u bytes at position %u out of total %u bytes. (wpos=%u)",
-            bbe.action, bbe.readsize, bbe.rpos, bbe.cursize, bbe.wpos);
+        logerror("ItemProtoCache: record %u damaged, attempt to \"%s\" %u bytes at position %u out of total %u bytes.",
+            id, bbe.action, bbe.readsize, bbe.rpos, bbe.cursize);
+        delete proto;
+        return NULL;
     }
 
-    fh.close();
-    logdetail("ItemProtoCache: Loaded %u Item Prototypes",total);
+    return proto;
 }
 
+// appends all prototypes the file doesn't have yet
 void ItemProtoCache_WriteDataToCache(WorldSession *session)
 {
-	if (!session->objmgr.GetItemProtoCount())
-		return;
-
-    const char* fn = "./cache/ItemPrototypes.cache";
-    std::fstream fh;
-    fh.open(fn, std::ios_base::out | std::ios_base::binary);
-    if(!fh)
-    {
-        logerror("ItemProtoCache: Could not write to file '%s'!",fn);
-        return;
-    }
-
-    uint32 total = session->objmgr.GetItemProtoCount();
-	fh.write((char*)&ITEMPROTOTYPES_CACHE_VERSION,4);
-    fh.write((char*)&total,4);
-
+    PrototypeCacheFile& cache = PrototypeCache_Get()->items;
+    ItemProtoMap *data = session->objmgr.GetItemProtoStorage();
+    ByteBuffer records, buf;
     uint32 counter=0;
-    ByteBuffer buf;
-    for(ItemProtoMap::iterator it = session->objmgr.GetItemProtoStorage()->begin(); it != session->objmgr.GetItemProtoStorage()->end(); it++)
+    for(ItemProtoMap::iterator it = data->begin(); it != data->end(); it++)
     {
+        if(cache.Contains(it->first))
+            continue;
         buf.clear();
         ItemProto *proto = it->second;
         buf << proto->Id;
@@ -339,7 +440,7 @@ void ItemProtoCache_WriteDataToCache(WorldSession *session)
         }
         buf << proto->ScalingStatDistribution;
         buf << proto->ScalingStatValue;
-        for(int i = 0; i < 5; i++)
+        for(int i = 0; i < MAX_ITEM_PROTO_DAMAGES; i++)
         {
             buf << proto->Damage[i].DamageMin;
             buf << proto->Damage[i].DamageMax;
@@ -356,7 +457,7 @@ void ItemProtoCache_WriteDataToCache(WorldSession *session)
         buf << proto->Ammo_type;
 
         buf << (float)proto->RangedModRange;
-        for(int s = 0; s < 5; s++)
+        for(int s = 0; s < MAX_ITEM_PROTO_SPELLS; s++)
         {
             buf << proto->Spells[s].SpellId;
             buf << proto->Spells[s].SpellTrigger;
@@ -397,52 +498,26 @@ void ItemProtoCache_WriteDataToCache(WorldSession *session)
         buf << proto->HolidayId;
 
         //DEBUG(logdebug("ItemProtoCache: Saved %u [%s]",proto->Id, proto->Name[0].c_str()));
-        uint32 size = buf.size();
-        fh.write((char*)&size,sizeof(uint32));
-        fh.write((char*)buf.contents(),buf.size());
+        cache.AddRecord(records, proto->Id, buf);
         counter++;
     }
-    fh.flush();
-    fh.close();
-    log("ItemProtoCache: Saved %u Item Prototypes",counter);
+    if(counter && cache.Append(records))
+        log("ItemProtoCache: Saved %u Item Prototypes",counter);
 }
 
-void CreatureTemplateCache_InsertDataToSession(WorldSession *session)
+CreatureTemplate *CreatureTemplateCache_Read(PrototypeCacheFile& cache, uint32 id)
 {
-    logdetail("CreatureTemplateCache: Loading...");
-    const char* fn = "./cache/CreatureTemplates.cache";
-    std::fstream fh;
-    fh.open(fn, std::ios_base::in | std::ios_base::binary);
-    if(!fh)
-    {
-        logerror("CreatureTemplateCache: Could not open file '%s'!",fn);
-        return;
-    }
+    uint32 size;
+    const uint8 *data = cache.Find(id, size);
+    if(!data)
+        return NULL;
 
-    uint32 cacheversion, total, counter = 0;
+    ByteBuffer buf(size);
+    buf.append(data, size);
+    CreatureTemplate *ct = new CreatureTemplate();
 
     try
     {
-
-    fh.read((char*)&cacheversion,4);
-    if(cacheversion != CREATURETEMPLATES_CACHE_VERSION)
-    {
-        logerror("CreatureTemplateCache is outdated! Creating new cache.");
-        fh.close();
-        return;
-    }
-    fh.read((char*)&total,4);
-    logdetail("CreatureTemplateCache: %u creature templates stored",total);
-
-    uint32 datasize;
-    ByteBuffer buf;
-    for(uint32 i = 0; i < total && !fh.eof(); i++)
-    {
-        buf.clear();
-        fh.read((char*)&datasize,sizeof(uint32));
-        buf.resize(datasize);
-        fh.read((char*)buf.contents(),datasize);
-        CreatureTemplate *ct = new CreatureTemplate();
         buf >> ct->entry;
         buf >> ct->name;
         buf >> ct->subname;
@@ -461,46 +536,28 @@ void CreatureTemplateCache_InsertDataToSession(WorldSession *session)
         for(uint32 i = 0; i < 4; i++)
             buf >> ct->questItems[i];
         buf >> ct->movementId;
-
-        if(ct->entry)
-        {
-            session->objmgr.Add(ct);
-            counter++;
-        } else
-            delete ct;
-    }
-
     }
     catch (ByteBufferException bbe)
     {
-        logerror("ByteBuffer exception: attempt to \"%s\" %u bytes at position %u out of total %u bytes. (wpos=%u)",
-            bbe.action, bbe.readsize, bbe.rpos, bbe.cursize, bbe.wpos);
+        logerror("CreatureTemplateCache: record %u damaged, attempt to \"%s\" %u bytes at position %u out of total %u bytes.",
+            id, bbe.action, bbe.readsize, bbe.rpos, bbe.cursize);
+        delete ct;
+        return NULL;
     }
 
-    fh.close();
-    logdetail("CreatureTemplateCache: Loaded %u Creature Templates",counter);
+    return ct;
 }
 
 void CreatureTemplateCache_WriteDataToCache(WorldSession *session)
 {
-    if (!session->objmgr.GetCreatureTemplateCount())
-        return;
-
-    const char* fn = "./cache/CreatureTemplates.cache";
-    std::fstream fh;
-    fh.open(fn, std::ios_base::out | std::ios_base::binary);
-    if(!fh)
-    {
-        logerror("CreatureTemplateCache: Could not write to file '%s'!",fn);
-        return;
-    }
-    uint32 total = session->objmgr.GetCreatureTemplateCount();
-    fh.write((char*)&CREATURETEMPLATES_CACHE_VERSION,4);
-    fh.write((char*)&total,4);
+    PrototypeCacheFile& cache = PrototypeCache_Get()->creatures;
+    CreatureTemplateMap *data = session->objmgr.GetCreatureTemplateStorage();
+    ByteBuffer records, buf;
     uint32 counter=0;
-    ByteBuffer buf;
-    for(CreatureTemplateMap::iterator it = session->objmgr.GetCreatureTemplateStorage()->begin(); it != session->objmgr.GetCreatureTemplateStorage()->end(); it++)
+    for(CreatureTemplateMap::iterator it = data->begin(); it != data->end(); it++)
     {
+        if(cache.Contains(it->first))
+            continue;
         buf.clear();
         CreatureTemplate *ct = it->second;
         buf << ct->entry;
@@ -522,106 +579,62 @@ void CreatureTemplateCache_WriteDataToCache(WorldSession *session)
             buf << ct->questItems[i];
         buf << ct->movementId;
 
-        uint32 size = buf.size();
-        fh.write((char*)&size,sizeof(uint32));
-        fh.write((char*)buf.contents(),buf.size());
+        cache.AddRecord(records, ct->entry, buf);
         counter++;
     }
-    fh.flush();
-    fh.close();
-    log("CreatureTemplateCache: Saved %u Creature Templates",counter);
+    if(counter && cache.Append(records))
+        log("CreatureTemplateCache: Saved %u Creature Templates",counter);
 }
 
-void GOTemplateCache_InsertDataToSession(WorldSession *session)
+GameobjectTemplate *GOTemplateCache_Read(PrototypeCacheFile& cache, uint32 id)
 {
-    logdetail("GOTemplateCache: Loading...");
-    const char* fn = "./cache/GOTemplates.cache";
-    std::fstream fh;
-    fh.open(fn, std::ios_base::in | std::ios_base::binary);
-    if(!fh)
-    {
-        logerror("GOTemplateCache: Could not open file '%s'!",fn);
-        return;
-    }
+    uint32 size;
+    const uint8 *data = cache.Find(id, size);
+    if(!data)
+        return NULL;
 
-    uint32 cacheversion, total, counter = 0;
+    ByteBuffer buf(size);
+    buf.append(data, size);
+    GameobjectTemplate *go = new GameobjectTemplate();
 
     try
     {
-
-        fh.read((char*)&cacheversion,4);
-        if(cacheversion != GOTEMPLATES_CACHE_VERSION)
-        {
-            logerror("GOTemplateCache is outdated! Creating new cache.");
-            fh.close();
-            return;
-        }
-        fh.read((char*)&total,4);
-        logdetail("GOTemplateCache: %u gameobject templates stored",total);
-
-        uint32 datasize;
-        ByteBuffer buf;
-        for(uint32 i = 0; i < total && !fh.eof(); i++)
-        {
-            buf.clear();
-            fh.read((char*)&datasize,sizeof(uint32));
-            buf.resize(datasize);
-            fh.read((char*)buf.contents(),datasize);
-            GameobjectTemplate *go = new GameobjectTemplate();
-            buf >> go->entry;
-            buf >> go->type;
-            buf >> go->displayId;
-            buf >> go->name;
-            buf >> go->castBarCaption;
-            buf >> go->unk1;
-            buf >> go->faction;
-            buf >> go->flags;
-            buf >> go->size;
-            for(uint32 i = 0; i < GAMEOBJECT_DATA_FIELDS; i++)
-                buf >> go->raw.data[i];
-            buf >> go->size;
-            for(uint32 i = 0; i < 4; i++)
-                buf >> go->questItems[i];
-
-            if(go->entry)
-            {
-                session->objmgr.Add(go);
-                counter++;
-            } else
-                delete go;
-        }
-
+        buf >> go->entry;
+        buf >> go->type;
+        buf >> go->displayId;
+        buf >> go->name;
+        buf >> go->castBarCaption;
+        buf >> go->unk1;
+        buf >> go->faction;
+        buf >> go->flags;
+        buf >> go->size;
+        for(uint32 i = 0; i < GAMEOBJECT_DATA_FIELDS; i++)
+            buf >> go->raw.data[i];
+        buf >> go->size;
+        for(uint32 i = 0; i < 4; i++)
+            buf >> go->questItems[i];
     }
     catch (ByteBufferException bbe)
     {
-        logerror("ByteBuffer exception: attempt to \"%s\" %u bytes at position %u out of total %u bytes. (wpos=%u)",
-            bbe.action, bbe.readsize, bbe.rpos, bbe.cursize, bbe.wpos);
+        logerror("GOTemplateCache: record %u damaged, attempt to \"%s\" %u bytes at position %u out of total %u bytes.",
+            id, bbe.action, bbe.readsize, bbe.rpos, bbe.cursize);
+        delete go;
+        return NULL;
     }
 
-    fh.close();
-    logdetail("GOTemplateCache: Loaded %u Gameobject Templates",counter);
+    return go;
 }
 
 void GOTemplateCache_WriteDataToCache(WorldSession *session)
 {
-    if (!session->objmgr.GetGOTemplateCount())
-        return;
-
-    const char* fn = "./cache/GOTemplates.cache";
-    std::fstream fh;
-    fh.open(fn, std::ios_base::out | std::ios_base::binary);
-    if(!fh)
-    {
-        logerror("GOTemplateCache: Could not write to file '%s'!",fn);
-        return;
-    }
-    uint32 total = session->objmgr.GetGOTemplateCount();
-    fh.write((char*)&GOTEMPLATES_CACHE_VERSION,4);
-    fh.write((char*)&total,4);
+    PrototypeCacheFile& cache = PrototypeCache_Get()->gameobjects;
+    GOTemplateMap *data = session->objmgr.GetGOTemplateStorage();
+    ByteBuffer records, buf;
     uint32 counter=0;
-    ByteBuffer buf;
-    for(GOTemplateMap::iterator it = session->objmgr.GetGOTemplateStorage()->begin(); it != session->objmgr.GetGOTemplateStorage()->end(); it++)
+    for(GOTemplateMap::iterator it = data->begin(); it != data->end(); it++)
     {
+        if(cache.Contains(it->first))
+            continue;
         buf.clear();
         GameobjectTemplate *go = it->second;
         buf << go->entry;
@@ -639,13 +652,34 @@ void GOTemplateCache_WriteDataToCache(WorldSession *session)
         for(uint32 i = 0; i < 4; i++)
             buf << go->questItems[i];
 
-        uint32 size = buf.size();
-        fh.write((char*)&size,sizeof(uint32));
-        fh.write((char*)buf.contents(),buf.size());
+        cache.AddRecord(records, go->entry, buf);
         counter++;
     }
-    fh.flush();
-    fh.close();
-    log("GOTemplateCache: Saved %u Gameobject Templates",counter);
+    if(counter && cache.Append(records))
+        log("GOTemplateCache: Saved %u Gameobject Templates",counter);
 }
 
+ZThread::FastMutex protoCacheMutex;
+PrototypeCache *protoCache = NULL;
+
+// the cache files are loaded once per process and used by every session. templates are read from them
+// (without locking) whenever a session needs one it doesn't have in memory yet.
+PrototypeCache *PrototypeCache_Get(void)
+{
+    ZThread::Guard<ZThread::FastMutex> g(protoCacheMutex);
+    if(!protoCache)
+    {
+        protoCache = new PrototypeCache();
+        protoCache->items.Load();
+        protoCache->creatures.Load();
+        protoCache->gameobjects.Load();
+    }
+    return protoCache;
+}
+
+void PrototypeCache_Delete(void)
+{
+    ZThread::Guard<ZThread::FastMutex> g(protoCacheMutex);
+    delete protoCache;
+    protoCache = NULL;
+}
@@ -1,6 +1,15 @@
 #ifndef _CACHEHANDLER_H
 #define _CACHEHANDLER_H
 
+#include <set>
+#include "MappedFile.h"
+
+class ObjMgr;
+class WorldSession;
+struct ItemProto;
+struct CreatureTemplate;
+struct GameobjectTemplate;
+
 typedef std::map<uint64,std::string> PlayerNameMap;
 
 class PlayerNameCache
@@ -19,13 +28,45 @@ private:
     PlayerNameMap _cache;
 };
 
-void ItemProtoCache_InsertDataToSession(WorldSession *session);
+// a template cache file: a version number, then records of {uint32 id, uint32 size, size bytes}, which are only appended.
+// the file is mapped and indexed at load, a record is only deserialized when a session needs that template.
+class PrototypeCacheFile
+{
+public:
+    PrototypeCacheFile(const char *fn, uint32 version, const char *what);
+    bool Load(void);
+    const uint8 *Find(uint32 id, uint32& size) const;
+    bool Contains(uint32 id) const; // in the file, or appended since loading
+    void AddRecord(ByteBuffer& records, uint32 id, const ByteBuffer& data);
+    bool Append(const ByteBuffer& records);
+    inline uint32 GetCount(void) const { return _index.size() + _stored.size(); }
+
+private:
+    const char *_fn, *_what;
+    uint32 _version;
+    MappedFile _file;
+    std::vector<std::pair<uint32,uint32> > _index; // id, position of the record. sorted by id
+    std::set<uint32> _stored; // appended after loading
+    std::vector<uint32> _pending; // added with AddRecord(), not yet appended
+    bool _reset; // file was missing or unusable, the next Append() starts a new one
+};
+
+struct PrototypeCache
+{
+    PrototypeCache();
+    PrototypeCacheFile items, creatures, gameobjects;
+};
+
+ItemProto *ItemProtoCache_Read(PrototypeCacheFile& cache, uint32 id);
 void ItemProtoCache_WriteDataToCache(WorldSession *session);
 
-void CreatureTemplateCache_InsertDataToSession(WorldSession *session);
+CreatureTemplate *CreatureTemplateCache_Read(PrototypeCacheFile& cache, uint32 id);
 void CreatureTemplateCache_WriteDataToCache(WorldSession *session);
 
-void GOTemplateCache_InsertDataToSession(WorldSession *session);
+GameobjectTemplate *GOTemplateCache_Read(PrototypeCacheFile& cache, uint32 id);
 void GOTemplateCache_WriteDataToCache(WorldSession *session);
 
+PrototypeCache *PrototypeCache_Get(void);
+void PrototypeCache_Delete(void);
+
 #endif
@@ -0,0 +1,96 @@
+#include "common.h"
+#include "GuidIndex.h"
+
+GuidIndex::GuidIndex(uint32 size)
+{
+    uint32 cap = 16;
+    while(cap < size)
+        cap <<= 1;
+    Entry e = { 0, 0 };
+    _table.assign(cap, e);
+    _mask = cap - 1;
+    _count = 0;
+}
+
+bool GuidIndex::Find(uint64 guid, uint32& value) const
+{
+    if(!guid)
+        return false;
+    for(uint32 i = _Slot(guid); _table[i].guid; i = (i + 1) & _mask)
+    {
+        if(_table[i].guid == guid)
+        {
+            value = _table[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void GuidIndex::Set(uint64 guid, uint32 value)
+{
+    if(!guid)
+        return;
+    // keep the table at most half full, probe sequences stay short then
+    if((_count + 1) * 2 > _table.size())
+        _Grow();
+    uint32 i = _Slot(guid);
+    while(_table[i].guid && _table[i].guid != guid)
+        i = (i + 1) & _mask;
+    if(!_table[i].guid)
+    {
+        _table[i].guid = guid;
+        _count++;
+    }
+    _table[i].value = value;
+}
+
+bool GuidIndex::Erase(uint64 guid)
+{
+    if(!guid)
+        return false;
+    uint32 i = _Slot(guid);
+    while(_table[i].guid != guid)
+    {
+        if(!_table[i].guid)
+            return false;
+        i = (i + 1) & _mask;
+    }
+
+    // move following entries of the same probe sequence back into the gap, so no tombstones are needed
+    uint32 gap = i;
+    for(uint32 j = (i + 1) & _mask; _table[j].guid; j = (j + 1) & _mask)
+    {
+        uint32 home = _Slot(_table[j].guid);
+        // the entry at j may fill the gap only if its home slot is not between gap and j (cyclic)
+        bool between = gap <= j ? (gap < home && home <= j) : (gap < home || home <= j);
+        if(!between)
+        {
+            _table[gap] = _table[j];
+            gap = j;
+        }
+    }
+    _table[gap].guid = 0;
+    _count--;
+    return true;
+}
+
+void GuidIndex::Clear(void)
+{
+    for(uint32 i = 0; i < _table.size(); i++)
+        _table[i].guid = 0;
+    _count = 0;
+}
+
+void GuidIndex::_Grow(void)
+{
+    std::vector<Entry> old;
+    old.swap(_table);
+    Entry e = { 0, 0 };
+    _table.assign(old.size() * 2, e);
+    _mask = _table.size() - 1;
+    _count = 0;
+    for(uint32 i = 0; i < old.size(); i++)
+        if(old[i].guid)
+            Set(old[i].guid, old[i].value);
+}
@@ -0,0 +1,41 @@
+#ifndef _GUIDINDEX_H
+#define _GUIDINDEX_H
+
+#include "common.h"
+#include <vector>
+
+// open addressing hash table guid -> uint32, linear probing.
+// guid 0 is used to mark free slots and can not be stored.
+class GuidIndex
+{
+public:
+    GuidIndex(uint32 size = 1024);
+    bool Find(uint64 guid, uint32& value) const;
+    void Set(uint64 guid, uint32 value); // inserts or overwrites
+    bool Erase(uint64 guid);
+    void Clear(void);
+    inline uint32 Size(void) const { return _count; }
+
+private:
+    struct Entry
+    {
+        uint64 guid;
+        uint32 value;
+    };
+
+    // guids of one type differ only in the low bits, mix them a bit so that they don't end up in clusters
+    inline uint32 _Slot(uint64 guid) const
+    {
+        guid ^= guid >> 33;
+        guid *= 0xFF51AFD7ED558CCDULL;
+        guid ^= guid >> 33;
+        return uint32(guid) & _mask;
+    }
+    void _Grow(void);
+
+    std::vector<Entry> _table;
+    uint32 _mask;
+    uint32 _count;
+};
+
+#endif
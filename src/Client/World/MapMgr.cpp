@@ -1,8 +1,11 @@
 #include "common.h"
+#include "zthread/Guard.h"
 #include "log.h"
 #include "MemoryDataHolder.h"
 #include "MapTile.h"
+#include "HeightMapFile.h"
 #include "MapMgr.h"
+#include "PathFinder.h"
 
 
 char* MapMgr::MapID2Name(uint32 mid)
@@ -17,12 +20,62 @@ char* MapMgr::MapID2Name(uint32 mid)
 }
 
 
+// how far ahead of the current position (in the direction we are moving) tiles are prefetched
+#define PREFETCH_DISTANCE (TILESIZE / 2.0f)
+// tiles further away than this (in grid units) from the current tile are unloaded
+#define KEEP_TILES_RADIUS 2
+
+struct PendingTile
+{
+    uint32 mapid;
+    uint32 pos;
+};
+
+// finished tiles are handed over from the loader threads to the MapMgr through this.
+// it is reference counted, because the MapMgr may be deleted while loads are still in progress.
+struct MapTileLoadQueue
+{
+    struct Result
+    {
+        uint32 mapid;
+        uint32 pos;
+        MapTile *tile; // NULL if loading failed
+    };
+    ZThread::FastMutex mutex;
+    uint32 refs; // 1 for the owning MapMgr + 1 per pending file
+    bool orphaned; // MapMgr is gone, throw away everything that is loaded from now on
+    std::map<std::string,PendingTile> pending; // filename -> tile
+    std::deque<Result> done;
+};
+
+static void ReleaseLoadQueue(MapTileLoadQueue *q)
+{
+    bool last;
+    {
+        ZThread::Guard<ZThread::FastMutex> g(q->mutex);
+        last = !--q->refs;
+    }
+    if(last)
+    {
+        for(std::deque<MapTileLoadQueue::Result>::iterator it = q->done.begin(); it != q->done.end(); it++)
+            delete it->tile;
+        delete q;
+    }
+}
+
 MapMgr::MapMgr(PseuInstance* _inst)
 {
     DEBUG(logdebug("Creating MapMgr with TILESIZE=%.3f CHUNKSIZE=%.3f UNITSIZE=%.3f",TILESIZE,CHUNKSIZE,UNITSIZE));
     _tiles = new MapTileStorage();
+    _heightmap = NULL;
+    _pathfinder = new PathFinder(this);
+    _queue = new MapTileLoadQueue();
+    _queue->refs = 1;
+    _queue->orphaned = false;
     _gridx = _gridy = _mapid = (-1);
     _mapsLoaded = false;
+    _hasLastPos = false;
+    _loadStartMS = 0;
     _instance = _inst;
     mapdb=_instance->dbmgr.GetDB("map");
 }
@@ -30,11 +83,34 @@ MapMgr::MapMgr(PseuInstance* _inst)
 MapMgr::~MapMgr()
 {
     Flush();
+    {
+        ZThread::Guard<ZThread::FastMutex> g(_queue->mutex);
+        _queue->orphaned = true;
+    }
+    ReleaseLoadQueue(_queue);
+    delete _heightmap;
+    delete _pathfinder;
     delete _tiles;
 }
 
 void MapMgr::Update(float x, float y, uint32 m)
 {
+    if(m != _mapid && _OpenHeightMap(m))
+    {
+        Flush();
+        _mapid = m;
+        _gridx = _gridy = (-1);
+    }
+    if(_heightmap)
+    {
+        // nothing to load, all heights are in the mapped file
+        GridCoordPair gcoords = GetTransformGridCoordPair(x,y);
+        _gridx = gcoords.x;
+        _gridy = gcoords.y;
+        _mapsLoaded = true;
+        return;
+    }
+
     if(m != _mapid)
     {
         Flush(); // we teleported to a new map, drop all loaded maps
@@ -63,20 +139,60 @@ void MapMgr::Update(float x, float y, uint32 m)
         _mapid = m;
         _gridx = _gridy = (-1); // must load tiles now
     }
+    _ImportLoadedTiles();
     GridCoordPair gcoords = GetTransformGridCoordPair(x,y);
     if(gcoords.x != _gridx || gcoords.y != _gridy)
     {
+        _mapsLoaded = false; // before changing the grid coords, the GUI checks both from another thread
         _gridx = gcoords.x;
         _gridy = gcoords.y;
         _LoadNearTiles(_gridx,_gridy,m);
         _UnloadOldTiles();
     }
-    _mapsLoaded = true; // at this point, everything should be loaded (if maps existing)
+    _PrefetchTiles(x,y,m);
+    _ImportLoadedTiles(); // in single-threaded mode the tiles are already there
+    bool wasLoaded = _mapsLoaded;
+    _mapsLoaded = _NearTilesDone();
+    if(_mapsLoaded && !wasLoaded)
+        logdetail("MAPMGR: Tiles near (%u, %u) ready after %u ms, %u tiles loaded, memory usage %u KB",
+            _gridx, _gridy, getMSTime() - _loadStartMS, GetLoadedMapsCount(), GetProcessMemoryUsage());
+}
+
+// without GUI only heights are needed. use the compact heightmap made by stuffextract if there is one,
+// false if the ADT files have to be used
+bool MapMgr::_OpenHeightMap(uint32 m)
+{
+    delete _heightmap;
+    _heightmap = NULL;
+    PseuInstanceConf *conf = _instance->GetConf();
+    if(!conf->useHeightMaps || conf->enablegui)
+        return false;
+
+    char buf[255];
+    MemoryDataHolder::MakeHeightMapFilename(buf,m);
+    uint32 ms = getMSTime();
+    int32 mem = GetProcessMemoryUsage();
+    HeightMapFile *hmap = new HeightMapFile();
+    if(!hmap->Open(buf))
+    {
+        delete hmap;
+        logdebug("MAPMGR: No heightmap '%s', using ADT files",buf);
+        return false;
+    }
+    _heightmap = hmap;
+    logdetail("MAPMGR: Mapped heightmap '%s' (%u tiles, %s) in %u ms, memory usage %+d KB",
+        buf, hmap->GetTileCount(), FilesizeFormat(hmap->GetSize()).c_str(), getMSTime() - ms,
+        int32(GetProcessMemoryUsage()) - mem);
+    return true;
 }
 
 void MapMgr::Flush(void)
 {
     _mapsLoaded = false;
+    _hasLastPos = false;
+    _requested.reset(); // still pending loads are dropped once they arrive
+    _failed.reset();
+    _pathfinder->Clear();
     for(uint32 i = 0; i < 4096; i++)
         _tiles->UnloadMapTile(i);
     logdebug("MAPMGR: Flushed all maps");
@@ -84,24 +200,61 @@ void MapMgr::Flush(void)
 
 void MapMgr::_LoadNearTiles(uint32 gx, uint32 gy, uint32 m)
 {
-    _mapsLoaded = false;
     logdebug("MAPMGR: Loading near tiles for (%u, %u) map %u",gx,gy,m);
+    _loadStartMS = getMSTime();
+    _LoadTile(gx,gy,m); // the tile we are standing on is needed first
     for(uint32 v = gy-1; v <= gy+1; v++)
     {
         for(uint32 h = gx-1; h <= gx+1; h++)
         {
-            logdebug("MAPMGR: Loading tile x %u y %u on map %u",h,v,m);
             _LoadTile(h,v,m);
         }
     }
 }
 
+// look a bit ahead in the direction we are moving. as soon as that point is on another tile,
+// request the 3x3 tiles around it, so that they are ready when we actually cross the border.
+void MapMgr::_PrefetchTiles(float x, float y, uint32 m)
+{
+    float dx = x - _lastx;
+    float dy = y - _lasty;
+    bool moved = _hasLastPos;
+    _lastx = x;
+    _lasty = y;
+    _hasLastPos = true;
+    if(!moved)
+        return;
+
+    float len = sqrt(dx*dx + dy*dy);
+    if(len < 0.01f || len > TILESIZE) // standing still or teleported
+        return;
+
+    float f = PREFETCH_DISTANCE / len;
+    GridCoordPair ahead = GetTransformGridCoordPair(x + dx * f, y + dy * f);
+    if(ahead.x == _gridx && ahead.y == _gridy)
+        return;
+
+    for(uint32 v = ahead.y-1; v <= ahead.y+1; v++)
+    {
+        for(uint32 h = ahead.x-1; h <= ahead.x+1; h++)
+        {
+            if(abs(int32(h) - int32(_gridx)) <= KEEP_TILES_RADIUS && abs(int32(v) - int32(_gridy)) <= KEEP_TILES_RADIUS)
+                _LoadTile(h,v,m);
+        }
+    }
+}
+
+// request a tile from the MemoryDataHolder thread pool. the ADT is parsed in the loader thread,
+// the finished MapTile is picked up in _ImportLoadedTiles().
 void MapMgr::_LoadTile(uint32 gx, uint32 gy, uint32 m)
 {
+    if(gx >= 64 || gy >= 64)
+        return;
+    uint32 pos = gy*64 + gx;
+    if(_tiles->GetTile(pos) || _requested[pos] || _failed[pos])
+        return;
 
-    _mapsLoaded = false;
     std::string mapname = MapID2Name(m);
-    logdebug("Mapname: %s",mapname.c_str());
     char buf[255];
     MemoryDataHolder::MakeMapFilename(buf,m,mapname,gx,gy);
     if(!_tiles->TileExists(gx,gy))
@@ -113,43 +266,134 @@ void MapMgr::_LoadTile(uint32 gx, uint32 gy, uint32 m)
         }
         else
         {
-            logerror("MAPMGR: Not loading MapTile (%u, %u) map %u, no entry in WDT tile map",gx,gy,m);
+            logdebug("MAPMGR: Not loading MapTile (%u, %u) map %u, no entry in WDT tile map",gx,gy,m);
+            _failed[pos] = true;
             return;
         }
     }
 
-    if( !_tiles->GetTile(gx,gy) )
+    logdebug("MAPMGR: Requesting tile x %u y %u on map %u",gx,gy,m);
+    _requested[pos] = true;
     {
-        MemoryDataHolder::MemoryDataResult mdr = MemoryDataHolder::GetFileBasic(buf);
+        ZThread::Guard<ZThread::FastMutex> g(_queue->mutex);
+        PendingTile& pt = _queue->pending[buf];
+        pt.mapid = m;
+        pt.pos = pos;
+        _queue->refs++;
+    }
+    // must not hold the queue mutex here, the callback is run directly if the file is already in memory or threading is disabled.
+    // the reference keeps the file in memory until the callback has read it, even if the cache has no room; it drops it.
+    MemoryDataHolder::GetFile(buf, true, &MapMgr::TileLoadedCallback, _queue, NULL, true);
+}
+
+void MapMgr::TileLoadedCallback(void *ptr, std::string filename, uint32 flags)
+{
+    MapTileLoadQueue *q = (MapTileLoadQueue*)ptr;
+    PendingTile pt;
+    bool wanted;
+    {
+        ZThread::Guard<ZThread::FastMutex> g(q->mutex);
+        std::map<std::string,PendingTile>::iterator it = q->pending.find(filename);
+        wanted = it != q->pending.end() && !q->orphaned;
+        if(it != q->pending.end())
+        {
+            pt = it->second;
+            q->pending.erase(it);
+        }
+    }
+
+    MapTile *tile = NULL;
+    bool referenced = true; // by _LoadTile(), also if the load failed
+    if(wanted && (flags & MemoryDataHolder::MDH_FILE_OK))
+    {
+        // still referenced by _LoadTile(), so this only looks the data up
+        MemoryDataHolder::MemoryDataResult mdr = MemoryDataHolder::GetFile(filename, false, NULL, NULL, NULL, false);
         if(mdr.flags & MemoryDataHolder::MDH_FILE_OK && mdr.data.size)
         {
             ByteBuffer bb(mdr.data.size);
             bb.append(mdr.data.ptr,mdr.data.size);
-            MemoryDataHolder::Delete(buf);
+            MemoryDataHolder::Delete(filename);
+            referenced = false;
             ADTFile *adt = new ADTFile();
             if(adt->LoadMem(bb))
             {
-              logdebug("MAPMGR: Loaded ADT '%s'",buf);
-              MapTile *tile = new MapTile();
-              tile->ImportFromADT(adt);
-              _tiles->SetTile(tile,gx,gy);
+                tile = new MapTile();
+                tile->ImportFromADT(adt);
+                logdebug("MAPMGR: Loaded ADT '%s'",filename.c_str());
             }
             else
             {
-              logerror("MAPMGR: Error loading ADT '%s'",buf);//This should not happen!!
+                logerror("MAPMGR: Error loading ADT '%s'",filename.c_str());//This should not happen!!
             }
             delete adt;
-            logdebug("MAPMGR: Imported MapTile (%u, %u) for map %u",gx,gy,m);
+        }
+    }
+    if(referenced)
+        MemoryDataHolder::Delete(filename);
+    if(wanted && !tile)
+        logerror("MAPMGR: Loading ADT '%s' failed!",filename.c_str());
+
+    if(wanted)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(q->mutex);
+        if(q->orphaned) // MapMgr was deleted while we were parsing
+        {
+            delete tile;
         }
         else
         {
-            logerror("MAPMGR: Loading ADT '%s' failed!",buf);
+            MapTileLoadQueue::Result r;
+            r.mapid = pt.mapid;
+            r.pos = pt.pos;
+            r.tile = tile;
+            q->done.push_back(r);
         }
     }
-    else
+    ReleaseLoadQueue(q);
+}
+
+void MapMgr::_ImportLoadedTiles(void)
+{
+    std::deque<MapTileLoadQueue::Result> done;
     {
-        logdebug("MAPMGR: No need to load MapTile (%u, %u) map %u",gx,gy,m);
+        ZThread::Guard<ZThread::FastMutex> g(_queue->mutex);
+        if(_queue->done.empty())
+            return;
+        done.swap(_queue->done);
     }
+    for(std::deque<MapTileLoadQueue::Result>::iterator it = done.begin(); it != done.end(); it++)
+    {
+        // drop tiles nobody waits for anymore (map changed or flushed meanwhile)
+        if(it->mapid != _mapid || !_requested[it->pos] || _tiles->GetTile(it->pos))
+        {
+            delete it->tile;
+            continue;
+        }
+        _requested[it->pos] = false;
+        if(!it->tile)
+        {
+            _failed[it->pos] = true;
+            continue;
+        }
+        uint32 gx = it->pos % 64, gy = it->pos / 64;
+        if(abs(int32(gx) - int32(_gridx)) > KEEP_TILES_RADIUS || abs(int32(gy) - int32(_gridy)) > KEEP_TILES_RADIUS)
+        {
+            logdebug("MAPMGR: Dropping MapTile (%u, %u) map %u, already out of range",gx,gy,_mapid);
+            delete it->tile;
+            continue;
+        }
+        _tiles->SetTile(it->tile,it->pos);
+        logdebug("MAPMGR: Imported MapTile (%u, %u) for map %u",gx,gy,_mapid);
+    }
+}
+
+bool MapMgr::_NearTilesDone(void)
+{
+    for(uint32 v = _gridy-1; v <= _gridy+1; v++)
+        for(uint32 h = _gridx-1; h <= _gridx+1; h++)
+            if(h < 64 && v < 64 && _requested[v*64 + h])
+                return false;
+    return true;
 }
 
 void MapMgr::_UnloadOldTiles(void)
@@ -158,7 +402,7 @@ void MapMgr::_UnloadOldTiles(void)
     {
         for(int32 gx=0; gx<64; gx++)
         {
-            if( (int32(_gridx) < gx-1 || int32(_gridx) > gx+1) && (int32(_gridy) < gy-1 || int32(_gridy) > gy+1) )
+            if( abs(int32(_gridx) - gx) > KEEP_TILES_RADIUS || abs(int32(_gridy) - gy) > KEEP_TILES_RADIUS )
             {
                 if(_tiles->GetTile(gx,gy))
                 {
@@ -170,15 +414,12 @@ void MapMgr::_UnloadOldTiles(void)
     }
 }
 
-// Using forceLoad is VERY ineffective here, because the tile is removed again after the next Update() call!
+// forceLoad only requests the tile, it is available after one of the next Update() calls (if it is near enough to be kept)
 MapTile *MapMgr::GetTile(uint32 xg, uint32 yg, bool forceLoad)
 {
     MapTile *tile = _tiles->GetTile(xg,yg);
     if(!tile && forceLoad)
-    {
         _LoadTile(xg,yg,_mapid);
-        tile = _tiles->GetTile(xg,yg);
-    }
     return tile;
 }
 
@@ -217,6 +458,9 @@ uint32 MapMgr::GetLoadedMapsCount(void)
 
 float MapMgr::GetZ(float x, float y)
 {
+    if(_heightmap)
+        return _heightmap->GetZ(x,y);
+
     GridCoordPair gcoords = GetTransformGridCoordPair(x,y);
     MapTile *tile = _tiles->GetTile(gcoords.x,gcoords.y);
     if(tile)
@@ -224,10 +468,52 @@ float MapMgr::GetZ(float x, float y)
         return tile->GetZ(x,y);
     }
 
-    logerror("MapMgr::GetZ() called for not loaded MapTile (%u, %u) for (%f, %f)",gcoords.x,gcoords.y,x,y);
+    // never wait for the tile here, it is most likely still being loaded
+    logdebug("MapMgr::GetZ() called for not loaded MapTile (%u, %u) for (%f, %f)",gcoords.x,gcoords.y,x,y);
     return INVALID_HEIGHT;
 }
 
+void MapMgr::GetZ(const float *xs, const float *ys, float *out, uint32 n)
+{
+    if(_heightmap)
+    {
+        for(uint32 i = 0; i < n; i++)
+            out[i] = _heightmap->GetZ(xs[i],ys[i]);
+        return;
+    }
+    // hand over runs of positions on the same tile, mostly that's all of them
+    uint32 i = 0;
+    while(i < n)
+    {
+        GridCoordPair gcoords = GetTransformGridCoordPair(xs[i],ys[i]);
+        uint32 j = i + 1;
+        while(j < n)
+        {
+            GridCoordPair next = GetTransformGridCoordPair(xs[j],ys[j]);
+            if(next.x != gcoords.x || next.y != gcoords.y)
+                break;
+            j++;
+        }
+        if(MapTile *tile = _tiles->GetTile(gcoords.x,gcoords.y))
+            tile->GetZ(xs + i, ys + i, out + i, j - i);
+        else
+            for(uint32 k = i; k < j; k++)
+                out[k] = INVALID_HEIGHT;
+        i = j;
+    }
+}
+
+bool MapMgr::GetTileHeights(uint32 gx, uint32 gy, float *grid)
+{
+    if(_heightmap)
+        return _heightmap->GetTileHeights(gx,gy,grid);
+    MapTile *tile = _tiles->GetTile(gx,gy);
+    if(!tile)
+        return false;
+    memcpy(grid, tile->GetHeightGrid(), sizeof(float) * 129 * 129);
+    return true;
+}
+
 std::string MapMgr::GetLoadedTilesString(void)
 {
     std::stringstream s;
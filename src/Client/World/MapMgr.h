@@ -1,11 +1,15 @@
 #ifndef MAPMGR_H
 #define MAPMGR_H
 
+#include <bitset>
 #include "PseuWoW.h"
 #include "SCPDatabase.h"
 
 class MapTileStorage;
 class MapTile;
+class HeightMapFile;
+class PathFinder;
+struct MapTileLoadQueue;
 
 struct GridCoordPair
 {
@@ -23,28 +27,45 @@ public:
     void Update(float,float,uint32);
     void Flush(void);
     float GetZ(float,float);
+    void GetZ(const float *xs, const float *ys, float *out, uint32 n); // INVALID_HEIGHT for positions on tiles not loaded
     static uint32 GetGridCoord(float f);
     static GridCoordPair GetTransformGridCoordPair(float x, float y);
     MapTile *GetTile(uint32 xg, uint32 yg, bool forceLoad = false);
+    static void TileLoadedCallback(void *ptr, std::string filename, uint32 flags); // runs in a MemoryDataHolder loader thread
     MapTile *GetCurrentTile(void);
     MapTile *GetNearTile(int32, int32);
     char* MapID2Name(uint32);
-    inline bool Loaded(void) { return _mapsLoaded; }
+    inline bool Loaded(void) { return _mapsLoaded; } // true if the 3x3 tiles around us are done loading
     uint32 GetLoadedMapsCount(void);
     std::string GetLoadedTilesString(void);
     inline uint32 GetGridX(void) { return _gridx; }
     inline uint32 GetGridY(void) { return _gridy; }
+    inline bool UsesHeightMap(void) { return _heightmap != NULL; }
+    bool GetTileHeights(uint32 gx, uint32 gy, float *grid); // 129x129 outer vertex heights of a loaded tile
+    inline PathFinder *GetPathFinder(void) { return _pathfinder; }
 
 private:
     PseuInstance *_instance;
     SCPDatabase* mapdb;
     MapTileStorage *_tiles;
+    HeightMapFile *_heightmap; // if not NULL, heights come from here and no tiles are loaded
+    PathFinder *_pathfinder;
+    MapTileLoadQueue *_queue; // shared with the loader threads, outlives us if loads are still pending
+    bool _OpenHeightMap(uint32);
     void _LoadTile(uint32,uint32,uint32);
     void _LoadNearTiles(uint32,uint32,uint32);
+    void _PrefetchTiles(float,float,uint32);
+    void _ImportLoadedTiles(void);
     void _UnloadOldTiles(void);
+    bool _NearTilesDone(void);
     uint32 _mapid;
     uint32 _gridx,_gridy;
     bool _mapsLoaded;
+    std::bitset<4096> _requested; // tiles of the current map whose load is in progress
+    std::bitset<4096> _failed; // tiles that could not be loaded, not requested again until the map changes
+    float _lastx,_lasty; // position at the previous Update(), used to guess where we are heading
+    bool _hasLastPos;
+    uint32 _loadStartMS; // when the current near tiles were requested, for the log
 };
 
 #endif
@@ -1,6 +1,8 @@
 #include "PseuWoW.h"
 #include "WorldSession.h"
 #include "World.h"
+#include "MapMgr.h"
+#include "MapTile.h"
 #include "MovementMgr.h"
 #include "Player.h"
 #include "MovementInfo.h"
@@ -12,6 +14,7 @@ MovementMgr::MovementMgr()
     _optime = 0;
     _updatetime = 0;
     _moved = false;
+    _pathpos = 0;
 }
 
 MovementMgr::~MovementMgr()
@@ -64,11 +67,14 @@ void MovementMgr::Update(bool sendDirect)
     uint32 timediff = curtime - _updatetime;
     _updatetime = curtime;
 
-    WorldPosition pos = _mychar->GetPosition();
     float turnspeed = _mychar->GetSpeed(MOVE_TURN) / 1000.0f * timediff;
     float runspeed = _mychar->GetSpeed(MOVE_RUN) / 1000.0f * timediff;
     _movespeed = runspeed; // or use walkspeed, depending on setting. for now use only runspeed
     // TODO: calc other speeds as soon as implemented
+
+    if(!sendDirect && IsMovingTo())
+        _FollowPath(_movespeed);
+    WorldPosition pos = _mychar->GetPosition();
 /*
     if(_movemode == MOVEMODE_MANUAL)
     {
@@ -150,6 +156,107 @@ void MovementMgr::Update(bool sendDirect)
     // TODO: apply gravity, handle falling, swimming, etc.
 }
 
+bool MovementMgr::MoveTo(float x, float y, float z)
+{
+    World *world = _instance->GetWSession()->GetWorld();
+    MapMgr *mmgr = world ? world->GetMapMgr() : NULL;
+    WorldPosition pos = _mychar->GetPosition();
+    _path.clear();
+    _pathpos = 0;
+    if(mmgr)
+    {
+        uint32 ms = getMSTime();
+        PathFinder *pf = mmgr->GetPathFinder();
+        if(!pf->FindPath(pos.x, pos.y, x, y, _path))
+        {
+            logdebug("MovementMgr: No path from (%.1f, %.1f) to (%.1f, %.1f) found", pos.x, pos.y, x, y);
+            return false;
+        }
+        logdebug("MovementMgr: Path to (%.1f, %.1f) with %u waypoints found in %u ms (%u cells)",
+            x, y, _path.size(), getMSTime() - ms, pf->GetLastExpanded());
+        for(uint32 i = 0; i < _path.size(); i++)
+            if(_path[i].z == INVALID_HEIGHT)
+                _path[i].z = z;
+    }
+    else // no maps, nothing known about the terrain
+    {
+        _path.push_back(PathNode(x, y, z));
+    }
+
+    _movemode = MOVEMODE_AUTO;
+    pos.o = atan2(_path[0].y - pos.y, _path[0].x - pos.x);
+    if(pos.o < 0)
+        pos.o += float(2 * M_PI);
+    _mychar->SetPosition(pos);
+    if(_moveFlags & MOVEMENTFLAG_FORWARD)
+        MoveSetFacing();
+    else
+        MoveStartForward();
+    return true;
+}
+
+// moves the character dist yards along the path of MoveTo(), turning at the waypoints
+void MovementMgr::_FollowPath(float dist)
+{
+    if(_movemode != MOVEMODE_AUTO) // the user took over control
+    {
+        _path.clear();
+        _pathpos = 0;
+        return;
+    }
+    WorldPosition pos = _mychar->GetPosition();
+    float oldo = pos.o;
+    while(_pathpos < _path.size())
+    {
+        PathNode& n = _path[_pathpos];
+        float dx = n.x - pos.x, dy = n.y - pos.y;
+        float d = sqrt(dx*dx + dy*dy);
+        if(d > dist)
+        {
+            pos.x += dx / d * dist;
+            pos.y += dy / d * dist;
+            pos.o = atan2(dy, dx);
+            break;
+        }
+        pos.x = n.x;
+        pos.y = n.y;
+        pos.z = n.z;
+        dist -= d;
+        _pathpos++;
+    }
+    if(pos.o < 0)
+        pos.o += float(2 * M_PI);
+    if(_pathpos < _path.size())
+    {
+        World *world = _instance->GetWSession()->GetWorld();
+        if(world && world->GetMapMgr())
+        {
+            float z = world->GetPosZ(pos.x, pos.y);
+            if(z != INVALID_HEIGHT)
+                pos.z = z;
+        }
+    }
+    _mychar->SetPosition(pos);
+
+    if(_pathpos >= _path.size())
+    {
+        _path.clear();
+        _pathpos = 0;
+        MoveStop();
+    }
+    else
+    {
+        // turning across 0 gives a difference near 2*pi, that is not a turn
+        float turn = pos.o - oldo;
+        if(turn > M_PI)
+            turn -= float(2 * M_PI);
+        else if(turn < -M_PI)
+            turn += float(2 * M_PI);
+        if(fabs(turn) > 0.01f) // reached a waypoint and turned
+            MoveSetFacing();
+    }
+}
+
 // stops
 void MovementMgr::MoveStop(void)
 {
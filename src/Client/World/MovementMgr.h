@@ -1,8 +1,10 @@
 #ifndef MOVEMENTMGR_H
 #define MOVEMENTMGR_H
 
+#include <vector>
 #include "common.h"
 #include "MovementInfo.h"
+#include "PathFinder.h"
 
 #define MOVE_HEARTBEAT_DELAY 500
 #define MOVE_TURN_UPDATE_DIFF 0.15f // not sure about original/real value, but this seems good
@@ -50,6 +52,8 @@ public:
     void MoveFallLand(void);
     void MoveSetFacing(void);
     void MoveJump(void);
+    bool MoveTo(float x, float y, float z); // walks there on its own (MOVEMODE_AUTO); around steep terrain if maps are used
+    inline bool IsMovingTo(void) { return _pathpos < _path.size(); }
     //bool IsJumping(void);
     inline bool GetMoveFlags(void) { return _moveFlags; }
     inline bool HasMoveFlag(uint32 flag) { return _moveFlags & flag; }
@@ -63,6 +67,7 @@ public:
 
 private:
     void _BuildPacket(uint16);
+    void _FollowPath(float dist);
     PseuInstance *_instance;
     MyCharacter *_mychar;
     uint32 _moveFlags; // server relevant flags (move forward/backward/swim/fly/jump/etc)
@@ -74,6 +79,8 @@ private:
     uint32 _falltime;
     UnitMoveType _movetype; // index used for speed selection
     bool _moved;
+    std::vector<PathNode> _path; // waypoints of MoveTo()
+    uint32 _pathpos; // waypoint we are walking to
 
 
 };
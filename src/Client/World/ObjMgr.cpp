@@ -2,10 +2,13 @@
 #include "log.h"
 #include "PseuWoW.h"
 #include "ObjMgr.h"
+#include "CacheHandler.h"
 #include "GUI/PseuGUI.h"
 
 ObjMgr::ObjMgr()
 {
+    _instance = NULL;
+    _cache = NULL;
     DEBUG(logdebug("DEBUG: ObjMgr created"));
 }
 
@@ -34,14 +37,24 @@ void ObjMgr::RemoveAll(void)
     {
         delete i->second;
     }
-    while(_obj.size())
+    for(uint32 t = 0; t < TYPEID_MAX; t++)
     {
-        Remove(_obj.begin()->first, true);
+        while(_pools[t].objs.size())
+        {
+            Object *o = _pools[t].objs.back();
+            if(GetObj(o->GetGUID(), true) == o)
+                Remove(o->GetGUID(), true);
+            else // not in the index, can only happen with guid 0
+            {
+                _RemoveFromPool(o);
+                delete o;
+            }
+        }
     }
-    if(PseuGUI *gui = _instance->GetGUI())
+    if(PseuGUI *gui = _instance ? _instance->GetGUI() : NULL)
     {
-        // necessary that the pending-to-delete GUIDs just stored by deleting the objects above will be cleared
-        // so that newly added DrawObjects with uncleared pending-to-delete GUIDs will not get deleted again immediately.
+        // the GUI thread deletes all DrawObjects queued up to here, including the deletes just queued above,
+        // so that DrawObjects added later with the same GUIDs stay.
         gui->NotifyAllObjectsDeletion();
     }
 }
@@ -59,18 +72,53 @@ void ObjMgr::Remove(uint64 guid, bool del)
             gui->NotifyObjectDeletion(guid); // we have a gui, which must delete linked DrawObject
         if(del)
         {
-            _obj.erase(guid); // now delete the obj from the mgr
+            _RemoveFromPool(o); // now delete the obj from the mgr
             delete o; // and delete the obj itself
         }
     }
     else
     {
-        _obj.erase(guid); // we can safely erase an object that does not exist
-                          // - if we reach this point there was a bug anyway
+        // if we reach this point there was a bug anyway
         logcustom(2,LRED,"ObjMgr::Remove("I64FMT") - not existing",guid);
     }
 }
 
+// swaps the last object of the pool into the gap, so that pools stay dense
+void ObjMgr::_RemoveFromPool(Object *o)
+{
+    uint8 tid = o->GetTypeId();
+    ObjectPool& pool = _pools[tid];
+    uint32 slot, idx;
+    if(_index.Find(o->GetGUID(), slot) && (slot >> 24) == tid && pool.objs[slot & 0xFFFFFF] == o)
+    {
+        idx = slot & 0xFFFFFF;
+        _index.Erase(o->GetGUID());
+    }
+    else
+    {
+        for(idx = 0; idx < pool.objs.size() && pool.objs[idx] != o; idx++);
+        if(idx == pool.objs.size())
+            return;
+    }
+
+    uint32 last = pool.objs.size() - 1;
+    if(idx != last)
+    {
+        Object *moved = pool.objs[last];
+        pool.objs[idx] = moved;
+        pool.pos[idx] = pool.pos[last];
+        if(moved->IsWorldObject())
+            ((WorldObject*)moved)->_posindex = idx;
+        uint32 mslot;
+        if(_index.Find(moved->GetGUID(), mslot) && mslot == ((uint32(tid) << 24) | last))
+            _index.Set(moved->GetGUID(), (uint32(tid) << 24) | idx);
+    }
+    pool.objs.pop_back();
+    pool.pos.pop_back();
+    if(o->IsWorldObject())
+        ((WorldObject*)o)->_posmirror = NULL;
+}
+
 // -- Object part --
 
 void ObjMgr::Add(Object *o)
@@ -78,11 +126,27 @@ void ObjMgr::Add(Object *o)
     Object *ox = GetObj(o->GetGUID(),true); // if an object already exists in the mgr, store old ptr...
     if(o == ox)
         return; // if both pointers are the same, do nothing (already added and happy)
-    _obj[o->GetGUID()] = o; // ...assign new one...
-    if(ox) // and if != NULL, delete the old object (completely, from memory)
+    if(ox) // ...and if != NULL, delete the old object (completely, from memory)...
+    {
+        _RemoveFromPool(ox);
+        delete ox;
+    }
+
+    // ...then assign the new one
+    uint8 tid = o->GetTypeId();
+    ObjectPool& pool = _pools[tid];
+    uint32 idx = pool.objs.size();
+    pool.objs.push_back(o);
+    if(o->IsWorldObject())
     {
-        delete ox; // only delete pointer, everything else is already reserved for the just added new obj
+        WorldObject *wo = (WorldObject*)o;
+        pool.pos.push_back(wo->_wpos);
+        wo->_posmirror = &pool.pos;
+        wo->_posindex = idx;
     }
+    else
+        pool.pos.push_back(WorldPosition());
+    _index.Set(o->GetGUID(), (uint32(tid) << 24) | idx);
 
     if(PseuGUI *gui = _instance->GetGUI())
         gui->NotifyObjectCreation(o);
@@ -90,27 +154,27 @@ void ObjMgr::Add(Object *o)
 
 Object *ObjMgr::GetObj(uint64 guid, bool also_depleted)
 {
-    if(!guid)
+    uint32 slot;
+    if(!guid || !_index.Find(guid, slot))
         return NULL;
-    for(ObjectMap::iterator i = _obj.begin(); i!=_obj.end(); i++)
-        if(i->second->GetGUID() == guid)
-        {
-            if(i->second->_IsDepleted() && !also_depleted)
-                return NULL;
-            return i->second;
-        }
-    return NULL;
+    Object *o = _pools[slot >> 24].objs[slot & 0xFFFFFF];
+    if(o->_IsDepleted() && !also_depleted)
+        return NULL;
+    return o;
 }
 
-// iterate over all objects and assign a name to all matching the entry and typeid
+// iterate over all objects of that typeid and assign a name to all matching the entry
 uint32 ObjMgr::AssignNameToObj(uint32 entry, uint8 type, std::string name)
 {
     uint32 changed = 0;
-    for(ObjectMap::iterator it = _obj.begin(); it != _obj.end(); it++)
+    if(type >= TYPEID_MAX)
+        return 0;
+    std::vector<Object*>& objs = _pools[type].objs;
+    for(uint32 i = 0; i < objs.size(); i++)
     {
-        if(it->second->GetEntry() == entry && (it->second->GetTypeId() == type))
+        if(objs[i]->GetEntry() == entry)
         {
-            it->second->SetName(name);
+            objs[i]->SetName(name);
             changed++;
         }
     }
@@ -122,13 +186,64 @@ void ObjMgr::ReNotifyGUI(void)
     PseuGUI *gui = _instance->GetGUI();
     if(!gui)
         return;
-    for(ObjectMap::iterator it = _obj.begin(); it != _obj.end(); it++)
+    for(uint32 t = 0; t < TYPEID_MAX; t++)
+    {
+        for(uint32 i = 0; i < _pools[t].objs.size(); i++)
+        {
+            Object *o = _pools[t].objs[i];
+            if(o->_IsDepleted())
+                continue;
+            gui->NotifyObjectCreation(o);
+        }
+    }
+}
+
+uint32 ObjMgr::GetObjectsInRange(float x, float y, float z, float range, uint32 typemask, std::vector<WorldObject*>& result)
+{
+    float range2 = range * range;
+    uint32 found = 0;
+    for(uint32 t = 0; t < TYPEID_MAX; t++)
     {
-        Object *o = it->second;
-        if(o->_IsDepleted())
+        ObjectPool& pool = _pools[t];
+        if(!(typemask & (1 << t)) || pool.objs.empty() || !pool.objs[0]->IsWorldObject())
             continue;
-        gui->NotifyObjectCreation(o);
+        const WorldPosition *pos = &pool.pos[0];
+        for(uint32 i = 0; i < pool.pos.size(); i++)
+        {
+            float dx = pos[i].x - x, dy = pos[i].y - y, dz = pos[i].z - z;
+            if(dx*dx + dy*dy + dz*dz <= range2 && !pool.objs[i]->_IsDepleted())
+            {
+                result.push_back((WorldObject*)pool.objs[i]);
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+// maxrange <= 0 means no limit
+WorldObject *ObjMgr::GetNearestObject(float x, float y, float z, float maxrange, uint32 typemask, uint64 exclude)
+{
+    WorldObject *nearest = NULL;
+    float best = maxrange > 0 ? maxrange * maxrange : -1;
+    for(uint32 t = 0; t < TYPEID_MAX; t++)
+    {
+        ObjectPool& pool = _pools[t];
+        if(!(typemask & (1 << t)) || pool.objs.empty() || !pool.objs[0]->IsWorldObject())
+            continue;
+        const WorldPosition *pos = &pool.pos[0];
+        for(uint32 i = 0; i < pool.pos.size(); i++)
+        {
+            float dx = pos[i].x - x, dy = pos[i].y - y, dz = pos[i].z - z;
+            float d = dx*dx + dy*dy + dz*dz;
+            if((best < 0 || d < best) && !pool.objs[i]->_IsDepleted() && pool.objs[i]->GetGUID() != exclude)
+            {
+                best = d;
+                nearest = (WorldObject*)pool.objs[i];
+            }
+        }
     }
+    return nearest;
 }
 
 
@@ -145,7 +260,11 @@ ItemProto *ObjMgr::GetItemProto(uint32 entry)
     ItemProtoMap::iterator it = _iproto.find(entry);
     if(it != _iproto.end())
         return it->second;
-    return NULL;
+    // not used by this session so far, read it from the cache file if it is there
+    ItemProto *proto = _cache ? ItemProtoCache_Read(_cache->items, entry) : NULL;
+    if(proto)
+        Add(proto);
+    return proto;
 }
 
 void ObjMgr::AddNonexistentItem(uint32 id)
@@ -170,7 +289,10 @@ CreatureTemplate *ObjMgr::GetCreatureTemplate(uint32 entry)
     CreatureTemplateMap::iterator it = _creature_templ.find(entry);
     if(it != _creature_templ.end())
         return it->second;
-    return NULL;
+    CreatureTemplate *ct = _cache ? CreatureTemplateCache_Read(_cache->creatures, entry) : NULL;
+    if(ct)
+        Add(ct);
+    return ct;
 }
 
 void ObjMgr::AddNonexistentCreature(uint32 id)
@@ -195,7 +317,10 @@ GameobjectTemplate *ObjMgr::GetGOTemplate(uint32 entry)
     GOTemplateMap::iterator it = _go_templ.find(entry);
     if(it != _go_templ.end())
         return it->second;
-    return NULL;
+    GameobjectTemplate *go = _cache ? GOTemplateCache_Read(_cache->gameobjects, entry) : NULL;
+    if(go)
+        Add(go);
+    return go;
 }
 
 void ObjMgr::AddNonexistentGO(uint32 id)
@@ -6,13 +6,22 @@
 #include "Item.h"
 #include "Unit.h"
 #include "GameObject.h"
+#include "GuidIndex.h"
 
 typedef std::map<uint32,ItemProto*> ItemProtoMap;
 typedef std::map<uint32,CreatureTemplate*> CreatureTemplateMap;
 typedef std::map<uint32,GameobjectTemplate*> GOTemplateMap;
-typedef std::map<uint64,Object*> ObjectMap;
+
+// all objects of one type id. positions are copied into a dense array as well (only used for world objects),
+// so that range searches don't need to touch every object.
+struct ObjectPool
+{
+    std::vector<Object*> objs;
+    std::vector<WorldPosition> pos; // same index as objs
+};
 
 class PseuInstance;
+struct PrototypeCache;
 
 class ObjMgr
 {
@@ -20,6 +29,8 @@ public:
     ObjMgr();
     ~ObjMgr();
     void SetInstance(PseuInstance*);
+    // cache files prototypes are read from when they are not in this mgr yet, see PrototypeCache_Get()
+    inline void SetPrototypeCache(PrototypeCache *cache) { _cache = cache; }
     void RemoveAll(void); // TODO: this needs to be called on SMSG_LOGOUT_COMPLETE once implemented.
 
     // Item Prototype functions
@@ -63,21 +74,30 @@ public:
     void Add(Object*);
     void Remove(uint64 guid, bool del); // remove all objects with that guid (should be only 1 object in total anyway)
     Object *GetObj(uint64 guid, bool also_depleted = false);
-    inline uint32 GetObjectCount(void) { return _obj.size(); }
+    inline uint32 GetObjectCount(void) { return _index.Size(); }
     uint32 AssignNameToObj(uint32 entry, uint8 type, std::string name);
     void ReNotifyGUI(void);
 
+    // range searches over world objects, ignoring object sizes. typemask has bit (1 << TYPEID_xxx) set for each wanted type id,
+    // note that this means TYPE_UNIT selects creatures only, use (TYPE_UNIT | TYPE_PLAYER) to include players.
+    uint32 GetObjectsInRange(float x, float y, float z, float range, uint32 typemask, std::vector<WorldObject*>& result);
+    WorldObject *GetNearestObject(float x, float y, float z, float maxrange, uint32 typemask, uint64 exclude = 0);
+
 private:
     ItemProtoMap _iproto;
     CreatureTemplateMap _creature_templ;
     GOTemplateMap _go_templ;
 
-    ObjectMap _obj;
+    void _RemoveFromPool(Object*);
+
+    ObjectPool _pools[TYPEID_MAX];
+    GuidIndex _index; // guid -> (typeid << 24) | index in pool
     std::set<uint32> _noitem;
     std::set<uint32> _reqpnames;
     std::set<uint32> _nocreature;
     std::set<uint32> _nogameobj;
     PseuInstance *_instance;
+    PrototypeCache *_cache;
 
 };
 
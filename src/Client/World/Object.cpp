@@ -41,6 +41,8 @@ WorldObject::WorldObject()
 {
     _depleted = false;
     _m = 0;
+    _posmirror = NULL;
+    _posindex = 0;
 }
 
 void WorldObject::SetPosition(float x, float y, float z, float o)
@@ -49,6 +51,7 @@ void WorldObject::SetPosition(float x, float y, float z, float o)
     _wpos.y = y;
     _wpos.z = z;
     _wpos.o = o;
+    _SyncPosition();
 }
 
 void WorldObject::SetPosition(float x, float y, float z, float o, uint16 _map)
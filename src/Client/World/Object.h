@@ -96,6 +96,12 @@ public:
     {
         _uint32values[ offset ] = value;
     }
+    // copies count raw values starting at offset, caller has to make sure offset+count <= GetValuesCount().
+    // values are taken bytewise, they may be unaligned
+    inline void SetUInt32Values( uint16 offset, const uint8 *values, uint16 count )
+    {
+        memcpy(&_uint32values[ offset ], values, count * sizeof(uint32));
+    }
     inline void SetUInt64Value( UpdateFieldName index, uint64 value )
     {
         *((uint64*)&(_uint32values[ Object::updatefields[index].offset ])) = value;
@@ -136,11 +142,12 @@ protected:
 
 class WorldObject : public Object
 {
+    friend class ObjMgr;
 public:
     virtual ~WorldObject ( ) {}
     void SetPosition(float x, float y, float z, float o, uint16 _map);
     void SetPosition(float x, float y, float z, float o);
-    inline void SetPosition(WorldPosition& wp) { _wpos = wp; }
+    inline void SetPosition(WorldPosition& wp) { _wpos = wp; _SyncPosition(); }
     inline void SetPosition(WorldPosition& wp, uint16 mapid) { SetPosition(wp); _m = mapid; }
     inline WorldPosition GetPosition(void) {return _wpos; }
     inline WorldPosition *GetPositionPtr(void) {return &_wpos; }
@@ -156,9 +163,14 @@ public:
 
 protected:
     WorldObject();
+    inline void _SyncPosition(void) { if(_posmirror) (*_posmirror)[_posindex] = _wpos; }
     WorldPosition _wpos; // coords, orientation
     uint16 _m; // map
 
+private:
+    std::vector<WorldPosition> *_posmirror; // copy of _wpos kept by the ObjMgr for range searches, see ObjectPool
+    uint32 _posindex;
+
 };
 
 inline uint32 GetValuesCountByTypeId(uint8 tid)
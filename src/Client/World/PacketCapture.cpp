@@ -0,0 +1,104 @@
+#include "common.h"
+#include "PacketCapture.h"
+
+PacketCaptureWriter::PacketCaptureWriter()
+{
+    _fh = NULL;
+    _start = 0;
+    _count = 0;
+}
+
+PacketCaptureWriter::~PacketCaptureWriter()
+{
+    Close();
+}
+
+bool PacketCaptureWriter::Open(const char *fn, uint32 build)
+{
+    Close();
+    _fh = fopen(fn, "wb");
+    if(!_fh)
+    {
+        logerror("PacketCapture: Can't open '%s' for writing",fn);
+        return false;
+    }
+    setvbuf(_fh, NULL, _IOFBF, 64 * 1024);
+
+    PacketCaptureHeader hdr;
+    memcpy(hdr.tag, "PWPC", 4);
+    hdr.version = PACKET_CAPTURE_VERSION;
+    hdr.build = build;
+    hdr.starttime = uint32(time(NULL));
+    fwrite(&hdr, sizeof(hdr), 1, _fh);
+
+    _start = GetMonotonicMS();
+    _count = 0;
+    log("PacketCapture: Recording received packets to '%s'",fn);
+    return true;
+}
+
+void PacketCaptureWriter::Close(void)
+{
+    if(!_fh)
+        return;
+    fclose(_fh);
+    _fh = NULL;
+    logdetail("PacketCapture: %u packets recorded",_count);
+}
+
+void PacketCaptureWriter::Write(uint16 opcode, const uint8 *data, uint32 size)
+{
+    if(!_fh)
+        return;
+    PacketCaptureRecord rec;
+    rec.time = uint32(GetMonotonicMS() - _start);
+    rec.opcode = opcode;
+    rec.size = size;
+    if(fwrite(&rec, sizeof(rec), 1, _fh) != 1 || (size && fwrite(data, size, 1, _fh) != 1))
+    {
+        logerror("PacketCapture: Write error, recording stopped");
+        Close();
+        return;
+    }
+    _count++;
+}
+
+
+PacketCaptureReader::PacketCaptureReader()
+{
+    _hdr = NULL;
+    _pos = 0;
+}
+
+bool PacketCaptureReader::Open(const char *fn)
+{
+    _hdr = NULL;
+    if(!_file.Open(fn))
+        return false;
+    const PacketCaptureHeader *hdr = (const PacketCaptureHeader*)_file.GetData();
+    if(_file.GetSize() < sizeof(PacketCaptureHeader) || memcmp(hdr->tag, "PWPC", 4))
+    {
+        logerror("PacketCapture: '%s' is not a capture file",fn);
+        return false;
+    }
+    if(hdr->version != PACKET_CAPTURE_VERSION)
+    {
+        logerror("PacketCapture: '%s' has version %u, expected %u",fn,hdr->version,PACKET_CAPTURE_VERSION);
+        return false;
+    }
+    _hdr = hdr;
+    Rewind();
+    return true;
+}
+
+bool PacketCaptureReader::Next(PacketCaptureRecord& rec, const uint8*& data)
+{
+    if(!_hdr || _file.GetSize() - _pos < sizeof(PacketCaptureRecord))
+        return false;
+    memcpy(&rec, _file.GetData() + _pos, sizeof(PacketCaptureRecord));
+    if(_file.GetSize() - _pos - sizeof(PacketCaptureRecord) < rec.size)
+        return false;
+    data = _file.GetData() + _pos + sizeof(PacketCaptureRecord);
+    _pos += sizeof(PacketCaptureRecord) + rec.size;
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef _PACKETCAPTURE_H
+#define _PACKETCAPTURE_H
+
+#include <stdio.h>
+#include "common.h"
+#include "MappedFile.h"
+
+// capture file of the decrypted packets received from the world server, written by WorldSocket
+// (see "PacketCapture" in PseuWoW.conf) and played back by pseuwow-replay.
+// layout: PacketCaptureHeader, then one PacketCaptureRecord per packet, each followed by its payload.
+// all values are little endian.
+#define PACKET_CAPTURE_VERSION 1
+
+#if defined( __GNUC__ )
+#pragma pack(1)
+#else
+#pragma pack(push,1)
+#endif
+
+struct PacketCaptureHeader
+{
+    char tag[4]; // "PWPC"
+    uint32 version;
+    uint32 build; // client build the packets belong to
+    uint32 starttime; // unix time when the capture was started
+};
+
+struct PacketCaptureRecord
+{
+    uint32 time; // ms since the capture was started
+    uint16 opcode;
+    uint32 size; // payload bytes following this record
+};
+
+#if defined( __GNUC__ )
+#pragma pack()
+#else
+#pragma pack(pop)
+#endif
+
+class PacketCaptureWriter
+{
+public:
+    PacketCaptureWriter();
+    ~PacketCaptureWriter();
+    bool Open(const char *fn, uint32 build); // truncates an existing file
+    void Close(void);
+    inline bool IsOpen(void) { return _fh != NULL; }
+    void Write(uint16 opcode, const uint8 *data, uint32 size);
+    inline uint32 GetCount(void) { return _count; }
+
+private:
+    FILE *_fh;
+    uint64 _start;
+    uint32 _count;
+};
+
+// reads a capture file in place, records point into the mapped file
+class PacketCaptureReader
+{
+public:
+    PacketCaptureReader();
+    bool Open(const char *fn); // false if the file is missing, damaged or has another version
+    inline uint32 GetBuild(void) { return _hdr ? _hdr->build : 0; }
+    inline uint32 GetStartTime(void) { return _hdr ? _hdr->starttime : 0; }
+    // next packet, false at the end of the file. a truncated last record (client was killed) counts as end.
+    bool Next(PacketCaptureRecord& rec, const uint8*& data);
+    inline void Rewind(void) { _pos = sizeof(PacketCaptureHeader); }
+
+private:
+    MappedFile _file;
+    const PacketCaptureHeader *_hdr;
+    uint32 _pos;
+};
+
+#endif
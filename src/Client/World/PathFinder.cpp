@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <math.h>
+#include "common.h"
+#include "MapTile.h"
+#include "MapMgr.h"
+#include "PathFinder.h"
+
+#define GRID_CELLS (64 * 128) // cells per axis on a whole map
+#define SQRT2 1.41421356f
+
+// global cell coords: rows run along x, columns along y, both grow towards lower world coords, like the tiles
+static inline int32 CellRow(float x) { return int32(floor((ZEROPOINT - x) / UNITSIZE)); }
+static inline int32 CellCol(float y) { return int32(floor((ZEROPOINT - y) / UNITSIZE)); }
+static inline float CellCenterX(int32 row) { return ZEROPOINT - (row + 0.5f) * UNITSIZE; }
+static inline float CellCenterY(int32 col) { return ZEROPOINT - (col + 0.5f) * UNITSIZE; }
+
+PathFinder::PathFinder(MapMgr *mmgr)
+{
+    _mapmgr = mmgr;
+    memset(_walkmaps, 0, sizeof(_walkmaps));
+    _curstamp = 0;
+    _expanded = 0;
+}
+
+PathFinder::~PathFinder()
+{
+    Clear();
+}
+
+void PathFinder::Clear(void)
+{
+    for(uint32 i = 0; i < 64*64; i++)
+    {
+        delete _walkmaps[i];
+        _walkmaps[i] = NULL;
+    }
+    _comps.clear();
+}
+
+const TileWalkMap *PathFinder::_GetWalkMap(uint32 gx, uint32 gy)
+{
+    uint32 pos = gy * 64 + gx;
+    if(_walkmaps[pos])
+        return _walkmaps[pos];
+    if(_missing[pos])
+        return NULL;
+
+    std::vector<float> h(129*129);
+    if(!_mapmgr->GetTileHeights(gx, gy, &h[0]))
+    {
+        _missing[pos] = true; // not loaded (yet), try again with the next query
+        return NULL;
+    }
+
+    // a cell is walkable if none of its edges and diagonals is too steep
+    const float limit = UNITSIZE * PATH_MAX_SLOPE, dlimit = limit * SQRT2;
+    const uint16 UNLABELED = 0xFFFF;
+    TileWalkMap *wm = new TileWalkMap();
+    for(uint32 r = 0; r < 128; r++)
+    {
+        for(uint32 c = 0; c < 128; c++)
+        {
+            const float *o = &h[r * 129 + c];
+            float h00 = o[0], h01 = o[1], h10 = o[129], h11 = o[130];
+            bool walkable = h00 != INVALID_HEIGHT && h01 != INVALID_HEIGHT && h10 != INVALID_HEIGHT && h11 != INVALID_HEIGHT
+                && fabs(h00 - h01) <= limit && fabs(h10 - h11) <= limit
+                && fabs(h00 - h10) <= limit && fabs(h01 - h11) <= limit
+                && fabs(h00 - h11) <= dlimit && fabs(h01 - h10) <= dlimit;
+            wm->comp[r * 128 + c] = walkable ? UNLABELED : 0;
+        }
+    }
+
+    // flood fill the areas. diagonal steps need both orthogonal neighbours (see FindPath()), so 4 neighbours are enough
+    uint16 areas = 0;
+    std::vector<uint16> todo;
+    for(uint32 i = 0; i < 128*128; i++)
+    {
+        if(wm->comp[i] != UNLABELED)
+            continue;
+        wm->comp[i] = ++areas;
+        todo.push_back(i);
+        while(!todo.empty())
+        {
+            uint32 cur = todo.back();
+            todo.pop_back();
+            uint32 r = cur >> 7, c = cur & 127;
+            uint32 next[4] = { cur - 128, cur + 128, cur - 1, cur + 1 };
+            bool inside[4] = { r > 0, r < 127, c > 0, c < 127 };
+            for(uint32 d = 0; d < 4; d++)
+            {
+                if(inside[d] && wm->comp[next[d]] == UNLABELED)
+                {
+                    wm->comp[next[d]] = areas;
+                    todo.push_back(next[d]);
+                }
+            }
+        }
+    }
+    wm->compbase = _comps.size();
+    for(uint32 a = 0; a < areas; a++)
+        _comps.push_back(wm->compbase + a);
+    _walkmaps[pos] = wm;
+    _JoinAreas(wm, gx, gy);
+    DEBUG(logdebug("PathFinder: walkability for tile (%u, %u): %u areas", gx, gy, areas));
+    return wm;
+}
+
+uint32 PathFinder::_FindArea(uint32 a)
+{
+    while(_comps[a] != a)
+    {
+        _comps[a] = _comps[_comps[a]]; // path halving keeps the trees flat
+        a = _comps[a];
+    }
+    return a;
+}
+
+// joins the areas along the borders to the neighbouring tiles that already have a walk map
+void PathFinder::_JoinAreas(const TileWalkMap *wm, uint32 gx, uint32 gy)
+{
+    // neighbour offset, our first border cell, their first border cell, step along the border
+    static const int32 sides[4][5] = {
+        { -1,  0,     0,           127,  128 }, // gx - 1: our column 0, their column 127
+        {  1,  0,     127,         0,    128 }, // gx + 1
+        {  0, -1,     0,           127*128, 1 }, // gy - 1: our row 0, their row 127
+        {  0,  1,     127*128,     0,    1 }, // gy + 1
+    };
+    for(uint32 s = 0; s < 4; s++)
+    {
+        int32 nx = int32(gx) + sides[s][0], ny = int32(gy) + sides[s][1];
+        if(nx < 0 || ny < 0 || nx >= 64 || ny >= 64 || !_walkmaps[ny * 64 + nx])
+            continue;
+        const TileWalkMap *nwm = _walkmaps[ny * 64 + nx];
+        for(uint32 i = 0; i < 128; i++)
+        {
+            uint16 a = wm->comp[sides[s][2] + i * sides[s][4]], b = nwm->comp[sides[s][3] + i * sides[s][4]];
+            if(!a || !b)
+                continue;
+            uint32 ra = _FindArea(wm->compbase + a - 1), rb = _FindArea(nwm->compbase + b - 1);
+            if(ra != rb)
+                _comps[std::max(ra, rb)] = std::min(ra, rb);
+        }
+    }
+}
+
+uint32 PathFinder::_GetArea(int32 row, int32 col)
+{
+    if(row < 0 || col < 0 || row >= GRID_CELLS || col >= GRID_CELLS)
+        return 0;
+    const TileWalkMap *wm = _GetWalkMap(col >> 7, row >> 7);
+    uint16 a = wm ? wm->comp[(row & 127) * 128 + (col & 127)] : 0;
+    return a ? _FindArea(wm->compbase + a - 1) + 1 : 0;
+}
+
+bool PathFinder::_IsWalkable(int32 row, int32 col)
+{
+    if(row < 0 || col < 0 || row >= GRID_CELLS || col >= GRID_CELLS)
+        return false;
+    const TileWalkMap *wm = _GetWalkMap(col >> 7, row >> 7);
+    return wm && wm->comp[(row & 127) * 128 + (col & 127)];
+}
+
+bool PathFinder::_FindNearWalkable(int32& row, int32& col, int32 radius)
+{
+    if(_IsWalkable(row, col))
+        return true;
+    for(int32 d = 1; d <= radius; d++)
+        for(int32 r = row - d; r <= row + d; r++)
+            for(int32 c = col - d; c <= col + d; c++)
+                if((abs(r - row) == d || abs(c - col) == d) && _IsWalkable(r, c))
+                {
+                    row = r;
+                    col = c;
+                    return true;
+                }
+    return false;
+}
+
+// checks the cells along the line between two cell centers
+bool PathFinder::_CanWalkStraight(int32 r0, int32 c0, int32 r1, int32 c1)
+{
+    int32 dr = r1 - r0, dc = c1 - c0;
+    int32 steps = std::max(abs(dr), abs(dc)) * 4; // 4 samples per cell is enough to not skip corners
+    for(int32 i = 1; i < steps; i++)
+    {
+        float f = float(i) / steps;
+        if(!_IsWalkable(int32(floor(r0 + 0.5f + dr * f)), int32(floor(c0 + 0.5f + dc * f))))
+            return false;
+    }
+    return true;
+}
+
+void PathFinder::_TrimBuffers(void)
+{
+    if(_stamp.size() <= PATH_KEEP_CELLS)
+        return;
+    // swap, clear() would keep the capacity. fresh stamps are 0, which never matches _curstamp
+    std::vector<float>().swap(_cost);
+    std::vector<int32>().swap(_parent);
+    std::vector<uint32>().swap(_stamp);
+    std::vector<uint32>().swap(_closed);
+    std::vector<OpenEntry>().swap(_open);
+}
+
+bool PathFinder::FindPath(float sx, float sy, float ex, float ey, std::vector<PathNode>& path)
+{
+    path.clear();
+    _expanded = 0;
+    _missing.reset();
+    int32 sr = CellRow(sx), sc = CellCol(sy), er = CellRow(ex), ec = CellCol(ey);
+    if(sr < 0 || sc < 0 || er < 0 || ec < 0 || sr >= GRID_CELLS || sc >= GRID_CELLS || er >= GRID_CELLS || ec >= GRID_CELLS)
+        return false;
+    // we might stand on a steep cell already, or want to reach one; use the nearest walkable cells instead
+    if(!_FindNearWalkable(sr, sc, 2) || !_FindNearWalkable(er, ec, 3))
+    {
+        DEBUG(logdebug("PathFinder: no walkable cell near start or end"));
+        return false;
+    }
+
+    // search only in the box around start and end
+    int32 r0 = std::max(0, std::min(sr, er) - PATH_SEARCH_MARGIN), r1 = std::min(GRID_CELLS - 1, std::max(sr, er) + PATH_SEARCH_MARGIN);
+    int32 c0 = std::max(0, std::min(sc, ec) - PATH_SEARCH_MARGIN), c1 = std::min(GRID_CELLS - 1, std::max(sc, ec) + PATH_SEARCH_MARGIN);
+    int32 w = c1 - c0 + 1, size = w * (r1 - r0 + 1);
+    if(size > 1024 * 1024)
+    {
+        DEBUG(logdebug("PathFinder: end point too far away"));
+        return false;
+    }
+    // all tiles the search may enter must be joined in before the areas tell anything.
+    // keep them at hand, the search looks up 8 neighbours per cell
+    int32 tr0 = r0 >> 7, tc0 = c0 >> 7, tw = (c1 >> 7) - tc0 + 1;
+    _boxmaps.clear();
+    for(int32 gy = tr0; gy <= r1 >> 7; gy++)
+        for(int32 gx = tc0; gx <= c1 >> 7; gx++)
+            _boxmaps.push_back(_GetWalkMap(gx, gy));
+    if(_GetArea(sr, sc) != _GetArea(er, ec))
+    {
+        DEBUG(logdebug("PathFinder: end point not in the walkable area of the start point"));
+        return false;
+    }
+    if(uint32(size) > _stamp.size())
+    {
+        _cost.resize(size);
+        _parent.resize(size);
+        _stamp.resize(size, 0);
+        _closed.resize(size, 0);
+    }
+    if(!++_curstamp) // wrapped around, old stamps could match again
+    {
+        std::fill(_stamp.begin(), _stamp.end(), 0);
+        std::fill(_closed.begin(), _closed.end(), 0);
+        _curstamp = 1;
+    }
+
+    static const int32 dirs[8][2] = { {-1,0}, {1,0}, {0,-1}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1} };
+    int32 start = (sr - r0) * w + (sc - c0), goal = (er - r0) * w + (ec - c0);
+    _open.clear();
+    _cost[start] = 0;
+    _parent[start] = -1;
+    _stamp[start] = _curstamp;
+    OpenEntry e;
+    e.f = 0;
+    e.idx = start;
+    _open.push_back(e);
+    bool found = false;
+    uint64 deadline = GetMonotonicUS() + PATH_MAX_US;
+    while(!_open.empty() && _expanded < PATH_MAX_EXPANDED)
+    {
+        if(!(_expanded & 63) && _expanded && GetMonotonicUS() > deadline)
+            break;
+        std::pop_heap(_open.begin(), _open.end());
+        int32 cur = _open.back().idx;
+        _open.pop_back();
+        if(_closed[cur] == _curstamp)
+            continue;
+        _closed[cur] = _curstamp;
+        _expanded++;
+        if(cur == goal)
+        {
+            found = true;
+            break;
+        }
+        int32 cr = cur / w, cc = cur % w;
+        bool walk[8];
+        for(uint32 d = 0; d < 8; d++)
+        {
+            int32 nr = cr + dirs[d][0], nc = cc + dirs[d][1];
+            walk[d] = false;
+            if(nr >= 0 && nc >= 0 && nr <= r1 - r0 && nc < w)
+            {
+                int32 gr = nr + r0, gc = nc + c0;
+                const TileWalkMap *wm = _boxmaps[((gr >> 7) - tr0) * tw + (gc >> 7) - tc0];
+                walk[d] = wm && wm->comp[(gr & 127) * 128 + (gc & 127)];
+            }
+        }
+        for(uint32 d = 0; d < 8; d++)
+        {
+            // diagonal moves must not cut corners: both orthogonal neighbours on the way must be walkable too
+            if(!walk[d] || (d >= 4 && !(walk[d < 6 ? 0 : 1] && walk[d % 2 ? 3 : 2])))
+                continue;
+            int32 nr = cr + dirs[d][0], nc = cc + dirs[d][1];
+            int32 n = nr * w + nc;
+            if(_closed[n] == _curstamp)
+                continue;
+            float g = _cost[cur] + (d >= 4 ? SQRT2 : 1.0f);
+            if(_stamp[n] == _curstamp && _cost[n] <= g)
+                continue;
+            _stamp[n] = _curstamp;
+            _cost[n] = g;
+            _parent[n] = cur;
+            // octile distance, weighted: finds a path with far fewer expanded cells, which is at most
+            // PATH_HEURISTIC_WEIGHT times longer than the shortest one (and is straightened afterwards anyway)
+            int32 dr = abs(nr - (er - r0)), dc = abs(nc - (ec - c0));
+            e.f = g + PATH_HEURISTIC_WEIGHT * ((dr + dc) + (SQRT2 - 2.0f) * std::min(dr, dc));
+            e.idx = n;
+            _open.push_back(e);
+            std::push_heap(_open.begin(), _open.end());
+        }
+    }
+    if(!found)
+    {
+        DEBUG(logdebug("PathFinder: no path found, %u cells expanded", _expanded));
+        _TrimBuffers();
+        return false;
+    }
+
+    // collect the cells, then drop every cell that can be skipped by walking straight
+    std::vector<int32> cells;
+    for(int32 i = goal; i >= 0; i = _parent[i])
+        cells.push_back(i);
+    std::reverse(cells.begin(), cells.end());
+    std::vector<float> xs, ys;
+    for(uint32 i = 0; i + 1 < cells.size(); )
+    {
+        uint32 j = i + 1;
+        int32 ir = cells[i] / w + r0, ic = cells[i] % w + c0;
+        while(j + 1 < cells.size() && _CanWalkStraight(ir, ic, cells[j+1] / w + r0, cells[j+1] % w + c0))
+            j++;
+        if(j + 1 < cells.size())
+        {
+            xs.push_back(CellCenterX(cells[j] / w + r0));
+            ys.push_back(CellCenterY(cells[j] % w + c0));
+        }
+        i = j;
+    }
+    _TrimBuffers();
+    xs.push_back(ex);
+    ys.push_back(ey);
+
+    std::vector<float> zs(xs.size());
+    _mapmgr->GetZ(&xs[0], &ys[0], &zs[0], xs.size());
+    for(uint32 i = 0; i < xs.size(); i++)
+        path.push_back(PathNode(xs[i], ys[i], zs[i]));
+    return true;
+}
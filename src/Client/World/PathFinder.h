@@ -0,0 +1,84 @@
+#ifndef _PATHFINDER_H
+#define _PATHFINDER_H
+
+#include <bitset>
+#include <vector>
+#include "common.h"
+
+class MapMgr;
+
+// steepest walkable slope (height difference per yard), about 50 degrees
+#define PATH_MAX_SLOPE 1.19f
+// A* gives up after expanding that many cells (about 0.25 us each), or after PATH_MAX_US, whatever comes first.
+// goals in another walkable area are rejected before the search, so this only ends searches for goals
+// that can be reached, but only by leaving the search area. pseuwow-bench path shows the latency
+#define PATH_MAX_EXPANDED 4000
+#define PATH_MAX_US 700
+// the search area is the box around start and end, plus this many cells on each side
+#define PATH_SEARCH_MARGIN 32
+#define PATH_HEURISTIC_WEIGHT 1.5f
+// search buffers for more cells than that (about 1 MB) are freed after the query, a far query must not keep its memory
+#define PATH_KEEP_CELLS (256*256)
+
+struct PathNode
+{
+    PathNode() {}
+    PathNode(float px, float py, float pz) : x(px), y(py), z(pz) {}
+    float x,y,z;
+};
+
+// which cells (UNITSIZE x UNITSIZE, 128x128 per tile) of a map tile can be walked on,
+// and which of them are connected within the tile
+struct TileWalkMap
+{
+    uint16 comp[128*128]; // index: row (x) * 128 + column (y). 0 = not walkable, else the area of the cell in this tile
+    uint32 compbase; // PathFinder::_comps index of area 1
+};
+
+// finds walkable paths on the height data of a MapMgr with A* on a grid of one cell per vertex cell.
+// walkability of a tile is computed once when it is needed first (and loaded) and kept until Clear().
+// the walkable areas of neighbouring tiles are joined when a tile is added, so cells in different areas
+// can't reach each other and FindPath() fails for them without searching.
+class PathFinder
+{
+public:
+    PathFinder(MapMgr *mmgr);
+    ~PathFinder();
+    void Clear(void); // the map changed
+    // path from (sx,sy) to (ex,ey), start point not included. false if there is no path over loaded tiles.
+    bool FindPath(float sx, float sy, float ex, float ey, std::vector<PathNode>& path);
+    inline uint32 GetLastExpanded(void) { return _expanded; }
+
+private:
+    const TileWalkMap *_GetWalkMap(uint32 gx, uint32 gy);
+    bool _IsWalkable(int32 row, int32 col);
+    uint32 _GetArea(int32 row, int32 col); // 0 if not walkable
+    uint32 _FindArea(uint32 a);
+    void _JoinAreas(const TileWalkMap *wm, uint32 gx, uint32 gy);
+    bool _FindNearWalkable(int32& row, int32& col, int32 radius);
+    bool _CanWalkStraight(int32 r0, int32 c0, int32 r1, int32 c1);
+    void _TrimBuffers(void);
+
+    MapMgr *_mapmgr;
+    TileWalkMap *_walkmaps[64*64]; // [gy * 64 + gx]
+    std::vector<uint32> _comps; // union-find over the areas of all walk maps, parent of each area
+
+    // search state, kept between queries to avoid allocations. a cell belongs to the current query only if its stamp matches.
+    std::vector<float> _cost;
+    std::vector<int32> _parent;
+    std::vector<uint32> _stamp; // cell was reached
+    std::vector<uint32> _closed; // cell was expanded
+    uint32 _curstamp;
+    std::bitset<64*64> _missing; // tiles found not loaded during the current query
+    struct OpenEntry
+    {
+        float f;
+        int32 idx;
+        bool operator<(const OpenEntry& o) const { return f > o.f; } // std heap is a max heap
+    };
+    std::vector<OpenEntry> _open;
+    std::vector<const TileWalkMap*> _boxmaps; // walk maps of the tiles in the search area, NULL if not loaded
+    uint32 _expanded;
+};
+
+#endif
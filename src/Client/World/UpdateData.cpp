@@ -17,21 +17,16 @@ void WorldSession::_HandleCompressedUpdateObjectOpcode(WorldPacket& recvPacket)
 {
     uint32 realsize;
     recvPacket >> realsize;
-    ZCompressor z;
-    z.append(recvPacket.contents() + sizeof(uint32),recvPacket.size() - sizeof(uint32));
-    z.Compressed(true);
-    z.RealSize(realsize);
-    z.Inflate();
-    if(z.Compressed())
+    // inflate straight into the reused buffer and parse it there
+    _inflatePkt.SetOpcode(recvPacket.GetOpcode());
+    _inflatePkt.resize(realsize);
+    if(!realsize || !_inflater.Inflate(recvPacket.contents() + sizeof(uint32), recvPacket.size() - sizeof(uint32), (uint8*)_inflatePkt.contents(), realsize))
     {
-        logerror("_HandleCompressedUpdateObjectOpcode(): Inflate() failed! size=%u realsize=%u",z.size(),realsize);
+        logerror("_HandleCompressedUpdateObjectOpcode(): Inflate() failed! size=%u realsize=%u",recvPacket.size() - sizeof(uint32),realsize);
         return;
     }
-    WorldPacket wp;
-    wp.SetOpcode(recvPacket.GetOpcode());
-    wp.append(z.contents(),z.size());
 
-    _HandleUpdateObjectOpcode(wp);
+    _HandleUpdateObjectOpcode(_inflatePkt);
 }
 
 void WorldSession::_HandleUpdateObjectOpcode(WorldPacket& recvPacket)
@@ -439,7 +434,7 @@ void WorldSession::_ValuesUpdate(uint64 uguid, WorldPacket& recvPacket)
 {
     Object *obj = objmgr.GetObj(uguid);
     uint8 blockcount,tyid;
-    uint32 value, masksize, valuesCount;
+    uint32 masksize, valuesCount;
 
     if(obj)
     {
@@ -457,31 +452,45 @@ void WorldSession::_ValuesUpdate(uint64 uguid, WorldPacket& recvPacket)
 
     recvPacket >> blockcount;
     masksize = blockcount << 2; // each sizeof(uint32) == <4> * sizeof(uint8) // 1<<2 == <4>
-    UpdateMask umask;
-    uint32 *updateMask = new uint32[blockcount];
-    umask.SetCount(masksize);
+    uint32 updateMask[256]; // blockcount is an uint8, so this is always large enough
     recvPacket.read((uint8*)updateMask, masksize);
-    umask.SetMask(updateMask);
-    //delete [] updateMask; // will be deleted at ~UpdateMask() !!!!
     logdev("ValuesUpdate TypeId=%u GUID="I64FMT" pObj=%X Blocks=%u Masksize=%u",tyid,uguid,obj,blockcount,masksize);
     // just in case the object does not exist, and we have really a container instead of an item, and a value in
     // the container fields is set, THEN we have a problem. this should never be the case; it can be fixed in a
     // more correct way if there is the need.
     // (-> valuesCount smaller then it should be might skip a few bytes and corrupt the packet)
-    for (uint32 i = 0; i < valuesCount; i++)
+
+    // bits beyond valuesCount are ignored
+    uint32 usedblocks = std::min<uint32>(blockcount, (valuesCount + 31) >> 5);
+    if(usedblocks && (valuesCount & 31) && usedblocks == ((valuesCount + 31) >> 5))
+        updateMask[usedblocks - 1] &= (1u << (valuesCount & 31)) - 1;
+
+    // check once that all values are there, instead of once per value
+    uint32 setbits = 0;
+    for(uint32 b = 0; b < usedblocks; b++)
+        setbits += UpdateMaskBitCount(updateMask[b]);
+    uint32 bytes = setbits * sizeof(uint32);
+    if(recvPacket.rpos() + bytes > recvPacket.size())
+        throw ByteBufferException("ValuesUpdate", recvPacket.rpos(), recvPacket.wpos(), bytes, recvPacket.size());
+
+    const uint8 *values = recvPacket.contents() + recvPacket.rpos(); // not aligned, only memcpy from it
+    recvPacket.rpos(recvPacket.rpos() + bytes);
+    if(!obj)
+        return; // drop the values, since object doesnt exist (always 4 bytes each)
+
+    // walk only the set bits; every run of consecutive set bits is copied in one go
+    for(uint32 b = 0; b < usedblocks; b++)
     {
-        if (umask.GetBit(i))
+        uint32 word = updateMask[b];
+        while(word)
         {
-            if(obj)
-            {
-                recvPacket >> value;
-                obj->SetUInt32Value(i, value);  //It does not matter what type of value we are setting, just copy the bytes
-                DEBUG(logdev("%u %u",i,value));
-            }
-            else
-            {
-                recvPacket >> value; // drop the value, since object doesnt exist (always 4 bytes)
-            }
+            uint32 bit = UpdateMaskLowestBit(word);
+            uint32 rest = ~(word >> bit);
+            uint32 run = rest ? UpdateMaskLowestBit(rest) : 32 - bit;
+            obj->SetUInt32Values((b << 5) + bit, values, run);
+            DEBUG(for(uint32 k = 0; k < run; k++) { uint32 v; memcpy(&v, values + k * sizeof(uint32), sizeof(uint32)); logdev("%u %u",(b << 5) + bit + k,v); })
+            values += run * sizeof(uint32);
+            word = (run + bit >= 32) ? 0 : word & ~(((1u << run) - 1) << bit);
         }
     }
 }
@@ -19,6 +19,41 @@
 #ifndef __UPDATEMASK_H
 #define __UPDATEMASK_H
 
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
+// index of the lowest set bit. v must not be 0.
+inline uint32 UpdateMaskLowestBit(uint32 v)
+{
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, v);
+    return idx;
+#elif defined(__GNUC__)
+    return __builtin_ctz(v);
+#else
+    uint32 idx = 0;
+    while(!(v & 1))
+    {
+        v >>= 1;
+        idx++;
+    }
+    return idx;
+#endif
+}
+
+inline uint32 UpdateMaskBitCount(uint32 v)
+{
+#if defined(__GNUC__)
+    return __builtin_popcount(v);
+#else
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+}
+
 class UpdateMask
 {
     public:
@@ -1,5 +1,66 @@
 
 #include "WorldPacket.h"
+#include "zthread/Guard.h"
 
+WorldPacketPool::WorldPacketPool(uint32 maxpooled, uint32 maxpktsize)
+{
+    _maxpooled = maxpooled;
+    _maxpktsize = maxpktsize;
+    _acquired = _allocated = 0;
+    _free.reserve(maxpooled);
+}
 
+WorldPacketPool::~WorldPacketPool()
+{
+    for(uint32 i = 0; i < _free.size(); i++)
+        delete _free[i];
+}
 
+void WorldPacketPool::SetMaxPooled(uint32 maxpooled)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mut);
+    _maxpooled = maxpooled;
+    while(_free.size() > maxpooled)
+    {
+        delete _free.back();
+        _free.pop_back();
+    }
+}
+
+WorldPacket *WorldPacketPool::Acquire(uint16 opcode, uint32 size)
+{
+    WorldPacket *pkt = NULL;
+    {
+        ZThread::Guard<ZThread::FastMutex> g(_mut);
+        _acquired++;
+        if(_free.size())
+        {
+            pkt = _free.back();
+            _free.pop_back();
+        }
+        else
+            _allocated++;
+    }
+    if(!pkt)
+        pkt = new WorldPacket(opcode, size);
+    pkt->SetOpcode(opcode);
+    pkt->resize(size); // keeps the capacity of a recycled packet, so no realloc if it fits
+    return pkt;
+}
+
+void WorldPacketPool::Release(WorldPacket *pkt)
+{
+    if(!pkt)
+        return;
+    if(pkt->capacity() <= _maxpktsize)
+    {
+        pkt->clear();
+        ZThread::Guard<ZThread::FastMutex> g(_mut);
+        if(_free.size() < _maxpooled)
+        {
+            _free.push_back(pkt);
+            return;
+        }
+    }
+    delete pkt;
+}
@@ -1,8 +1,10 @@
 #ifndef _WORLDPACKET_H
 #define _WORLDPACKET_H
 
+#include <vector>
 #include "SysDefs.h"
 #include "ByteBuffer.h"
+#include "zthread/FastMutex.h"
 
 class WorldPacket : public ByteBuffer
 {
@@ -19,5 +21,27 @@ private:
 
 };
 
+// Keeps handled packets together with their storage, so that receiving a packet
+// does not need a heap allocation once the pool is warmed up.
+// Acquire() and Release() may be called from different threads.
+class WorldPacketPool
+{
+public:
+    WorldPacketPool(uint32 maxpooled = 256, uint32 maxpktsize = 0x10000);
+    ~WorldPacketPool();
+    WorldPacket *Acquire(uint16 opcode, uint32 size); // returns a packet with size() == size, contents undefined
+    void Release(WorldPacket *pkt); // takes ownership; use instead of delete
+    void SetMaxPooled(uint32 maxpooled); // 0 allocates every packet, like before there was a pool
+    inline uint32 GetAcquireCount(void) { return _acquired; }
+    inline uint32 GetAllocCount(void) { return _allocated; }
+
+private:
+    ZThread::FastMutex _mut;
+    std::vector<WorldPacket*> _free;
+    uint32 _maxpooled; // never keep more than this amount of unused packets
+    uint32 _maxpktsize; // packets whose storage grew beyond this are freed instead of pooled
+    uint32 _acquired, _allocated;
+};
+
 
 #endif
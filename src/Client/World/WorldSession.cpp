@@ -1,4 +1,5 @@
 #include "common.h"
+#include "zthread/Guard.h"
 
 #include "Auth/Sha1.h"
 #include "Auth/BigNumber.h"
@@ -28,21 +29,24 @@ uint32 Object::maxvalues[TYPEID_MAX];
 UpdateField Object::updatefields[UPDATEFIELDS_NAME_COUNT];
 uint8 MovementInfo::_c=CLIENT_UNKNOWN;
 
-WorldSession::WorldSession(PseuInstance *in)
+WorldSession::WorldSession(PseuInstance *in) : pktQueue(4096), sendPktQueue(256), _sh(in->GetConf()->networkbackend, in->GetSocketHandler())
 {
     logdebug("-> Starting WorldSession 0x%X from instance 0x%X",this,in); // should never output a null ptr
     _instance = in;
     _mustdie=false;
     _logged=false;
     _socket=NULL;
+    _offline=false;
+    _droppedsends=0;
     _myGUID=0; // i dont have a guid yet
     _channels = new Channel(this);
     _world = new World(this);
-    _sh.SetAutoCloseSockets(false);
     objmgr.SetInstance(in);
     _lag_ms = 0;
     //...
 
+    _BuildOpcodeDispatchTable();
+
     _SetupObjectFields();
     MovementInfo::_c=in->GetConf()->client;
 
@@ -73,26 +77,32 @@ WorldSession::~WorldSession()
 
     _instance->GetScripts()->RunScriptIfExists("_onworldsessiondelete");
 
-    logdebug("~WorldSession(): %u packets left unhandled, and %u delayed. deleting.",pktQueue.size(),delayedPktQueue.size());
-    WorldPacket *packet;
-    // clear the queue
-    while(pktQueue.size())
-    {
-        packet = pktQueue.next();
-        delete packet;
-    }
+    logdebug("~WorldSession(): %u packets left unhandled, and %u delayed. deleting.",pktQueue.Size() + _injectedPktQueue.size(),delayedPktQueue.size());
+    logdebug("~WorldSession(): packet pool handed out %u packets, %u had to be allocated",_pktPool.GetAcquireCount(),_pktPool.GetAllocCount());
     // clear the delayed queue
-    while(delayedPktQueue.size())
+    for(DelayedPacketQueue::iterator it = delayedPktQueue.begin(); it != delayedPktQueue.end(); it++)
     {
-        packet = delayedPktQueue.back().pkt;
-        delayedPktQueue.pop_back();
-        delete packet;
+        GetInstance()->GetTimers().Remove(it->first);
+        delete it->second;
     }
+    delayedPktQueue.clear();
 
     if(_channels)
         delete _channels;
     if(_socket)
+    {
+        ZThread::Guard<ZThread::FastRecursiveMutex> g(_sh.GetMutex());
+        _sh.Remove(_socket);
         delete _socket;
+    }
+    // clear the queues, now that the socket can't add to them anymore
+    WorldPacket *packet;
+    while(pktQueue.Pop(packet))
+        delete packet;
+    while(sendPktQueue.Pop(packet))
+        delete packet;
+    for(std::deque<WorldPacket*>::iterator it = _injectedPktQueue.begin(); it != _injectedPktQueue.end(); it++)
+        delete *it;
     if(_world)
         delete _world;
     DEBUG(logdebug("~WorldSession() this=0x%X _instance=0x%X",this,_instance));
@@ -101,45 +111,52 @@ WorldSession::~WorldSession()
 void WorldSession::SetMustDie(void)
 {
     _mustdie = true;
+    GetInstance()->Wakeup(); // may be called by the shared network thread
     logdebug("WorldSession: Must die now.");
 }
 
 void WorldSession::Start(void)
 {
     log("Connecting to '%s' on port %u",GetInstance()->GetConf()->worldhost.c_str(),GetInstance()->GetConf()->worldport);
-    _socket=new WorldSocket(_sh,this);
+    _socket=new WorldSocket(_sh.Get(),this);
+    _socket->SetCorked(GetInstance()->GetConf()->sendbatching > 1);
     _socket->Open(GetInstance()->GetConf()->worldhost,GetInstance()->GetConf()->worldport);
     _sh.Add(_socket);
-
-    // if we cant connect, wait until the socket gives up (after 5 secs)
-    while( (!MustDie()) && (!_socket->IsOk()) && (!GetInstance()->Stopped()) )
-    {
-        logdev("WorldSession::Start(): Socket not ok, waiting...");
-        _sh.Select(3,0);
-        GetInstance()->Sleep(100);
-    }
-    logdev("WorldSession::Start() done, mustdie:%u, socket_ok:%u stopped:%u",MustDie(),_socket->IsOk(),GetInstance()->Stopped());
+    // no waiting for the connection here, the server starts with SMSG_AUTH_CHALLENGE.
+    // if it can't connect, the socket gives up after 5 secs and Update() lets the session die
 }
 
 void WorldSession::_LoadCache(void)
 {
     logdetail("Loading Cache...");
     plrNameCache.ReadFromFile(); // load names/guids of known players
-    ItemProtoCache_InsertDataToSession(this);
-    CreatureTemplateCache_InsertDataToSession(this);
-    GOTemplateCache_InsertDataToSession(this);
+    // the template cache files are loaded once per process, templates are taken from them when needed
+    objmgr.SetPrototypeCache(PrototypeCache_Get());
     //...
 }
 
 void WorldSession::AddToPktQueue(WorldPacket *pkt)
 {
-    pktQueue.add(pkt);
+    pktQueue.Push(pkt);
+    if(_sh.IsShared())
+        GetInstance()->Wakeup();
+}
+
+void WorldSession::InjectPacket(WorldPacket *pkt)
+{
+    _injectedPktQueue.push_back(pkt);
 }
 
 void WorldSession::SendWorldPacket(WorldPacket &pkt)
 {
     if(GetInstance()->GetConf()->showmyopcodes)
         logcustom(0,BROWN,"<< Opcode %u [%s] (%u bytes)", pkt.GetOpcode(), GetOpcodeName(pkt.GetOpcode()), pkt.size());
+    if(_offline)
+    {
+        _droppedsends++;
+        return;
+    }
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(_sh.GetMutex());
     if(_socket && _socket->IsOk())
         _socket->SendWorldPacket(pkt);
     else
@@ -150,59 +167,83 @@ void WorldSession::SendWorldPacket(WorldPacket &pkt)
 
 void WorldSession::Update(void)
 {
-    if( _sh.GetCount() ) // the socket will remove itself from the handler if it got closed
-        _sh.Select(0,0);
-    else // so we just need to check if the socket doesnt exist or if it exists but isnt valid anymore.
-    {    // if thats the case, we dont need the session anymore either
-        if(!_socket || (_socket && !_socket->IsOk()))
-        {
-            _OnLeaveWorld();
-            SetMustDie();
-        }
+    // the instance polls the socket. it will remove itself from the handler if it got closed,
+    // so we just need to check if the socket doesnt exist or if it exists but isnt valid anymore.
+    // if thats the case, we dont need the session anymore either. offline there is no socket that could have been closed
+    if( !_offline && !_sh.HasSockets() && (!_socket || (_socket && !_socket->IsOk())) )
+    {
+        _OnLeaveWorld();
+        SetMustDie();
     }
 
+    // everything sent from here on goes out with one write at the end
+    uint8 batching = GetInstance()->GetConf()->sendbatching;
+    if(batching == 1)
+        _SetSocketCorked(true);
+
     // process the send queue and send packets buffered by other threads
-    while(sendPktQueue.size())
+    WorldPacket *pkt;
+    while(sendPktQueue.Pop(pkt))
     {
-        WorldPacket *pkt = sendPktQueue.next();
         SendWorldPacket(*pkt);
         delete pkt;
     }
 
     // while there are packets on the queue, handle them
-    while(pktQueue.size())
+    while(pktQueue.Pop(pkt))
+    {
+        HandleWorldPacket(pkt);
+    }
+    // packets spoofed by scripts; handlers may inject more, those are handled in the next update
+    for(uint32 n = _injectedPktQueue.size(); n; n--)
     {
-        HandleWorldPacket(pktQueue.next());
+        pkt = _injectedPktQueue.front();
+        _injectedPktQueue.pop_front();
+        HandleWorldPacket(pkt);
     }
 
     // now check if there are packets that couldnt be handled earlier due to missing data
-    _HandleDelayedPackets();
-
     _DoTimedActions();
 
     if(_world)
         _world->Update();
+
+    if(batching)
+        _SetSocketCorked(batching > 1);
+}
+
+void WorldSession::_SetSocketCorked(bool corked)
+{
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(_sh.GetMutex());
+    if(_socket)
+    {
+        _socket->SetCorked(corked);
+        _socket->Flush();
+    }
+}
+
+void WorldSession::FlushSends(void)
+{
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(_sh.GetMutex());
+    if(_socket)
+        _socket->Flush();
 }
 
 // this func will delete the WorldPacket after it is handled!
 void WorldSession::HandleWorldPacket(WorldPacket *packet)
 {
-    static DefScriptPackage *sc = GetInstance()->GetScripts();
-    static OpcodeHandler *table = _GetOpcodeHandlerTable();
+    DefScriptPackage *sc = GetInstance()->GetScripts();
 
-    bool known = false;
-    uint16 hpos;
-    for (hpos = 0; table[hpos].handler != NULL; hpos++)
-    {
-        if (table[hpos].opcode == packet->GetOpcode())
-        {
-            known=true;
-            break;
-        }
-    }
+    // script hooks are only looked up again if scripts were loaded or unloaded in the meantime
+    if(_opcodeScriptsVersion != sc->GetScriptsVersion())
+        _UpdateOpcodeScriptHooks();
 
+    static const OpcodeDispatchEntry unknownEntry = { NULL, false, false };
+    const OpcodeDispatchEntry& entry = packet->GetOpcode() < MAX_OPCODE_ID ? _opcodeDispatch[packet->GetOpcode()] : unknownEntry;
+
+    bool known = entry.handler != NULL;
     bool hideOpcode = false;
-    bool disabledOpcode = IsOpcodeDisabled(packet->GetOpcode());
+    bool disabledOpcode = entry.disabled;
     if(disabledOpcode && GetInstance()->GetConf()->hideDisabledOpcodes)
         hideOpcode = true;
 
@@ -233,10 +274,10 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
     {
         // if there is a script attached to that opcode, call it now.
         // note: the pkt rpos needs to be reset by the scripts!
-        std::string scname = "opcode::";
-        scname += stringToLower(GetOpcodeName(packet->GetOpcode()));
-        if(sc->ScriptExists(scname))
+        if(entry.hasScript)
         {
+            std::string scname = "opcode::";
+            scname += stringToLower(GetOpcodeName(packet->GetOpcode()));
             std::string pktname = "PACKET::";
             pktname += GetOpcodeName(packet->GetOpcode());
             GetInstance()->GetScripts()->bytebuffers.Assign(pktname,packet);
@@ -248,7 +289,7 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
         if(known && !disabledOpcode)
         {
             packet->rpos(0);
-            (this->*table[hpos].handler)(*packet);
+            (this->*entry.handler)(*packet);
         }
     }
     catch (ByteBufferException bbe)
@@ -259,7 +300,7 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
         logerror("WorldSession: ByteBufferException");
         logerror("ByteBuffer reported: %s", errbuf);
         // copied from below
-        logerror("Data: pktsize=%u, handler=0x%X queuesize=%u",packet->size(),table[hpos].handler,pktQueue.size());
+        logerror("Data: pktsize=%u, handler=0x%X queuesize=%u",packet->size(),entry.handler,pktQueue.Size());
         logerror("Packet Hexdump:");
         logerror("%s",toHexDump((uint8*)packet->contents(),packet->size(),true).c_str());
 
@@ -269,7 +310,7 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
     catch (...)
     {
         logerror("Exception while handling opcode %u [%s]!",packet->GetOpcode(),GetOpcodeName(packet->GetOpcode()));
-        logerror("Data: pktsize=%u, handler=0x%X queuesize=%u",packet->size(),table[hpos].handler,pktQueue.size());
+        logerror("Data: pktsize=%u, handler=0x%X queuesize=%u",packet->size(),entry.handler,pktQueue.Size());
         logerror("Packet Hexdump:");
         logerror("%s",toHexDump((uint8*)packet->contents(),packet->size(),true).c_str());
 
@@ -277,7 +318,7 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
             DumpPacket(*packet, packet->rpos(), "unknown exception");
     }
 
-    delete packet;
+    _pktPool.Release(packet);
 }
 
 
@@ -365,50 +406,78 @@ OpcodeHandler *WorldSession::_GetOpcodeHandlerTable() const
     return table;
 }
 
+void WorldSession::_BuildOpcodeDispatchTable(void)
+{
+    for(uint32 i = 0; i < MAX_OPCODE_ID; i++)
+    {
+        _opcodeDispatch[i].handler = NULL;
+        _opcodeDispatch[i].disabled = false;
+        _opcodeDispatch[i].hasScript = false;
+    }
+    OpcodeHandler *table = _GetOpcodeHandlerTable();
+    for(uint32 i = 0; table[i].handler != NULL; i++)
+    {
+        if(table[i].opcode < MAX_OPCODE_ID)
+            _opcodeDispatch[table[i].opcode].handler = table[i].handler;
+    }
+    _UpdateOpcodeScriptHooks();
+}
+
+void WorldSession::_UpdateOpcodeScriptHooks(void)
+{
+    DefScriptPackage *sc = GetInstance()->GetScripts();
+    std::string scname;
+    for(uint32 i = 0; i < MAX_OPCODE_ID; i++)
+    {
+        scname = "opcode::";
+        scname += stringToLower(GetOpcodeName(i));
+        _opcodeDispatch[i].hasScript = sc->ScriptExists(scname);
+    }
+    _opcodeScriptsVersion = sc->GetScriptsVersion();
+}
+
 void WorldSession::_DelayWorldPacket(WorldPacket& pkt, uint32 ms)
 {
     DEBUG(logdebug("DelayWorldPacket (%s, size: %u, ms: %u)",GetOpcodeName(pkt.GetOpcode()),pkt.size(),ms));
     // need to copy the packet, because the current packet will be deleted after it got handled
-    WorldPacket *pktcopy = new WorldPacket(pkt.GetOpcode(),pkt.size());
-    pktcopy->append(pkt.contents(),pkt.size());
-    delayedPktQueue.push_back(DelayedWorldPacket(pktcopy,ms));
+    WorldPacket *pktcopy = _pktPool.Acquire(pkt.GetOpcode(),pkt.size());
+    if(pkt.size())
+        memcpy((void*)pktcopy->contents(),pkt.contents(),pkt.size());
+    delayedPktQueue[GetInstance()->GetTimers().AddIn(ms, this, pktcopy)] = pktcopy;
     DEBUG(logdebug("-> WP ptr = 0x%X",pktcopy));
 }
 
-void WorldSession::_HandleDelayedPackets(void)
+// called from PseuInstance::Update() when a delayed packet is due
+void WorldSession::OnTimer(uint64 id, void *arg)
 {
-    if(delayedPktQueue.size())
+    WorldPacket *pkt = (WorldPacket*)arg;
+    delayedPktQueue.erase(id);
+    DEBUG(logdebug("Handling delayed packet (%s [%u], size: %u, ptr: 0x%X)",GetOpcodeName(pkt->GetOpcode()),pkt->GetOpcode(),pkt->size(),pkt));
+    try
     {
-        DelayedPacketQueue copy(delayedPktQueue);
-        delayedPktQueue.clear(); // clear original, since it might be filled up by newly delayed packets, which would cause endless loop
-        while(copy.size())
-        {
-            DelayedWorldPacket d = copy.front();
-            copy.pop_front(); // remove packet from front
-            if(clock() >= d.when) // if its time to handle this packet, do so
-            {
-                DEBUG(logdebug("Handling delayed packet (%s [%u], size: %u, ptr: 0x%X)",GetOpcodeName(d.pkt->GetOpcode()),d.pkt->GetOpcode(),d.pkt->size(),d.pkt));
-                HandleWorldPacket(d.pkt);
-            }
-            else
-            {
-                delayedPktQueue.push_back(d); // and if not, put it again onto the queue
-            }
-        }
+        HandleWorldPacket(pkt); // may delay it again, but that makes a new copy
+    }
+    catch(...)
+    {
+        logerror("Unhandled exception while handling delayed packet");
     }
 }
 
 // use this func to send packets from other threads
 void WorldSession::AddSendWorldPacket(WorldPacket *pkt)
 {
-    sendPktQueue.add(pkt);
+    {
+        ZThread::Guard<ZThread::FastMutex> g(_sendPktMutex);
+        sendPktQueue.Push(pkt);
+    }
+    GetInstance()->Wakeup();
 }
 void WorldSession::AddSendWorldPacket(WorldPacket& pkt)
 {
     WorldPacket *wp = new WorldPacket(pkt.GetOpcode(),pkt.size());
     if(pkt.size())
         wp->append(pkt.contents(),pkt.size());
-    sendPktQueue.add(wp);
+    AddSendWorldPacket(wp);
 }
 
 void WorldSession::SetTarget(uint64 guid)
@@ -569,11 +638,14 @@ void WorldSession::_HandleAuthChallengeOpcode(WorldPacket& recvPacket)
     auth << (uint32)0; // TODO: this is not correct value, expected: 160 bytes of addon_data
     auth.SetOpcode(CMSG_AUTH_SESSION);
 
+    // with a shared network thread, the reply could be read before the crypt is set up; keep the socket locked until then
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(_sh.GetMutex());
     SendWorldPacket(auth);
 
     // note that if the sessionkey/auth is wrong or failed, the server sends the following packet UNENCRYPTED!
     // so its not 100% correct to init the crypt here, but it should do the job if authing was correct
-    _socket->InitCrypt(GetInstance()->GetSessionKey());
+    if(_socket)
+        _socket->InitCrypt(GetInstance()->GetSessionKey());
 
 }
 
@@ -712,6 +784,12 @@ void WorldSession::_HandleCharEnumOpcode(WorldPacket& recvPacket)
 
         }
      }
+        // swarm bots without a configured character name just take the first one on their account
+        if(!char_found && num && GetInstance()->GetConf()->swarmindex && GetInstance()->GetConf()->charname.empty())
+        {
+            charId = 0;
+            char_found = true;
+        }
         if(!char_found)
         {
             if(PseuGUI *gui = GetInstance()->GetGUI())
@@ -773,7 +851,7 @@ void WorldSession::EnterWorldWithCharacter(std::string name)
     AddSendWorldPacket(pkt); // it can be called from gui thread also, use threadsafe version
 
     // close realm session when logging into world
-    if(!MustDie() && _socket->IsOk() && GetInstance()->GetRSession())
+    if(!MustDie() && _socket && _socket->IsOk() && GetInstance()->GetRSession())
     {
         GetInstance()->GetRSession()->SetMustDie(); // realm session is no longer needed
     }
@@ -787,7 +865,8 @@ void WorldSession::PreloadDataBeforeEnterWorld(PlayerEnum& pl)
     {
         mmgr->Update(pl._x, pl._y, pl._mapId); // make it load the map files
 		_world->UpdatePos(pl._x,pl._y,pl._mapId);
-		GetInstance()->GetGUI()->SetSceneState(SCENESTATE_LOADING);
+		if(GetInstance()->GetGUI())
+		    GetInstance()->GetGUI()->SetSceneState(SCENESTATE_LOADING);
 
         // preload additional map data only when the GUI is enabled
         // TODO: at some later point we will need the geometry for correct collision calculation, etc...
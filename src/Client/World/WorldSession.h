@@ -2,17 +2,20 @@
 #define _WORLDSESSION_H
 
 #include <deque>
-#include <bitset>
+#include <map>
 
 #include "common.h"
 #include "PseuWoW.h"
-#include "Network/SocketHandler.h"
+#include "SessionSocketHandler.h"
 #include "Player.h"
 #include "Auth/AuthCrypt.h"
 #include "SharedDefines.h"
 #include "ObjMgr.h"
 #include "CacheHandler.h"
 #include "Opcodes.h"
+#include "WorldPacket.h"
+#include "ZCompressor.h"
+#include "SPSCRing.h"
 
 class WorldSocket;
 class WorldPacket;
@@ -20,6 +23,7 @@ class Channel;
 class RealmSession;
 struct OpcodeHandler;
 class World;
+class WorldSession;
 
 struct WhoListEntry
 {
@@ -31,14 +35,6 @@ struct WhoListEntry
     uint32 zoneId;
 };
 
-struct DelayedWorldPacket
-{
-    DelayedWorldPacket() { pkt = NULL; when = clock(); }
-    DelayedWorldPacket(WorldPacket *p, uint32 ms) { pkt = p; when = ms + clock(); }
-    WorldPacket *pkt;
-    clock_t when;
-};
-
 // helper used for GUI
 struct CharacterListExt
 {
@@ -50,11 +46,19 @@ struct CharacterListExt
 };
 
 
+// one slot per opcode id, so that dispatching a packet is a single indexed lookup
+struct OpcodeDispatchEntry
+{
+    void (WorldSession::*handler)(WorldPacket& recvPacket); // NULL if opcode is unknown
+    bool disabled; // set via switchopcodehandler
+    bool hasScript; // true if an "opcode::<name>" script exists
+};
+
 typedef std::vector<WhoListEntry> WhoList;
 typedef std::vector<CharacterListExt> CharList;
-typedef std::deque<DelayedWorldPacket> DelayedPacketQueue;
+typedef std::map<uint64,WorldPacket*> DelayedPacketQueue; // timer id -> packet
 
-class WorldSession
+class WorldSession : public TimerWheelHandler
 {
     friend class Channel;
 
@@ -62,15 +66,21 @@ public:
     WorldSession(PseuInstance *i);
     ~WorldSession();
     void Init(void);
+    void OnTimer(uint64 id, void *arg); // a delayed packet is due
 
     inline PseuInstance *GetInstance(void) { return _instance; }
     inline SCPDatabaseMgr& GetDBMgr(void) { return GetInstance()->dbmgr; }
 
-    void AddToPktQueue(WorldPacket *pkt);
+    void AddToPktQueue(WorldPacket *pkt); // from the socket, which may be handled by the network thread
+    void InjectPacket(WorldPacket *pkt); // from this session's own thread, handled like a received packet
+    void FlushSends(void); // sends what the socket collected with SendBatching
+    inline WorldPacketPool& GetPacketPool(void) { return _pktPool; }
     void Update(void);
     void Start(void);
     inline bool MustDie(void) { return _mustdie; }
     void SetMustDie(void);
+    inline void SetOffline(void) { _offline = true; } // no socket, packets are only fed via HandleWorldPacket(); sent ones are dropped
+    inline uint32 GetDroppedSendCount(void) { return _droppedsends; }
     void SendWorldPacket(WorldPacket&);
     void AddSendWorldPacket(WorldPacket *pkt);
     void AddSendWorldPacket(WorldPacket& pkt);
@@ -108,9 +118,9 @@ public:
 
     void HandleWorldPacket(WorldPacket*);
 
-    inline void DisableOpcode(uint16 opcode) { _disabledOpcodes[opcode] = true; }
-    inline void EnableOpcode(uint16 opcode) { _disabledOpcodes[opcode] = false; }
-    inline bool IsOpcodeDisabled(uint16 opcode) { return _disabledOpcodes[opcode]; }
+    inline void DisableOpcode(uint16 opcode) { _opcodeDispatch[opcode].disabled = true; }
+    inline void EnableOpcode(uint16 opcode) { _opcodeDispatch[opcode].disabled = false; }
+    inline bool IsOpcodeDisabled(uint16 opcode) { return _opcodeDispatch[opcode].disabled; }
 
     PlayerNameCache plrNameCache;
     ObjMgr objmgr;
@@ -119,13 +129,14 @@ public:
 private:
 
     OpcodeHandler *_GetOpcodeHandlerTable(void) const;
+    void _BuildOpcodeDispatchTable(void);
+    void _UpdateOpcodeScriptHooks(void);
 
     // Helpers
     void _OnEnterWorld(void); // = login
     void _OnLeaveWorld(void); // = logout
     void _DoTimedActions(void);
     void _DelayWorldPacket(WorldPacket&, uint32);
-    void _HandleDelayedPackets(void);
     void _SetupObjectFields(void);
 
     // Opcode Handlers
@@ -172,20 +183,30 @@ private:
     void _QueryObjectInfo(uint64 guid);
 
     void _LoadCache(void);
+    void _SetSocketCorked(bool corked); // and send what was collected so far
 
     PseuInstance *_instance;
     WorldSocket *_socket;
-    ZThread::LockedQueue<WorldPacket*,ZThread::FastMutex> pktQueue, sendPktQueue;
+    SPSCRing<WorldPacket*> pktQueue; // socket -> Update()
+    SPSCRing<WorldPacket*> sendPktQueue; // AddSendWorldPacket() -> Update()
+    ZThread::FastMutex _sendPktMutex; // AddSendWorldPacket() is called from the GUI and the session thread, the ring takes one producer
+    std::deque<WorldPacket*> _injectedPktQueue;
+    WorldPacketPool _pktPool; // recycles received packets, see WorldSocket::OnRead()
+    ZInflateStream _inflater; // used for all compressed update packets of this session
+    WorldPacket _inflatePkt; // inflated SMSG_COMPRESSED_UPDATE_OBJECT, storage is kept between packets
     DelayedPacketQueue delayedPktQueue;
     bool _logged,_mustdie; // world status
-    SocketHandler _sh; // handles the WorldSocket
+    bool _offline;
+    uint32 _droppedsends; // packets not sent because the session is offline
+    SessionSocketHandler _sh; // handles the WorldSocket
     Channel *_channels;
     uint64 _myGUID;
     World *_world;
     WhoList _whoList;
     CharList _charList;
     uint32 _lag_ms;
-    std::bitset<MAX_OPCODE_ID> _disabledOpcodes;
+    OpcodeDispatchEntry _opcodeDispatch[MAX_OPCODE_ID];
+    uint32 _opcodeScriptsVersion; // DefScriptPackage::GetScriptsVersion() at the time the script hooks were looked up
 
 };
 
@@ -11,10 +11,28 @@ WorldSocket::WorldSocket(SocketHandler &h, WorldSession *s) : TcpSocket(h)
     _session = s;
     _gothdr = false;
     _ok=false;
+    _corked = false;
+    _sentpackets = _writes = 0;
+    _sentbytes = 0;
 
     //Dummy functions for unencrypted packets on WorldSocket
     pDecryptRecv = &AuthCrypt::DecryptRecvDummy;
     pEncryptSend = &AuthCrypt::EncryptSendDummy;
+
+    PseuInstanceConf *conf = s->GetInstance()->GetConf();
+    if(conf->packetcapture.size())
+    {
+        // every bot of a swarm gets its own file
+        std::string fn = conf->packetcapture;
+        if(conf->swarmindex)
+            fn += "." + toString(conf->swarmindex);
+        _capture.Open(fn.c_str(), conf->clientbuild);
+    }
+}
+
+WorldSocket::~WorldSocket()
+{
+    logdebug("WorldSocket: sent %u packets (%s) with %u writes",_sentpackets,FilesizeFormat(_sentbytes).c_str(),_writes);
 }
 
 bool WorldSocket::IsOk(void)
@@ -70,10 +88,10 @@ void WorldSocket::OnRead()
                 break;
             }
             _gothdr=false;
-            WorldPacket *wp = new WorldPacket(_remaining);
-            wp->resize(_remaining);
+            WorldPacket *wp = GetSession()->GetPacketPool().Acquire(_opcode,_remaining);
             ibuf.Read((char*)wp->contents(),_remaining);
-            wp->SetOpcode(_opcode);
+            if(_capture.IsOpen())
+                _capture.Write(_opcode,wp->contents(),_remaining);
             GetSession()->AddToPktQueue(wp);
         }
         else // no pending header stored, so this packet must be a header
@@ -135,8 +153,9 @@ void WorldSocket::OnRead()
             // the header is fine, now check if there are more data
             if(_remaining == 0) // this is a packet with no data (like CMSG_NULL_ACTION)
             {
-                WorldPacket *wp = new WorldPacket;
-                wp->SetOpcode(_opcode);
+                WorldPacket *wp = GetSession()->GetPacketPool().Acquire(_opcode,0);
+                if(_capture.IsOpen())
+                    _capture.Write(_opcode,NULL,0);
                 GetSession()->AddToPktQueue(wp);
             }
             else // there is a data part to fetch
@@ -156,11 +175,53 @@ void WorldSocket::SendWorldPacket(WorldPacket &pkt)
     hdr.size = ntohs(pkt.size()+4);
     hdr.cmd = pkt.GetOpcode();
     (_crypt.*pEncryptSend)((uint8*)&hdr, 6);
-    ByteBuffer final(pkt.size()+6);
-    final.append((uint8*)&hdr,sizeof(ClientPktHeader));
+    _outbuf.append((uint8*)&hdr,sizeof(ClientPktHeader));
     if(pkt.size())
-        final.append(pkt.contents(),pkt.size());
-    SendBuf((char*)final.contents(),final.size());
+        _outbuf.append(pkt.contents(),pkt.size());
+    _sentpackets++;
+    if(!_corked || _outbuf.size() >= WORLDSOCKET_CORK_LIMIT)
+        Flush();
+}
+
+void WorldSocket::SetCorked(bool corked)
+{
+    _corked = corked;
+    if(!corked)
+        Flush();
+}
+
+void WorldSocket::Flush(void)
+{
+    if(!_outbuf.size())
+        return;
+    const char *buf = (const char*)_outbuf.contents();
+    size_t len = _outbuf.size(), sent = 0;
+    // if nothing is waiting in the output buffer, write directly and save copying everything into it.
+    // whatever the kernel doesn't take now goes to the output buffer and is sent when the socket is writable.
+    if(!GetOutputLength() && Ready() && !IsSSL())
+    {
+        int n = send(GetSocket(), buf, (int)len, MSG_NOSIGNAL);
+        if(n > 0)
+            sent = n;
+#ifdef _WIN32
+        else if(n < 0 && Errno != WSAEWOULDBLOCK && Errno != WSAEINTR)
+#else
+        else if(n < 0 && Errno != EWOULDBLOCK && Errno != EAGAIN && Errno != EINTR)
+#endif
+        {
+            // the connection is broken, close it the way TcpSocket does when a buffered write fails
+            logerror("WorldSocket: send failed: %s", StrError(Errno));
+            SetCloseAndDelete(true);
+            SetLost();
+            _outbuf.clear();
+            return;
+        }
+    }
+    if(sent < len)
+        SendBuf(buf + sent, len - sent);
+    _writes++;
+    _sentbytes += len;
+    _outbuf.clear();
 }
 
 void WorldSocket::InitCrypt(BigNumber *k)
@@ -3,6 +3,8 @@
 
 #include "Network/TcpSocket.h"
 #include "SysDefs.h"
+#include "PacketCapture.h"
+#include "ByteBuffer.h"
 
 class WorldSession;
 class BigNumber;
@@ -41,11 +43,14 @@ struct ServerPktHeaderBig
 #pragma pack(pop)
 #endif
 
+// corked packets are sent at the latest when this many bytes are collected
+#define WORLDSOCKET_CORK_LIMIT 65536
 
 class WorldSocket : public TcpSocket
 {
 public:
     WorldSocket(SocketHandler &h, WorldSession *s);
+    ~WorldSocket();
     WorldSession *GetSession(void) { return _session; }
     bool IsOk();
     
@@ -55,7 +60,9 @@ public:
     void OnDelete();
     void OnException();
 
-    void SendWorldPacket(WorldPacket &pkt);
+    void SendWorldPacket(WorldPacket &pkt); // sent right away unless corked
+    void SetCorked(bool corked); // while corked, packets are collected and sent with one write by Flush() or uncorking
+    void Flush(void);
     void InitCrypt(BigNumber *);
 
 private:
@@ -68,6 +75,11 @@ private:
     uint16 _opcode; // stores the last recieved opcode
     uint32 _remaining; // bytes amount of the next data packet
     bool _ok;
+    bool _corked;
+    ByteBuffer _outbuf; // encrypted packets not yet handed to the socket, storage is kept
+    uint32 _sentpackets, _writes;
+    uint64 _sentbytes;
+    PacketCaptureWriter _capture; // only open if "PacketCapture" is set in the conf
 
 };
 
@@ -4,6 +4,8 @@
 #include "main.h"
 #include "PseuWoW.h"
 #include "MemoryDataHolder.h"
+#include "SessionSocketHandler.h"
+#include "World/CacheHandler.h"
 
 
 std::list<PseuInstanceRunnable*> instanceList; // TODO: move this to a "Master" class later
@@ -58,7 +60,8 @@ void quitproc(void)
     log("Waiting for all instances to finish... [%u]\n",instanceList.size());
     for(std::list<PseuInstanceRunnable*>::iterator i=instanceList.begin();i!=instanceList.end();i++)
     {
-        (*i)->GetInstance()->Stop();
+        if((*i)->GetInstance())
+            (*i)->GetInstance()->Stop();
     }
 }
 
@@ -67,6 +70,8 @@ void abortproc(void)
     log("Terminating all instances... [%u]\n",instanceList.size());
     for(std::list<PseuInstanceRunnable*>::iterator i=instanceList.begin();i!=instanceList.end();i++)
     {
+        if(!(*i)->GetInstance())
+            continue;
         (*i)->GetInstance()->SetFastQuit(true);
         (*i)->GetInstance()->Stop();
     }
@@ -78,6 +83,46 @@ void _new_handler(void)
     throw;
 }
 
+// starts the bots one after another, so that the first one loads everything that is shared
+// and the memory each one needs on top of that can be measured
+void _RunSwarm(uint32 count)
+{
+    std::list<ZThread::Thread*> threads;
+    uint32 memstart = GetProcessMemoryUsage(), memlast = memstart, memfirst = 0;
+    log("Swarm: starting %u bots, process uses %u KB",count,memstart);
+
+    for(uint32 i = 1; i <= count; i++)
+    {
+        PseuInstanceRunnable *r = new PseuInstanceRunnable(i);
+        instanceList.push_back(r);
+        threads.push_back(new ZThread::Thread(r));
+        while(!r->IsInitDone())
+            ZThread::Thread::sleep(5);
+
+        uint32 mem = GetProcessMemoryUsage();
+        log("Swarm: bot %u/%u initialized, %+d KB (total %u KB)",i,count,int32(mem - memlast),mem);
+        if(i == 1)
+            memfirst = mem - memlast;
+        memlast = mem;
+
+        PseuInstance *ins = r->GetInstance();
+        if(ins && i < count)
+        {
+            for(uint32 t = 0; t < ins->GetConf()->swarmlogindelay && !ins->Stopped(); t += 50)
+                ZThread::Thread::sleep(50);
+        }
+    }
+    if(count > 1)
+        log("Swarm: all %u bots up. First bot: %d KB, each further bot: %d KB on average",
+            count, int32(memfirst), int32(memlast - memstart - memfirst) / int32(count - 1));
+
+    for(std::list<ZThread::Thread*>::iterator it = threads.begin(); it != threads.end(); it++)
+    {
+        (*it)->wait();
+        delete *it;
+    }
+}
+
 #if PLATFORM == PLATFORM_WIN32 && !defined(_CONSOLE)
 int CALLBACK WinMain( IN HINSTANCE hInstance, IN HINSTANCE hPrevInstance, IN LPSTR lpCmdLine, IN int nShowCmd)
 {
@@ -99,17 +144,36 @@ int main(int argc, char* argv[])
         logcustom(0,GREEN,"Compiler: %s ("COMPILER_VERSION_OUT")",COMPILER_NAME,COMPILER_VERSION);
         logcustom(0,GREEN,"Compiled: %s  %s",__DATE__,__TIME__);
 
+        uint32 swarmsize = 0;
+        for(int a = 1; a < argc; a++)
+        {
+            if((!strcmp(argv[a],"-swarm") || !strcmp(argv[a],"--swarm")) && a + 1 < argc)
+                swarmsize = atoi(argv[++a]);
+        }
+
         _HookSignals();
         MemoryDataHolder::Init();
 
-        // 1 instance is enough for now
-        PseuInstanceRunnable *r=new PseuInstanceRunnable();
-        ZThread::Thread t(r);
-        instanceList.push_back(r);
-        t.setPriority((ZThread::Priority)2);
-        //...
-        t.wait();
-        //...
+        if(swarmsize)
+        {
+            _RunSwarm(swarmsize);
+        }
+        else
+        {
+            // 1 instance is enough for now
+            PseuInstanceRunnable *r=new PseuInstanceRunnable();
+            ZThread::Thread t(r);
+            instanceList.push_back(r);
+            t.setPriority((ZThread::Priority)2);
+            //...
+            t.wait();
+            //...
+        }
+        SCPDatabaseMgr::DropSharedDBs();
+        PrototypeCache_Delete();
+        DefScriptPackage::ClearSharedScripts();
+        SessionSocketHandler::Shutdown();
+        MemoryDataHolder::LogCacheStats();
         log_close();
         MemoryDataHolder::Shutdown();
         _UnhookSignals();
@@ -7,6 +7,7 @@ void _OnSignal(int);
 void quitproc(void);
 void abortproc(void);
 void _new_handler(void);
+void _RunSwarm(uint32);
 int main(int,char**);
 
 #endif
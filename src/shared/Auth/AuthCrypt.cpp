@@ -77,6 +77,31 @@ void AuthCrypt::EncryptSend_12340(uint8 *data, size_t len)
     _encrypt.UpdateData(len, data);
 }
 
+// server side: encrypts with the key the client decrypts with and vice versa
+void AuthCrypt::ServerInit_12340(BigNumber *K)
+{
+    uint8 ClientDecryptionKey[SEED_KEY_SIZE] = { 0xCC, 0x98, 0xAE, 0x04, 0xE8, 0x97, 0xEA, 0xCA, 0x12, 0xDD, 0xC0, 0x93, 0x42, 0x91, 0x53, 0x57 };
+    HmacHash serverEncryptHmac(SEED_KEY_SIZE, (uint8*)ClientDecryptionKey);
+    uint8 *encryptHash = serverEncryptHmac.ComputeHash(K);
+
+    uint8 ServerEncryptionKey[SEED_KEY_SIZE] = { 0xC2, 0xB3, 0x72, 0x3C, 0xC6, 0xAE, 0xD9, 0xB5, 0x34, 0x3C, 0x53, 0xEE, 0x2F, 0x43, 0x67, 0xCE };
+    HmacHash clientDecryptHmac(SEED_KEY_SIZE, (uint8*)ServerEncryptionKey);
+    uint8 *decryptHash = clientDecryptHmac.ComputeHash(K);
+
+    _decrypt.Init(decryptHash);
+    _encrypt.Init(encryptHash);
+
+    uint8 syncBuf[1024];
+
+    memset(syncBuf, 0, 1024);
+    _encrypt.UpdateData(1024, syncBuf);
+
+    memset(syncBuf, 0, 1024);
+    _decrypt.UpdateData(1024, syncBuf);
+
+    _initialized = true;
+}
+
 
 void AuthCrypt::Init_8606(BigNumber *K)
 {
@@ -145,6 +170,40 @@ void AuthCrypt::EncryptSend_6005(uint8 *data, size_t len)
 
 }
 
+// server side: the 6 byte client header is decrypted, the 4 byte server header encrypted
+void AuthCrypt::ServerDecryptRecv_6005(uint8 *data, size_t len)
+{
+    if (!_initialized)
+        return;
+    if (len < CRYPTED_SEND_LEN_6005)
+        return;
+
+    for (size_t t = 0; t < CRYPTED_SEND_LEN_6005; t++)
+    {
+        _recv_i %= _key.size();
+        uint8 x = (data[t] - _recv_j) ^ _key[_recv_i];
+        ++_recv_i;
+        _recv_j = data[t];
+        data[t] = x;
+    }
+}
+
+void AuthCrypt::ServerEncryptSend_6005(uint8 *data, size_t len)
+{
+    if (!_initialized)
+        return;
+    if (len < CRYPTED_RECV_LEN_6005)
+        return;
+
+    for (size_t t = 0; t < CRYPTED_RECV_LEN_6005; t++)
+    {
+        _send_i %= _key.size();
+        uint8 x = (data[t] ^ _key[_send_i]) + _send_j;
+        ++_send_i;
+        data[t] = _send_j = x;
+    }
+}
+
 void AuthCrypt::SetKey_6005(uint8 *key, size_t len)
 {
     _key.resize(len);
@@ -48,6 +48,11 @@ class AuthCrypt
         void DecryptRecv_6005(uint8 *, size_t);
         void EncryptSend_6005(uint8 *, size_t);
 
+        //server side, used by the stub server tool. the 2.4.3 server inits with Init_8606()
+        void ServerInit_12340(BigNumber *K);
+        void ServerDecryptRecv_6005(uint8 *, size_t);
+        void ServerEncryptSend_6005(uint8 *, size_t);
+
         bool IsInitialized() { return _initialized; }
 
         const static size_t CRYPTED_SEND_LEN_6005 = 6;
@@ -239,6 +239,7 @@ class ByteBuffer
         const uint8 *contents() const { return &_storage[0]; };
 
         inline size_t size() const { return _storage.size(); };
+        inline size_t capacity() const { return _storage.capacity(); };
 
         void resize(size_t newsize)
         {
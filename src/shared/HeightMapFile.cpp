@@ -0,0 +1,249 @@
+#include <fstream>
+#include <math.h>
+#include "common.h"
+#include "log.h"
+#include "MapTile.h"
+#include "HeightMapFile.h"
+
+// stores count heights relative to zmin in 16 bits each
+static void QuantizeHeights(const float *in, uint32 count, float base, float& zmin, float& zstep, uint16 *out)
+{
+    float lo = in[0], hi = in[0];
+    for(uint32 i = 1; i < count; i++)
+    {
+        if(in[i] < lo)
+            lo = in[i];
+        if(in[i] > hi)
+            hi = in[i];
+    }
+    zmin = base + lo;
+    zstep = (hi - lo) / 65535.0f;
+    for(uint32 i = 0; i < count; i++)
+        out[i] = zstep > 0 ? uint16((in[i] - lo) / zstep + 0.5f) : 0;
+}
+
+bool HeightMapFile::Open(const char *fn)
+{
+    if(!_file.Open(fn))
+        return false;
+
+    const HeightMapHeader *hdr = (const HeightMapHeader*)_file.GetData();
+    if(_file.GetSize() < sizeof(HeightMapHeader) || memcmp(hdr->magic, HEIGHTMAP_MAGIC, 4) || hdr->version != HEIGHTMAP_VERSION)
+    {
+        logerror("HeightMapFile: '%s' is not a valid heightmap (version %u required)", fn, HEIGHTMAP_VERSION);
+        _file.Close();
+        return false;
+    }
+    for(uint32 i = 0; i < 64*64; i++)
+    {
+        uint32 offs = hdr->offsets[i];
+        if(offs && (offs < sizeof(HeightMapHeader) || offs % 4 || uint64(offs) + sizeof(HeightMapTile) > _file.GetSize()))
+        {
+            logerror("HeightMapFile: '%s' is damaged (tile %u out of file bounds)", fn, i);
+            _file.Close();
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32 HeightMapFile::GetTileCount(void) const
+{
+    return IsOpen() ? ((const HeightMapHeader*)_file.GetData())->tiles : 0;
+}
+
+bool HeightMapFile::HasTile(uint32 gx, uint32 gy) const
+{
+    return gx < 64 && gy < 64 && _GetTile(gy*64 + gx);
+}
+
+const HeightMapTile *HeightMapFile::_GetTile(uint32 pos) const
+{
+    if(!IsOpen() || pos >= 64*64)
+        return NULL;
+    uint32 offs = ((const HeightMapHeader*)_file.GetData())->offsets[pos];
+    return offs ? (const HeightMapTile*)(_file.GetData() + offs) : NULL;
+}
+
+const HeightMapTile *HeightMapFile::_GetTile(float x, float y) const
+{
+    // same as MapMgr::GetTransformGridCoordPair(), x and y are swapped
+    float gx = (ZEROPOINT - y) / TILESIZE;
+    float gy = (ZEROPOINT - x) / TILESIZE;
+    if(gx < 0 || gy < 0 || gx >= 64 || gy >= 64)
+        return NULL;
+    return _GetTile(uint32(gy)*64 + uint32(gx));
+}
+
+float HeightMapFile::GetZ(float x, float y) const
+{
+    const HeightMapTile *tile = _GetTile(x,y);
+    if(!tile)
+        return INVALID_HEIGHT;
+
+    float fx = (tile->basex - x) / UNITSIZE;
+    float fy = (tile->basey - y) / UNITSIZE;
+    if(!(fx >= 0.0f && fx <= 128.0f && fy >= 0.0f && fy <= 128.0f))
+        return INVALID_HEIGHT;
+    uint32 r = uint32(fx), c = uint32(fy);
+    if(r > 127)
+        r = 127;
+    if(c > 127)
+        c = 127;
+    const HeightMapChunk& ch = tile->chunks[(r / 8) * 16 + (c / 8)];
+    uint32 lr = r % 8, lc = c % 8;
+    const uint16 *o = &ch.rough[lr * 9 + lc];
+    return InterpolateCellHeight(ch.zmin + o[0] * ch.zstep, ch.zmin + o[1] * ch.zstep,
+        ch.zmin + o[9] * ch.zstep, ch.zmin + o[10] * ch.zstep, ch.zmin + ch.fine[lr * 8 + lc] * ch.zstep,
+        fx - r, fy - c);
+}
+
+bool HeightMapFile::GetTileHeights(uint32 gx, uint32 gy, float *grid) const
+{
+    if(gx >= 64 || gy >= 64)
+        return false;
+    const HeightMapTile *tile = _GetTile(gy*64 + gx);
+    if(!tile)
+        return false;
+    for(uint32 c = 0; c < 256; c++)
+    {
+        const HeightMapChunk& ch = tile->chunks[c];
+        float *out = grid + (c / 16) * 8 * 129 + (c % 16) * 8;
+        for(uint32 r = 0; r < 9; r++)
+            for(uint32 v = 0; v < 9; v++)
+                out[r * 129 + v] = ch.zmin + ch.rough[r * 9 + v] * ch.zstep;
+    }
+    return true;
+}
+
+float HeightMapFile::GetLiquidZ(float x, float y) const
+{
+    const HeightMapTile *tile = _GetTile(x,y);
+    if(!tile || !(tile->flags & HMT_LIQUID))
+        return INVALID_HEIGHT;
+    uint32 offs = (const uint8*)tile - _file.GetData() + sizeof(HeightMapTile);
+    if(uint64(offs) + sizeof(HeightMapLiquid) * 256 > _file.GetSize())
+        return INVALID_HEIGHT;
+
+    uint32 chx = (uint32)fabs((tile->basex - x) / CHUNKSIZE);
+    uint32 chy = (uint32)fabs((tile->basey - y) / CHUNKSIZE);
+    if(chx > 15 || chy > 15)
+        return INVALID_HEIGHT;
+    const HeightMapChunk& ch = tile->chunks[chx*16 + chy];
+    const HeightMapLiquid& lq = ((const HeightMapLiquid*)(_file.GetData() + offs))[chx*16 + chy];
+    if(lq.zstep < 0)
+        return INVALID_HEIGHT;
+
+    uint32 vx = (uint32)floor((fabs(ch.basex - x) / (CHUNKSIZE/8.0f)) + 0.5f);
+    uint32 vy = (uint32)floor((fabs(ch.basey - y) / (CHUNKSIZE/8.0f)) + 0.5f);
+    if(vx > 8 || vy > 8)
+        return INVALID_HEIGHT;
+    return lq.zmin + lq.h[vx*9 + vy] * lq.zstep;
+}
+
+
+void HeightMapWriter::AddTile(uint32 gx, uint32 gy, ADTFile& adt)
+{
+    if(gx >= 64 || gy >= 64 || _tiles.count(gy*64 + gx))
+        return;
+    std::vector<uint8> data;
+    BuildTile(adt, data);
+    AddTile(gx, gy, data);
+}
+
+void HeightMapWriter::AddTile(uint32 gx, uint32 gy, std::vector<uint8>& data)
+{
+    if(gx >= 64 || gy >= 64 || _tiles.count(gy*64 + gx))
+        return;
+    _tiles[gy*64 + gx].swap(data);
+}
+
+void HeightMapWriter::BuildTile(ADTFile& adt, std::vector<uint8>& data)
+{
+    HeightMapTile *tile = new HeightMapTile();
+    HeightMapLiquid *liquid = new HeightMapLiquid[CHUNKS_PER_TILE];
+    memset(tile, 0, sizeof(HeightMapTile));
+    memset(liquid, 0, sizeof(HeightMapLiquid) * CHUNKS_PER_TILE);
+    for(uint32 c = 0; c < CHUNKS_PER_TILE; c++)
+    {
+        ADTMapChunk& ac = adt._chunks[c];
+        HeightMapChunk& ch = tile->chunks[c];
+        ch.basex = ac.hdr.xbase; // same coord swapping as in MapTile::ImportFromADT()
+        ch.basey = ac.hdr.ybase;
+
+        // split the 145 vertices into outer and inner ones, format: 9 outer, 8 inner, 9 outer, ... , 9 outer
+        float rough[9*9], fine[8*8];
+        for(uint32 row = 0, r = 0, f = 0, v = 0; row < 17; row++)
+        {
+            if(row % 2 == 0)
+                for(uint32 i = 0; i < 9; i++)
+                    rough[r++] = ac.vertices[v++];
+            else
+                for(uint32 i = 0; i < 8; i++)
+                    fine[f++] = ac.vertices[v++];
+        }
+        // quantize both with one common range so they share zmin/zstep
+        float all[9*9 + 8*8];
+        uint16 q[9*9 + 8*8];
+        memcpy(all, rough, sizeof(rough));
+        memcpy(all + 9*9, fine, sizeof(fine));
+        QuantizeHeights(all, 9*9 + 8*8, ac.hdr.zbase, ch.zmin, ch.zstep, q);
+        memcpy(ch.rough, q, sizeof(ch.rough));
+        memcpy(ch.fine, q + 9*9, sizeof(ch.fine));
+
+        HeightMapLiquid& lq = liquid[c];
+        if(ac.haswater)
+        {
+            float lqh[9*9];
+            for(uint32 i = 0; i < 9*9; i++)
+                lqh[i] = ac.lqvertex[i].h;
+            QuantizeHeights(lqh, 9*9, 0, lq.zmin, lq.zstep, lq.h);
+            tile->flags |= HMT_LIQUID;
+        }
+        else
+        {
+            lq.zmin = INVALID_HEIGHT;
+            lq.zstep = -1;
+        }
+    }
+    tile->basex = tile->chunks[0].basex;
+    tile->basey = tile->chunks[0].basey;
+
+    data.clear();
+    data.insert(data.end(), (uint8*)tile, (uint8*)tile + sizeof(HeightMapTile));
+    if(tile->flags & HMT_LIQUID)
+        data.insert(data.end(), (uint8*)liquid, (uint8*)(liquid + CHUNKS_PER_TILE));
+
+    delete tile;
+    delete [] liquid;
+}
+
+bool HeightMapWriter::Save(const char *fn, uint32 mapid)
+{
+    HeightMapHeader *hdr = new HeightMapHeader();
+    memset(hdr, 0, sizeof(HeightMapHeader));
+    memcpy(hdr->magic, HEIGHTMAP_MAGIC, 4);
+    hdr->version = HEIGHTMAP_VERSION;
+    hdr->mapid = mapid;
+    hdr->tiles = _tiles.size();
+    uint32 offs = sizeof(HeightMapHeader);
+    for(std::map<uint32, std::vector<uint8> >::iterator it = _tiles.begin(); it != _tiles.end(); it++)
+    {
+        hdr->offsets[it->first] = offs;
+        offs += it->second.size();
+    }
+
+    std::fstream fh;
+    fh.open(fn, std::ios_base::out | std::ios_base::binary);
+    if(!fh.is_open())
+    {
+        delete hdr;
+        return false;
+    }
+    fh.write((char*)hdr, sizeof(HeightMapHeader));
+    for(std::map<uint32, std::vector<uint8> >::iterator it = _tiles.begin(); it != _tiles.end(); it++)
+        fh.write((char*)&it->second[0], it->second.size());
+    fh.close();
+    delete hdr;
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef _HEIGHTMAPFILE_H
+#define _HEIGHTMAPFILE_H
+
+#include <vector>
+#include <map>
+#include "SysDefs.h"
+#include "MappedFile.h"
+
+class ADTFile;
+
+// compact, height-only map format (*.hmap), one file per map. written by stuffextract (+heightmaps),
+// used instead of the ADT files if only heights are needed (no GUI).
+// all structures are stored as-is (little endian), so the file can be used directly from a memory mapping.
+//
+// layout: HeightMapHeader, then for each existing tile a HeightMapTile,
+// followed by CHUNKS_PER_TILE HeightMapLiquid if the tile has the HMT_LIQUID flag.
+
+#define HEIGHTMAP_MAGIC "HMAP"
+#define HEIGHTMAP_VERSION 1
+
+enum HeightMapTileFlags
+{
+    HMT_LIQUID = 0x01, // liquid heights follow the tile
+};
+
+// the 9x9 outer and 8x8 inner vertices of a chunk, each quantized to 16 bits: z = zmin + value * zstep
+struct HeightMapChunk
+{
+    float basex, basey;
+    float zmin, zstep;
+    uint16 rough[9*9];
+    uint16 fine[8*8];
+    uint16 pad;
+};
+
+struct HeightMapLiquid
+{
+    float zmin, zstep; // zstep < 0 means there is no liquid in this chunk
+    uint16 h[9*9];
+    uint16 pad;
+};
+
+struct HeightMapTile
+{
+    uint32 flags;
+    uint32 reserved;
+    float basex, basey; // same as chunks[0]
+    HeightMapChunk chunks[256];
+};
+
+struct HeightMapHeader
+{
+    char magic[4];
+    uint32 version;
+    uint32 mapid;
+    uint32 tiles; // number of tiles stored
+    uint32 offsets[64*64]; // file offset of each tile (y*64 + x), 0 if not present
+};
+
+class HeightMapFile
+{
+public:
+    bool Open(const char *fn);
+    inline void Close(void) { _file.Close(); }
+    inline bool IsOpen(void) const { return _file.IsOpen(); }
+    inline uint32 GetSize(void) const { return _file.GetSize(); }
+    uint32 GetTileCount(void) const;
+    bool HasTile(uint32 gx, uint32 gy) const;
+    float GetZ(float x, float y) const; // interpolated like MapTile::GetZ(); INVALID_HEIGHT if no data
+    float GetLiquidZ(float x, float y) const; // nearest liquid vertex; INVALID_HEIGHT if there is no liquid
+    bool GetTileHeights(uint32 gx, uint32 gy, float *grid) const; // 129x129 outer vertex heights, like MapTile::GetHeightGrid()
+
+private:
+    const HeightMapTile *_GetTile(float x, float y) const;
+    const HeightMapTile *_GetTile(uint32 pos) const;
+
+    MappedFile _file;
+};
+
+// collects tiles from ADT files and writes them as .hmap file.
+// tiles are written in grid order, no matter in which order they were added.
+class HeightMapWriter
+{
+public:
+    void AddTile(uint32 gx, uint32 gy, ADTFile& adt);
+    void AddTile(uint32 gx, uint32 gy, std::vector<uint8>& data); // takes over data from BuildTile(), leaves it empty
+    static void BuildTile(ADTFile& adt, std::vector<uint8>& data); // needs no writer, so it can run without holding a lock
+    bool Save(const char *fn, uint32 mapid);
+    inline uint32 GetTileCount(void) const { return _tiles.size(); }
+
+private:
+    std::map<uint32, std::vector<uint8> > _tiles; // tile (y*64 + x) -> HeightMapTile, and liquid data if present
+};
+
+#endif
@@ -31,6 +31,31 @@ ByteBuffer MPQFile::ReadFile(const char *fn)
     return bb;
 }
 
+// same, but reads directly into a buffer the caller takes over
+uint8 *MPQFile::ReadFile(const char *fn, uint32& size)
+{
+    HANDLE fh;
+    size = 0;
+    if(!SFileOpenFileEx(_mpq, fn, 0, &fh))
+        return NULL;
+    uint32 fsize = SFileGetFileSize(fh);
+    uint8 *buf = NULL;
+    if(fsize && fsize != SFILE_INVALID_SIZE)
+    {
+        buf = new uint8[fsize];
+        DWORD rd = 0;
+        if(SFileReadFile(fh, buf, fsize, &rd, NULL) && rd == fsize)
+            size = fsize;
+        else
+        {
+            delete [] buf;
+            buf = NULL;
+        }
+    }
+    SFileCloseFile(fh);
+    return buf;
+}
+
 uint32 MPQFile::GetFileSize(const char *fn)
 {
     HANDLE fh;
@@ -13,6 +13,8 @@ public:
 	~MPQFile();
     inline bool IsOpen(void) { return _isopen; }
     ByteBuffer ReadFile(const char*);
+    uint8 *ReadFile(const char*, uint32& size); // returns a new[] buffer, NULL on error
+    inline HANDLE GetHandle(void) { return _mpq; }
     uint32 GetFileSize(const char*);
     bool HasFile(const char*);
 	void Close(void);
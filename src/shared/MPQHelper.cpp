@@ -1,4 +1,5 @@
 #include <vector>
+#include <algorithm>
 #include "common.h"
 #include "MPQHelper.h"
 #include "MPQFile.h"
@@ -9,6 +10,8 @@
 
 MPQHelper::MPQHelper()
 {
+    _index = NULL;
+    _ownindex = false;
 }
 
 void MPQHelper::Init()
@@ -65,45 +68,159 @@ void MPQHelper::Init()
         if(::FileExists(*it))
         {
             _files.push_back(new MPQFile((*it).c_str()));
+            _filenames.push_back(*it);
         }
     }
+    _BuildIndex();
+}
+
+void MPQHelper::InitFrom(const MPQHelper& other)
+{
+    for(uint32 i = 0; i < other._filenames.size(); i++)
+    {
+        _files.push_back(new MPQFile(other._filenames[i].c_str()));
+        _filenames.push_back(other._filenames[i]);
+    }
+    _index = other._index;
+    _ownindex = false;
 }
 
 MPQHelper::~MPQHelper()
 {
-    for(std::list<MPQFile*>::iterator it=_files.begin(); it != _files.end(); it++)
+    for(std::vector<MPQFile*>::iterator it=_files.begin(); it != _files.end(); it++)
     {
         (*it)->Close();
         delete *it;
     }
+    if(_ownindex)
+        delete _index;
 }
 
-ByteBuffer MPQHelper::ExtractFile(const char* fn)
+// FNV-1a over the name like StormLib sees it: case insensitive, '/' is the same as '\\'
+uint64 MPQIndex::Hash(const char *fn)
 {
-    ByteBuffer bb;
-    for(std::list<MPQFile*>::iterator i = _files.begin(); i != _files.end(); i++)
+    uint64 h = 14695981039346656037ULL;
+    for( ; *fn; fn++)
     {
-        MPQFile *mpq = *i;
-        if(mpq->IsOpen() && mpq->HasFile(fn) && mpq->GetFileSize(fn) > 0)
+        char c = *fn == '/' ? '\\' : toupper(*fn);
+        h = (h ^ uint8(c)) * 1099511628211ULL;
+    }
+    return h;
+}
+
+const MPQIndex::Entry *MPQIndex::Find(const char *fn) const
+{
+    Entry e;
+    e.hash = Hash(fn);
+    std::vector<Entry>::const_iterator it = std::lower_bound(entries.begin(), entries.end(), e);
+    return it != entries.end() && it->hash == e.hash ? &*it : NULL;
+}
+
+// list all files of all archives once, so that a lookup doesn't have to ask every archive
+void MPQHelper::_BuildIndex(void)
+{
+    uint32 ms = getMSTime();
+    _index = new MPQIndex;
+    _ownindex = true;
+    _index->unindexed.resize(_files.size(), false);
+    for(uint32 i = 0; i < _files.size(); i++)
+    {
+        if(!_files[i]->IsOpen())
+            continue;
+        SFILE_FIND_DATA fd;
+        HANDLE fh = SFileFindFirstFile(_files[i]->GetHandle(), "*", &fd, NULL);
+        if(!fh)
+        {
+            _index->unindexed[i] = true;
+            continue;
+        }
+        do
         {
-           // printf("MPQE: Using %s from %s\n",fn,i->c_str());
-            bb = mpq->ReadFile(fn);
-            return bb;
+            if(!fd.dwFileSize || !strcmp(fd.cFileName, LISTFILE_NAME) || !strcmp(fd.cFileName, ATTRIBUTES_NAME))
+                continue;
+            // not all names are in the listfile, files of this archive can only be found by asking it
+            if(IsPseudoFileName(fd.cFileName, NULL))
+            {
+                _index->unindexed[i] = true;
+                continue;
+            }
+            MPQIndex::Entry e;
+            e.hash = MPQIndex::Hash(fd.cFileName);
+            e.size = fd.dwFileSize;
+            e.archive = i;
+            _index->entries.push_back(e);
         }
+        while(SFileFindNextFile(fh, &fd));
+        SFileFindClose(fh);
     }
-    return bb; // will be empty if returned here
+    // for files in more than one archive, keep the entry of the archive that comes first
+    std::stable_sort(_index->entries.begin(), _index->entries.end());
+    std::vector<MPQIndex::Entry>& v = _index->entries;
+    uint32 n = 0;
+    for(uint32 i = 0; i < v.size(); i++)
+        if(!n || v[i].hash != v[n-1].hash)
+            v[n++] = v[i];
+    v.resize(n);
+    std::vector<MPQIndex::Entry>(v).swap(v); // trim capacity
+
+    logdetail("MPQHelper: indexed %u files in %u archives in %u ms", (uint32)_index->entries.size(), (uint32)_files.size(), getMSTime() - ms);
 }
 
-bool MPQHelper::FileExists(const char *fn)
+// returns the archive a file should be read from
+MPQFile *MPQHelper::_FindFile(const char *fn, uint32 *size)
 {
-    for(std::list<MPQFile*>::iterator i = _files.begin(); i != _files.end(); i++)
+    const MPQIndex::Entry *e = _index ? _index->Find(fn) : NULL;
+    // archives without (complete) listfile that come before the indexed one could still override the file,
+    // and files not in the index at all can only be in those
+    uint32 end = e ? e->archive : _files.size();
+    for(uint32 i = 0; i < end; i++)
     {
-        if((*i)->IsOpen() && (*i)->HasFile(fn) && (*i)->GetFileSize(fn) > 0)
-            return true;
+        MPQFile *mpq = _files[i];
+        if(_index && !_index->unindexed[i])
+            continue;
+        if(mpq->IsOpen() && mpq->HasFile(fn))
+        {
+            uint32 s = mpq->GetFileSize(fn);
+            if(s)
+            {
+                if(size)
+                    *size = s;
+                return mpq;
+            }
+        }
     }
-    return false;
+    if(e && _files[e->archive]->IsOpen())
+    {
+        if(size)
+            *size = e->size;
+        return _files[e->archive];
+    }
+    return NULL;
 }
 
+ByteBuffer MPQHelper::ExtractFile(const char* fn)
+{
+    ByteBuffer bb;
+    if(MPQFile *mpq = _FindFile(fn))
+        bb = mpq->ReadFile(fn);
+    return bb; // will be empty if not found
+}
 
+uint8 *MPQHelper::ExtractFile(const char* fn, uint32& size)
+{
+    size = 0;
+    MPQFile *mpq = _FindFile(fn);
+    return mpq ? mpq->ReadFile(fn, size) : NULL;
+}
 
+bool MPQHelper::FileExists(const char *fn)
+{
+    return _FindFile(fn) != NULL;
+}
 
+uint32 MPQHelper::GetFileSize(const char *fn)
+{
+    uint32 size = 0;
+    _FindFile(fn, &size);
+    return size;
+}
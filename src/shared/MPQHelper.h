@@ -5,17 +5,49 @@
 
 class MPQFile;
 
+// which archive to read each file from, built once from the archives' listfiles.
+// read-only after building, so it can be shared between threads.
+class MPQIndex
+{
+public:
+    struct Entry
+    {
+        uint64 hash; // of the normalized file name
+        uint32 size;
+        uint32 archive; // position in patch order
+        bool operator<(const Entry& e) const { return hash < e.hash; }
+    };
+    const Entry *Find(const char*) const;
+    static uint64 Hash(const char*);
+
+    std::vector<Entry> entries; // sorted by hash
+    std::vector<bool> unindexed; // per archive: has no listfile, must be searched directly
+};
+
+// a set of open archives. StormLib handles must not be used by more than one thread at a time,
+// so each thread that reads files needs its own MPQHelper; see InitFrom().
 class MPQHelper
 {
 public:
     MPQHelper();
     ~MPQHelper();
     void Init();
+    void InitFrom(const MPQHelper&); // open the same archives as an already initialized helper and share its index
     ByteBuffer ExtractFile(const char*);
+    uint8 *ExtractFile(const char*, uint32& size); // returns a new[] buffer, NULL if not found
     bool FileExists(const char*);
+    uint32 GetFileSize(const char*);
 private:
-    std::list<MPQFile*> _files;
+    MPQHelper(const MPQHelper&);
+    MPQHelper& operator=(const MPQHelper&);
+    void _BuildIndex(void);
+    MPQFile *_FindFile(const char*, uint32 *size = NULL);
+
+    std::vector<MPQFile*> _files; // existing archives in patch order, first has the highest priority
+    std::vector<std::string> _filenames; // same order as _files
     std::list<std::string> _patches;
+    MPQIndex *_index;
+    bool _ownindex;
 };
 
 #endif
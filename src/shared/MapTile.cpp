@@ -3,6 +3,15 @@
 #include "log.h"
 #include "MemoryDataHolder.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   ifdef _MSC_VER
+#       define MAPTILE_ALIGN __declspec(align(16))
+#   else
+#       define MAPTILE_ALIGN __attribute__((aligned(16)))
+#   endif
+#endif
+
 MapTile::MapTile()
 {
 }
@@ -125,6 +134,7 @@ void MapTile::ImportFromADT(ADTFile *adt)
     _xbase = _chunks[0].basex;
     _ybase = _chunks[0].basey;
     _hbase = _chunks[0].baseheight;
+    _BuildHeightGrid();
 
     DEBUG(logdebug("MapTile first chunk base: h=%f x=%f y=%f",_hbase,_xbase,_ybase));
 }
@@ -145,43 +155,104 @@ void MapTileStorage::_DebugDump(void)
     printf(out.c_str());
 }
 
-// get approx Z position for world position (x,y).
-float MapTile::GetZ(float x, float y)
+void MapTile::_BuildHeightGrid(void)
 {
-    float bx,by;
-    float real_z;
-    bx = _chunks[0].basex; // world base coords of tile
-    by = _chunks[0].basey;
-    uint32 chx = (uint32)fabs((bx - x) / CHUNKSIZE); // get chunk id for given coords
-    uint32 chy = (uint32)fabs((by - y) / CHUNKSIZE);
-    if( chx > 15 || chy > 15)
-    {
-        logerror("MapTile::GetZ() wrong chunk indexes (%d, %d) for (%f, %f)",chx,chy,x,y);
-        logerror(" - These coords are NOT on this tile!");
-        return INVALID_HEIGHT;
-    }
-    MapChunk& ch = _chunks[chx*16 + chy];
-    uint32 vx,vy; // get vertex position (0,0) ... (8,8);
-    vy = (uint32)floor((fabs(ch.basey - y) / (CHUNKSIZE/16.0f)) + 0.5f);
-    if (vy % 2 == 0)
-    {
-        vx = (uint32)floor((fabs(ch.basex - x) / (CHUNKSIZE/8.0f)) + 0.5f);
-        real_z = ch.hmap_rough[vx*9 + (vy/2)] + ch.baseheight;
-    }
-    else if (vy % 2 != 0)
+    for(uint32 ch = 0; ch < 256; ch++)
     {
-        vx = (uint32)floor((fabs(ch.basex - x) / (CHUNKSIZE/7.0f)) ); //edit: removed + 0.5f
-        real_z = ch.hmap_fine[vx*8 + ((vy-1)/2)] + ch.baseheight;
+        MapChunk& chunk = _chunks[ch];
+        uint32 row0 = (ch / 16) * 8, col0 = (ch % 16) * 8; // chunks are stored as [y * 16 + x], see GetChunk(); its y is the row (world x)
+        for(uint32 r = 0; r < 9; r++)
+            for(uint32 c = 0; c < 9; c++)
+                _hgrid_outer[(row0 + r) * 129 + col0 + c] = chunk.hmap_rough[r*9 + c] + chunk.baseheight;
+        for(uint32 r = 0; r < 8; r++)
+            for(uint32 c = 0; c < 8; c++)
+                _hgrid_inner[(row0 + r) * 128 + col0 + c] = chunk.hmap_fine[r*8 + c] + chunk.baseheight;
     }
-    if(vx > 8 || vy > 17)
-    {
-        logerror("MapTile::GetZ() wrong vertex indexes (%d, %d) for chunk (%d, %d) for (%f, %f) chunkpos (%f, %f) tile (%f, %f)",vx,vy,chx,chy,x,y,ch.basex,ch.basey,bx,by);
+}
+
+// get Z position for world position (x,y), interpolated between the surrounding vertices
+float MapTile::GetZ(float x, float y)
+{
+    // position in vertex grid units, 0..128 on both axes
+    float fx = (_xbase - x) / UNITSIZE;
+    float fy = (_ybase - y) / UNITSIZE;
+    if(!(fx >= 0.0f && fx <= 128.0f && fy >= 0.0f && fy <= 128.0f)) // also catches NaN
         return INVALID_HEIGHT;
+    uint32 r = uint32(fx), c = uint32(fy);
+    if(r > 127)
+        r = 127;
+    if(c > 127)
+        c = 127;
+    const float *o = &_hgrid_outer[r * 129 + c];
+    return InterpolateCellHeight(o[0], o[1], o[129], o[130], _hgrid_inner[r * 128 + c], fx - r, fy - c);
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+// the vertex loads are done one by one (SSE2 has no gather), everything else 4 positions at once.
+// must give exactly the same results as GetZ().
+void MapTile::GetZ(const float *xs, const float *ys, float *out, uint32 n)
+{
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+    const __m128 gridmax = _mm_set1_ps(128.0f), cellmax = _mm_set1_ps(127.0f);
+    const __m128 invalid = _mm_set1_ps(INVALID_HEIGHT);
+    const __m128 xbase = _mm_set1_ps(_xbase), ybase = _mm_set1_ps(_ybase), unit = _mm_set1_ps(UNITSIZE);
+    uint32 i = 0;
+    for( ; i + 4 <= n; i += 4)
+    {
+        __m128 fx = _mm_div_ps(_mm_sub_ps(xbase, _mm_loadu_ps(xs + i)), unit);
+        __m128 fy = _mm_div_ps(_mm_sub_ps(ybase, _mm_loadu_ps(ys + i)), unit);
+        __m128 valid = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(fx, zero), _mm_cmple_ps(fx, gridmax)),
+                                  _mm_and_ps(_mm_cmpge_ps(fy, zero), _mm_cmple_ps(fy, gridmax)));
+        // clamp, so that invalid positions still read inside the grid; their result is replaced below
+        __m128 rf = _mm_min_ps(_mm_max_ps(_mm_and_ps(valid, fx), zero), cellmax);
+        __m128 cf = _mm_min_ps(_mm_max_ps(_mm_and_ps(valid, fy), zero), cellmax);
+        __m128i ri = _mm_cvttps_epi32(rf), ci = _mm_cvttps_epi32(cf);
+        __m128 u = _mm_sub_ps(fx, _mm_cvtepi32_ps(ri));
+        __m128 v = _mm_sub_ps(fy, _mm_cvtepi32_ps(ci));
+
+        MAPTILE_ALIGN float h00[4], h01[4], h10[4], h11[4], hc[4];
+        MAPTILE_ALIGN int32 rr[4], cc[4];
+        _mm_store_si128((__m128i*)rr, ri);
+        _mm_store_si128((__m128i*)cc, ci);
+        for(uint32 k = 0; k < 4; k++)
+        {
+            const float *o = &_hgrid_outer[rr[k] * 129 + cc[k]];
+            h00[k] = o[0];
+            h01[k] = o[1];
+            h10[k] = o[129];
+            h11[k] = o[130];
+            hc[k] = _hgrid_inner[rr[k] * 128 + cc[k]];
+        }
+        __m128 a00 = _mm_load_ps(h00), a01 = _mm_load_ps(h01), a10 = _mm_load_ps(h10), a11 = _mm_load_ps(h11);
+
+        // pick the triangle, same as InterpolateCellHeight()
+        __m128 ulev = _mm_cmple_ps(u, v);
+        __m128 lower = _mm_cmple_ps(_mm_add_ps(u, v), one);
+        #define SEL(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+        __m128 p = SEL(ulev, SEL(lower, a00, a01), SEL(lower, a00, a10));
+        __m128 q = SEL(ulev, SEL(lower, a01, a11), SEL(lower, a10, a11));
+        __m128 s = SEL(ulev, SEL(lower, v, u), SEL(lower, u, v));
+        __m128 t = SEL(ulev, SEL(lower, u, _mm_sub_ps(one, v)), SEL(lower, v, _mm_sub_ps(one, u)));
+        __m128 z = _mm_add_ps(_mm_add_ps(p, _mm_mul_ps(_mm_sub_ps(q, p), s)),
+                              _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(two, _mm_load_ps(hc)), p), q), t));
+        _mm_storeu_ps(out + i, SEL(valid, z, invalid));
+        #undef SEL
     }
+    for( ; i < n; i++)
+        out[i] = GetZ(xs[i], ys[i]);
+}
 
-    return real_z;
+#else
+
+void MapTile::GetZ(const float *xs, const float *ys, float *out, uint32 n)
+{
+    for(uint32 i = 0; i < n; i++)
+        out[i] = GetZ(xs[i], ys[i]);
 }
 
+#endif
+
 void MapTile::DebugDumpToFile(void)
 {
     const char *f = "0123456789abcdefghijklmnopqrstuvwxyz";
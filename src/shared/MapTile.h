@@ -13,6 +13,25 @@
 
 #define INVALID_HEIGHT -99999.0f
 
+// height inside one cell of a chunk's vertex grid. the cell is split into 4 triangles that meet at the
+// inner vertex hc; u is the position along the vertex rows (x), v along the columns (y), both 0..1.
+inline float InterpolateCellHeight(float h00, float h01, float h10, float h11, float hc, float u, float v)
+{
+    // every triangle is one outer edge P-Q plus hc: z = P + (Q-P)*s + (2*hc-P-Q)*t
+    float p, q, s, t;
+    if(u <= v)
+    {
+        if(u + v <= 1.0f) { p = h00; q = h01; s = v; t = u; }
+        else              { p = h01; q = h11; s = u; t = 1.0f - v; }
+    }
+    else
+    {
+        if(u + v <= 1.0f) { p = h00; q = h10; s = u; t = v; }
+        else              { p = h10; q = h11; s = v; t = 1.0f - u; }
+    }
+    return p + (q - p) * s + (2.0f * hc - p - q) * t;
+}
+
 // individual chunks of a map
 class MapChunk
 {
@@ -53,7 +72,8 @@ public:
     MapTile();
     ~MapTile();
     void ImportFromADT(ADTFile*);
-    float GetZ(float,float);
+    float GetZ(float,float); // INVALID_HEIGHT if not on this tile
+    void GetZ(const float *xs, const float *ys, float *out, uint32 n); // same as calling GetZ() n times, but faster
     void DebugDumpToFile(void);
     inline MapChunk *GetChunk(uint32 x, uint32 y) { return &_chunks[y * 16 + x]; }
     inline float GetBaseX(void) { return _xbase; }
@@ -65,9 +85,16 @@ public:
     inline MCSE_chunk *GetSoundEmitter(uint32 i) { return &_soundemm[i]; }
     inline uint32 GetWMOCount(void) { return _wmo_data.size(); }
     inline WorldMapObject *GetWMO(uint32 i) { return &_wmo_data[i]; }
+    inline const float *GetHeightGrid(void) { return _hgrid_outer; } // 129x129 outer vertex heights
 
 private:
+    void _BuildHeightGrid(void);
+
     MapChunk _chunks[256]; // 16x16
+    // absolute heights of all vertices of the tile, made from the chunks. index: row (x) * size + column (y).
+    // neighbouring chunks share their border vertices.
+    float _hgrid_outer[129*129];
+    float _hgrid_inner[128*128]; // cell center vertices
     std::vector<std::string> _textures;
     std::vector<std::string> _wmos;
     std::vector<std::string> _models;
@@ -0,0 +1,98 @@
+#include "MappedFile.h"
+
+#if PLATFORM == PLATFORM_WIN32
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+    _data = NULL;
+    _size = 0;
+#if PLATFORM == PLATFORM_WIN32
+    _file = _mapping = NULL;
+#else
+    _fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const char *fn)
+{
+    Close();
+#if PLATFORM == PLATFORM_WIN32
+    // others may still append to the file, the mapping keeps the size it had when it was opened
+    HANDLE fh = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(fh == INVALID_HANDLE_VALUE)
+        return false;
+    DWORD size = ::GetFileSize(fh, NULL);
+    if(!size || size == INVALID_FILE_SIZE)
+    {
+        CloseHandle(fh);
+        return false;
+    }
+    HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!mh)
+    {
+        CloseHandle(fh);
+        return false;
+    }
+    void *p = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    if(!p)
+    {
+        CloseHandle(mh);
+        CloseHandle(fh);
+        return false;
+    }
+    _file = fh;
+    _mapping = mh;
+    _data = (const uint8*)p;
+    _size = size;
+#else
+    int fd = open(fn, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) || !st.st_size)
+    {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    _fd = fd;
+    _data = (const uint8*)p;
+    _size = st.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::Close(void)
+{
+    if(!_data)
+        return;
+#if PLATFORM == PLATFORM_WIN32
+    UnmapViewOfFile(_data);
+    CloseHandle(_mapping);
+    CloseHandle(_file);
+    _file = _mapping = NULL;
+#else
+    munmap((void*)_data, _size);
+    close(_fd);
+    _fd = -1;
+#endif
+    _data = NULL;
+    _size = 0;
+}
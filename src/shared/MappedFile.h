@@ -0,0 +1,33 @@
+#ifndef _MAPPEDFILE_H
+#define _MAPPEDFILE_H
+
+#include <stddef.h>
+#include "SysDefs.h"
+
+// maps a whole file read-only into memory. the pages are shared with every other process
+// (or MappedFile object) that maps the same file, and are only read from disk when touched.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+    bool Open(const char *fn); // false if the file does not exist or is empty
+    void Close(void);
+    inline bool IsOpen(void) const { return _data != NULL; }
+    inline const uint8 *GetData(void) const { return _data; }
+    inline uint32 GetSize(void) const { return _size; }
+
+private:
+    MappedFile(const MappedFile&); // not copyable
+    MappedFile& operator=(const MappedFile&);
+
+    const uint8 *_data;
+    uint32 _size;
+#if PLATFORM == PLATFORM_WIN32
+    void *_file, *_mapping; // HANDLEs, kept as void* to not pull windows.h into every file
+#else
+    int _fd;
+#endif
+};
+
+#endif
@@ -1,6 +1,5 @@
 #include <fstream>
 #include "MemoryDataHolder.h"
-#include "TypeStorage.h"
 #include "zthread/Condition.h"
 #include "zthread/Task.h"
 #include "zthread/PoolExecutor.h"
@@ -13,20 +12,68 @@ namespace MemoryDataHolder
     class DataLoaderRunnable;
     ZThread::PoolExecutor *executor = NULL;
 
-    ZThread::FastMutex mutex;
-    TypeStorage<memblock> storage;
-    TypeStorage<DataLoaderRunnable> loaders;
-    TypeStorage<uint32> refs;
+    // one file known to the cache. it exists while it is referenced, beeing loaded, or loaded and unreferenced;
+    // in the last case it is in the LRU list and will be evicted once the cache exceeds its budget.
+    struct CacheEntry
+    {
+        std::string name;
+        uint32 hash;
+        memblock mb; // ptr is NULL while not loaded
+        uint32 refs;
+        DataLoaderRunnable *loader; // not NULL while a loader works on this file
+        CacheEntry *next; // next entry in the same hash bucket
+        CacheEntry *lruprev, *lrunext;
+        bool inlru;
+    };
+
+    ZThread::FastMutex mutex; // protects everything below
+    std::vector<CacheEntry*> buckets;
+    uint32 entrycount = 0;
+    CacheEntry *lruhead = NULL, *lrutail = NULL; // head is the least recently used entry
+    CacheStats stats;
     bool alwaysSingleThreaded = false;
 
     bool loadFromMPQ = false;
-    MPQHelper mpq;
+    MPQHelper mpq; // owns the index, is the first handle set in the pool
+    // StormLib handles can't be shared between threads, so every thread reading from the MPQs
+    // takes one set of open archives from here, and gives it back when done. new sets are opened as needed,
+    // so there are at most as many as threads reading at the same time.
+    ZThread::FastMutex mpqmutex;
+    std::vector<MPQHelper*> mpqpool;
+
+    static MPQHelper *_AcquireMPQ(void)
+    {
+        {
+            ZThread::Guard<ZThread::FastMutex> g(mpqmutex);
+            if(!mpqpool.empty())
+            {
+                MPQHelper *h = mpqpool.back();
+                mpqpool.pop_back();
+                return h;
+            }
+        }
+        MPQHelper *h = new MPQHelper();
+        h->InitFrom(mpq);
+        return h;
+    }
+
+    static void _ReleaseMPQ(MPQHelper *h)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mpqmutex);
+        mpqpool.push_back(h);
+    }
 
 
     void Init(void)
     {
         if(!executor)
             executor = new ZThread::PoolExecutor(1);
+        if(buckets.empty())
+        {
+            buckets.resize(1024, NULL);
+            memset(&stats, 0, sizeof(stats));
+            stats.budget = uint64(256) * 1024 * 1024;
+        }
     }
 
     void Shutdown(void)
@@ -36,6 +83,14 @@ namespace MemoryDataHolder
         executor->cancel(); // stop accepting new threads
         executor->interrupt(); // interrupt all working threads
         // executor will delete itself automatically
+
+        // close the archive handles opened for the loader threads. mpq itself holds the index and is a global.
+        // handles still in use by an interrupted loader are given back later and not freed, that's fine at exit.
+        ZThread::Guard<ZThread::FastMutex> g(mpqmutex);
+        for(uint32 i = 0; i < mpqpool.size(); i++)
+            if(mpqpool[i] != &mpq)
+                delete mpqpool[i];
+        mpqpool.clear();
     }
 
     void SetThreadCount(uint32 t)
@@ -57,9 +112,14 @@ namespace MemoryDataHolder
 
     void SetUseMPQ(std::string loc)
     {
-        loadFromMPQ=true;
+        // every instance of a swarm applies its conf, but the archives are opened only once
+        ZThread::Guard<ZThread::FastMutex> g(mpqmutex);
+        if(loadFromMPQ)
+            return;
         SetLocale(loc.c_str());
         mpq.Init();
+        mpqpool.push_back(&mpq);
+        loadFromMPQ=true;
     }
 
     void MakeMapFilename(char* fn, uint32 mid, std::string mname, uint32 x, uint32 y)
@@ -76,6 +136,11 @@ namespace MemoryDataHolder
         else
             sprintf(fn,"./data/maps/%u.wdt",(uint16)mid);
     }
+    // heightmaps are made by stuffextract, they never come from MPQ files
+    void MakeHeightMapFilename(char* fn, uint32 mid)
+    {
+        sprintf(fn,"./data/maps/%u.hmap",(uint16)mid);
+    }
     void MakeTextureFilename(char* fn, std::string fname)
     {
         if(loadFromMPQ)
@@ -115,13 +180,162 @@ namespace MemoryDataHolder
     {
         logdebug("%s",fname.c_str());
         if(loadFromMPQ)
-            return mpq.FileExists(fname.c_str());
+        {
+            MPQHelper *h = _AcquireMPQ();
+            bool exists = h->FileExists(fname.c_str());
+            _ReleaseMPQ(h);
+            return exists;
+        }
         else
             return GetFileSize(fname.c_str());
 
     }
 
 
+    // FNV-1a
+    static uint32 _Hash(const std::string& s)
+    {
+        uint32 h = 2166136261U;
+        for(uint32 i = 0; i < s.length(); i++)
+            h = (h ^ uint8(s[i])) * 16777619U;
+        return h;
+    }
+
+    // all _-functions below must be called with the mutex held
+    static CacheEntry *_Find(const std::string& s, uint32 h)
+    {
+        for(CacheEntry *e = buckets[h & (buckets.size() - 1)]; e; e = e->next)
+            if(e->hash == h && e->name == s)
+                return e;
+        return NULL;
+    }
+
+    static CacheEntry *_Find(const std::string& s)
+    {
+        return _Find(s, _Hash(s));
+    }
+
+    static CacheEntry *_Create(const std::string& s, uint32 h)
+    {
+        if(entrycount >= buckets.size()) // keep the chains short, buckets.size() must stay a power of 2
+        {
+            std::vector<CacheEntry*> old(buckets.size() * 2, NULL);
+            old.swap(buckets);
+            for(uint32 i = 0; i < old.size(); i++)
+            {
+                for(CacheEntry *e = old[i], *next; e; e = next)
+                {
+                    next = e->next;
+                    e->next = buckets[e->hash & (buckets.size() - 1)];
+                    buckets[e->hash & (buckets.size() - 1)] = e;
+                }
+            }
+        }
+        CacheEntry *e = new CacheEntry;
+        e->name = s;
+        e->hash = h;
+        e->refs = 0;
+        e->loader = NULL;
+        e->lruprev = e->lrunext = NULL;
+        e->inlru = false;
+        CacheEntry *& b = buckets[h & (buckets.size() - 1)];
+        e->next = b;
+        b = e;
+        entrycount++;
+        return e;
+    }
+
+    static void _LRUUnlink(CacheEntry *e)
+    {
+        if(!e->inlru)
+            return;
+        (e->lruprev ? e->lruprev->lrunext : lruhead) = e->lrunext;
+        (e->lrunext ? e->lrunext->lruprev : lrutail) = e->lruprev;
+        e->lruprev = e->lrunext = NULL;
+        e->inlru = false;
+        stats.unusedfiles--;
+        stats.unusedbytes -= e->mb.size;
+    }
+
+    // append as most recently used
+    static void _LRUAppend(CacheEntry *e)
+    {
+        e->lruprev = lrutail;
+        e->lrunext = NULL;
+        (lrutail ? lrutail->lrunext : lruhead) = e;
+        lrutail = e;
+        e->inlru = true;
+        stats.unusedfiles++;
+        stats.unusedbytes += e->mb.size;
+    }
+
+    // removes the entry from the cache and frees its memory
+    static void _Remove(CacheEntry *e)
+    {
+        _LRUUnlink(e);
+        CacheEntry **pp = &buckets[e->hash & (buckets.size() - 1)];
+        while(*pp != e)
+            pp = &(*pp)->next;
+        *pp = e->next;
+        entrycount--;
+        if(e->mb.ptr)
+        {
+            DEBUG(logdev("MemoryDataHolder: freeing '%s' (size %s)", e->name.c_str(), FilesizeFormat(e->mb.size).c_str()));
+            stats.files--;
+            stats.bytes -= e->mb.size;
+            e->mb.free();
+        }
+        delete e;
+    }
+
+    // drop unreferenced files, least recently used first, until the cache fits into its budget
+    static void _Evict(void)
+    {
+        while(lruhead && stats.bytes > stats.budget)
+        {
+            stats.evictions++;
+            _Remove(lruhead);
+        }
+    }
+
+    // the entry lost its last reference
+    static void _Release(CacheEntry *e)
+    {
+        if(e->mb.ptr)
+        {
+            _LRUAppend(e);
+            _Evict();
+        }
+        else if(!e->loader)
+            _Remove(e); // loading failed, nothing to keep
+    }
+
+    // called by the loaders when they are done, mb is NULL if the file could not be loaded.
+    // must be called before the callbacks are processed!
+    static void _FinishLoad(const std::string& s, memblock *mb)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        CacheEntry *e = _Find(s);
+        if(!e) // can't happen, entries with a loader are never removed
+        {
+            if(mb)
+                mb->free();
+            return;
+        }
+        e->loader = NULL;
+        if(mb)
+        {
+            e->mb = *mb;
+            stats.files++;
+            stats.bytes += mb->size;
+        }
+        if(!e->refs)
+            _Release(e);
+        else
+            _Evict(); // the new file may have pushed the cache over its budget
+    }
+
+
     class DataLoaderRunnable : public ZThread::Runnable
     {
     public:
@@ -133,92 +347,50 @@ namespace MemoryDataHolder
         {
             DEBUG(logdev("~DataLoaderRunnable(%s) 0x%X", _name.c_str(), this));
         }
-        void SetStores(TypeStorage<memblock> *mem, TypeStorage<DataLoaderRunnable> *ldrs)
-        {
-            _storage = mem;
-            _loaders = ldrs;
-        }
         // the threaded part
         void run()
         {
-            memblock *mb = new memblock();
+            memblock mb;
             if(loadFromMPQ)
             {
-                if(!mpq.FileExists(_name.c_str()))
+                DEBUG(logdev("DataLoaderRunnable: Reading From MPQ'%s'...", _name.c_str()));
+                MPQHelper *h = _AcquireMPQ();
+                mb.ptr = h->ExtractFile(_name.c_str(), mb.size);
+                _ReleaseMPQ(h);
+                if(!mb.ptr)
                 {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
                     logerror("DataLoaderRunnable: Error opening file in MPQ: '%s'", _name.c_str());
-                    _loaders->Unlink(_name);
+                    _FinishLoad(_name, NULL);
                     DoCallbacks(_name, MDH_FILE_ERROR); // call callback func, 'false' to indicate file couldnt be loaded
-                    delete mb;
                     return;
                 }
-                DEBUG(logdev("DataLoaderRunnable: Reading From MPQ'%s'... (%s)", _name.c_str(), FilesizeFormat(mb->size).c_str()));
-                const ByteBuffer& bb = mpq.ExtractFile(_name.c_str());
-//                 fh.read((char*)mb->ptr, mb->size);
-                if(!bb.size())
-                {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    logerror("DataLoaderRunnable: Error opening file in MPQ: '%s'", _name.c_str());
-                    _loaders->Unlink(_name);
-                    DoCallbacks(_name, MDH_FILE_ERROR); // call callback func, 'false' to indicate file couldnt be loaded
-                    delete mb;
-                    return;
-                }
-
-                mb->size=bb.size();
-                mb->alloc(mb->size);
-
-                memcpy((char*)mb->ptr,(char*)bb.contents(),bb.size());
-                {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    _storage->Assign(_name, mb);
-                    _loaders->Unlink(_name); // must be unlinked after the file is fully loaded, but before the callbacks are processed!
-                }
-                DEBUG(logdev("DataLoaderRunnable: Done with '%s' (%s)", _name.c_str(), FilesizeFormat(mb->size).c_str()));
-                DoCallbacks(_name, MDH_FILE_OK | MDH_FILE_JUST_LOADED);
             }
             else
             {
-                _FixFileName(_name);
+                // the cache key stays the requested name, only the file on disk may be named differently
+                std::string fn = _name;
+                _FixFileName(fn);
 
-                mb->size = GetFileSize(_name.c_str());
-                // couldnt open file if size is 0
-                if(!mb->size)
-                {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    logerror("DataLoaderRunnable: Error opening file: '%s'", _name.c_str());
-                    _loaders->Unlink(_name);
-                    DoCallbacks(_name, MDH_FILE_ERROR); // call callback func, 'false' to indicate file couldnt be loaded
-                    delete mb;
-                    return;
-                }
-                mb->alloc(mb->size);
+                uint32 size = GetFileSize(fn.c_str());
                 std::ifstream fh;
-                fh.open(_name.c_str(), std::ios_base::in | std::ios_base::binary);
+                // couldnt open file if size is 0
+                if(size)
+                    fh.open(fn.c_str(), std::ios_base::in | std::ios_base::binary);
                 if(!fh.is_open())
                 {
-                    {
-                        ZThread::Guard<ZThread::FastMutex> g(_mut);
-                        logerror("DataLoaderRunnable: Error opening file: '%s'", _name.c_str());
-                        _loaders->Unlink(_name);
-                    }
-                    mb->free();
-                    delete mb;
-                    DoCallbacks(_name, MDH_FILE_ERROR);
+                    logerror("DataLoaderRunnable: Error opening file: '%s'", fn.c_str());
+                    _FinishLoad(_name, NULL);
+                    DoCallbacks(_name, MDH_FILE_ERROR); // call callback func, 'false' to indicate file couldnt be loaded
                     return;
                 }
-                DEBUG(logdev("DataLoaderRunnable: Reading '%s'... (%s)", _name.c_str(), FilesizeFormat(mb->size).c_str()));
-                fh.read((char*)mb->ptr, mb->size);
+                mb.alloc(size);
+                DEBUG(logdev("DataLoaderRunnable: Reading '%s'... (%s)", fn.c_str(), FilesizeFormat(mb.size).c_str()));
+                fh.read((char*)mb.ptr, mb.size);
                 fh.close();
-                {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    _storage->Assign(_name, mb);
-                    _loaders->Unlink(_name); // must be unlinked after the file is fully loaded, but before the callbacks are processed!
-                }
-                DEBUG(logdev("DataLoaderRunnable: Done with '%s' (%s)", _name.c_str(), FilesizeFormat(mb->size).c_str()));
-                DoCallbacks(_name, MDH_FILE_OK | MDH_FILE_JUST_LOADED);
             }
+            _FinishLoad(_name, &mb);
+            DEBUG(logdev("DataLoaderRunnable: Done with '%s' (%s)", _name.c_str(), FilesizeFormat(mb.size).c_str()));
+            DoCallbacks(_name, MDH_FILE_OK | MDH_FILE_JUST_LOADED);
         }
 
         inline void AddCallback(callback_func func, void *ptr = NULL, ZThread::Condition *cond = NULL)
@@ -260,9 +432,6 @@ namespace MemoryDataHolder
        bool _threaded;
        std::string _name;
        std::string _MPQname;
-       ZThread::FastMutex _mut;
-       TypeStorage<memblock> *_storage;
-       TypeStorage<DataLoaderRunnable> *_loaders;
 
     };
 
@@ -274,25 +443,28 @@ namespace MemoryDataHolder
         if(alwaysSingleThreaded)
             threaded = false;
 
-        // manage reference counter
-        uint32 *refcount = refs.GetNoCreate(s);
-        if(!refcount)
+        uint32 h = _Hash(s);
+        CacheEntry *e = _Find(s, h);
+        if(!e)
+            e = _Create(s, h);
+
+        // manage reference counter. a referenced file is never evicted.
+        if(ref_counted)
         {
-            refcount = new uint32;
-            *refcount = ref_counted ? 1 : 0;
-            refs.Assign(s,refcount);
-        }
-        else
-        {
-            if(ref_counted)
-            {
-                (*refcount)++;
-            }
+            _LRUUnlink(e);
+            e->refs++;
         }
 
-        if(memblock *mb = storage.GetNoCreate(s))
+        if(e->mb.ptr)
         {
             DEBUG(logdev("MDH: Reusing '%s' from memory",s.c_str()));
+            stats.hits++;
+            if(e->inlru) // still unreferenced, but just used
+            {
+                _LRUUnlink(e);
+                _LRUAppend(e);
+            }
+            memblock mb = e->mb;
             // the file was requested some other time, is still present in memory and the pointer can simply be returned...
             mutex.release(); // everything ok, mutex can be unloaded safely
             // execute callback and broadcast condition (must check for MDH_FILE_ALREADY_EXIST in callback func)
@@ -302,17 +474,18 @@ namespace MemoryDataHolder
             if(cond)
                 cond->broadcast();
 
-            return MemoryDataResult(*mb, rf);
+            return MemoryDataResult(mb, rf);
         }
         else
         {
-            DataLoaderRunnable *ldr = loaders.GetNoCreate(s);
+            DataLoaderRunnable *ldr = e->loader;
             DEBUG(logdev("MDH: Found Loader 0x%X for '%s'",ldr,s.c_str()));
             if(ldr == NULL)
             {
                 // no loader thread is working on that file...
-                ldr = loaders.Get(s);
-                ldr->SetStores(&storage,&loaders);
+                stats.misses++;
+                ldr = new DataLoaderRunnable();
+                e->loader = ldr;
                 ldr->AddCallback(func,ptr,cond); // not threadsafe!
 
                 mutex.release(); // the mutex can be released safely now
@@ -329,12 +502,16 @@ namespace MemoryDataHolder
                 {
                     ldr->run(); // will exit after the whole file is loaded and the callbacks were run
                     delete ldr;
-                    memblock *mbret = storage.GetNoCreate(s);
-                    DEBUG(logdev("Non-threaded loader returning memblock at 0x%X",mbret));
+                    ZThread::Guard<ZThread::FastMutex> g(mutex);
+                    // without a reference, the file may already be evicted again if the cache is full
+                    e = _Find(s, h);
+                    DEBUG(logdev("Non-threaded loader returning memblock at 0x%X",e ? e->mb.ptr : NULL));
                     uint32 rf = MDH_FILE_JUST_LOADED;
-                    if(mbret)
+                    if(e && e->mb.ptr)
                         rf |= MDH_FILE_OK;
-                    return MemoryDataResult(mbret ? *mbret : memblock(), rf);
+                    else if(e && ref_counted && !--e->refs) // nothing returned, so the caller won't Delete() it
+                        _Release(e);
+                    return MemoryDataResult(rf & MDH_FILE_OK ? e->mb : memblock(), rf);
                 }
             }
             else // if a loader is already existing, add callbacks to that loader.
@@ -349,7 +526,8 @@ namespace MemoryDataHolder
     bool IsLoaded(std::string s)
     {
         ZThread::Guard<ZThread::FastMutex> g(mutex);
-        return storage.Exists(s);
+        CacheEntry *e = _Find(s);
+        return e && e->mb.ptr;
     }
 
     // ensure the file is present in memory, but do not touch the reference counter
@@ -362,39 +540,43 @@ namespace MemoryDataHolder
     bool Delete(std::string s)
     {
         ZThread::Guard<ZThread::FastMutex> g(mutex);
-        uint32 *refcount = refs.GetNoCreate(s);
-        if(!refcount)
+        CacheEntry *e = _Find(s);
+        if(!e || !e->refs)
         {
             logerror("MemoryDataHolder:Delete(\"%s\"): no refcount", s.c_str());
             return false;
         }
-        else
+        e->refs--;
+        DEBUG(logdev("MemoryDataHolder::Delete(\"%s\"): refcount dropped to %u", s.c_str(), e->refs));
+        if(!e->refs)
         {
-            if(*refcount > 0)
-                (*refcount)--;
-            DEBUG(logdev("MemoryDataHolder::Delete(\"%s\"): refcount dropped to %u", s.c_str(), *refcount));
-        }
-        if(!*refcount)
-        {
-            refs.Delete(s);
-            if(memblock *mb = storage.GetNoCreate(s))
-            {
-                DEBUG(logdev("MemoryDataHolder:: deleting 0x%X (size %s)", mb->ptr, FilesizeFormat(mb->size).c_str()));
-                mb->free();
-                storage.Delete(s);
-                return true;
-            }
-            else
-            {
-                logerror("MemoryDataHolder::Delete(\"%s\"): no buf existing",s.c_str());
-                return false;
-            }
+            bool loaded = e->mb.ptr != NULL;
+            _Release(e);
+            return loaded;
         }
         return true;
     }
 
+    void SetCacheSize(uint64 bytes)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        stats.budget = bytes;
+        _Evict();
+    }
 
+    CacheStats GetCacheStats(void)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        return stats;
+    }
 
-
+    void LogCacheStats(void)
+    {
+        CacheStats cs = GetCacheStats();
+        uint32 req = cs.hits + cs.misses;
+        log("MemoryDataHolder: %u files, %s in memory (%u files, %s unused), budget %s. %u hits, %u misses (%.1f%% hits), %u evictions",
+            cs.files, FilesizeFormat(cs.bytes).c_str(), cs.unusedfiles, FilesizeFormat(cs.unusedbytes).c_str(),
+            FilesizeFormat(cs.budget).c_str(), cs.hits, cs.misses, req ? cs.hits * 100.0f / req : 0.0f, cs.evictions);
+    }
 
 };
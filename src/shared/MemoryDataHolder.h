@@ -45,6 +45,20 @@ namespace MemoryDataHolder
         uint32 flags; // see ResultFlags enum
     };
 
+    // counters of the file cache. files that are not referenced by anyone are kept in memory
+    // until the cache grows beyond its budget, then the least recently used ones are freed.
+    struct CacheStats
+    {
+        uint32 files; // files in memory
+        uint64 bytes;
+        uint32 unusedfiles; // files in memory without reference, these can be evicted
+        uint64 unusedbytes;
+        uint64 budget;
+        uint32 hits; // requests served from memory
+        uint32 misses; // requests that had to load the file
+        uint32 evictions;
+    };
+
     void Init(void);
     void Shutdown(void);
     void SetThreadCount(uint32);
@@ -52,16 +66,22 @@ namespace MemoryDataHolder
     //Helper functions to compensate for directory structure differences between Pseu and MPQ
     void MakeMapFilename(char*,uint32,std::string,uint32,uint32);
     void MakeWDTFilename(char*,uint32,std::string);
+    void MakeHeightMapFilename(char*,uint32);
     void MakeTextureFilename(char*, std::string);
     void MakeModelFilename(char*, std::string);
     void MakeWMOFilename(char*, std::string);
     bool FileExists(std::string);
 
+    // if ref_counted, the file stays in memory until Delete() is called for it. data returned without reference
+    // is only valid until the cache needs room for other files.
     MemoryDataResult GetFile(std::string s, bool threaded = false, callback_func func = NULL,void *ptr = NULL, ZThread::Condition *cond = NULL, bool ref_counted = true);
-    inline MemoryDataResult GetFileBasic(std::string s) { return GetFile(s, false, NULL, NULL, NULL, false); }
+    inline MemoryDataResult GetFileBasic(std::string s) { return GetFile(s); } // call Delete() when done with the data
     bool IsLoaded(std::string);
     void BackgroundLoadFile(std::string);
-    bool Delete(std::string);
+    bool Delete(std::string); // drop a reference
+    void SetCacheSize(uint64 bytes);
+    CacheStats GetCacheStats(void);
+    void LogCacheStats(void);
 };
 
 #endif
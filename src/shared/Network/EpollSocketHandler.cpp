@@ -0,0 +1,148 @@
+/**
+ **	File ......... EpollSocketHandler.cpp
+ **/
+#include "EpollSocketHandler.h"
+
+#ifdef HAVE_EPOLL
+
+#include <errno.h>
+#include <string.h>
+#include "Socket.h"
+
+EpollSocketHandler::EpollSocketHandler(StdLog *p)
+:SocketHandler(p)
+{
+    m_epfd = epoll_create(64);
+    if (m_epfd == -1)
+    {
+        LogError(NULL, "epoll_create", Errno, StrError(Errno), LOG_LEVEL_FATAL);
+    }
+    m_events.resize(64);
+}
+
+
+EpollSocketHandler::~EpollSocketHandler()
+{
+    if (m_epfd != -1)
+    {
+        close(m_epfd);
+    }
+}
+
+
+void EpollSocketHandler::Get(SOCKET s,bool& r,bool& w,bool& e)
+{
+    interest_m::iterator it = m_interest.find(s);
+    unsigned int ev = it != m_interest.end() ? (*it).second : 0;
+    r = (ev & EPOLLIN) ? true : false;
+    w = (ev & EPOLLOUT) ? true : false;
+    e = (ev & EPOLLPRI) ? true : false;
+}
+
+
+void EpollSocketHandler::Set(SOCKET s,bool bRead,bool bWrite,bool bException)
+{
+    if (s < 0 || m_epfd == -1)
+        return;
+    unsigned int ev = (bRead ? EPOLLIN : 0) | (bWrite ? EPOLLOUT : 0) | (bException ? EPOLLPRI : 0);
+    struct epoll_event e;
+    memset(&e, 0, sizeof(e));
+    e.events = ev;
+    e.data.fd = s;
+
+    interest_m::iterator it = m_interest.find(s);
+    if (it == m_interest.end())
+    {
+        if (!ev)
+            return;
+        if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, s, &e) == -1)
+        {
+            LogError(NULL, "epoll_ctl(ADD)", Errno, StrError(Errno));
+            return;
+        }
+        m_interest[s] = ev;
+    }
+    else if (!ev)
+    {
+// the fd may already be closed, in which case the kernel removed it by itself
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, s, &e);
+        m_interest.erase(it);
+    }
+    else if ((*it).second != ev)
+    {
+        if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, s, &e) == -1)
+        {
+// fd number was closed and reused without Set(s,false,false,false) in between
+            if (Errno != ENOENT || epoll_ctl(m_epfd, EPOLL_CTL_ADD, s, &e) == -1)
+            {
+                LogError(NULL, "epoll_ctl(MOD)", Errno, StrError(Errno));
+                m_interest.erase(it);
+                return;
+            }
+        }
+        (*it).second = ev;
+    }
+}
+
+
+int EpollSocketHandler::Wait(long msec)
+{
+    struct epoll_event e;
+    int n = epoll_wait(m_epfd, &e, 1, (int)msec);
+    return n;
+}
+
+
+int EpollSocketHandler::Select(long sec,long usec)
+{
+    AddPendingSockets((size_t)-1);
+
+    if (m_events.size() < m_sockets.size())
+        m_events.resize(m_sockets.size());
+
+    int timeout = (int)(sec * 1000 + (usec + 999) / 1000);
+    int n = epoll_wait(m_epfd, &m_events[0], (int)m_events.size(), timeout);
+    if (n == -1)
+    {
+        if (Errno != EINTR)
+            LogError(NULL, "epoll_wait", Errno, StrError(Errno));
+    }
+    else
+    {
+// readiness-independent work; only flag tests, no syscalls
+        for (socket_m::iterator it = m_sockets.begin(); it != m_sockets.end(); it++)
+        {
+            if ((*it).second)
+                CheckSocketState((*it).second);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            socket_m::iterator it = m_sockets.find(m_events[i].data.fd);
+            if (it == m_sockets.end() || !(*it).second)
+                continue;
+            Socket *p = (*it).second;
+            if (p -> IsSSLNegotiate() || p -> SSLConnecting())
+                continue;
+            unsigned int ev = m_events[i].events;
+            bool r, w, e;
+            Get((*it).first, r, w, e);
+// select() reports errors/hangups as readable resp. writable, so the socket callbacks expect it that way
+            if (ev & (EPOLLERR | EPOLLHUP))
+            {
+                if (!r && !w)
+                {
+// nobody would pick the error up, and it would be reported again on every call
+                    Set((*it).first, false, false, false);
+                    continue;
+                }
+                ev |= (r ? EPOLLIN : 0) | (w ? EPOLLOUT : 0);
+            }
+            HandleSocketEvents(p, (ev & EPOLLIN) && r, (ev & EPOLLOUT) && w, (ev & EPOLLPRI) && e);
+        }
+    }
+
+    RemoveClosedSockets();
+    return n;
+}
+
+#endif                                            // HAVE_EPOLL
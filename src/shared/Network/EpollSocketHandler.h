@@ -0,0 +1,42 @@
+/**
+ **	File ......... EpollSocketHandler.h
+ **/
+#ifndef _EPOLLSOCKETHANDLER_H
+#define _EPOLLSOCKETHANDLER_H
+
+#include "SocketHandler.h"
+
+#ifdef __linux__
+#define HAVE_EPOLL
+
+#include <vector>
+#include <sys/epoll.h>
+
+/** SocketHandler using epoll instead of select().
+    Not limited by FD_SETSIZE, and a Select() call only dispatches the sockets
+    the kernel reported as ready instead of testing every socket's fd_set bits.
+    Notifications are level-triggered: TcpSocket::OnRead() does a single recv()
+    per call, so edge-triggered mode would lose data that arrived in one burst. */
+class EpollSocketHandler : public SocketHandler
+{
+    typedef std::map<SOCKET,unsigned int> interest_m;
+
+    public:
+        EpollSocketHandler(StdLog * = NULL);
+        ~EpollSocketHandler();
+
+        void Set(SOCKET s,bool bRead,bool bWrite,bool bException = true);
+        void Get(SOCKET s,bool& r,bool& w,bool& e);
+        int Select(long sec,long usec);
+/** Block until one of the sockets is ready or the timeout expired, without dispatching anything.
+    Safe to call from another thread while no Select() is running. */
+        int Wait(long msec);
+
+    private:
+        int m_epfd;
+        interest_m m_interest; // events registered per fd
+        std::vector<struct epoll_event> m_events;
+};
+
+#endif                                            // __linux__
+#endif                                            // _EPOLLSOCKETHANDLER_H
@@ -185,12 +185,31 @@ void SocketHandler::Set(SOCKET s,bool bRead,bool bWrite,bool bException)
 }
 
 
-int SocketHandler::Select(long sec,long usec)
+void SocketHandler::Remove(Socket *p)
 {
-    struct timeval tv;
-    int n;
+    for (socket_m::iterator it = m_add.begin(); it != m_add.end(); it++)
+    {
+        if ((*it).second == p)
+        {
+            m_add.erase(it);
+            break;
+        }
+    }
+    for (socket_m::iterator it = m_sockets.begin(); it != m_sockets.end(); it++)
+    {
+        if ((*it).second == p)
+        {
+            Set((*it).first, false, false, false);
+            m_sockets.erase(it);
+            break;
+        }
+    }
+}
+
 
-    while (m_add.size() && m_sockets.size() < FD_SETSIZE )
+void SocketHandler::AddPendingSockets(size_t max)
+{
+    while (m_add.size() && m_sockets.size() < max )
     {
         socket_m::iterator it = m_add.begin();
         SOCKET s = (*it).first;
@@ -211,6 +230,15 @@ int SocketHandler::Select(long sec,long usec)
         m_sockets[s] = p;
         m_add.erase(it);
     }
+}
+
+
+int SocketHandler::Select(long sec,long usec)
+{
+    struct timeval tv;
+    int n;
+
+    AddPendingSockets(FD_SETSIZE);
 
 #ifdef __APPLE_CC__
     fd_set rfds;
@@ -264,102 +292,121 @@ int SocketHandler::Select(long sec,long usec)
             Socket *p = (*it2).second;
             if (p)
             {
-                if (p -> CallOnConnect() && p -> Ready() )
+                if (CheckSocketState(p) && n > 0)
                 {
-                    if (p -> IsSSL())             // SSL Enabled socket
-                        p -> OnSSLConnect();
-                    else
-                    if (p -> Socks4())
-                        p -> OnSocks4Connect();
-                    else
-                        p -> OnConnect();
-                    p -> SetCallOnConnect( false );
+                    HandleSocketEvents(p, FD_ISSET(i, &rfds) ? true : false, FD_ISSET(i, &wfds) ? true : false, FD_ISSET(i, &efds) ? true : false);
                 }
+            }                                     // if (p)
+        }                                         // for
+    }
+
+    RemoveClosedSockets();
+    return n;
+}
+
+
+bool SocketHandler::CheckSocketState(Socket *p)
+{
+    if (p -> CallOnConnect() && p -> Ready() )
+    {
+        if (p -> IsSSL())             // SSL Enabled socket
+            p -> OnSSLConnect();
+        else
+        if (p -> Socks4())
+            p -> OnSocks4Connect();
+        else
+            p -> OnConnect();
+        p -> SetCallOnConnect( false );
+    }
 // new SSL negotiate method
-                if (p -> IsSSLNegotiate())
-                {
-                    p -> SSLNegotiate();
-                }
-                else
+    if (p -> IsSSLNegotiate())
+    {
+        p -> SSLNegotiate();
+        return false;
+    }
 // old SSL method...
-                if (p -> SSLConnecting())
-                {
-                    if (p -> SSLCheckConnect())
-                    {
-                        p -> OnSSLInitDone();
-                    }
-                }
-                else
-                if (n > 0)
-                {
-                    if (FD_ISSET(i, &rfds))
-                    {
-                        TcpSocket *tcp = (TcpSocket *)(p);
+    if (p -> SSLConnecting())
+    {
+        if (p -> SSLCheckConnect())
+        {
+            p -> OnSSLInitDone();
+        }
+        return false;
+    }
+    return true;
+}
+
+
+void SocketHandler::HandleSocketEvents(Socket *p,bool r,bool w,bool e)
+{
+    if (r)
+    {
+        TcpSocket *tcp = (TcpSocket *)(p);
 //TcpSocket *tcp = dynamic_cast<TcpSocket *>(p);
 // LockWrite (save total output buffer size)
 // Sockets with write lock won't call OnWrite in SendBuf
 // That will happen in UnlockWrite, if necessary
-                        p -> OnRead();
-                        bool need_more = false;
-                        while (tcp && p -> Socks4() && tcp -> GetInputLength() && !need_more && !p -> CloseAndDelete())
-                        {
-                            need_more = p -> OnSocks4Read();
-                        }
-                        if (!p -> Socks4())
-                        {
-                            if (p -> LineProtocol())
-                            {
-                                p -> ReadLine();
-                            }
-//							p -> Touch();
-                        }
+        p -> OnRead();
+        bool need_more = false;
+        while (tcp && p -> Socks4() && tcp -> GetInputLength() && !need_more && !p -> CloseAndDelete())
+        {
+            need_more = p -> OnSocks4Read();
+        }
+        if (!p -> Socks4())
+        {
+            if (p -> LineProtocol())
+            {
+                p -> ReadLine();
+            }
+//			p -> Touch();
+        }
 // UnlockWrite (call OnWrite if saved size == 0 && total output buffer size > 0)
-                    }
-                    if (FD_ISSET(i, &wfds))
-                    {
-                        if (p -> Connecting())
-                        {
-                            if (p -> CheckConnect())
-                            {
-                                if (p -> IsSSL()) // SSL Enabled socket
-                                    p -> OnSSLConnect();
-                                else
-                                if (p -> Socks4())
-                                    p -> OnSocks4Connect();
-                                else
-                                    p -> OnConnect();
-                            }
-                            else
-                            {
+    }
+    if (w)
+    {
+        if (p -> Connecting())
+        {
+            if (p -> CheckConnect())
+            {
+                if (p -> IsSSL()) // SSL Enabled socket
+                    p -> OnSSLConnect();
+                else
+                if (p -> Socks4())
+                    p -> OnSocks4Connect();
+                else
+                    p -> OnConnect();
+            }
+            else
+            {
 // failed
-                                if (p -> Socks4())
-                                {
-                                    p -> OnSocks4ConnectFailed();
-                                }
-                                else
-                                {
-//									LogError(p, "connect failed", Errno, StrError(Errno), LOG_LEVEL_FATAL);
-                                    p -> SetCloseAndDelete( true );
-                                    p -> OnConnectFailed();
-                                }
-                            }
-//								p -> Touch();
-                        }
-                        else
-                        {
-                            p -> OnWrite();
-//								p -> Touch();
-                        }
-                    }
-                    if (FD_ISSET(i, &efds))
-                    {
-                        p -> OnException();
-                    }
+                if (p -> Socks4())
+                {
+                    p -> OnSocks4ConnectFailed();
                 }
-            }                                     // if (p)
-        }                                         // for
+                else
+                {
+//					LogError(p, "connect failed", Errno, StrError(Errno), LOG_LEVEL_FATAL);
+                    p -> SetCloseAndDelete( true );
+                    p -> OnConnectFailed();
+                }
+            }
+//				p -> Touch();
+        }
+        else
+        {
+            p -> OnWrite();
+//				p -> Touch();
+        }
+    }
+    if (e)
+    {
+        p -> OnException();
     }
+}
+
 
+void SocketHandler::RemoveClosedSockets()
+{
     bool repeat;
     do
     {
@@ -439,7 +486,6 @@ int SocketHandler::Select(long sec,long usec)
             }
         }
     } while (repeat);
-    return n;
 }
 
 
@@ -479,6 +525,16 @@ bool SocketHandler::Valid(Socket *p0)
 }
 
 
+bool SocketHandler::Handles(Socket *p)
+{
+    socket_m::iterator it = m_sockets.find(p -> GetSocket());
+    if (it != m_sockets.end() && (*it).second == p)
+        return true;
+    it = m_add.find(p -> GetSocket());
+    return it != m_add.end() && (*it).second == p;
+}
+
+
 void SocketHandler::RegStdLog(StdLog *x)
 {
     m_stdlog = x;
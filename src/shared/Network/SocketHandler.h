@@ -35,6 +35,7 @@ class ResolvServer;
 
 class SocketHandler
 {
+    protected:
 /** Map type for holding file descriptors/socket object pointers. */
     typedef std::map<SOCKET,Socket *> socket_m;
 
@@ -49,14 +50,18 @@ class SocketHandler
         void LogError(Socket *,const std::string&,int,const std::string&,loglevel_t = LOG_LEVEL_WARNING);
 
         void Add(Socket *);
+/** Stop handling a socket without closing or deleting it. */
+        void Remove(Socket *);
 /** Set read/write/exception file descriptor sets (fd_set). */
-        void Set(SOCKET s,bool bRead,bool bWrite,bool bException = true);
-        int Select(long sec,long usec);
+        virtual void Set(SOCKET s,bool bRead,bool bWrite,bool bException = true);
+        virtual int Select(long sec,long usec);
         bool Valid(Socket *);
+/** Like Valid(), but also true for sockets not yet picked up by Select(); lookup by file descriptor. */
+        bool Handles(Socket *);
 /** Override and return false to deny all incoming connections. */
         virtual bool OkToAccept();
 /** Get status of read/write/exception file descriptor set for a socket. */
-        void Get(SOCKET s,bool& r,bool& w,bool& e);
+        virtual void Get(SOCKET s,bool& r,bool& w,bool& e);
 
 /** ResolveLocal (hostname) - call once before calling any GetLocal method. */
         void ResolveLocal();
@@ -69,6 +74,8 @@ class SocketHandler
 
 /** Return number of sockets handled by this handler.  */
         size_t GetCount();
+/** Return number of sockets Add'ed but not yet picked up by Select(). */
+        size_t GetPendingCount() { return m_add.size(); }
 /** Indicates that the handler runs under SocketThread. */
         void SetSlave(bool x = true);
 /** Find available open connection (used by connection pool). */
@@ -93,6 +100,14 @@ class SocketHandler
 
         socket_m m_sockets;
     protected:
+/** Start handling sockets that were Add'ed since the last call, as long as less than max sockets are handled. */
+        void AddPendingSockets(size_t max);
+/** Connect callbacks and SSL negotiation; returns false if the socket must not get read/write events yet. */
+        bool CheckSocketState(Socket *);
+/** Dispatch read/write/exception readiness of a socket. */
+        void HandleSocketEvents(Socket *,bool r,bool w,bool e);
+/** Handle detached sockets, connect timeouts and sockets marked for CloseAndDelete. */
+        void RemoveClosedSockets();
 
         socket_m m_add;
 
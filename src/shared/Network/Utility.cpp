@@ -21,6 +21,7 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 #include "Utility.h"
+#include <string.h>
 
 std::string Utility::base64(const std::string& str_in)
 {
@@ -149,3 +150,34 @@ std::string Utility::rfc1738_decode(const std::string& src)
     }
     return dst;
 }                                                 // rfc1738_decode
+
+
+bool Utility::LoopbackPair(SOCKET& a, SOCKET& b)
+{
+    a = b = INVALID_SOCKET;
+    SOCKET l = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (l == INVALID_SOCKET)
+    {
+        return false;
+    }
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sa);
+    if (bind(l, (struct sockaddr *)&sa, len) != -1 && getsockname(l, (struct sockaddr *)&sa, &len) != -1 &&
+        listen(l, 1) != -1 && (a = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) != INVALID_SOCKET &&
+        connect(a, (struct sockaddr *)&sa, len) != -1)
+    {
+        b = accept(l, NULL, NULL);
+    }
+    closesocket(l);
+    if (b == INVALID_SOCKET)
+    {
+        if (a != INVALID_SOCKET)
+            closesocket(a);
+        a = INVALID_SOCKET;
+        return false;
+    }
+    return true;
+}                                                 // LoopbackPair
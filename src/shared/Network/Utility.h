@@ -35,6 +35,7 @@ typedef unsigned __int64 uint64_t;
 #endif
 #endif
 #include "Base64.h"
+#include "socket_include.h"
 
 class Utility
 {
@@ -47,5 +48,7 @@ class Utility
         static unsigned int hex2unsigned(const std::string& str);
         static std::string rfc1738_encode(const std::string& src);
         static std::string rfc1738_decode(const std::string& src);
+/** Connected pair of tcp sockets over 127.0.0.1, like socketpair() but also on win32. */
+        static bool LoopbackPair(SOCKET& a, SOCKET& b);
 };
 #endif                                            // _UTILITY_H
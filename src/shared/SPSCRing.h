@@ -0,0 +1,179 @@
+#ifndef _SPSCRING_H
+#define _SPSCRING_H
+
+#include <deque>
+#include <vector>
+#include "SysDefs.h"
+#include "DebugStuff.h"
+#include "zthread/Condition.h"
+#include "zthread/FastMutex.h"
+#include "zthread/Guard.h"
+
+#if COMPILER == COMPILER_MICROSOFT
+#  include <windows.h>
+#endif
+
+// memory ordering for the ring indices. each index is written by one thread only.
+namespace SPSCAtomic
+{
+#if COMPILER == COMPILER_GNU && COMPILER_VERSION >= 40700
+    inline uint32 LoadAcquire(const volatile uint32 *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+    inline void StoreRelease(volatile uint32 *p, uint32 v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+    inline void FullBarrier(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+#elif COMPILER == COMPILER_GNU
+    inline uint32 LoadAcquire(const volatile uint32 *p) { uint32 v = *p; __sync_synchronize(); return v; }
+    inline void StoreRelease(volatile uint32 *p, uint32 v) { __sync_synchronize(); *p = v; }
+    inline void FullBarrier(void) { __sync_synchronize(); }
+#else
+    // volatile accesses have acquire/release semantics with VC
+    inline uint32 LoadAcquire(const volatile uint32 *p) { return *p; }
+    inline void StoreRelease(volatile uint32 *p, uint32 v) { *p = v; }
+    inline void FullBarrier(void) { MemoryBarrier(); }
+#endif
+}
+
+// bounded lock-free queue for exactly one producer and one consumer thread.
+// TryPush() fails if the ring is full. Push() never fails: if the ring is full, it appends to a locked
+// overflow list instead and keeps doing so until the consumer has caught up, so the order is kept.
+// that lock is only taken while the consumer lags behind by more than the capacity.
+// with blocking set, WaitPop() can block the consumer until something is pushed. that costs the producer a full
+// memory barrier per push (most of the time of a push), so rings that are only polled should leave it off.
+template <class T> class SPSCRing
+{
+public:
+    SPSCRing(uint32 capacity = 1024, bool blocking = false) : _blocking(blocking), _cond(_waitmutex)
+    {
+        uint32 size = 2;
+        while(size < capacity)
+            size <<= 1;
+        _buf.resize(size);
+        _mask = size - 1;
+        _head = _tail = 0;
+        _cachedhead = _cachedtail = 0;
+        _spilling = 0;
+        _waiting = 0;
+    }
+
+    // producer side
+    bool TryPush(const T& v)
+    {
+        uint32 head = _head;
+        if(head - _cachedtail > _mask)
+        {
+            _cachedtail = SPSCAtomic::LoadAcquire(&_tail);
+            if(head - _cachedtail > _mask)
+                return false;
+        }
+        _buf[head & _mask] = v;
+        SPSCAtomic::StoreRelease(&_head, head + 1);
+        _Wake();
+        return true;
+    }
+
+    void Push(const T& v)
+    {
+        // only the producer sets _spilling, so 0 is never stale here
+        if(!SPSCAtomic::LoadAcquire(&_spilling) && TryPush(v))
+            return;
+        {
+            ZThread::Guard<ZThread::FastMutex> g(_spillmutex);
+            if(!_spilling && TryPush(v)) // the consumer took the overflow meanwhile
+                return;
+            _spill.push_back(v);
+            SPSCAtomic::StoreRelease(&_spilling, 1);
+        }
+        _Wake();
+    }
+
+    // consumer side
+    bool Pop(T& v)
+    {
+        while(true)
+        {
+            // the overflow was taken when the ring was empty, so everything in it is older than the ring contents
+            if(!_out.empty())
+            {
+                v = _out.front();
+                _out.pop_front();
+                return true;
+            }
+            uint32 tail = _tail;
+            if(tail == _cachedhead)
+                _cachedhead = SPSCAtomic::LoadAcquire(&_head);
+            if(tail != _cachedhead)
+            {
+                v = _buf[tail & _mask];
+                _buf[tail & _mask] = T();
+                SPSCAtomic::StoreRelease(&_tail, tail + 1);
+                return true;
+            }
+            if(!SPSCAtomic::LoadAcquire(&_spilling))
+                return false;
+            ZThread::Guard<ZThread::FastMutex> g(_spillmutex);
+            // while spilling, the producer does not use the ring, so once it is empty here it stays empty
+            if(_tail != SPSCAtomic::LoadAcquire(&_head))
+                continue;
+            _out.swap(_spill);
+            SPSCAtomic::StoreRelease(&_spilling, 0);
+        }
+    }
+
+    bool WaitPop(T& v, uint32 timeout) // ms, 0 waits until something is pushed. needs blocking
+    {
+        ASSERT(_blocking);
+        if(Pop(v))
+            return true;
+        {
+            ZThread::Guard<ZThread::FastMutex> g(_waitmutex);
+            SPSCAtomic::StoreRelease(&_waiting, 1);
+            SPSCAtomic::FullBarrier(); // pairs with the one in _Wake(): either the producer sees _waiting, or we see what it pushed
+            if(_tail == SPSCAtomic::LoadAcquire(&_head) && !SPSCAtomic::LoadAcquire(&_spilling))
+            {
+                if(timeout)
+                    _cond.wait(timeout);
+                else
+                    _cond.wait();
+            }
+            SPSCAtomic::StoreRelease(&_waiting, 0);
+        }
+        return Pop(v);
+    }
+
+    // consumer side; without what is still in the overflow
+    inline uint32 Size(void) { return SPSCAtomic::LoadAcquire(&_head) - _tail + _out.size(); }
+    inline bool Empty(void) { return !Size() && !SPSCAtomic::LoadAcquire(&_spilling); }
+    inline uint32 Capacity(void) { return _mask + 1; }
+
+private:
+    void _Wake(void)
+    {
+        if(!_blocking)
+            return;
+        SPSCAtomic::FullBarrier();
+        if(SPSCAtomic::LoadAcquire(&_waiting))
+        {
+            ZThread::Guard<ZThread::FastMutex> g(_waitmutex);
+            _cond.signal();
+        }
+    }
+
+    std::vector<T> _buf;
+    uint32 _mask;
+    const bool _blocking;
+    char _pad0[64];
+    volatile uint32 _head; // written by the producer
+    uint32 _cachedtail; // producer's last look at _tail
+    char _pad1[64];
+    volatile uint32 _tail; // written by the consumer
+    uint32 _cachedhead; // consumer's last look at _head
+    std::deque<T> _out; // consumer's part of the overflow
+    char _pad2[64];
+    volatile uint32 _spilling;
+    volatile uint32 _waiting;
+    std::deque<T> _spill;
+    ZThread::FastMutex _spillmutex;
+    ZThread::FastMutex _waitmutex;
+    ZThread::Condition _cond;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "common.h"
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel()
+{
+    for(uint32 l = 0; l < 4; l++)
+        for(uint32 s = 0; s < 256; s++)
+            _slots[l][s].prev = _slots[l][s].next = &_slots[l][s];
+    _far.prev = _far.next = &_far;
+    _firing.prev = _firing.next = &_firing;
+    _now = GetMonotonicMS();
+    _count = 0;
+}
+
+TimerWheel::~TimerWheel()
+{
+}
+
+uint64 TimerWheel::Add(uint64 when, TimerWheelHandler *handler, void *arg)
+{
+    Node *n;
+    if(_free.size())
+    {
+        n = _free.back();
+        _free.pop_back();
+    }
+    else
+    {
+        _nodes.push_back(Node());
+        n = &_nodes.back();
+        n->index = _nodes.size() - 1;
+        n->gen = 0;
+    }
+    n->prev = n->next = n;
+    n->when = when;
+    n->handler = handler;
+    n->arg = arg;
+    if(when <= _now) // the current tick is done already, fire with the next one
+        _Append(&_slots[0][(_now + 1) & 0xFF], n);
+    else
+        _Insert(n);
+    _count++;
+    return (uint64(n->gen) << 32) | (n->index + 1);
+}
+
+uint64 TimerWheel::AddIn(uint32 ms, TimerWheelHandler *handler, void *arg)
+{
+    return Add(Now() + ms, handler, arg);
+}
+
+uint64 TimerWheel::Now(void)
+{
+    return GetMonotonicMS();
+}
+
+bool TimerWheel::Remove(uint64 id)
+{
+    uint32 idx = uint32(id) - 1;
+    if(!id || idx >= _nodes.size())
+        return false;
+    Node *n = &_nodes[idx];
+    if(n->gen != uint32(id >> 32) || !n->handler)
+        return false;
+    _Unlink(n);
+    _Free(n);
+    return true;
+}
+
+void TimerWheel::_Free(Node *n)
+{
+    n->handler = NULL;
+    n->arg = NULL;
+    n->gen++;
+    _free.push_back(n);
+    _count--;
+}
+
+void TimerWheel::_Insert(Node *n)
+{
+    uint64 when = n->when;
+    if((when >> 8) == (_now >> 8))
+        _Append(&_slots[0][when & 0xFF], n);
+    else if((when >> 16) == (_now >> 16))
+        _Append(&_slots[1][(when >> 8) & 0xFF], n);
+    else if((when >> 24) == (_now >> 24))
+        _Append(&_slots[2][(when >> 16) & 0xFF], n);
+    else if((when >> 32) == (_now >> 32))
+        _Append(&_slots[3][(when >> 24) & 0xFF], n);
+    else
+        _Append(&_far, n);
+}
+
+// re-inserts all timers of a slot; they end up in lower levels now
+void TimerWheel::_Cascade(Node *list)
+{
+    while(!_Empty(list))
+    {
+        Node *n = list->next;
+        _Unlink(n);
+        _Insert(n);
+    }
+}
+
+void TimerWheel::Update(uint64 now)
+{
+    if(!_count)
+    {
+        if(now > _now)
+            _now = now;
+        return;
+    }
+    while(_now < now)
+    {
+        if(!_count) // nothing left, no need to step through the rest
+        {
+            _now = now;
+            break;
+        }
+        _now++;
+        if(!(_now & 0xFF))
+        {
+            if(!(_now & 0xFFFF))
+            {
+                if(!(_now & 0xFFFFFF))
+                {
+                    if(!(_now & 0xFFFFFFFFULL))
+                        _Cascade(&_far);
+                    _Cascade(&_slots[3][(_now >> 24) & 0xFF]);
+                }
+                _Cascade(&_slots[2][(_now >> 16) & 0xFF]);
+            }
+            _Cascade(&_slots[1][(_now >> 8) & 0xFF]);
+        }
+
+        Node *slot = &_slots[0][_now & 0xFF];
+        if(_Empty(slot))
+            continue;
+        // move the whole slot away first, handlers may add or remove timers
+        _firing.next = slot->next;
+        _firing.prev = slot->prev;
+        _firing.next->prev = &_firing;
+        _firing.prev->next = &_firing;
+        slot->prev = slot->next = slot;
+        while(!_Empty(&_firing))
+        {
+            Node *n = _firing.next;
+            _Unlink(n);
+            TimerWheelHandler *h = n->handler;
+            void *arg = n->arg;
+            uint64 id = (uint64(n->gen) << 32) | (n->index + 1);
+            _Free(n);
+            h->OnTimer(id, arg);
+        }
+    }
+}
+
+uint64 TimerWheel::_MinWhen(Node *list)
+{
+    uint64 m = list->next->when;
+    for(Node *n = list->next; n != list; n = n->next)
+        if(n->when < m)
+            m = n->when;
+    return m;
+}
+
+bool TimerWheel::GetNextExpiry(uint64& when)
+{
+    if(!_count)
+        return false;
+    // every level only holds timers of its current block, so the first non-empty slot found
+    // in the lowest level holds the next timer
+    for(uint32 l = 0; l < 4; l++)
+    {
+        uint32 shift = l * 8;
+        uint32 cur = uint32(_now >> shift) & 0xFF;
+        for(uint32 s = cur + 1; s <= 0xFFu + (l ? 0u : 1u); s++) // level 0 may hold already due timers in the first slot of the next block
+        {
+            Node *slot = &_slots[l][s & 0xFF];
+            if(!_Empty(slot))
+            {
+                when = _MinWhen(slot);
+                return true;
+            }
+        }
+    }
+    if(!_Empty(&_far))
+    {
+        when = _MinWhen(&_far);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,61 @@
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+#include "SysDefs.h"
+#include <deque>
+#include <vector>
+
+class TimerWheelHandler
+{
+public:
+    virtual ~TimerWheelHandler() {}
+    virtual void OnTimer(uint64 id, void *arg) = 0;
+};
+
+// hierarchical timer wheel with 1 ms resolution, based on GetMonotonicMS().
+// 4 levels of 256 slots each; a timer is kept in the lowest level whose current block contains its
+// expiry time, and moved down a level whenever that block is reached. adding and removing are O(1).
+// not thread safe, to be used by the thread that calls Update().
+class TimerWheel
+{
+public:
+    TimerWheel();
+    ~TimerWheel();
+    uint64 Add(uint64 when, TimerWheelHandler *handler, void *arg = NULL); // absolute time; returns id, never 0
+    uint64 AddIn(uint32 ms, TimerWheelHandler *handler, void *arg = NULL); // relative to Now()
+    bool Remove(uint64 id); // false if the timer already fired or was removed
+    void Update(uint64 now); // calls the handlers of all timers that expired until now
+    inline void Update(void) { Update(Now()); }
+    bool GetNextExpiry(uint64& when); // false if no timer is pending
+    inline uint32 Size(void) { return _count; }
+    static uint64 Now(void); // = GetMonotonicMS(), usable without including tools.h
+
+private:
+    struct Node
+    {
+        Node *prev, *next;
+        uint64 when;
+        TimerWheelHandler *handler;
+        void *arg;
+        uint32 index; // in _nodes
+        uint32 gen; // increased on every reuse, so that old ids don't match
+    };
+
+    void _Insert(Node *n);
+    void _Cascade(Node *list);
+    static inline void _Unlink(Node *n) { n->prev->next = n->next; n->next->prev = n->prev; n->prev = n->next = n; }
+    static inline void _Append(Node *list, Node *n) { n->prev = list->prev; n->next = list; list->prev->next = n; list->prev = n; }
+    static inline bool _Empty(Node *list) { return list->next == list; }
+    void _Free(Node *n);
+    uint64 _MinWhen(Node *list);
+
+    Node _slots[4][256]; // list heads
+    Node _far; // timers more than 2^32 ms ahead
+    Node _firing; // timers currently being fired by Update()
+    std::deque<Node> _nodes; // deque, so that pointers stay valid when it grows
+    std::vector<Node*> _free;
+    uint64 _now; // all timers up to this time are fired
+    uint32 _count;
+};
+
+#endif
@@ -123,4 +123,48 @@ void ZCompressor::clear(void)
     _real_size=0;
     _iscompressed=false;
 }
+
+ZInflateStream::ZInflateStream()
+{
+    _stream = new z_stream;
+    memset(_stream, 0, sizeof(z_stream));
+    _ready = false;
+}
+
+ZInflateStream::~ZInflateStream()
+{
+    if(_ready)
+        inflateEnd(_stream);
+    delete _stream;
+}
+
+bool ZInflateStream::Inflate(const uint8 *src, uint32 src_size, uint8 *dst, uint32 dst_size)
+{
+    if(!_ready)
+    {
+        if(Z_OK != inflateInit(_stream))
+        {
+            logerror("ZInflateStream: inflateInit failed!");
+            return false;
+        }
+        _ready = true;
+    }
+    else if(Z_OK != inflateReset(_stream))
+    {
+        logerror("ZInflateStream: inflateReset failed!");
+        return false;
+    }
+
+    _stream->next_in = (Bytef*)src;
+    _stream->avail_in = src_size;
+    _stream->next_out = (Bytef*)dst;
+    _stream->avail_out = dst_size;
+    int result = inflate(_stream, Z_FINISH);
+    if(result != Z_STREAM_END || _stream->total_out != dst_size)
+    {
+        logerror("ZInflateStream: Inflate error! result=%d cursize=%u origsize=%u realsize=%u",result,src_size,(uint32)_stream->total_out,dst_size);
+        return false;
+    }
+    return true;
+}
     
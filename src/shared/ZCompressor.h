@@ -22,12 +22,23 @@ protected:
     bool _iscompressed;
     void _compress(void* dst, uint32 *dst_size, void* src, uint32 src_size, uint8 level=4);
     uint32 _real_size;
+};
 
+struct z_stream_s;
 
-
-
-
-
+// keeps one zlib inflate state alive and only resets it between calls,
+// instead of setting up a new one for every compressed block.
+class ZInflateStream
+{
+public:
+    ZInflateStream();
+    ~ZInflateStream();
+    // inflates a complete zlib stream; true if exactly dst_size bytes were written to dst
+    bool Inflate(const uint8 *src, uint32 src_size, uint8 *dst, uint32 dst_size);
+
+private:
+    z_stream_s *_stream;
+    bool _ready; // inflateInit() done
 };
 
 
@@ -11,6 +11,9 @@
 #   include <mmsystem.h>
 #   include <time.h>
 #   include <direct.h>
+#   include <psapi.h>
+#   include <sys/types.h>
+#   include <sys/stat.h>
 #else
 #   include <sys/dir.h>
 #   include <sys/stat.h>
@@ -18,7 +21,11 @@
 #       include <time.h>
 #   endif
 #   include <sys/timeb.h>
+#   include <sys/resource.h>
 #   include <unistd.h>
+#   include <fcntl.h>
+#   include <time.h>
+#   include <pthread.h>
 #endif
 
 #ifndef MAX_PATH
@@ -229,6 +236,71 @@ uint32 GetFileSize(const char* sFileName)
     return end_pos - begin_pos;
 }
 
+// last modification time of a file (unix timestamp), 0 if it doesn't exist
+uint32 GetFileModTime(const char *fn)
+{
+    if(!fn || !*fn)
+        return 0;
+#if PLATFORM == PLATFORM_WIN32
+    struct _stat st;
+    if(_stat(fn, &st))
+        return 0;
+#else
+    struct stat st;
+    if(stat(fn, &st))
+        return 0;
+#endif
+    return uint32(st.st_mtime);
+}
+
+// moves file `from` to `to`, replacing `to` in one step. processes that still have the old file
+// open or mapped keep seeing the old content, instead of a truncated file.
+bool RenameFile(const char *from, const char *to)
+{
+#if PLATFORM == PLATFORM_WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+// appends to an existing file with a single write. other processes appending to the same file at the
+// same time can't end up in the middle of it, as they can with buffered writes that are split up.
+bool AppendToFile(const char *fn, const void *data, uint32 size)
+{
+#if PLATFORM == PLATFORM_WIN32
+    // with FILE_APPEND_DATA access only, every write goes to the current end of the file in one piece
+    HANDLE fh = CreateFileA(fn, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(fh == INVALID_HANDLE_VALUE)
+        return false;
+    DWORD written = 0;
+    bool ok = WriteFile(fh, data, size, &written, NULL) && written == size;
+    return CloseHandle(fh) && ok;
+#else
+    int fd = open(fn, O_WRONLY | O_APPEND);
+    if(fd < 0)
+        return false;
+    ssize_t n;
+    do
+        n = write(fd, data, size);
+    while(n < 0 && errno == EINTR);
+    bool ok = n == (ssize_t)size;
+    return !close(fd) && ok;
+#endif
+}
+
+// name for a temp file next to `fn` that no other process or thread uses, to write it and then RenameFile() it to `fn`
+std::string MakeTempFileName(const char *fn)
+{
+#if PLATFORM == PLATFORM_WIN32
+    uint64 pid = GetCurrentProcessId(), tid = GetCurrentThreadId();
+#else
+    uint64 pid = getpid(), tid = (uint64)(size_t)pthread_self();
+#endif
+    return std::string(fn) + "." + toString(pid) + "-" + toString(tid) + ".tmp";
+}
+
 // fix filenames for linux ( '/' instead of windows '\')
 void _FixFileName(std::string& str)
 {
@@ -263,12 +335,12 @@ std::string NormalizeFilename(std::string s)
     return s;
 }
 
-std::string FilesizeFormat(uint32 b)
+std::string FilesizeFormat(uint64 b)
 {
     char buf[15];
     if (b < 1024)
     {
-        sprintf(buf,"%lu B",b);
+        sprintf(buf,"%u B",uint32(b));
     }
     else if(b < 1024*1024)
     {
@@ -342,3 +414,111 @@ std::string GetAbsolutePath(const char *filename)
 
     return p;
 }
+
+// returns the resident memory of the whole process in KB, 0 if unknown
+uint32 GetProcessMemoryUsage(void)
+{
+#if PLATFORM == PLATFORM_WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.WorkingSetSize / 1024;
+    return 0;
+#elif defined(__linux__)
+    unsigned long pages = 0, resident = 0;
+    FILE *fh = fopen("/proc/self/statm","r");
+    if(!fh)
+        return 0;
+    if(fscanf(fh, "%lu %lu", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fh);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return 0;
+#endif
+}
+
+// the most resident memory the process ever had in KB, 0 if unknown
+uint32 GetProcessPeakMemoryUsage(void)
+{
+#if PLATFORM == PLATFORM_WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize / 1024;
+    return 0;
+#else
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru))
+        return 0;
+#   if defined(__APPLE_CC__)
+    return ru.ru_maxrss / 1024; // bytes on OS X
+#   else
+    return ru.ru_maxrss;
+#   endif
+#endif
+}
+
+// user + system time of all threads of this process so far, in microseconds
+uint64 GetProcessCPUTimeUS(void)
+{
+#if PLATFORM == PLATFORM_WIN32
+    FILETIME ct, et, kt, ut;
+    if(!GetProcessTimes(GetCurrentProcess(), &ct, &et, &kt, &ut))
+        return 0;
+    // 100 ns units
+    return ((uint64(kt.dwHighDateTime) << 32 | kt.dwLowDateTime) + (uint64(ut.dwHighDateTime) << 32 | ut.dwLowDateTime)) / 10;
+#else
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru))
+        return 0;
+    return (uint64(ru.ru_utime.tv_sec) + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+// milliseconds since some unspecified point, never jumps back when the system time is changed.
+// use this instead of clock(), which counts cpu time on unix.
+uint64 GetMonotonicMS(void)
+{
+#if PLATFORM == PLATFORM_WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER ctr;
+    if(!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&ctr);
+    return uint64(ctr.QuadPart / (freq.QuadPart / 1000));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+// like GetMonotonicMS(), in microseconds. for timing short operations.
+uint64 GetMonotonicUS(void)
+{
+#if PLATFORM == PLATFORM_WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER ctr;
+    if(!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&ctr);
+    // split up, ctr * 1000000 would overflow after a few days of uptime
+    return uint64(ctr.QuadPart / freq.QuadPart) * 1000000 + uint64(ctr.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+// number of processors available, at least 1
+uint32 GetCPUCount(void)
+{
+#if PLATFORM == PLATFORM_WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? uint32(n) : 1;
+#endif
+}
@@ -23,12 +23,22 @@ bool FileExists(std::string);
 bool CreateDir(const char*);
 uint32 getMSTime(void);
 uint32 GetFileSize(const char*);
+uint32 GetFileModTime(const char*);
+bool RenameFile(const char*, const char*);
+std::string MakeTempFileName(const char*);
+bool AppendToFile(const char*, const void*, uint32);
 void _FixFileName(std::string&);
 std::string _PathToFileName(std::string);
 std::string NormalizeFilename(std::string);
-std::string FilesizeFormat(uint32);
+std::string FilesizeFormat(uint64);
 std::string GetWorkingDir(void);
 bool SetWorkingDir(const char*);
 std::string GetAbsolutePath(const char*);
+uint32 GetProcessMemoryUsage(void);
+uint32 GetProcessPeakMemoryUsage(void);
+uint64 GetProcessCPUTimeUS(void);
+uint64 GetMonotonicMS(void);
+uint64 GetMonotonicUS(void);
+uint32 GetCPUCount(void);
 
 #endif
@@ -0,0 +1,166 @@
+#include <algorithm>
+
+#include "common.h"
+#include "SPSCRing.h"
+
+// spscring_test: order checks for SPSCRing, run by ctest.
+// "spscring_test -bench [-n <items>]" times producer/consumer throughput against ZThread::LockedQueue instead.
+
+static uint32 failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { printf("FAILED: %s (line %u)\n", #cond, __LINE__); failures++; } } while(0)
+
+// a 4-slot ring spills after 4 pushes, so most of this goes through the overflow list
+static void TestOverflowOrder(void)
+{
+    SPSCRing<uint32> r(4);
+    CHECK(r.Capacity() == 4);
+    uint32 pushed = 0, popped = 0, v;
+    for(uint32 round = 0; round < 50; round++)
+    {
+        // push more than fits, then take some but not all, so that ring and overflow are both in use
+        for(uint32 i = 0; i < round % 11 + 1; i++)
+            r.Push(pushed++);
+        for(uint32 i = 0; i < round % 7 && r.Pop(v); i++)
+            CHECK(v == popped++);
+    }
+    while(r.Pop(v))
+        CHECK(v == popped++);
+    CHECK(popped == pushed);
+    CHECK(r.Empty());
+    CHECK(!r.Pop(v));
+
+    // TryPush() never spills
+    for(uint32 i = 0; i < 4; i++)
+        CHECK(r.TryPush(i));
+    CHECK(!r.TryPush(4));
+    for(uint32 i = 0; i < 4; i++)
+        CHECK(r.Pop(v) && v == i);
+    CHECK(r.Empty());
+}
+
+class Producer : public ZThread::Runnable
+{
+public:
+    Producer(SPSCRing<uint32> *r, uint32 n) : _r(r), _n(n) {}
+    void run(void)
+    {
+        for(uint32 i = 0; i < _n; i++)
+            _r->Push(i);
+    }
+private:
+    SPSCRing<uint32> *_r;
+    uint32 _n;
+};
+
+// the consumer runs on the calling thread, polling or waiting. returns the number of items out of order.
+static uint32 _RunPair(SPSCRing<uint32>& r, uint32 n, bool wait)
+{
+    uint32 next = 0, wrong = 0, v;
+    ZThread::Thread t(new Producer(&r, n));
+    while(next < n)
+    {
+        if(wait ? r.WaitPop(v, 100) : r.Pop(v))
+        {
+            if(v != next)
+                wrong++;
+            next = v + 1;
+        }
+        else if(!wait)
+            ZThread::Thread::yield();
+    }
+    t.wait();
+    return wrong;
+}
+
+static void TestThreads(void)
+{
+    SPSCRing<uint32> small(4), big(1024), blocking(4, true);
+    CHECK(_RunPair(small, 1000000, false) == 0);
+    CHECK(small.Empty());
+    CHECK(_RunPair(big, 1000000, false) == 0);
+    CHECK(big.Empty());
+    CHECK(_RunPair(blocking, 200000, true) == 0);
+    CHECK(blocking.Empty());
+}
+
+class LockedProducer : public ZThread::Runnable
+{
+public:
+    LockedProducer(ZThread::LockedQueue<uint32,ZThread::FastMutex> *q, uint32 n) : _q(q), _n(n) {}
+    void run(void)
+    {
+        for(uint32 i = 0; i < _n; i++)
+            _q->add(i);
+    }
+private:
+    ZThread::LockedQueue<uint32,ZThread::FastMutex> *_q;
+    uint32 _n;
+};
+
+static void Bench(uint32 n)
+{
+    uint64 t = GetMonotonicUS();
+    {
+        ZThread::LockedQueue<uint32,ZThread::FastMutex> q;
+        ZThread::Thread pt(new LockedProducer(&q, n));
+        for(uint32 got = 0; got < n; )
+        {
+            if(q.size())
+            {
+                q.next();
+                got++;
+            }
+            else
+                ZThread::Thread::yield();
+        }
+        pt.wait();
+    }
+    printf("LockedQueue:             %6.2f M/s\n", n / double(std::max<uint64>(GetMonotonicUS() - t, 1)));
+
+    const uint32 caps[] = { 4, 64, 1024, 0 };
+    for(uint32 i = 0; caps[i]; i++)
+    {
+        SPSCRing<uint32> r(caps[i]);
+        t = GetMonotonicUS();
+        uint32 wrong = _RunPair(r, n, false);
+        printf("SPSCRing(%4u):          %6.2f M/s%s\n", caps[i], n / double(std::max<uint64>(GetMonotonicUS() - t, 1)),
+            wrong ? ", OUT OF ORDER" : "");
+    }
+    SPSCRing<uint32> br(1024, true);
+    t = GetMonotonicUS();
+    uint32 wrong = _RunPair(br, n, true);
+    printf("SPSCRing(1024) WaitPop:  %6.2f M/s%s\n", n / double(std::max<uint64>(GetMonotonicUS() - t, 1)),
+        wrong ? ", OUT OF ORDER" : "");
+}
+
+int main(int argc, char *argv[])
+{
+    bool bench = false;
+    uint32 n = 10000000;
+    for(int a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a],"-bench"))
+            bench = true;
+        else if(!strcmp(argv[a],"-n") && a + 1 < argc)
+            n = std::max(atoi(argv[++a]), 1);
+        else
+        {
+            printf("Usage: spscring_test [-bench [-n <items>]]\n");
+            return 1;
+        }
+    }
+    if(bench)
+    {
+        Bench(n);
+        return 0;
+    }
+
+    TestOverflowOrder();
+    TestThreads();
+    if(failures)
+        printf("%u checks failed\n", failures);
+    else
+        printf("all checks passed\n");
+    return failures ? 1 : 0;
+}
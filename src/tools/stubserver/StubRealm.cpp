@@ -0,0 +1,258 @@
+#include <algorithm>
+
+#include "StubServer.h"
+#include "Auth/Sha1.h"
+
+// realm side: SRP6 logon with the password from -pass for every account, and a realm list with one realm.
+// like the client's RealmSocket, every read is taken as one whole packet; both sides wait for the answer before sending more.
+
+enum StubAuthCmd
+{
+    STUB_AUTH_LOGON_CHALLENGE   = 0x00,
+    STUB_AUTH_LOGON_PROOF       = 0x01,
+    STUB_REALM_LIST             = 0x10
+};
+
+enum StubAuthResult
+{
+    STUB_AUTH_SUCCESS           = 0x00,
+    STUB_AUTH_NO_MATCH          = 0x04,
+    STUB_AUTH_WRONG_BUILD       = 0x09
+};
+
+static const char *N_hex = "894B645E89E1535BBDAD5B8B290650530801B18EBFBF5E8FAB3C82872A3E9BB7";
+
+// BigNumber::AsByteArray() has no leading zeros, the packets want fixed sizes
+static void _AppendPadded(ByteBuffer& buf, BigNumber& bn, uint32 len)
+{
+    uint32 n = std::min<uint32>(bn.GetNumBytes(), len);
+    buf.append(bn.AsByteArray(), n);
+    for(; n < len; n++)
+        buf << uint8(0);
+}
+
+StubRealmSocket::StubRealmSocket(SocketHandler& h) : TcpSocket(h)
+{
+    _server = NULL;
+    _authed = false;
+}
+
+void StubRealmSocket::OnAccept(void)
+{
+    SocketHandler& hnd = Handler();
+    _server = static_cast<StubSocketHandler*>(&hnd)->GetServer();
+    logdebug("Realm: connection from %s:%u",GetRemoteAddress().c_str(),GetRemotePort());
+}
+
+void StubRealmSocket::OnRead(void)
+{
+    TcpSocket::OnRead();
+    uint32 len = ibuf.GetLength();
+    if(!len)
+        return;
+    ByteBuffer pkt;
+    pkt.resize(len);
+    ibuf.Read((char*)pkt.contents(), len);
+
+    try
+    {
+        switch(pkt[0])
+        {
+            case STUB_AUTH_LOGON_CHALLENGE: _HandleLogonChallenge(pkt); break;
+            case STUB_AUTH_LOGON_PROOF:     _HandleLogonProof(pkt); break;
+            case STUB_REALM_LIST:           _HandleRealmList(pkt); break;
+            default:
+                logerror("Realm: unknown cmd 0x%X from %s, closing",pkt[0],GetRemoteAddress().c_str());
+                SetCloseAndDelete();
+        }
+    }
+    catch(ByteBufferException&)
+    {
+        logerror("Realm: short packet, cmd 0x%X, %u bytes, closing",pkt[0],len);
+        SetCloseAndDelete();
+    }
+}
+
+void StubRealmSocket::_SendPacket(ByteBuffer& pkt)
+{
+    SendBuf((const char*)pkt.contents(), pkt.size());
+}
+
+void StubRealmSocket::_HandleLogonChallenge(ByteBuffer& pkt)
+{
+    uint8 cmd, err, acclen;
+    uint16 size, build;
+    pkt >> cmd >> err >> size;
+    pkt.rpos(11); // "WoW", version
+    pkt >> build;
+    pkt.rpos(33); // platform, os, locale, timezone, ip
+    pkt >> acclen;
+    _user.resize(acclen);
+    pkt.read((uint8*)&_user[0], acclen);
+
+    StubConf& conf = _server->GetConf();
+    ByteBuffer reply;
+    reply << uint8(STUB_AUTH_LOGON_CHALLENGE) << uint8(0);
+    if(build != conf.build)
+    {
+        logerror("Realm: %s logs in with build %u, expected %u",_user.c_str(),build,conf.build);
+        reply << uint8(STUB_AUTH_WRONG_BUILD);
+        _SendPacket(reply);
+        return;
+    }
+    _server->SetLoginStart(_user, GetMonotonicUS());
+
+    BigNumber N, g, x, k(3);
+    N.SetHexStr(N_hex);
+    g.SetDword(7);
+    _salt.SetRand(32 * 8);
+
+    Sha1Hash userhash, xhash;
+    std::string authstr = stringToUpper(_user + ":" + conf.pass);
+    userhash.UpdateData(authstr);
+    userhash.Finalize();
+    xhash.UpdateBigNumbers(&_salt, NULL);
+    xhash.UpdateData(userhash.GetDigest(), userhash.GetLength());
+    xhash.Finalize();
+    x.SetBinary(xhash.GetDigest(), xhash.GetLength());
+    _v = g.ModExp(x, N);
+    _b.SetRand(19 * 8);
+    _B = ((_v * k) + g.ModExp(_b, N)) % N;
+
+    BigNumber unk;
+    unk.SetRand(16 * 8);
+    reply << uint8(STUB_AUTH_SUCCESS);
+    _AppendPadded(reply, _B, 32);
+    reply << uint8(1);
+    _AppendPadded(reply, g, 1);
+    reply << uint8(32);
+    _AppendPadded(reply, N, 32);
+    _AppendPadded(reply, _salt, 32);
+    _AppendPadded(reply, unk, 16);
+    reply << uint8(0); // security flags
+    _SendPacket(reply);
+}
+
+void StubRealmSocket::_HandleLogonProof(ByteBuffer& pkt)
+{
+    // A is sent without leading zeros, followed by M1, crc hash, key count and security flags
+    if(_user.empty() || pkt.size() < 1 + 20 + 20 + 2 + 1 || pkt.size() > 1 + 32 + 20 + 20 + 2)
+        throw ByteBufferException("LogonProof", 0, 0, pkt.size(), pkt.size());
+    uint32 alen = pkt.size() - (1 + 20 + 20 + 2);
+    const uint8 *M1 = pkt.contents() + 1 + alen;
+
+    BigNumber N, g, A, u, S;
+    N.SetHexStr(N_hex);
+    g.SetDword(7);
+    A.SetBinary(pkt.contents() + 1, alen);
+
+    Sha1Hash uhash;
+    uhash.UpdateBigNumbers(&A, &_B, NULL);
+    uhash.Finalize();
+    u.SetBinary(uhash.GetDigest(), 20);
+    S = (A * _v.ModExp(u, N)).ModExp(_b, N);
+
+    // session key, split and hashed the same way as the client does it
+    ByteBuffer sbuf;
+    _AppendPadded(sbuf, S, 32);
+    uint8 S1[16], S2[16], S_hash[40];
+    for(uint32 i = 0; i < 16; i++)
+    {
+        S1[i] = sbuf[i * 2];
+        S2[i] = sbuf[i * 2 + 1];
+    }
+    Sha1Hash S1hash, S2hash;
+    S1hash.UpdateData(S1, 16);
+    S1hash.Finalize();
+    S2hash.UpdateData(S2, 16);
+    S2hash.Finalize();
+    for(uint32 i = 0; i < 20; i++)
+    {
+        S_hash[i * 2] = S1hash.GetDigest()[i];
+        S_hash[i * 2 + 1] = S2hash.GetDigest()[i];
+    }
+
+    uint8 Ng_hash[20];
+    Sha1Hash userhash, Nhash, ghash;
+    userhash.UpdateData((const uint8*)_user.c_str(), _user.length());
+    userhash.Finalize();
+    Nhash.UpdateBigNumbers(&N, NULL);
+    Nhash.Finalize();
+    ghash.UpdateBigNumbers(&g, NULL);
+    ghash.Finalize();
+    for(uint32 i = 0; i < 20; i++)
+        Ng_hash[i] = Nhash.GetDigest()[i] ^ ghash.GetDigest()[i];
+    BigNumber t_acc, t_Ng_hash;
+    t_acc.SetBinary(userhash.GetDigest(), userhash.GetLength());
+    t_Ng_hash.SetBinary(Ng_hash, 20);
+
+    Sha1Hash M1hash;
+    M1hash.UpdateBigNumbers(&t_Ng_hash, &t_acc, &_salt, &A, &_B, NULL);
+    M1hash.UpdateData(S_hash, 40);
+    M1hash.Finalize();
+
+    ByteBuffer reply;
+    reply << uint8(STUB_AUTH_LOGON_PROOF);
+    if(memcmp(M1hash.GetDigest(), M1, 20))
+    {
+        logerror("Realm: %s sent a wrong proof (password is not \"%s\"?)",_user.c_str(),_server->GetConf().pass.c_str());
+        _server->GetStats().c.authfailures++;
+        reply << uint8(STUB_AUTH_NO_MATCH);
+        _SendPacket(reply);
+        return;
+    }
+
+    Sha1Hash M2hash;
+    M2hash.UpdateBigNumbers(&A, NULL);
+    M2hash.UpdateData(M1hash.GetDigest(), M1hash.GetLength());
+    M2hash.UpdateData(S_hash, 40);
+    M2hash.Finalize();
+
+    reply << uint8(STUB_AUTH_SUCCESS);
+    reply.append(M2hash.GetDigest(), 20);
+    if(_server->GetConf().client == STUB_CLIENT_CLASSIC)
+        reply << uint32(0);
+    else
+        reply << uint32(0x00800000) << uint32(0) << uint16(0); // account flags (pro pass), survey id, unk flags
+    _SendPacket(reply);
+
+    BigNumber K;
+    K.SetBinary(S_hash, 40);
+    _server->SetSessionKey(_user, K);
+    _server->GetStats().c.realmlogins++;
+    _authed = true;
+    logdetail("Realm: %s logged in",_user.c_str());
+}
+
+void StubRealmSocket::_HandleRealmList(ByteBuffer& pkt)
+{
+    if(!_authed)
+    {
+        SetCloseAndDelete();
+        return;
+    }
+    StubConf& conf = _server->GetConf();
+    bool classic = conf.client == STUB_CLIENT_CLASSIC;
+    ByteBuffer realms;
+    realms << uint32(0);
+    if(classic)
+        realms << uint8(1) << uint32(0); // count, icon
+    else
+        realms << uint16(1) << uint8(0) << uint8(0); // count, icon, locked
+    realms << uint8(0); // flags
+    realms << conf.realmname;
+    realms << (conf.host + ":" + toString(conf.worldport));
+    realms << float(0.0f); // population
+    realms << uint8(1); // characters
+    realms << uint8(1); // timezone
+    realms << uint8(1); // realm id
+    if(classic)
+        realms << uint16(0x0002);
+    else
+        realms << uint16(0x0010);
+
+    ByteBuffer reply;
+    reply << uint8(STUB_REALM_LIST) << uint16(realms.size());
+    reply.append(realms);
+    _SendPacket(reply);
+}
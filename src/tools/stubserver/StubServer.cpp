@@ -0,0 +1,264 @@
+#include <algorithm>
+
+#include "StubServer.h"
+#include "Network/ListenSocket.h"
+
+StubServer *server = NULL;
+
+StubConf::StubConf()
+{
+    client = STUB_CLIENT_WOTLK;
+    build = 0;
+    host = "127.0.0.1";
+    realmport = 3724;
+    worldport = 8085;
+    realmname = "MaNGOS"; // default RealmName in PseuWoW.conf
+    pass = "bot";
+    npcs = 50;
+    rate = 20;
+    movepct = 50;
+    probe = 1000;
+    kick = 0;
+    duration = 0;
+    report = 5;
+}
+
+uint32 StubSamples::Percentile(uint32 pct)
+{
+    if(_s.empty())
+        return 0;
+    std::sort(_s.begin(), _s.end());
+    return _s[std::min<uint32>(_s.size() * pct / 100, _s.size() - 1)];
+}
+
+StubServer::StubServer()
+{
+    _lowguid = 0;
+    _probeentry = 100000; // far above the creature entries the stream npcs use
+    _captured = false;
+    _stop = false;
+    _lastreportus = 0;
+    _h.SetServer(this);
+}
+
+StubServer::~StubServer()
+{
+}
+
+bool StubServer::Init(void)
+{
+    switch(_conf.client)
+    {
+        case STUB_CLIENT_CLASSIC: _conf.build = 6005; break;
+        case STUB_CLIENT_TBC:     _conf.build = 8606; break;
+        case STUB_CLIENT_WOTLK:   _conf.build = 12340; break;
+        default:
+            logerror("Unknown client %u, use 1 (classic), 2 (tbc) or 3 (wotlk)",_conf.client);
+            return false;
+    }
+    if(!_conf.report)
+        _conf.report = 5;
+    if(_conf.capture.size() && !_capture.Open(_conf.capture.c_str(), _conf.build))
+    {
+        logerror("Can't write capture file '%s'",_conf.capture.c_str());
+        return false;
+    }
+
+    // many bots connect at once, a small listen queue would delay their connects by the SYN retry time
+    ListenSocket<StubRealmSocket> *rs = new ListenSocket<StubRealmSocket>(_h);
+    if(rs->Bind(_conf.realmport, 128))
+    {
+        logerror("Can't bind realm port %u",_conf.realmport);
+        delete rs;
+        return false;
+    }
+    _h.Add(rs);
+    ListenSocket<StubWorldSocket> *ws = new ListenSocket<StubWorldSocket>(_h);
+    if(ws->Bind(_conf.worldport, 128))
+    {
+        logerror("Can't bind world port %u",_conf.worldport);
+        delete ws;
+        return false;
+    }
+    _h.Add(ws);
+
+    log("StubServer: client build %u, realm \"%s\" on port %u, world on %s:%u",
+        _conf.build, _conf.realmname.c_str(), _conf.realmport, _conf.host.c_str(), _conf.worldport);
+    log("StubServer: %u npcs per character, %u packets/s (%u%% SMSG_MONSTER_MOVE), probe every %u ms",
+        _conf.npcs, _conf.rate, _conf.movepct, _conf.probe);
+    return true;
+}
+
+void StubServer::Run(void)
+{
+    uint64 start = GetMonotonicUS(), lastupdate = 0;
+    _lastreportus = start;
+    while(!_stop)
+    {
+        _h.Select(0, 1000);
+        uint64 now = GetMonotonicUS();
+        // the stream is paced by elapsed time, so once per ms is fine no matter how many sockets were ready
+        if(now - lastupdate >= 1000)
+        {
+            lastupdate = now;
+            for(std::set<StubWorldSocket*>::iterator it = _world.begin(); it != _world.end(); it++)
+                (*it)->Update(now);
+        }
+        if(now - _lastreportus >= _conf.report * 1000000ULL)
+            _Report(now);
+        if(_conf.duration && now - start >= _conf.duration * 1000000ULL)
+            break;
+    }
+    _Report(GetMonotonicUS());
+}
+
+void StubServer::SetSessionKey(const std::string& user, BigNumber& K)
+{
+    _keys[user] = K;
+}
+
+BigNumber *StubServer::GetSessionKey(const std::string& user)
+{
+    std::map<std::string, BigNumber>::iterator it = _keys.find(user);
+    return it == _keys.end() ? NULL : &it->second;
+}
+
+void StubServer::SetLoginStart(const std::string& user, uint64 us)
+{
+    _loginstart[user] = us;
+}
+
+void StubServer::LoginDone(const std::string& user, uint64 us)
+{
+    std::map<std::string, uint64>::iterator it = _loginstart.find(user);
+    if(it == _loginstart.end())
+        return;
+    _stats.loginus.Add(uint32(us - it->second));
+    _loginstart.erase(it);
+}
+
+bool StubServer::ClaimCapture(void)
+{
+    if(_captured || !_capture.IsOpen())
+        return false;
+    _captured = true;
+    return true;
+}
+
+void StubServer::EndCapture(void)
+{
+    log("StubServer: %u packets captured to '%s'",_capture.GetCount(),_conf.capture.c_str());
+    _capture.Close();
+}
+
+void StubServer::_Report(uint64 nowus)
+{
+    double secs = std::max<uint64>(nowus - _lastreportus, 1) / 1000000.0;
+    StubCounters& c = _stats.c;
+    uint32 inworld = 0;
+    for(std::set<StubWorldSocket*>::iterator it = _world.begin(); it != _world.end(); it++)
+        if((*it)->InWorld())
+            inworld++;
+
+    log("%u in world | realm logins %u (%.1f/s), world logins %u (%.1f/s), auth failures %u, kicks %u",
+        inworld, c.realmlogins, (c.realmlogins - _lastreport.realmlogins) / secs,
+        c.worldlogins, (c.worldlogins - _lastreport.worldlogins) / secs, c.authfailures, c.kicks);
+    log("  stream: %.0f packets/s, %s/s, %.0f skipped/s (client behind)",
+        (c.packets - _lastreport.packets) / secs, FilesizeFormat(uint64((c.bytes - _lastreport.bytes) / secs)).c_str(),
+        (c.backlogged - _lastreport.backlogged) / secs);
+    uint64 reads = c.reads - _lastreport.reads, recvpackets = c.recvpackets - _lastreport.recvpackets;
+    log("  from clients: %.0f packets/s, %s/s, %.0f reads/s (%.2f packets per read)",
+        recvpackets / secs, FilesizeFormat(uint64((c.recvbytes - _lastreport.recvbytes) / secs)).c_str(),
+        reads / secs, double(recvpackets) / std::max<uint64>(reads, 1));
+    if(_stats.loginus.Size())
+        log("  login ms:  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f  (%u)",
+            _stats.loginus.Percentile(50) / 1000.0, _stats.loginus.Percentile(90) / 1000.0,
+            _stats.loginus.Percentile(99) / 1000.0, _stats.loginus.Percentile(100) / 1000.0, _stats.loginus.Size());
+    if(_stats.probeus.Size())
+        log("  probe ms:  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f  (%u)",
+            _stats.probeus.Percentile(50) / 1000.0, _stats.probeus.Percentile(90) / 1000.0,
+            _stats.probeus.Percentile(99) / 1000.0, _stats.probeus.Percentile(100) / 1000.0, _stats.probeus.Size());
+
+    _stats.loginus.Clear();
+    _stats.probeus.Clear();
+    _lastreport = c;
+    _lastreportus = nowus;
+}
+
+void _OnSignal(int s)
+{
+    if(server)
+        server->Stop();
+    signal(s, _OnSignal);
+}
+
+void PrintHelp(void)
+{
+    printf("Usage: stubserver [options]\n\n");
+    printf("Stand-in realm and world server to benchmark PseuWoW, e.g. with \"pseuwow -swarm <n>\".\n");
+    printf("Every account logs in with the same password and gets one character.\n\n");
+    printf("-client <1|2|3>    - classic, tbc or wotlk, like Client in PseuWoW.conf, default 3\n");
+    printf("-host <addr>       - world server address in the realm list, default 127.0.0.1\n");
+    printf("-realmport <port>  - default 3724\n");
+    printf("-worldport <port>  - default 8085\n");
+    printf("-realm <name>      - realm name, must match RealmName in PseuWoW.conf, default MaNGOS\n");
+    printf("-pass <password>   - password of all accounts, default bot\n");
+    printf("-npcs <n>          - npcs created around every character, default 50\n");
+    printf("-rate <n>          - streamed packets per second and character, default 20\n");
+    printf("-movepct <n>       - percentage of SMSG_MONSTER_MOVE in the stream, default 50\n");
+    printf("-probe <ms>        - latency probe interval per character, 0 = off, default 1000\n");
+    printf("-kick <sec>        - close world connections after <sec>, to test reconnecting, default 0 = never\n");
+    printf("-duration <sec>    - stop after <sec>, default 0 = run until ctrl+c\n");
+    printf("-report <sec>      - seconds between reports, default 5\n");
+    printf("-capture <file>    - write what the first character gets after login to a capture file for pseuwow-replay,\n");
+    printf("                     e.g. with -npcs 5000 for a replay with many objects\n");
+}
+
+int main(int argc, char* argv[])
+{
+    StubServer srv;
+    StubConf& conf = srv.GetConf();
+    for(int a = 1; a < argc; a++)
+    {
+        const char *opt = argv[a];
+        if(a + 1 >= argc || opt[0] != '-')
+        {
+            PrintHelp();
+            return 1;
+        }
+        const char *val = argv[++a];
+        if     (!stricmp(opt,"-client"))    conf.client = atoi(val);
+        else if(!stricmp(opt,"-host"))      conf.host = val;
+        else if(!stricmp(opt,"-realmport")) conf.realmport = atoi(val);
+        else if(!stricmp(opt,"-worldport")) conf.worldport = atoi(val);
+        else if(!stricmp(opt,"-realm"))     conf.realmname = val;
+        else if(!stricmp(opt,"-pass"))      conf.pass = val;
+        else if(!stricmp(opt,"-npcs"))      conf.npcs = atoi(val);
+        else if(!stricmp(opt,"-rate"))      conf.rate = atoi(val);
+        else if(!stricmp(opt,"-movepct"))   conf.movepct = std::min(atoi(val), 100);
+        else if(!stricmp(opt,"-probe"))     conf.probe = atoi(val);
+        else if(!stricmp(opt,"-kick"))      conf.kick = atoi(val);
+        else if(!stricmp(opt,"-duration"))  conf.duration = atoi(val);
+        else if(!stricmp(opt,"-report"))    conf.report = atoi(val);
+        else if(!stricmp(opt,"-capture"))   conf.capture = val;
+        else
+        {
+            PrintHelp();
+            return 1;
+        }
+    }
+
+    log_prepare("stubserver_log.txt","w");
+    if(!srv.Init())
+    {
+        log_close();
+        return 1;
+    }
+    server = &srv;
+    signal(SIGINT, _OnSignal);
+    signal(SIGTERM, _OnSignal);
+    srv.Run();
+    server = NULL;
+    log_close();
+    return 0;
+}
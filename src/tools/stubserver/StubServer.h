@@ -0,0 +1,201 @@
+#ifndef STUBSERVER_H
+#define STUBSERVER_H
+
+#define _COMMON_SKIP_THREADS
+#include <map>
+#include <set>
+#include "common.h"
+#include "Auth/AuthCrypt.h"
+#include "Auth/BigNumber.h"
+#include "Network/TcpSocket.h"
+#include "Network/EpollSocketHandler.h"
+#include "PacketCapture.h"
+
+// stand-in realm and world server for load and latency benchmarks of the client.
+// it accepts every account with the one password it was started with, gives it one character
+// and streams synthetic SMSG_UPDATE_OBJECT / SMSG_MONSTER_MOVE packets once that character is in the world.
+// to drive it, start "pseuwow -swarm <n>" with SwarmAccName=bot{n} and the same client version.
+
+// same numbers as "Client" in PseuWoW.conf
+enum StubClient
+{
+    STUB_CLIENT_CLASSIC = 1,
+    STUB_CLIENT_TBC     = 2,
+    STUB_CLIENT_WOTLK   = 3
+};
+
+struct StubConf
+{
+    StubConf();
+    uint8 client;
+    uint16 build; // expected in the logon challenge, set from client
+    std::string host; // sent in the realm list
+    uint16 realmport, worldport;
+    std::string realmname;
+    std::string pass;
+    uint32 npcs; // created around every character after login
+    uint32 rate; // stream packets per second and character
+    uint32 movepct; // share of SMSG_MONSTER_MOVE in the stream, the rest are SMSG_UPDATE_OBJECT value updates
+    uint32 probe; // ms between latency probes per character, 0 = off
+    uint32 kick; // drop every world connection after this many seconds, 0 = never
+    uint32 duration; // seconds, 0 = until ctrl+c
+    uint32 report; // seconds between reports
+    std::string capture; // file the packets sent to the first character in the world are written to
+};
+
+// one latency sample list; cleared after each report
+class StubSamples
+{
+public:
+    inline void Add(uint32 us) { _s.push_back(us); }
+    inline uint32 Size(void) { return _s.size(); }
+    uint32 Percentile(uint32 pct); // sorts the samples
+    inline void Clear(void) { _s.clear(); }
+private:
+    std::vector<uint32> _s;
+};
+
+struct StubCounters
+{
+    StubCounters() { memset(this, 0, sizeof(StubCounters)); }
+    uint64 packets, bytes; // streamed to characters in the world
+    uint64 backlogged; // stream packets skipped because the client did not read fast enough
+    uint64 recvpackets, recvbytes, reads; // from the clients' world connections, reads ~ the clients' send() calls
+    uint32 realmlogins, authfailures, worldlogins, kicks;
+};
+
+struct StubStats
+{
+    StubCounters c;
+    StubSamples loginus; // logon challenge -> CMSG_PLAYER_LOGIN
+    StubSamples probeus; // probe creature created -> CMSG_CREATURE_QUERY received
+};
+
+#ifdef HAVE_EPOLL
+typedef EpollSocketHandler StubSocketHandlerBase;
+#else
+typedef SocketHandler StubSocketHandlerBase;
+#endif
+
+class StubServer;
+
+class StubSocketHandler : public StubSocketHandlerBase
+{
+public:
+    void SetServer(StubServer *srv) { _server = srv; }
+    StubServer *GetServer(void) { return _server; }
+private:
+    StubServer *_server;
+};
+
+class StubRealmSocket : public TcpSocket
+{
+public:
+    StubRealmSocket(SocketHandler& h);
+    void OnAccept(void);
+    void OnRead(void);
+
+private:
+    void _HandleLogonChallenge(ByteBuffer&);
+    void _HandleLogonProof(ByteBuffer&);
+    void _HandleRealmList(ByteBuffer&);
+    void _SendPacket(ByteBuffer&);
+
+    StubServer *_server;
+    std::string _user;
+    BigNumber _b, _B, _v, _salt;
+    bool _authed;
+};
+
+class StubWorldSocket : public TcpSocket
+{
+public:
+    StubWorldSocket(SocketHandler& h);
+    void OnAccept(void);
+    void OnRead(void);
+    void OnDelete(void);
+
+    void SendWorldPacket(uint16 opcode, ByteBuffer& data);
+    void Update(uint64 nowus);
+    inline bool InWorld(void) { return _inworld; }
+
+private:
+    void _HandlePacket(uint16 opcode, ByteBuffer&);
+    void _HandleAuthSession(ByteBuffer&);
+    void _HandleCharEnum(ByteBuffer&);
+    void _HandlePlayerLogin(ByteBuffer&);
+    void _HandlePing(ByteBuffer&);
+    void _HandleCreatureQuery(ByteBuffer&);
+
+    void _AppendCreateBlock(ByteBuffer&, uint64 guid, uint32 entry, bool self, float x, float y, float z);
+    void _AppendValues(ByteBuffer&, uint32 count, const uint16 *fields, const uint32 *values);
+    void _SendStreamPacket(void);
+    void _SendProbe(uint64 nowus);
+
+    StubServer *_server;
+    AuthCrypt _crypt;
+    bool _crypted;
+    uint32 _seed;
+    std::string _user;
+    uint64 _guid;
+    bool _inworld;
+    float _x, _y, _z;
+
+    bool _gothdr;
+    uint16 _opcode;
+    uint32 _remaining;
+
+    double _credit; // stream packets that may be sent now
+    uint64 _lastus, _nextprobeus, _probesentus, _kickus;
+    uint32 _probeentry; // entry of the probe creature that was not queried yet, 0 if none
+    bool _capturing; // what is sent goes to the server's capture file
+};
+
+class StubServer
+{
+public:
+    StubServer();
+    ~StubServer();
+    inline StubConf& GetConf(void) { return _conf; }
+    inline StubStats& GetStats(void) { return _stats; }
+    bool Init(void);
+    void Run(void);
+    inline void Stop(void) { _stop = true; }
+
+    // realm -> world handover
+    void SetSessionKey(const std::string& user, BigNumber& K);
+    BigNumber *GetSessionKey(const std::string& user);
+    void SetLoginStart(const std::string& user, uint64 us);
+    void LoginDone(const std::string& user, uint64 us);
+
+    inline void AddWorldSocket(StubWorldSocket *s) { _world.insert(s); }
+    inline void RemoveWorldSocket(StubWorldSocket *s) { _world.erase(s); }
+    inline uint32 NewGuid(void) { return ++_lowguid; }
+    inline uint32 NewProbeEntry(void) { return ++_probeentry; }
+
+    // -capture: only one character is recorded, from its login until it disconnects
+    bool ClaimCapture(void);
+    inline void CapturePacket(uint16 opcode, ByteBuffer& data) { _capture.Write(opcode, data.size() ? data.contents() : NULL, data.size()); }
+    void EndCapture(void);
+
+private:
+    void _Report(uint64 nowus);
+
+    StubConf _conf;
+    StubStats _stats;
+    std::map<std::string, BigNumber> _keys;
+    std::map<std::string, uint64> _loginstart;
+    std::set<StubWorldSocket*> _world;
+    uint32 _lowguid, _probeentry;
+    PacketCaptureWriter _capture;
+    bool _captured; // the capture was claimed already
+    volatile bool _stop;
+    uint64 _lastreportus;
+    StubCounters _lastreport; // counters at the last report
+    StubSocketHandler _h; // last, its sockets unregister themselves from _world when it deletes them
+};
+
+void _OnSignal(int);
+void PrintHelp(void);
+
+#endif
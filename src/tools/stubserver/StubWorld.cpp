@@ -0,0 +1,520 @@
+#include <algorithm>
+#include <ctype.h>
+
+#include "StubServer.h"
+#include "Auth/Sha1.h"
+#include "Opcodes.h"
+#include "SharedDefines.h"
+#include "UpdateData.h"
+#include "ObjectDefines.h"
+
+// world side: auth, one character per account, and after login the npc stream and latency probes.
+// packet layouts follow what the client's WorldSession handlers read for each version.
+
+#define STUB_TYPEID_UNIT   3
+#define STUB_TYPEID_PLAYER 4
+#define STUB_TYPE_OBJECT   0x01
+#define STUB_TYPE_UNIT     0x08
+#define STUB_TYPE_PLAYER   0x10
+
+#define STUB_NPC_ENTRY     1 // all stream npcs; the probes use entries from StubServer::NewProbeEntry()
+#define STUB_MAX_BACKLOG   0x10000 // stop streaming to a client while this many bytes wait to be sent to it
+#define STUB_MAX_BLOCKS    100 // create blocks per SMSG_UPDATE_OBJECT, keeps them below the 64k classic/tbc size limit
+
+// update field indexes, they moved in wotlk
+enum StubField
+{
+    STUB_FIELD_GUID = 0,
+    STUB_FIELD_TYPE = 2,
+    STUB_FIELD_ENTRY = 3,
+    STUB_FIELD_SCALE_X = 4,
+    STUB_FIELD_HEALTH,
+    STUB_FIELD_MAXHEALTH,
+    STUB_FIELD_LEVEL,
+    STUB_FIELD_MAX
+};
+
+static uint16 _FieldIndex(uint8 client, StubField f)
+{
+    bool wotlk = client == STUB_CLIENT_WOTLK;
+    switch(f)
+    {
+        case STUB_FIELD_HEALTH:    return wotlk ? 24 : 22;
+        case STUB_FIELD_MAXHEALTH: return wotlk ? 32 : 28;
+        case STUB_FIELD_LEVEL:     return wotlk ? 54 : 34;
+        default:                   return uint16(f);
+    }
+}
+
+static inline float _Rand(float range)
+{
+    return (rand() / float(RAND_MAX) - 0.5f) * range;
+}
+
+static inline uint32 _FloatBits(float f)
+{
+    uint32 u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline uint64 _NpcGuid(uint32 entry, uint32 low)
+{
+    return (uint64(HIGHGUID_UNIT) << 48) | (uint64(entry) << 24) | low;
+}
+
+StubWorldSocket::StubWorldSocket(SocketHandler& h) : TcpSocket(h)
+{
+    _server = NULL;
+    _crypted = false;
+    _seed = 0;
+    _guid = 0;
+    _inworld = false;
+    _x = -8949.95f; // northshire abbey
+    _y = -132.49f;
+    _z = 83.53f;
+    _gothdr = false;
+    _opcode = 0;
+    _remaining = 0;
+    _credit = 0;
+    _lastus = _nextprobeus = _probesentus = _kickus = 0;
+    _probeentry = 0;
+    _capturing = false;
+}
+
+void StubWorldSocket::OnAccept(void)
+{
+    SocketHandler& hnd = Handler();
+    _server = static_cast<StubSocketHandler*>(&hnd)->GetServer();
+    _server->AddWorldSocket(this);
+    logdebug("World: connection from %s:%u",GetRemoteAddress().c_str(),GetRemotePort());
+
+    _seed = uint32(rand()) ^ (uint32(rand()) << 16);
+    ByteBuffer pkt;
+    if(_server->GetConf().client == STUB_CLIENT_WOTLK)
+    {
+        pkt << uint32(1) << _seed;
+        for(uint32 i = 0; i < 32; i++)
+            pkt << uint8(rand());
+    }
+    else
+        pkt << _seed;
+    SendWorldPacket(SMSG_AUTH_CHALLENGE, pkt);
+}
+
+void StubWorldSocket::OnDelete(void)
+{
+    if(_server)
+        _server->RemoveWorldSocket(this);
+    if(_capturing)
+        _server->EndCapture();
+}
+
+void StubWorldSocket::OnRead(void)
+{
+    StubCounters& c = _server->GetStats().c;
+    size_t before = ibuf.GetLength();
+    TcpSocket::OnRead();
+    c.reads++;
+    c.recvbytes += ibuf.GetLength() - before;
+    bool wotlk = _server->GetConf().client == STUB_CLIENT_WOTLK;
+    while(ibuf.GetLength())
+    {
+        if(!_gothdr)
+        {
+            // client header: uint16 size (big endian, includes the opcode), uint32 opcode
+            uint8 hdr[6];
+            if(ibuf.GetLength() < sizeof(hdr))
+                break;
+            ibuf.Read((char*)hdr, sizeof(hdr));
+            if(_crypted)
+            {
+                if(wotlk)
+                    _crypt.DecryptRecv_12340(hdr, sizeof(hdr));
+                else
+                    _crypt.ServerDecryptRecv_6005(hdr, sizeof(hdr));
+            }
+            uint32 size = (hdr[0] << 8) | hdr[1];
+            _opcode = hdr[2] | (hdr[3] << 8);
+            if(size < 4 || _opcode >= MAX_OPCODE_ID)
+            {
+                logerror("World: bad header from %s (size %u, opcode %u), closing",_user.c_str(),size,_opcode);
+                SetCloseAndDelete();
+                return;
+            }
+            _remaining = size - 4;
+            _gothdr = true;
+        }
+        if(ibuf.GetLength() < _remaining)
+            break;
+        ByteBuffer pkt;
+        if(_remaining)
+        {
+            pkt.resize(_remaining);
+            ibuf.Read((char*)pkt.contents(), _remaining);
+        }
+        _gothdr = false;
+        c.recvpackets++;
+        try
+        {
+            _HandlePacket(_opcode, pkt);
+        }
+        catch(ByteBufferException&)
+        {
+            logerror("World: short %s from %s, closing",GetOpcodeName(_opcode),_user.c_str());
+            SetCloseAndDelete();
+            return;
+        }
+    }
+}
+
+void StubWorldSocket::SendWorldPacket(uint16 opcode, ByteBuffer& data)
+{
+    // server header: size (big endian, includes the opcode), uint16 opcode. wotlk marks 3 byte sizes with 0x80
+    uint32 size = data.size() + 2;
+    uint8 hdr[5];
+    uint32 hlen = 0;
+    bool wotlk = _server->GetConf().client == STUB_CLIENT_WOTLK;
+    if(wotlk && size > 0x7FFF)
+        hdr[hlen++] = 0x80 | uint8(size >> 16);
+    hdr[hlen++] = uint8(size >> 8);
+    hdr[hlen++] = uint8(size);
+    hdr[hlen++] = uint8(opcode);
+    hdr[hlen++] = uint8(opcode >> 8);
+    if(_crypted)
+    {
+        if(wotlk)
+            _crypt.EncryptSend_12340(hdr, hlen);
+        else
+            _crypt.ServerEncryptSend_6005(hdr, hlen);
+    }
+    // one SendBuf() per packet, so that a packet never waits for the next one in the socket buffer
+    ByteBuffer out(hlen + data.size());
+    out.append(hdr, hlen);
+    if(data.size())
+        out.append(data);
+    SendBuf((const char*)out.contents(), out.size());
+    if(_capturing)
+        _server->CapturePacket(opcode, data);
+}
+
+void StubWorldSocket::_HandlePacket(uint16 opcode, ByteBuffer& pkt)
+{
+    if(opcode != CMSG_AUTH_SESSION && !_crypted)
+    {
+        logerror("World: %s before CMSG_AUTH_SESSION, closing",GetOpcodeName(opcode));
+        SetCloseAndDelete();
+        return;
+    }
+    switch(opcode)
+    {
+        case CMSG_AUTH_SESSION:    _HandleAuthSession(pkt); break;
+        case CMSG_CHAR_ENUM:       _HandleCharEnum(pkt); break;
+        case CMSG_PLAYER_LOGIN:    _HandlePlayerLogin(pkt); break;
+        case CMSG_PING:            _HandlePing(pkt); break;
+        case CMSG_CREATURE_QUERY:  _HandleCreatureQuery(pkt); break;
+        default:
+            logdebug("World: ignored %s from %s",GetOpcodeName(opcode),_user.c_str());
+    }
+}
+
+void StubWorldSocket::_HandleAuthSession(ByteBuffer& pkt)
+{
+    StubConf& conf = _server->GetConf();
+    uint32 build, unk, clientseed;
+    uint64 unk64;
+    uint8 digest[20];
+    pkt >> build >> unk >> _user;
+    if(conf.client == STUB_CLIENT_WOTLK)
+        pkt >> unk >> clientseed >> unk >> unk >> unk >> unk64;
+    else
+        pkt >> clientseed;
+    pkt.read(digest, 20);
+
+    BigNumber *K = _server->GetSessionKey(_user);
+    bool ok = K != NULL;
+    if(ok)
+    {
+        Sha1Hash sha;
+        uint32 zero = 0;
+        sha.UpdateData(_user);
+        sha.UpdateData((uint8*)&zero, sizeof(uint32));
+        sha.UpdateData((uint8*)&clientseed, sizeof(uint32));
+        sha.UpdateData((uint8*)&_seed, sizeof(uint32));
+        sha.UpdateBigNumbers(K, NULL);
+        sha.Finalize();
+        ok = !memcmp(sha.GetDigest(), digest, 20);
+    }
+    if(!ok)
+    {
+        logerror("World: %s failed to authenticate (%s)",_user.c_str(),K ? "wrong digest" : "not logged in at the realm");
+        _server->GetStats().c.authfailures++;
+        ByteBuffer reply;
+        reply << uint8(K ? AUTH_FAILED : AUTH_UNKNOWN_ACCOUNT);
+        SendWorldPacket(SMSG_AUTH_RESPONSE, reply); // unencrypted, the client expects that
+        SetCloseAndDelete();
+        return;
+    }
+
+    switch(conf.client)
+    {
+        case STUB_CLIENT_CLASSIC: _crypt.Init_6005(K); break;
+        case STUB_CLIENT_TBC:     _crypt.Init_8606(K); break;
+        default:                  _crypt.ServerInit_12340(K); break;
+    }
+    _crypted = true;
+
+    ByteBuffer reply;
+    reply << uint8(AUTH_OK) << uint32(0) << uint8(0) << uint32(0); // billing time remaining, plan flags, time rested
+    if(conf.client > STUB_CLIENT_CLASSIC)
+        reply << uint8(conf.client - 1); // expansion
+    SendWorldPacket(SMSG_AUTH_RESPONSE, reply);
+}
+
+void StubWorldSocket::_HandleCharEnum(ByteBuffer& pkt)
+{
+    uint8 client = _server->GetConf().client;
+    if(!_guid)
+        _guid = _server->NewGuid();
+    std::string name = stringToLower(_user);
+    if(name.size())
+        name[0] = toupper(name[0]);
+
+    ByteBuffer reply;
+    reply << uint8(1);
+    reply << _guid << name;
+    reply << uint8(1) << uint8(1) << uint8(0); // human warrior, male
+    reply << uint8(0) << uint8(0) << uint8(0) << uint8(0) << uint8(0); // skin, face, hair style, hair color, facial hair
+    reply << uint8(1); // level
+    reply << uint32(12) << uint32(0) << _x << _y << _z; // zone, map
+    reply << uint32(0) << uint32(0); // guild, flags
+    if(client == STUB_CLIENT_WOTLK)
+        reply << uint32(0); // at login customize
+    reply << uint8(1); // first login
+    reply << uint32(0) << uint32(0) << uint32(0); // pet
+    for(uint32 i = 0; i < 20; i++)
+    {
+        reply << uint32(0) << uint8(0);
+        if(client > STUB_CLIENT_CLASSIC)
+            reply << uint32(0);
+    }
+    SendWorldPacket(SMSG_CHAR_ENUM, reply);
+}
+
+void StubWorldSocket::_HandlePlayerLogin(ByteBuffer& pkt)
+{
+    uint64 guid;
+    pkt >> guid;
+    if(guid != _guid || _inworld)
+    {
+        logerror("World: %s logs in with unknown character "I64FMT,_user.c_str(),guid);
+        SetCloseAndDelete();
+        return;
+    }
+    StubConf& conf = _server->GetConf();
+    uint64 now = GetMonotonicUS();
+    _server->LoginDone(_user, now);
+    _server->GetStats().c.worldlogins++;
+    _capturing = _server->ClaimCapture();
+
+    ByteBuffer verify;
+    verify << uint32(0) << _x << _y << _z << float(0.0f);
+    SendWorldPacket(SMSG_LOGIN_VERIFY_WORLD, verify);
+
+    // own character first, then the npcs around it
+    uint32 created = 0;
+    while(created < conf.npcs + 1)
+    {
+        uint32 blocks = std::min<uint32>(conf.npcs + 1 - created, STUB_MAX_BLOCKS);
+        ByteBuffer upd;
+        upd << blocks;
+        if(conf.client <= STUB_CLIENT_TBC)
+            upd << uint8(0); // has transport
+        for(uint32 i = 0; i < blocks; i++, created++)
+        {
+            if(!created)
+                _AppendCreateBlock(upd, _guid, 0, true, _x, _y, _z);
+            else
+                _AppendCreateBlock(upd, _NpcGuid(STUB_NPC_ENTRY, created), STUB_NPC_ENTRY, false, _x + _Rand(60), _y + _Rand(60), _z);
+        }
+        SendWorldPacket(SMSG_UPDATE_OBJECT, upd);
+    }
+
+    _inworld = true;
+    _credit = 0;
+    _lastus = now;
+    _nextprobeus = now + conf.probe * 1000ULL;
+    _kickus = now + conf.kick * 1000000ULL;
+    _probeentry = 0;
+    logdetail("World: %s entered the world",_user.c_str());
+}
+
+void StubWorldSocket::_HandlePing(ByteBuffer& pkt)
+{
+    uint32 ping;
+    pkt >> ping;
+    ByteBuffer reply;
+    reply << ping;
+    SendWorldPacket(SMSG_PONG, reply);
+}
+
+void StubWorldSocket::_HandleCreatureQuery(ByteBuffer& pkt)
+{
+    uint32 entry;
+    uint64 guid;
+    pkt >> entry >> guid;
+    if(entry && entry == _probeentry)
+    {
+        _server->GetStats().probeus.Add(uint32(GetMonotonicUS() - _probesentus));
+        _probeentry = 0;
+    }
+    // the stub has no creature templates; the client marks the entry as nonexistent and does not ask again
+    ByteBuffer reply;
+    reply << uint32(entry | 0x80000000);
+    SendWorldPacket(SMSG_CREATURE_QUERY_RESPONSE, reply);
+}
+
+void StubWorldSocket::_AppendCreateBlock(ByteBuffer& buf, uint64 guid, uint32 entry, bool self, float x, float y, float z)
+{
+    uint8 client = _server->GetConf().client;
+    buf << uint8(self ? UPDATETYPE_CREATE_OBJECT2 : UPDATETYPE_CREATE_OBJECT);
+    buf.appendPackGUID(guid);
+    buf << uint8(self ? STUB_TYPEID_PLAYER : STUB_TYPEID_UNIT);
+    uint16 flags = UPDATEFLAG_LIVING | (self ? UPDATEFLAG_SELF : 0);
+    if(client == STUB_CLIENT_WOTLK)
+        buf << flags;
+    else
+        buf << uint8(flags);
+
+    // movement info
+    buf << uint32(0); // movement flags
+    if(client == STUB_CLIENT_WOTLK)
+        buf << uint16(0);
+    else if(client == STUB_CLIENT_TBC)
+        buf << uint8(0);
+    buf << getMSTime() << x << y << z << float(0.0f);
+    buf << uint32(0); // fall time
+
+    // speeds: walk, run, swim back, swim, walk back, [fly, fly back], turn, [pitch]
+    buf << 2.5f << 7.0f << 4.5f << 4.722222f << 2.5f;
+    if(client > STUB_CLIENT_CLASSIC)
+        buf << 7.0f << 4.5f;
+    buf << 3.141594f;
+    if(client == STUB_CLIENT_WOTLK)
+        buf << 3.141594f;
+
+    uint16 fields[STUB_FIELD_MAX];
+    uint32 values[STUB_FIELD_MAX];
+    uint32 n = 0;
+    fields[n] = STUB_FIELD_GUID;        values[n++] = uint32(guid);
+    fields[n] = STUB_FIELD_GUID + 1;    values[n++] = uint32(guid >> 32);
+    fields[n] = STUB_FIELD_TYPE;        values[n++] = STUB_TYPE_OBJECT | STUB_TYPE_UNIT | (self ? STUB_TYPE_PLAYER : 0);
+    if(entry)
+    {
+        fields[n] = STUB_FIELD_ENTRY;   values[n++] = entry;
+    }
+    fields[n] = STUB_FIELD_SCALE_X;     values[n++] = _FloatBits(1.0f);
+    fields[n] = _FieldIndex(client, STUB_FIELD_HEALTH);    values[n++] = 100;
+    fields[n] = _FieldIndex(client, STUB_FIELD_MAXHEALTH); values[n++] = 100;
+    fields[n] = _FieldIndex(client, STUB_FIELD_LEVEL);     values[n++] = 1;
+    _AppendValues(buf, n, fields, values);
+}
+
+// fields must be in ascending order
+void StubWorldSocket::_AppendValues(ByteBuffer& buf, uint32 count, const uint16 *fields, const uint32 *values)
+{
+    uint32 blocks = count ? fields[count - 1] / 32 + 1 : 0;
+    uint32 mask[8];
+    memset(mask, 0, sizeof(mask));
+    for(uint32 i = 0; i < count; i++)
+        mask[fields[i] / 32] |= 1u << (fields[i] % 32);
+    buf << uint8(blocks);
+    for(uint32 b = 0; b < blocks; b++)
+        buf << mask[b];
+    for(uint32 i = 0; i < count; i++)
+        buf << values[i];
+}
+
+void StubWorldSocket::_SendStreamPacket(void)
+{
+    StubConf& conf = _server->GetConf();
+    uint64 guid = _NpcGuid(STUB_NPC_ENTRY, 1 + rand() % conf.npcs);
+    ByteBuffer pkt;
+    uint16 opcode;
+    if(uint32(rand() % 100) < conf.movepct)
+    {
+        opcode = SMSG_MONSTER_MOVE;
+        pkt.appendPackGUID(guid);
+        if(conf.client == STUB_CLIENT_WOTLK)
+            pkt << uint8(0);
+        pkt << _x + _Rand(60) << _y + _Rand(60) << _z << getMSTime();
+        pkt << uint8(0); // normal move
+        pkt << uint32(0) << uint32(1000) << uint32(1); // flags, move time, waypoints
+        pkt << _x + _Rand(60) << _y + _Rand(60) << _z;
+    }
+    else
+    {
+        opcode = SMSG_UPDATE_OBJECT;
+        pkt << uint32(1);
+        if(conf.client <= STUB_CLIENT_TBC)
+            pkt << uint8(0); // has transport
+        pkt << uint8(UPDATETYPE_VALUES);
+        pkt.appendPackGUID(guid);
+        uint16 field = _FieldIndex(conf.client, STUB_FIELD_HEALTH);
+        uint32 health = 1 + rand() % 100;
+        _AppendValues(pkt, 1, &field, &health);
+    }
+    SendWorldPacket(opcode, pkt);
+    StubCounters& c = _server->GetStats().c;
+    c.packets++;
+    c.bytes += pkt.size() + 4;
+}
+
+void StubWorldSocket::_SendProbe(uint64 nowus)
+{
+    // (re)create a creature with an entry the client has never seen; it answers with CMSG_CREATURE_QUERY
+    // once it handled the packet, so the time until then includes whatever the client still had queued.
+    // the guid stays the same, so the client replaces the last probe instead of collecting them
+    ByteBuffer upd;
+    upd << uint32(1);
+    if(_server->GetConf().client <= STUB_CLIENT_TBC)
+        upd << uint8(0);
+    _probeentry = _server->NewProbeEntry();
+    _AppendCreateBlock(upd, _NpcGuid(0, 0xFFFFFF), _probeentry, false, _x, _y, _z);
+    SendWorldPacket(SMSG_UPDATE_OBJECT, upd);
+    _probesentus = nowus;
+}
+
+void StubWorldSocket::Update(uint64 nowus)
+{
+    if(!_inworld)
+        return;
+    StubConf& conf = _server->GetConf();
+    if(conf.kick && nowus >= _kickus)
+    {
+        logdetail("World: kicking %s",_user.c_str());
+        _server->GetStats().c.kicks++;
+        _inworld = false;
+        SetCloseAndDelete();
+        return;
+    }
+    if(conf.probe && nowus >= _nextprobeus)
+    {
+        _SendProbe(nowus);
+        _nextprobeus = nowus + conf.probe * 1000ULL;
+    }
+    if(!conf.rate || !conf.npcs)
+        return;
+
+    // token bucket, at most one second worth of packets at once
+    _credit = std::min<double>(_credit + (nowus - _lastus) * conf.rate / 1000000.0, std::max<uint32>(conf.rate, 1));
+    _lastus = nowus;
+    while(_credit >= 1)
+    {
+        _credit -= 1;
+        if(GetOutputLength() > STUB_MAX_BACKLOG)
+            _server->GetStats().c.backlogged++;
+        else
+            _SendStreamPacket();
+    }
+}
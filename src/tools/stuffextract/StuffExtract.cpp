@@ -1,13 +1,18 @@
 #include <fstream>
 #include <set>
+#include <algorithm>
 #define _COMMON_NO_THREADS
 #include "common.h"
+#include "zthread/Thread.h"
+#include "zthread/FastMutex.h"
+#include "zthread/Guard.h"
 #include "Auth/MD5Hash.h"
 #include "tools.h"
 #include "MPQHelper.h"
 #include "dbcfile.h"
 #include "ADTFile.h"
 #include "WDTFile.h"
+#include "HeightMapFile.h"
 #include "StuffExtract.h"
 #include "DBCFieldData.h"
 #include "MPQLocale.h"
@@ -25,9 +30,11 @@ std::set<NameAndAlt> wmoNames;
 std::set<NameAndAlt> wmoGroupNames;
 std::set<NameAndAlt> soundFileSet;
 MPQHelper mpq;
+std::vector<ExtractContext*> workers;
 
 // default config; SCPs are done always
-bool doMaps=true, doSounds=false, doTextures=false, doWmos=false, doWmogroups=false, doModels=false, doMd5=true, doAutoclose=false;
+bool doMaps=true, doHeightmaps=false, doSounds=false, doTextures=false, doWmos=false, doWmogroups=false, doModels=false, doMd5=true, doAutoclose=false;
+uint32 threadCount=0; // 0: one per CPU
 
 
 
@@ -52,11 +59,23 @@ int main(int argc, char *argv[])
 		printf("Locale \"%s\" seems valid, starting conversion...\n",GetLocale());
         CreateDir("extractedstuff");
         CreateDir("extractedstuff/data");
+		uint32 start = getMSTime(), ms = start;
 		mpq.Init();
+        InitWorkers();
+        printf("Opening MPQ files took %u ms\n", getMSTime() - ms);
+        ms = getMSTime();
         ConvertDBC();
-        if(doMaps) ExtractMaps();
+        printf("Converting DBC files took %u ms\n", getMSTime() - ms);
+        if(doMaps)
+        {
+            ms = getMSTime();
+            ExtractMaps();
+            PrintStageDone("Maps", ms);
+        }
         if(doTextures || doModels || doWmos || doWmogroups) ExtractMapDependencies();
         if(doSounds) ExtractSoundFiles();
+        ms = getMSTime() - start;
+        printf("\nTotal time: %u.%03u s\n", ms / 1000, ms % 1000);
 		//...
 		if (!doAutoclose)
             printf("\n -- finished, press enter to exit --\n");
@@ -97,6 +116,7 @@ void ProcessCmdArgs(int argc, char *argv[])
 
             what = argv[i]+1; // skip first byte (+/-)
             if     (!stricmp(what,"maps"))        doMaps = on;
+            else if(!stricmp(what,"heightmaps"))  doHeightmaps = on;
             else if(!stricmp(what,"textures"))    doTextures = on;
             else if(!stricmp(what,"wmos"))        doWmos = on;
             else if(!stricmp(what,"wmogroups"))   doWmogroups = on;
@@ -104,6 +124,8 @@ void ProcessCmdArgs(int argc, char *argv[])
             else if(!stricmp(what,"sounds"))      doSounds = on;
             else if(!stricmp(what,"md5"))         doMd5 = on;
             else if(!stricmp(what,"autoclose"))   doAutoclose = on;
+            // number of threads to use. + or - as arg start doesnt matter here
+            else if(!strnicmp(what,"threads:",8)) threadCount = atoi(what+8);
             // autodetect or use given locale.   + or - as arg start doesnt matter here
             else if(!strnicmp(what,"locale:",7))
             {
@@ -128,6 +150,7 @@ void ProcessCmdArgs(int argc, char *argv[])
     if(!doMaps)
     {
         doWmos = false;
+        doHeightmaps = false;
     }
     if(!doWmos)
     {
@@ -146,6 +169,7 @@ void ProcessCmdArgs(int argc, char *argv[])
 void PrintConfig(void)
 {
     printf("config: Do maps:      %s\n",doMaps?"yes":"no");
+    printf("config: Do heightmaps:%s\n",doHeightmaps?"yes":"no");
     printf("config: Do textures:  %s\n",doTextures?"yes":"no");
     printf("config: Do wmos:      %s\n",doWmos?"yes":"no");
     printf("config: Do wmogroups: %s\n",doWmogroups?"yes":"no");
@@ -153,6 +177,7 @@ void PrintConfig(void)
     printf("config: Do sounds:    %s\n",doSounds?"yes":"no");
     printf("config: Calc md5:     %s\n",doMd5?"yes":"no");
     printf("config: Autoclose:    %s\n",doAutoclose?"yes":"no");
+    printf("config: Threads:      %u\n",threadCount ? threadCount : GetCPUCount());
 }
 
 void PrintHelp(void)
@@ -161,6 +186,7 @@ void PrintHelp(void)
     printf("Use + or - to turn a feature on or off.\n");
     printf("Features are:\n");
     printf("maps      - map extraction\n");
+    printf("heightmaps- write compact height-only .hmap files for headless use (requires maps extraction)\n");
     printf("textures  - extract textures\n");
     printf("wmos      - extract map WMOs (requires maps extraction)\n");
     printf("wmogroups - extract map WMO group files (requires maps and wmos extraction)\n");
@@ -171,11 +197,14 @@ void PrintHelp(void)
     printf("\n");
     printf("Use -locale:xxXX to set a locale. If you don't use this, you will be asked.\n");
     printf("Use -locale:auto to autodetect currently used locale.\n");
+    printf("Use -threads:N to use N threads for extraction. Default is one per CPU.\n");
+    printf("\n");
+    printf("With md5 on, files whose checksum did not change since the last run are not written again.\n");
     printf("\n");
     printf("Examples:\n");
     printf("stuffextract +sounds +md5 -maps +autoclose -locale:enGB\n");
     printf("stuffextract +md5 -wmos -sounds -locale:auto -autoclose\n");
-    printf("\nDefault is: +maps -sounds -textures -wmos -models +md5 -autoclose\n");
+    printf("\nDefault is: +maps -heightmaps -sounds -textures -wmos -models +md5 -autoclose\n");
 }
 
 
@@ -243,6 +272,26 @@ void OutSCP(const char *fn, SCPStorageMap& scp, std::string dbName="")
     }
 }
 
+// reads the md5.txt written by OutMD5() in a previous run
+MD5Manifest LoadMD5(const char *path)
+{
+    MD5Manifest m;
+    if(!doMd5)
+        return m;
+    std::string fullname(path);
+    fullname += "/md5.txt";
+    std::ifstream fh;
+    fh.open(fullname.c_str(), std::ios_base::in);
+    std::string line;
+    while(fh.is_open() && std::getline(fh, line))
+    {
+        std::string::size_type sep = line.rfind('|');
+        if(sep != std::string::npos)
+            m[line.substr(0, sep)] = line.substr(sep + 1);
+    }
+    return m;
+}
+
 void OutMD5(const char *path, MD5FileMap& fm)
 {
     if(!doMd5)
@@ -660,14 +709,224 @@ bool ConvertDBC(void)
     return true;
 }
 
-void ExtractMaps(void)
+// ---- work queue ----
+// every stage makes a list of files and lets all worker threads take jobs from it.
+// each worker has its own ExtractContext; its found dependencies and checksums are merged when the stage is done.
+
+static ZThread::FastMutex seMutex; // job counter, progress bar, console output, heightmap writer
+static uint32 jobNext, jobCount;
+static barGoLink *jobBar = NULL;
+
+class ExtractWorker : public ZThread::Runnable
 {
-    printf("\nExtracting maps...\n");
+public:
+    ExtractWorker(ExtractContext *ctx, ExtractJobFunc func, void *data) : _ctx(ctx), _func(func), _data(data) {}
+    void run()
+    {
+        while(true)
+        {
+            uint32 i;
+            {
+                ZThread::Guard<ZThread::FastMutex> g(seMutex);
+                if(jobNext >= jobCount)
+                    return;
+                i = jobNext++;
+                if(jobBar)
+                    jobBar->step();
+            }
+            _func(*_ctx, i, _data);
+        }
+    }
+private:
+    ExtractContext *_ctx;
+    ExtractJobFunc _func;
+    void *_data;
+};
+
+void InitWorkers(void)
+{
+    uint32 n = threadCount ? threadCount : GetCPUCount();
+    for(uint32 i = 0; i < n; i++)
+    {
+        ExtractContext *ctx = new ExtractContext;
+        if(i)
+        {
+            ctx->mpq = new MPQHelper();
+            ctx->mpq->InitFrom(mpq);
+        }
+        else
+            ctx->mpq = &mpq;
+        ctx->written = ctx->skipped = 0;
+        workers.push_back(ctx);
+    }
+    printf("Using %u threads.\n", n);
+}
+
+// runs func(context, i, data) for i = 0..count-1 on all workers. collected checksums go to md5 (if not NULL),
+// dependencies to the global name sets.
+void RunJobs(uint32 count, ExtractJobFunc func, void *data, MD5FileMap *md5, bool bar)
+{
+    jobNext = 0;
+    jobCount = count;
+    jobBar = bar && count ? new barGoLink(count, true) : NULL;
+    if(workers.size() == 1 || count < 2)
+    {
+        ExtractWorker w(workers[0], func, data);
+        w.run();
+    }
+    else
+    {
+        std::vector<ZThread::Thread*> threads;
+        for(uint32 i = 0; i < workers.size() && i < count; i++)
+            threads.push_back(new ZThread::Thread(new ExtractWorker(workers[i], func, data)));
+        for(uint32 i = 0; i < threads.size(); i++)
+        {
+            threads[i]->wait();
+            delete threads[i];
+        }
+    }
+    delete jobBar;
+    jobBar = NULL;
+
+    for(uint32 i = 0; i < workers.size(); i++)
+    {
+        ExtractContext *ctx = workers[i];
+        texNames.insert(ctx->deps.tex.begin(), ctx->deps.tex.end());
+        modelNames.insert(ctx->deps.model.begin(), ctx->deps.model.end());
+        wmoNames.insert(ctx->deps.wmo.begin(), ctx->deps.wmo.end());
+        wmoGroupNames.insert(ctx->deps.wmogroup.begin(), ctx->deps.wmogroup.end());
+        ctx->deps.tex.clear();
+        ctx->deps.model.clear();
+        ctx->deps.wmo.clear();
+        ctx->deps.wmogroup.clear();
+        for(MD5FileMap::iterator it = ctx->md5.begin(); it != ctx->md5.end(); it++)
+        {
+            if(md5 && !md5->count(it->first))
+                (*md5)[it->first] = it->second;
+            else
+                delete [] it->second;
+        }
+        ctx->md5.clear();
+    }
+}
+
+// number of files written and skipped by all workers since the last call
+void GetWriteCounts(uint32& written, uint32& skipped)
+{
+    written = skipped = 0;
+    for(uint32 i = 0; i < workers.size(); i++)
+    {
+        written += workers[i]->written;
+        skipped += workers[i]->skipped;
+        workers[i]->written = workers[i]->skipped = 0;
+    }
+}
+
+// writes an extracted file and remembers its checksum. if the checksum and size match the manifest of the
+// previous run, the file already there is left untouched.
+bool WriteExtracted(ExtractContext& ctx, const std::string& fn, const std::string& md5name, const uint8 *data, uint32 size, const MD5Manifest *manifest)
+{
+    if(doMd5)
+    {
+        MD5Hash h;
+        h.Update((uint8*)data, size);
+        h.Finalize();
+        uint8 *md5ptr = new uint8[MD5_DIGEST_LENGTH];
+        memcpy(md5ptr, h.GetDigest(), MD5_DIGEST_LENGTH);
+        MD5FileMap::iterator old = ctx.md5.find(md5name);
+        if(old != ctx.md5.end())
+            delete [] old->second;
+        ctx.md5[md5name] = md5ptr;
+        if(manifest)
+        {
+            MD5Manifest::const_iterator it = manifest->find(md5name);
+            if(it != manifest->end() && it->second == toHexDump(md5ptr,MD5_DIGEST_LENGTH,false) && GetFileSize(fn.c_str()) == size)
+            {
+                ctx.skipped++;
+                return true;
+            }
+        }
+    }
+    std::fstream fh;
+    fh.open(fn.c_str(), std::ios_base::out | std::ios_base::binary);
+    if(!fh.is_open())
+        return false;
+    fh.write((const char*)data, size);
+    fh.close();
+    ctx.written++;
+    return true;
+}
+
+void PrintStageDone(const char *what, uint32 startms)
+{
+    uint32 written, skipped;
+    GetWriteCounts(written, skipped);
+    uint32 ms = getMSTime() - startms;
+    printf("%s: %u files written, %u unchanged, %u.%03u s\n", what, written, skipped, ms / 1000, ms % 1000);
+}
+
+
+// ---- maps ----
+
+struct MapJobData
+{
+    uint32 mapid;
+    std::string name;
+    HeightMapWriter hmap;
+    const MD5Manifest *manifest;
+    uint32 tiles;
+};
+
+static void ExtractMapTile(ExtractContext& ctx, uint32 i, void *p)
+{
+    MapJobData *md = (MapJobData*)p;
+    uint32 x = i / 64, y = i % 64;
     char namebuf[200];
     char outbuf[2000];
-    uint32 extr,extrtotal=0;
+    sprintf(namebuf,"World\\Maps\\%s\\%s_%lu_%lu.adt",md->name.c_str(),md->name.c_str(),x,y);
+    sprintf(outbuf,MAPSDIR"/%lu_%lu_%lu.adt",md->mapid,x,y);
+    uint32 size;
+    uint8 *data = ctx.mpq->ExtractFile(namebuf, size);
+    if(!data)
+        return;
+    if(!WriteExtracted(ctx, outbuf, _PathToFileName(outbuf), data, size, md->manifest))
+    {
+        ZThread::Guard<ZThread::FastMutex> g(seMutex);
+        printf("\nERROR: Map extraction failed: could not save file %s\n",outbuf);
+    }
+
+    if(doTextures) ADT_FillTextureData(data,ctx.deps.tex);
+    if(doModels)   ADT_FillModelData(data,ctx.deps.model);
+    if(doWmos)     ADT_FillWMOData(data,ctx.deps.wmo);
+    if(doHeightmaps)
+    {
+        ByteBuffer adtbb;
+        adtbb.append(data, size);
+        ADTFile *adt = new ADTFile();
+        bool ok = adt->LoadMem(adtbb);
+        std::vector<uint8> tile;
+        if(ok)
+            HeightMapWriter::BuildTile(*adt,tile); // the expensive part, other jobs keep running meanwhile
+        delete adt;
+        ZThread::Guard<ZThread::FastMutex> g(seMutex);
+        if(ok)
+            md->hmap.AddTile(x,y,tile);
+        else
+            printf("\nWARNING: Could not parse %s, not added to heightmap\n",namebuf);
+    }
+    delete [] data;
+
+    ZThread::Guard<ZThread::FastMutex> g(seMutex);
+    md->tiles++;
+}
+
+void ExtractMaps(void)
+{
+    printf("\nExtracting maps...\n");
+    uint32 extrtotal=0;
     MD5FileMap md5map;
     CreateDir("extractedstuff/data/maps");
+    MD5Manifest manifest = LoadMD5(MAPSDIR);
     for(std::map<uint32,std::string>::iterator it = mapNames.begin(); it != mapNames.end(); it++)
     {
         // extract the WDT file that stores tile information
@@ -686,364 +945,285 @@ void ExtractMaps(void)
             wdt_fh.write((char*)wdt_bb.contents(),wdt_bb.size());
         wdt_fh.close();
 
-        printf("Extracted WDT '%s'\n",wdt_name);
-
         // then extract all ADT files
-        extr=0;
-        for(uint32 x=0; x<64; x++)
+        MapJobData *md = new MapJobData;
+        md->mapid = it->first;
+        md->name = it->second;
+        md->manifest = &manifest;
+        md->tiles = 0;
+        RunJobs(64*64, ExtractMapTile, md, &md5map, false);
+        printf("[%lu] %s: %u tiles\n",it->first,it->second.c_str(),md->tiles);
+        extrtotal += md->tiles;
+
+        if(doHeightmaps && md->hmap.GetTileCount())
         {
-            for(uint32 y=0;y<64; y++)
-            {
-                uint32 olddeps;
-                uint32 depdiff;
-                sprintf(namebuf,"World\\Maps\\%s\\%s_%lu_%lu.adt",it->second.c_str(),it->second.c_str(),x,y);
-                sprintf(outbuf,MAPSDIR"/%lu_%lu_%lu.adt",it->first,x,y);
-                if(mpq.FileExists(namebuf))
-                {
-                    const ByteBuffer& bb = mpq.ExtractFile(namebuf);
-                    if(bb.size())
-                    {
-                        std::fstream fh;
-                        //printf("Extracting map [ %s ]\n",outbuf);
-                        fh.open(outbuf, std::ios_base::out|std::ios_base::binary);
-                        if(!fh.is_open())
-                        {
-                            printf("\nERROR: Map extraction failed: could not save file %s\n",outbuf);
-                            return;
-                        }
-                        fh.write((char*)bb.contents(),bb.size());
-                        fh.flush();
-                        fh.close();
-                        olddeps = texNames.size() + modelNames.size() + wmoNames.size();
-
-                        if(doTextures) ADT_FillTextureData(bb.contents(),texNames);
-                        if(doModels)   ADT_FillModelData(bb.contents(),modelNames);
-                        if(doWmos)     ADT_FillWMOData(bb.contents(),wmoNames);
-
-                        depdiff = texNames.size() + modelNames.size() + wmoNames.size() - olddeps;
-                        if(doMd5)
-                        {
-                            MD5Hash h;
-                            h.Update((uint8*)bb.contents(), bb.size());
-                            h.Finalize();
-                            uint8 *md5ptr = new uint8[MD5_DIGEST_LENGTH];
-                            md5map[_PathToFileName(outbuf)] = md5ptr;
-                            memcpy(md5ptr, h.GetDigest(), MD5_DIGEST_LENGTH);
-                        }
-                        extr++;
-                        printf("[%lu:%lu] %s; %lu new deps.\n",extr,it->first,namebuf,depdiff);
-                    }
-                }
-            }
+            char hmap_out[300];
+            sprintf(hmap_out,MAPSDIR"/%lu.hmap",it->first);
+            if(md->hmap.Save(hmap_out,it->first))
+                printf("Wrote heightmap '%s' (%u tiles)\n",hmap_out,md->hmap.GetTileCount());
+            else
+                printf("\nERROR: could not save heightmap %s\n",hmap_out);
         }
-        extrtotal+=extr;
-        printf("\n");
+        delete md;
     }
 
     printf("\nDONE - %lu maps extracted, %u total dependencies.\n",extrtotal, texNames.size() + modelNames.size() + wmoNames.size());
     OutMD5(MAPSDIR,md5map);
 }
 
+
+// ---- map dependencies ----
+
+struct DepJobData
+{
+    std::vector<NameAndAlt> files;
+    std::string path;
+    MD5Manifest manifest;
+};
+
+static void ExtractWMO(ExtractContext& ctx, uint32 i, void *p)
+{
+    DepJobData *dd = (DepJobData*)p;
+    std::string mpqfn = dd->files[i].name;
+    std::string altfn = dd->files[i].alt.empty() ? mpqfn : dd->files[i].alt;
+    uint32 size;
+    uint8 *data = ctx.mpq->ExtractFile(mpqfn.c_str(), size);
+    if(!data)
+        return;
+    std::string realfn = dd->path + "/" + NormalizeFilename(_PathToFileName(altfn));
+    if(!WriteExtracted(ctx, realfn, _PathToFileName(realfn), data, size, &dd->manifest))
+    {
+        ZThread::Guard<ZThread::FastMutex> g(seMutex);
+        printf("Could not write WMO %s\n",realfn.c_str());
+    }
+    //Extract number of group files, Texture file names and M2s from WMO
+    if(doWmogroups || doTextures || doModels)
+    {
+        ByteBuffer bb;
+        bb.append(data, size);
+        WMO_Parse_Data(bb,mpqfn.c_str(),ctx.deps,doWmogroups,doTextures,doModels);
+    }
+    delete [] data;
+}
+
+static void ExtractWMOGroup(ExtractContext& ctx, uint32 i, void *p)
+{
+    DepJobData *dd = (DepJobData*)p;
+    std::string mpqfn = dd->files[i].name;
+    std::string altfn = dd->files[i].alt.empty() ? mpqfn : dd->files[i].alt;
+    uint32 size;
+    uint8 *data = ctx.mpq->ExtractFile(mpqfn.c_str(), size);
+    if(!data)
+        return;
+    std::string realfn = dd->path + "/" + NormalizeFilename(_PathToFileName(altfn));
+    if(!WriteExtracted(ctx, realfn, _PathToFileName(realfn), data, size, &dd->manifest))
+    {
+        ZThread::Guard<ZThread::FastMutex> g(seMutex);
+        printf("Could not write WMO %s\n",realfn.c_str());
+    }
+    delete [] data;
+}
+
+static void ExtractModel(ExtractContext& ctx, uint32 i, void *p)
+{
+    DepJobData *dd = (DepJobData*)p;
+    std::string mpqfn = dd->files[i].name;
+    // no idea what bliz intended by this. the ADT files refer to .mdx models,
+    // however there are only .m2 files in the MPQ archives.
+    // so we just need to check if there is a .m2 file instead of the .mdx file, and load that one.
+    if(!ctx.mpq->FileExists(mpqfn.c_str()))
+    {
+        std::string alt = mpqfn.substr(0,mpqfn.length()-2) + "2";
+        if(!ctx.mpq->FileExists(alt.c_str()))
+        {
+            ZThread::Guard<ZThread::FastMutex> g(seMutex);
+            printf("Failed to extract model: '%s'\n",alt.c_str());
+            return;
+        }
+        mpqfn = alt;
+    }
+    std::string altfn = dd->files[i].alt.empty() ? mpqfn : dd->files[i].alt;
+    std::string realfn = dd->path + "/" + NormalizeFilename(_PathToFileName(altfn));
+    uint32 size;
+    uint8 *data = ctx.mpq->ExtractFile(mpqfn.c_str(), size);
+    if(!data)
+        return;
+    if(!WriteExtracted(ctx, realfn, _PathToFileName(realfn), data, size, &dd->manifest))
+    {
+        ZThread::Guard<ZThread::FastMutex> g(seMutex);
+        printf("Could not write model %s\n",realfn.c_str());
+        delete [] data;
+        return;
+    }
+
+    // model ok, now extract skins
+    // for now first skin is all what we need
+    std::string copy = mpqfn;
+    std::transform(copy.begin(), copy.end(), copy.begin(), tolower);
+    if (copy.find(".wmo") == std::string::npos)
+    {
+        if (doTextures)
+        {
+            ByteBuffer bb;
+            bb.append(data, size);
+            FetchTexturesFromModel(bb, ctx.deps);
+        }
+
+        std::string skin = mpqfn.substr(0,mpqfn.length()-3) + "00.skin";
+        std::string skinrealfn = dd->path + "/" + NormalizeFilename(_PathToFileName(skin));
+        uint32 skinsize;
+        uint8 *skindata = ctx.mpq->ExtractFile(skin.c_str(), skinsize);
+        if(skindata)
+        {
+            if(!WriteExtracted(ctx, skinrealfn, _PathToFileName(skinrealfn), skindata, skinsize, &dd->manifest))
+            {
+                ZThread::Guard<ZThread::FastMutex> g(seMutex);
+                printf("Could not write skin %s\n",skinrealfn.c_str());
+            }
+            delete [] skindata;
+        }
+        else
+        {
+            ZThread::Guard<ZThread::FastMutex> g(seMutex);
+            printf("Could not open skin %s\n",skin.c_str());
+        }
+    }
+    delete [] data;
+}
+
+static void ExtractTexture(ExtractContext& ctx, uint32 i, void *p)
+{
+    DepJobData *dd = (DepJobData*)p;
+    const std::string& mpqfn = dd->files[i].name;
+    uint32 size;
+    uint8 *data = ctx.mpq->ExtractFile(mpqfn.c_str(), size);
+    if(!data)
+        return;
+
+    // prepare lowercased and "underlined" path for file
+    std::string copy = NormalizeFilename(mpqfn);
+    for(std::string::size_type pos = copy.find('/'); pos != std::string::npos; pos = copy.find('/', pos + 1))
+        CreateDir((dd->path + "/" + copy.substr(0, pos)).c_str());
+
+    // textures are stored with their directories, so the path is needed to tell them apart
+    std::string realfn = dd->path + "/" + copy;
+    if(!WriteExtracted(ctx, realfn, copy, data, size, &dd->manifest))
+    {
+        ZThread::Guard<ZThread::FastMutex> g(seMutex);
+        printf("Could not write texture %s\n",realfn.c_str());
+    }
+    delete [] data;
+}
+
 void ExtractMapDependencies(void)
 {
-    barGoLink *bar;
     printf("\nExtracting map dependencies...\n\n");
-    printf("- Preparing to read MPQ arcives...\n");
     std::string path = "extractedstuff/data";
     std::string pathtex = path + "/texture";
     std::string pathmodel = path + "/model";
     std::string pathwmo = path + "/wmo";
-    std::string mpqfn,realfn,altfn;
-    MD5FileMap md5Tex, md5Wmo, md5Wmogroup, md5Model;
+    MD5FileMap md5Tex, md5Wmo, md5Model;
     CreateDir(pathtex.c_str());
     CreateDir(pathmodel.c_str());
     CreateDir(pathwmo.c_str());
-    uint32 wmosdone=0,texdone=0,mdone=0;
+    DepJobData dd;
+    uint32 ms;
 
+    // WMOs and their group files go into the same directory, so they share one checksum list
+    dd.path = pathwmo;
+    dd.manifest = LoadMD5(pathwmo.c_str());
     if(doWmos)
     {
         printf("Extracting %u WMOS...\n",wmoNames.size());
-
-        bar = new barGoLink(wmoNames.size(),true);
-        for(std::set<NameAndAlt>::iterator i = wmoNames.begin(); i != wmoNames.end(); i++)
-        {
-            bar->step();
-            mpqfn = i->name;
-            altfn = i->alt;
-            if(altfn.empty())
-                altfn = mpqfn;
-            if(!mpq.FileExists((char*)mpqfn.c_str()))
-                continue;
-            realfn = pathwmo + "/" + NormalizeFilename(_PathToFileName(altfn));
-            std::fstream fh;
-            fh.open(realfn.c_str(),std::ios_base::out | std::ios_base::binary);
-            if(fh.is_open())
-            {
-                const ByteBuffer& bb = mpq.ExtractFile((char*)mpqfn.c_str());
-                fh.write((const char*)bb.contents(),bb.size());
-                //Extract number of group files, Texture file names and M2s from WMO
-                if(doWmogroups || doTextures || doModels) WMO_Parse_Data(bb,mpqfn.c_str(),doWmogroups,doTextures,doModels);
-                if(doMd5)
-                {
-                    MD5Hash h;
-                    h.Update((uint8*)bb.contents(), bb.size());
-                    h.Finalize();
-                    uint8 *md5ptr = new uint8[MD5_DIGEST_LENGTH];
-                    md5Wmo[_PathToFileName(realfn)] = md5ptr;
-                    memcpy(md5ptr, h.GetDigest(), MD5_DIGEST_LENGTH);
-                }
-                wmosdone++;
-            }
-            else
-                printf("Could not write WMO %s\n",realfn.c_str());
-            fh.close();
-        }
+        ms = getMSTime();
+        dd.files.assign(wmoNames.begin(), wmoNames.end());
+        RunJobs(dd.files.size(), ExtractWMO, &dd, &md5Wmo, true);
         printf("\n");
-        if(wmoNames.size())
-            OutMD5((char*)pathwmo.c_str(),md5Wmo);
-        delete bar;
+        PrintStageDone("WMOs", ms);
     }
 
     if(doWmogroups)
     {
         printf("Extracting WMO Group Files...\n");
-        bar = new barGoLink(wmoGroupNames.size(),true);
-        for(std::set<NameAndAlt>::iterator i = wmoGroupNames.begin(); i != wmoGroupNames.end(); i++)
-        {
-            bar->step();
-            mpqfn = i->name;
-            altfn = i->alt;
-            if(altfn.empty())
-                altfn = mpqfn;
-            if(!mpq.FileExists((char*)mpqfn.c_str()))
-                continue;
-            realfn = pathwmo + "/" + NormalizeFilename(_PathToFileName(altfn));
-            std::fstream fh;
-            fh.open(realfn.c_str(),std::ios_base::out | std::ios_base::binary);
-            if(fh.is_open())
-            {
-                const ByteBuffer& bb = mpq.ExtractFile((char*)mpqfn.c_str());
-                fh.write((const char*)bb.contents(),bb.size());
-                if(doMd5)
-                {
-                    MD5Hash h;
-                    h.Update((uint8*)bb.contents(), bb.size());
-                    h.Finalize();
-                    uint8 *md5ptr = new uint8[MD5_DIGEST_LENGTH];
-                    md5Wmogroup[_PathToFileName(realfn)] = md5ptr;
-                    memcpy(md5ptr, h.GetDigest(), MD5_DIGEST_LENGTH);
-                }
-                wmosdone++;
-            }
-            else
-                printf("Could not write WMO %s\n",realfn.c_str());
-            fh.close();
-        }
+        ms = getMSTime();
+        dd.files.assign(wmoGroupNames.begin(), wmoGroupNames.end());
+        RunJobs(dd.files.size(), ExtractWMOGroup, &dd, &md5Wmo, true);
         printf("\n");
-        if(wmoGroupNames.size())
-            OutMD5((char*)pathwmo.c_str(),md5Wmogroup);
-        delete bar;
+        PrintStageDone("WMO groups", ms);
     }
-
-
-
+    if(wmoNames.size() || wmoGroupNames.size())
+        OutMD5((char*)pathwmo.c_str(),md5Wmo);
 
     if(doModels)
     {
         printf("Extracting models...\n");
-        bar = new barGoLink(modelNames.size(),true);
-        for(std::set<NameAndAlt>::iterator i = modelNames.begin(); i != modelNames.end(); i++)
-        {
-            bar->step();
-            mpqfn = i->name;
-            // no idea what bliz intended by this. the ADT files refer to .mdx models,
-            // however there are only .m2 files in the MPQ archives.
-            // so we just need to check if there is a .m2 file instead of the .mdx file, and load that one.
-            if(!mpq.FileExists((char*)mpqfn.c_str()))
-            {
-                std::string alt = mpqfn.substr(0,mpqfn.length()-2) + "2";
-                if(!mpq.FileExists((char*)alt.c_str()))
-                {
-                    printf("Failed to extract model: '%s'\n",alt.c_str());
-                    continue;
-                }
-                else
-                {
-                    mpqfn = alt;
-                }
-            }
-            altfn = i->alt;
-            if(altfn.empty())
-                altfn = mpqfn;
-            realfn = pathmodel + "/" + NormalizeFilename(_PathToFileName(altfn));
-            std::fstream fh;
-            fh.open(realfn.c_str(),std::ios_base::out | std::ios_base::binary);
-            if(fh.is_open())
-            {
-                ByteBuffer bb = mpq.ExtractFile((char*)mpqfn.c_str());
-                fh.write((const char*)bb.contents(),bb.size());
-
-                if(doMd5)
-                {
-                    MD5Hash h;
-                    h.Update((uint8*)bb.contents(), bb.size());
-                    h.Finalize();
-                    uint8 *md5ptr = new uint8[MD5_DIGEST_LENGTH];
-                    md5Model[_PathToFileName(realfn)] = md5ptr;
-                    memcpy(md5ptr, h.GetDigest(), MD5_DIGEST_LENGTH);
-                }
-                mdone++;
-
-                // model ok, now extract skins
-                // for now first skin is all what we need
-                std::string copy = mpqfn;
-                std::transform(copy.begin(), copy.end(), copy.begin(), tolower);
-                if (copy.find(".wmo") == std::string::npos)
-                {
-                    if (doTextures)
-                        FetchTexturesFromModel(bb);
-
-                    std::string skin = mpqfn.substr(0,mpqfn.length()-3) + "00.skin";
-                    std::string skinrealfn = pathmodel + "/" + NormalizeFilename(_PathToFileName(skin));
-                    if (mpq.FileExists((char*)skin.c_str()))
-                    {
-                        std::fstream fhs;
-                        fhs.open(skinrealfn.c_str(),std::ios_base::out | std::ios_base::binary);
-                        if(fhs.is_open())
-                        {
-                            ByteBuffer bbs = mpq.ExtractFile((char*)skin.c_str());
-                            fhs.write((const char*)bbs.contents(),bbs.size());
-                        }
-                        else
-                            printf("Could not write skin %s\n",skinrealfn.c_str());
-
-                        fhs.close();
-                    }
-                    else
-                        printf("Could not open skin %s\n",skin.c_str());
-                }
-            }
-            else
-                printf("Could not write model %s\n",realfn.c_str());
-            fh.close();
-        }
+        ms = getMSTime();
+        dd.path = pathmodel;
+        dd.manifest = LoadMD5(pathmodel.c_str());
+        dd.files.assign(modelNames.begin(), modelNames.end());
+        RunJobs(dd.files.size(), ExtractModel, &dd, &md5Model, true);
         printf("\n");
+        PrintStageDone("Models", ms);
         if(modelNames.size())
             OutMD5((char*)pathmodel.c_str(),md5Model);
-        delete bar;
     }
 
     if(doTextures)
     {
         printf("Extracting textures...\n");
-        bar = new barGoLink(texNames.size(), true);
-        for(std::set<NameAndAlt>::iterator i = texNames.begin(); i != texNames.end(); i++)
-        {
-            bar->step();
-            mpqfn = i->name;
-            altfn = i->alt;
-            if(altfn.empty())
-                altfn = mpqfn;
-            if(!mpq.FileExists((char*)mpqfn.c_str()))
-                continue;
-
-            // prepare lowercased and "underlined" path for file
-            std::string copy = NormalizeFilename(mpqfn);
-            if (copy.find_first_of("/") != std::string::npos)
-            {
-                std::string copy2 = copy.c_str();
-                char* tok = strtok((char*)copy2.c_str(),"/");
-                std::string fullpath = pathtex;
-                while (tok && !strstr(tok, ".blp"))
-                {
-                    fullpath += "/";
-                    fullpath += tok;
-                    CreateDir(fullpath.c_str());
-                    tok = strtok(NULL, "/");
-                }
-            }
-
-            realfn = pathtex + "/" + copy; //_PathToFileName(altfn);
-            std::fstream fh;
-            fh.open(realfn.c_str(),std::ios_base::out | std::ios_base::binary);
-            if(fh.is_open())
-            {
-                const ByteBuffer& bb = mpq.ExtractFile((char*)mpqfn.c_str());
-                fh.write((const char*)bb.contents(),bb.size());
-                if(doMd5)
-                {
-                    MD5Hash h;
-                    h.Update((uint8*)bb.contents(), bb.size());
-                    h.Finalize();
-                    uint8 *md5ptr = new uint8[MD5_DIGEST_LENGTH];
-                    md5Tex[_PathToFileName(realfn)] = md5ptr;
-                    memcpy(md5ptr, h.GetDigest(), MD5_DIGEST_LENGTH);
-                }
-                texdone++;
-            }
-            else
-                printf("Could not write texture %s\n",realfn.c_str());
-            fh.close();
-        }
+        ms = getMSTime();
+        dd.path = pathtex;
+        dd.manifest = LoadMD5(pathtex.c_str());
+        dd.files.assign(texNames.begin(), texNames.end());
+        RunJobs(dd.files.size(), ExtractTexture, &dd, &md5Tex, true);
         printf("\n");
+        PrintStageDone("Textures", ms);
         if(texNames.size())
             OutMD5((char*)pathtex.c_str(),md5Tex);
-        delete bar;
     }
+}
 
 
+// ---- sounds ----
+
+static void ExtractSoundFile(ExtractContext& ctx, uint32 i, void *p)
+{
+    DepJobData *dd = (DepJobData*)p;
+    const NameAndAlt& f = dd->files[i];
+    uint32 size;
+    uint8 *data = ctx.mpq->ExtractFile(f.name.c_str(), size);
+    if(!data)
+    {
+        DEBUG( printf("MPQ: File not found: '%s'\n",f.name.c_str()) );
+        return;
+    }
+    std::string altfn = f.alt.empty() ? _PathToFileName(f.name) : f.alt;
+    std::string outfn = dd->path + "/" + NormalizeFilename(altfn);
+    if(!WriteExtracted(ctx, outfn, altfn, data, size, &dd->manifest))
+    {
+        ZThread::Guard<ZThread::FastMutex> g(seMutex);
+        printf("Could not write sound file '%s'\n",outfn.c_str());
+    }
+    delete [] data;
 }
 
 void ExtractSoundFiles(void)
 {
     MD5FileMap md5data;
-    uint32 done = 0;
     printf("\nExtracting game audio files, %u found in DBC...\n",soundFileSet.size());
     CreateDir(SOUNDDIR);
-    std::string outfn, altfn;
-    barGoLink bar(soundFileSet.size(),true);
-    for(std::set<NameAndAlt>::iterator i = soundFileSet.begin(); i != soundFileSet.end(); i++)
-    {
-        bar.step();
-        if(!mpq.FileExists((char*)i->name.c_str()))
-        {
-            DEBUG( printf("MPQ: File not found: '%s'\n",i->name.c_str()) );
-            continue;
-        }
-        altfn = i->alt.empty() ? _PathToFileName(i->name) : i->alt;
-
-        outfn = std::string(SOUNDDIR) + "/" + NormalizeFilename(altfn);
-        std::fstream fh;
-        fh.open(outfn.c_str(), std::ios_base::out | std::ios_base::binary);
-        if(fh.is_open())
-        {
-            const ByteBuffer& bb = mpq.ExtractFile((char*)i->name.c_str());
-            if(bb.size())
-            {
-                fh.write((const char*)bb.contents(),bb.size());
-                if(doMd5)
-                {
-                    MD5Hash h;
-                    h.Update((uint8*)bb.contents(), bb.size());
-                    h.Finalize();
-                    uint8 *md5ptr = new uint8[MD5_DIGEST_LENGTH];
-                    md5data[altfn] = md5ptr;
-                    memcpy(md5ptr, h.GetDigest(), MD5_DIGEST_LENGTH);
-                }
-                done++;
-            }
-        }
-        else
-        {
-            printf("Could not write sound file '%s'\n",outfn.c_str());
-        }
-        fh.close();
-    }
+    uint32 ms = getMSTime();
+    DepJobData dd;
+    dd.path = SOUNDDIR;
+    dd.manifest = LoadMD5(SOUNDDIR);
+    dd.files.assign(soundFileSet.begin(), soundFileSet.end());
+    RunJobs(dd.files.size(), ExtractSoundFile, &dd, &md5data, true);
     OutMD5(SOUNDDIR,md5data);
     printf("\n");
+    PrintStageDone("Sounds", ms);
 }
 
-void WMO_Parse_Data(ByteBuffer bb, const char* _filename, bool groups, bool textures, bool models)
+void WMO_Parse_Data(ByteBuffer bb, const char* _filename, DepSets& deps, bool groups, bool textures, bool models)
 {
     bb.rpos(20); //Skip MVER chunk and header of MHDR
     irr::scene::RootHeader header;
@@ -1057,7 +1237,7 @@ void WMO_Parse_Data(ByteBuffer bb, const char* _filename, bool groups, bool text
         {
             char grpfilename[255];
             sprintf(grpfilename,"%s_%03lu.wmo",filename.substr(0,filename.length()-4).c_str(),i);
-            wmoGroupNames.insert(NameAndAlt(grpfilename));
+            deps.wmogroup.insert(NameAndAlt(grpfilename));
         }
 
     }
@@ -1082,7 +1262,7 @@ void WMO_Parse_Data(ByteBuffer bb, const char* _filename, bool groups, bool text
                     bb.read((uint8*)&c,sizeof(char));
                     if(c=='\x0' && temp.size()>0)
                     {
-                        texNames.insert(NameAndAlt(temp));
+                        deps.tex.insert(NameAndAlt(temp));
                         temp.clear();
                     }
                     else if(c!=0)
@@ -1100,7 +1280,7 @@ void WMO_Parse_Data(ByteBuffer bb, const char* _filename, bool groups, bool text
                     bb.read((uint8*)&c,sizeof(char));
                     if(c=='\x0' && temp.size()>0)
                     {
-                        modelNames.insert(NameAndAlt(temp));
+                        deps.model.insert(NameAndAlt(temp));
                         temp.clear();
                     }
                     else if(c!=0)
@@ -1154,7 +1334,7 @@ void ADT_FillModelData(const uint8* data,std::set<NameAndAlt>& st)
     ADT_ExportStringSetByOffset(data,OFFSET_MODELS,st,"DIMM");
 }
 
-void FetchTexturesFromModel(ByteBuffer bb)
+void FetchTexturesFromModel(ByteBuffer bb, DepSets& deps)
 {
     bb.rpos(0);
     irr::scene::ModelHeader header;
@@ -1189,7 +1369,7 @@ void FetchTexturesFromModel(ByteBuffer bb)
         if (tempTexFileName.empty())
             continue;
         // printf(tempTexFileName.c_str()); // for debug
-        texNames.insert(NameAndAlt(tempTexFileName));
+        deps.tex.insert(NameAndAlt(tempTexFileName));
     }
 
 }
@@ -13,6 +13,7 @@
 
 typedef std::map< uint32,std::list<std::string> > SCPStorageMap;
 typedef std::map<std::string,uint8*> MD5FileMap;
+typedef std::map<std::string,std::string> MD5Manifest; // file name -> md5 as hex string
 
 // this struct is used to resolve conflicting names when extracting archives.
 // the problem is that some files stored in different folders in mpq archives will be extracted into one folder,
@@ -28,20 +29,45 @@ struct NameAndAlt
     std::string alt;
 };
 
+// files referenced by other files, found while extracting
+struct DepSets
+{
+    std::set<NameAndAlt> tex, model, wmo, wmogroup;
+};
+
+class MPQHelper;
+
+// per worker thread: own MPQ handles, found dependencies and checksums of written files
+struct ExtractContext
+{
+    MPQHelper *mpq;
+    DepSets deps;
+    MD5FileMap md5;
+    uint32 written, skipped;
+};
+
+typedef void (*ExtractJobFunc)(ExtractContext&, uint32, void*);
+
 int main(int argc, char *argv[]);
 void ProcessCmdArgs(int argc, char *argv[]);
 void PrintConfig(void);
 void PrintHelp(void);
 void OutSCP(const char*, SCPStorageMap&, std::string);
 void OutMD5(const char*, MD5FileMap&);
+MD5Manifest LoadMD5(const char*);
+void InitWorkers(void);
+void RunJobs(uint32, ExtractJobFunc, void*, MD5FileMap*, bool);
+void GetWriteCounts(uint32&, uint32&);
+bool WriteExtracted(ExtractContext&, const std::string&, const std::string&, const uint8*, uint32, const MD5Manifest*);
+void PrintStageDone(const char*, uint32);
 bool ConvertDBC(void);
 void ExtractMaps(void);
 void ExtractMapDependencies(void);
 void ExtractSoundFiles(void);
 
-void FetchTexturesFromModel(ByteBuffer);
+void FetchTexturesFromModel(ByteBuffer, DepSets&);
 
-void WMO_Parse_Data(ByteBuffer, const char*, bool, bool, bool);
+void WMO_Parse_Data(ByteBuffer, const char*, DepSets&, bool, bool, bool);
 
 void ADT_ExportStringSetByOffset(const uint8*, uint32, std::set<NameAndAlt>&, const char*);
 void ADT_FillTextureData(const uint8*,std::set<NameAndAlt>&);